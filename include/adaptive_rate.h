@@ -0,0 +1,257 @@
+#pragma once
+
+// 次の通過の予測にもとづく測定周期の切り替え（receiverの測定タスク）
+// レースが始まると、同じレーンの通過はほぼ一定の間隔（ラップタイム）で起きる。
+// ArrivalPredictor は直近のラップタイムの中央値から次の通過時刻を予測し、ばらつき（中央値からの
+// 絶対偏差の中央値）から予測の幅を決める。AdaptiveSampleRate は予測の幅の中だけ短い周期
+// （fastPeriodUs）で測って通過時刻の分解能を上げ、それ以外は長い周期（floorPeriodUs）で測る。
+// floorPeriodUs は予想外の通過（レースの最初の数周・コースアウトからの復帰）も取りこぼさないための
+// 下限の測定レートで、車体がセンサーの前にいる最短の時間より短くする（その間に必ず1回は測定できる）
+// 時刻は ms（millis()、差分で比較するので折り返しをまたいでもよい）
+// AdaptiveSampleRate は測定タスクだけが持ち、測定ごとの選択（AdaptiveRateStep）を返す。集計は loop() 側の
+// AdaptiveRateStats が受け取った AdaptiveRateStep だけから行う（測定タスクの状態を別のコアから読まない）
+// Arduino非依存（ホストでのシミュレーション: arrival_sim）
+//
+//   AdaptiveSampleRate rate(config);
+//   sample.rate = rate.update(sample.time, sample.result);  // 測定のたびに。sample.rate.periodUs が次の測定までの周期
+//   stats.record(sample.rate);                              // 受け取った側で集計
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "passage_detector.h"
+
+struct AdaptiveRateConfig {
+  uint32_t fastPeriodUs = 10000;   // 予測の幅の中（100Hz）
+  uint32_t floorPeriodUs = 25000;  // それ以外（40Hz、通過の最短30msより短く）
+  uint32_t minWindowMs = 150;      // 予測の幅（片側）の最小
+  uint32_t spreadFactor = 4;       // 予測の幅 = ばらつき × spreadFactor（最小 minWindowMs、最大ラップタイムの1/4）
+  uint32_t maxLapMs = 60000;       // これより間が空いたらレースが終わったとみなして学習し直す（予測をやめた後も同じ）
+  uint8_t minLaps = 3;             // 予測を始めるまでに学習するラップ数
+  uint8_t maxMissedLaps = 2;       // 予測した時刻に来なかった場合に、次の周を待つ回数（超えたら予測をやめる）
+};
+
+class ArrivalPredictor {
+ public:
+  static const size_t HISTORY = 8;  // 学習に使う直近のラップ数
+
+  explicit ArrivalPredictor(const AdaptiveRateConfig& config = AdaptiveRateConfig()) : config_(config) { reset(); }
+
+  void reset() {
+    laps_ = 0;
+    head_ = 0;
+    outliers_ = 0;
+    hasLast_ = false;
+    last_ = 0;
+    lapMs_ = 0;
+    spreadMs_ = 0;
+  }
+
+  // カウントした通過の時刻を記録し、前回からの間隔をラップタイムとして学習する
+  // 中央値から大きく外れた間隔は学習しない（通過を取りこぼした周は周回数で割る）。
+  // 外れた間隔が続いたらペースが変わったとみなし、その間隔から学習し直す
+  void passage(uint32_t now) {
+    if (hasLast_) {
+      learn(now - last_);
+    }
+    last_ = now;
+    hasLast_ = true;
+  }
+
+  // 予測できるだけのラップを学習したか
+  bool predicting() const { return laps_ >= config_.minLaps; }
+
+  // now 以降の次の通過の予測時刻（予測の幅の終わりを過ぎた周は飛ばす）
+  // 戻り値: 予測できなければfalse（学習が足りない・maxMissedLaps 周続けて来なかった）
+  bool next(uint32_t now, uint32_t& arrival) const {
+    if (!predicting()) {
+      return false;
+    }
+    uint32_t window = windowMs();
+    arrival = last_ + lapMs_;
+    for (uint32_t lap = 0; (int32_t)(now - arrival) > (int32_t)window; lap++) {
+      if (lap >= config_.maxMissedLaps) {
+        return false;
+      }
+      arrival += lapMs_;
+    }
+    return true;
+  }
+
+  // 予測の幅（片側、ms）
+  uint32_t windowMs() const {
+    uint32_t window = spreadMs_ * config_.spreadFactor;
+    window = window > config_.minWindowMs ? window : config_.minWindowMs;
+    return window < lapMs_ / 4 ? window : lapMs_ / 4;
+  }
+
+  uint32_t lapMs() const { return lapMs_; }        // 学習したラップタイム（中央値、未学習なら0）
+  uint32_t spreadMs() const { return spreadMs_; }  // ラップタイムのばらつき
+  uint8_t laps() const { return laps_; }
+
+ private:
+  void learn(uint32_t lap) {
+    // 予測をやめるほど間が空いた（レースの合間）: 次のレースのラップから学習し直す
+    if (lap > config_.maxLapMs || (laps_ > 0 && lap > lapMs_ * (2u + config_.maxMissedLaps))) {
+      laps_ = 0;
+      head_ = 0;
+      outliers_ = 0;
+      lapMs_ = 0;
+      spreadMs_ = 0;
+      return;
+    }
+    if (laps_ > 0 && (lap * 2 < lapMs_ || lap * 2 > lapMs_ * 3)) {
+      uint32_t multiple = (lap + lapMs_ / 2) / lapMs_;  // 取りこぼした周を含む間隔
+      if (multiple >= 2 && multiple <= 1u + config_.maxMissedLaps &&
+          distance(lap, multiple * lapMs_) <= windowMs() * multiple) {
+        lap /= multiple;
+      } else if (++outliers_ < 2) {
+        return;
+      } else {
+        laps_ = 0;  // ペースが変わった
+        head_ = 0;
+      }
+    }
+    outliers_ = 0;
+    history_[head_] = lap;
+    head_ = (head_ + 1) % HISTORY;
+    if (laps_ < HISTORY) {
+      laps_++;
+    }
+    uint32_t sorted[HISTORY];
+    for (size_t i = 0; i < laps_; i++) {
+      sorted[i] = history_[i];
+    }
+    lapMs_ = median(sorted, laps_);
+    for (size_t i = 0; i < laps_; i++) {
+      sorted[i] = distance(history_[i], lapMs_);
+    }
+    spreadMs_ = median(sorted, laps_);
+  }
+
+  static uint32_t distance(uint32_t a, uint32_t b) { return a > b ? a - b : b - a; }
+
+  // values を並べ替えて中央値を返す（HISTORY 個までなので挿入ソート）
+  static uint32_t median(uint32_t* values, size_t count) {
+    for (size_t i = 1; i < count; i++) {
+      uint32_t value = values[i];
+      size_t j = i;
+      for (; j > 0 && values[j - 1] > value; j--) {
+        values[j] = values[j - 1];
+      }
+      values[j] = value;
+    }
+    return count % 2 == 1 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+  }
+
+  AdaptiveRateConfig config_;
+  uint32_t history_[HISTORY];
+  uint8_t laps_;      // history_ の有効な数
+  uint8_t head_;      // 次に書き込む位置
+  uint8_t outliers_;  // 続けて学習しなかった間隔の数
+  bool hasLast_;
+  uint32_t last_;     // 最後の通過
+  uint32_t lapMs_;
+  uint32_t spreadMs_;
+};
+
+// AdaptiveSampleRate::update() でカウントした通過と予測の関係
+enum RatePassage : uint8_t {
+  RATE_PASSAGE_NONE,         // 通過をカウントしていない・予測していなかった
+  RATE_PASSAGE_HIT,          // 予測の幅の中に来た
+  RATE_PASSAGE_MISS,         // 予測していたのに幅の外に来た
+};
+
+// 測定1回分の周期の選択（ReceiverSample に入れて測定タスクから loop() に渡す）
+struct AdaptiveRateStep {
+  uint32_t periodUs = 0;  // 次の測定までの周期
+  uint32_t lapMs = 0;     // 学習したラップタイム（未学習なら0）
+  uint32_t spreadMs = 0;  // ラップタイムのばらつき
+  uint32_t windowMs = 0;  // 予測の幅（片側）
+  RatePassage passage = RATE_PASSAGE_NONE;
+  bool fast = false;      // 予測の幅の中（短い周期を選んだ）
+};
+
+class AdaptiveSampleRate {
+ public:
+  explicit AdaptiveSampleRate(const AdaptiveRateConfig& config = AdaptiveRateConfig())
+      : config_(config), predictor_(config), predicted_(false), inWindow_(false) {}
+
+  // 測定1回ごとに呼ぶ（result が PASSAGE_COUNTED なら通過を学習する）
+  // 戻り値: この測定での選択（periodUs が次の測定までの周期）
+  AdaptiveRateStep update(uint32_t now, PassageResult result) {
+    AdaptiveRateStep step;
+    if (result == PASSAGE_COUNTED) {
+      if (predicted_) {
+        // 短い周期で測っている間に来たか（予測が当たったか）
+        step.passage = inWindow_ ? RATE_PASSAGE_HIT : RATE_PASSAGE_MISS;
+      }
+      predictor_.passage(now);
+    }
+    uint32_t arrival;
+    predicted_ = predictor_.next(now, arrival);
+    inWindow_ = predicted_ && (int32_t)(arrival - now) <= (int32_t)predictor_.windowMs();
+    step.periodUs = inWindow_ ? config_.fastPeriodUs : config_.floorPeriodUs;
+    step.lapMs = predictor_.lapMs();
+    step.spreadMs = predictor_.spreadMs();
+    step.windowMs = predictor_.windowMs();
+    step.fast = inWindow_;
+    return step;
+  }
+
+  const ArrivalPredictor& predictor() const { return predictor_; }
+  bool inWindow() const { return inWindow_; }
+
+ private:
+  AdaptiveRateConfig config_;
+  ArrivalPredictor predictor_;
+  bool predicted_;  // 次の通過を予測している
+  bool inWindow_;   // 予測の幅の中（短い周期で測っている）
+};
+
+// AdaptiveRateStep の集計（receiverでは loop() だけが使う）
+class AdaptiveRateStats {
+ public:
+  AdaptiveRateStats() : fastSamples_(0), floorSamples_(0), hits_(0), misses_(0) {}
+
+  void record(const AdaptiveRateStep& step) {
+    if (step.fast) {
+      fastSamples_++;
+    } else {
+      floorSamples_++;
+    }
+    if (step.passage == RATE_PASSAGE_HIT) {
+      hits_++;
+    } else if (step.passage == RATE_PASSAGE_MISS) {
+      misses_++;
+    }
+    last_ = step;
+  }
+
+  const AdaptiveRateStep& last() const { return last_; }  // 最後に受け取った選択（ラップタイム・予測の幅）
+  uint32_t fastSamples() const { return fastSamples_; }    // 短い周期を選んだ測定の数
+  uint32_t floorSamples() const { return floorSamples_; }  // 長い周期を選んだ測定の数
+  uint32_t hits() const { return hits_; }      // 予測の幅の中に来た通過
+  uint32_t misses() const { return misses_; }  // 予測していたのに幅の外に来た通過（下限の周期で検出した）
+
+  // "RATE lap=4775ms spread=70ms window=+-280ms fast=7.9% hits=3342 misses=377"
+  size_t format(char* out, size_t capacity) const {
+    uint32_t samples = fastSamples_ + floorSamples_;
+    int length = snprintf(out, capacity, "RATE lap=%lums spread=%lums window=+-%lums fast=%.1f%% hits=%lu misses=%lu",
+                          (unsigned long)last_.lapMs, (unsigned long)last_.spreadMs, (unsigned long)last_.windowMs,
+                          samples ? 100.0 * fastSamples_ / samples : 0.0, (unsigned long)hits_,
+                          (unsigned long)misses_);
+    if (length < 0 || capacity == 0) {
+      return 0;
+    }
+    return (size_t)length < capacity ? (size_t)length : capacity - 1;
+  }
+
+ private:
+  uint32_t fastSamples_;
+  uint32_t floorSamples_;
+  uint32_t hits_;
+  uint32_t misses_;
+  AdaptiveRateStep last_;
+};
@@ -0,0 +1,268 @@
+#pragma once
+
+// 非同期・レベル別ログ（全ファームウェア共通）
+// ログはロックフリーのリングバッファへ書式化して積むだけで、シリアル出力は
+// 低優先度タスク（ホストでは任意のスレッド）が drain() で行う。
+// 複数の生産者（loop() と BLEコールバック）から同時に書き込める。満杯時は破棄して数える。
+//
+// コンパイル時レベル LOG_COMPILE_LEVEL 未満のマクロは空になり、引数も評価されない
+//   例: build_flags = -D LOG_COMPILE_LEVEL=LOG_LEVEL_DEBUG
+// さらにモジュールごとに実行時レベルを設定できる（asyncLog().setLevel()）
+// ホストでの計測: hot_path_bench の log_before_sync・log_before_usb_wait（以前の同期出力）と
+// log_after_enqueue・log_after_stripped
+//
+//   LOG_I(LOG_MOD_DETECT, "passage count=%d", count);
+//
+// リングは診断ログ専用（満杯なら捨てる）。PC向けプロトコル行（"STATUS:..." など）は捨てられないので
+// writeProtocolLine() で呼び出し元から直接 Serial へ書く（送信バッファが空くまで待つ）
+
+#include <atomic>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_NONE 4
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+#endif
+
+// 1レコードの最大文字数（接頭辞を含む、超過分は切り詰め）
+#ifndef LOG_RECORD_SIZE
+#define LOG_RECORD_SIZE 96
+#endif
+
+// リングバッファのレコード数（2のべき乗）
+#ifndef LOG_RING_RECORDS
+#define LOG_RING_RECORDS 32
+#endif
+
+#ifdef ARDUINO
+#include <Arduino.h>
+inline uint32_t asyncLogMillis() { return millis(); }
+#else
+#include <chrono>
+inline uint32_t asyncLogMillis() {
+  return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+enum LogModule : uint8_t {
+  LOG_MOD_MAIN,
+  LOG_MOD_BLE,
+  LOG_MOD_SENSOR,
+  LOG_MOD_DETECT,
+  LOG_MOD_UART,
+  LOG_MOD_COUNT,
+};
+
+inline const char* logModuleName(uint8_t module) {
+  static const char* const names[LOG_MOD_COUNT] = {"main", "ble", "sensor", "detect", "uart"};
+  return module < LOG_MOD_COUNT ? names[module] : "?";
+}
+
+inline char logLevelChar(uint8_t level) {
+  static const char chars[] = {'D', 'I', 'W', 'E'};
+  return level < sizeof(chars) ? chars[level] : '?';
+}
+
+// 有界MPMCキュー（各セルのシーケンス番号で所有権を受け渡す）
+class AsyncLog {
+ public:
+  AsyncLog() : enqueuePos_(0), dequeuePos_(0), dropped_(0) {
+    for (size_t i = 0; i < LOG_RING_RECORDS; i++) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < LOG_MOD_COUNT; i++) {
+      levels_[i] = LOG_LEVEL_DEBUG;
+    }
+  }
+
+  void setLevel(uint8_t module, uint8_t level) {
+    if (module < LOG_MOD_COUNT) {
+      levels_[module] = level;
+    }
+  }
+  bool enabled(uint8_t module, uint8_t level) const {
+    return module < LOG_MOD_COUNT && level >= levels_[module];
+  }
+
+  // 書式化してリングへ積む（raw=trueなら接頭辞なし）
+  // 戻り値: 積めたらtrue（満杯・レベル不足ならfalse）
+  bool vwrite(uint8_t level, uint8_t module, bool raw, const char* format, va_list args) {
+    if (!raw && !enabled(module, level)) {
+      return false;
+    }
+    Cell* cell = acquire();
+    if (!cell) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    int prefix = 0;
+    if (!raw) {
+      prefix = snprintf(cell->text, LOG_RECORD_SIZE, "[%lu][%c][%s] ",
+                        (unsigned long)asyncLogMillis(), logLevelChar(level), logModuleName(module));
+      if (prefix < 0 || prefix >= LOG_RECORD_SIZE) {
+        prefix = 0;
+      }
+    }
+    int body = vsnprintf(cell->text + prefix, LOG_RECORD_SIZE - prefix, format, args);
+    size_t length = prefix + (body < 0 ? 0 : (size_t)body);
+    cell->length = length < LOG_RECORD_SIZE ? (uint8_t)length : LOG_RECORD_SIZE - 1;
+    publish(cell);
+    return true;
+  }
+
+  bool write(uint8_t level, uint8_t module, bool raw, const char* format, ...)
+      __attribute__((format(printf, 5, 6))) {
+    va_list args;
+    va_start(args, format);
+    bool ok = vwrite(level, module, raw, format, args);
+    va_end(args);
+    return ok;
+  }
+
+  // 溜まったレコードを出力する（消費者は1つだけ）
+  // sink(const char* text, size_t length) を1レコード（改行なし）ごとに呼ぶ
+  // 戻り値: 出力したレコード数
+  template <typename Sink>
+  size_t drain(Sink sink, size_t maxRecords = LOG_RING_RECORDS) {
+    size_t drained = 0;
+    while (drained < maxRecords) {
+      size_t pos = dequeuePos_;
+      Cell& cell = cells_[pos & (LOG_RING_RECORDS - 1)];
+      size_t seq = cell.sequence.load(std::memory_order_acquire);
+      if (seq != pos + 1) {
+        break;
+      }
+      sink(cell.text, (size_t)cell.length);
+      dequeuePos_ = pos + 1;
+      cell.sequence.store(pos + LOG_RING_RECORDS, std::memory_order_release);
+      drained++;
+    }
+    return drained;
+  }
+
+  uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    uint8_t length;
+    char text[LOG_RECORD_SIZE];
+  };
+
+  Cell* acquire() {
+    size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+    while (true) {
+      Cell& cell = cells_[pos & (LOG_RING_RECORDS - 1)];
+      size_t seq = cell.sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          cell.sequence.store(pos, std::memory_order_relaxed);  // 書き込み中の印（posのまま）
+          return &cell;
+        }
+      } else if (diff < 0) {
+        return nullptr;  // 満杯
+      } else {
+        pos = enqueuePos_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void publish(Cell* cell) {
+    size_t pos = cell->sequence.load(std::memory_order_relaxed);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+  }
+
+  static_assert((LOG_RING_RECORDS & (LOG_RING_RECORDS - 1)) == 0, "LOG_RING_RECORDS must be a power of two");
+  static_assert(LOG_RECORD_SIZE <= 255, "LOG_RECORD_SIZE must fit in uint8_t");
+
+  Cell cells_[LOG_RING_RECORDS];
+  std::atomic<size_t> enqueuePos_;
+  size_t dequeuePos_;
+  std::atomic<uint32_t> dropped_;
+  uint8_t levels_[LOG_MOD_COUNT];
+};
+
+inline AsyncLog& asyncLog() {
+  static AsyncLog log;
+  return log;
+}
+
+// レベル別マクロ（コンパイル時レベル未満は空）
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_D(module, ...) asyncLog().write(LOG_LEVEL_DEBUG, module, false, __VA_ARGS__)
+#else
+#define LOG_D(module, ...) ((void)0)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_INFO
+#define LOG_I(module, ...) asyncLog().write(LOG_LEVEL_INFO, module, false, __VA_ARGS__)
+#else
+#define LOG_I(module, ...) ((void)0)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_WARN
+#define LOG_W(module, ...) asyncLog().write(LOG_LEVEL_WARN, module, false, __VA_ARGS__)
+#else
+#define LOG_W(module, ...) ((void)0)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_E(module, ...) asyncLog().write(LOG_LEVEL_ERROR, module, false, __VA_ARGS__)
+#else
+#define LOG_E(module, ...) ((void)0)
+#endif
+
+#ifdef ARDUINO
+// 1行を改行つきの1回の Serial.write で書く（ドレインタスクと他のタスクの行が途中で混ざらないように）
+inline void serialWriteLine(const char* text, size_t length) {
+  char line[LOG_RECORD_SIZE + 2];
+  if (length > LOG_RECORD_SIZE) {
+    length = LOG_RECORD_SIZE;
+  }
+  memcpy(line, text, length);
+  line[length] = '\r';
+  line[length + 1] = '\n';
+  Serial.write((const uint8_t*)line, length + 2);
+}
+
+// プロトコル行（接頭辞なし）をリングを通さずに書く。レベルによらず常に出力し、捨てない
+inline void writeProtocolLine(const char* format, ...) __attribute__((format(printf, 1, 2)));
+inline void writeProtocolLine(const char* format, ...) {
+  char line[LOG_RECORD_SIZE];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  if (length < 0) {
+    return;
+  }
+  serialWriteLine(line, (size_t)length < sizeof(line) ? (size_t)length : sizeof(line) - 1);
+}
+
+// 低優先度のドレインタスクを起動する（Serialへ出力）
+inline void asyncLogDrainTask(void*) {
+  while (true) {
+    size_t n = asyncLog().drain([](const char* text, size_t length) {
+      serialWriteLine(text, length);
+    });
+    if (n == 0) {
+      vTaskDelay(pdMS_TO_TICKS(5));
+    }
+  }
+}
+
+inline void startAsyncLog(UBaseType_t priority = 1) {
+  xTaskCreatePinnedToCore(asyncLogDrainTask, "log", 3072, nullptr, priority, nullptr, ARDUINO_RUNNING_CORE);
+}
+#endif
@@ -0,0 +1,126 @@
+#pragma once
+
+// receiverのベースライン校正値の保存形式（NVSに保存し、次の起動ですぐ検知を始める）
+// Arduino非依存（ホスト環境でもコンパイル可能、HalStorage越しに読み書きする）
+//
+// レコード構成（リトルエンディアン、BASELINE_RECORD_SIZE バイト）:
+//   0  magic      u32  BASELINE_RECORD_MAGIC
+//   4  version    u8   BASELINE_RECORD_VERSION
+//   5  offset     i8   校正時のセンサーオフセット（mm、変わっていたら使わない）
+//   6  baseline   u16  ベースライン距離（mm）
+//   8  noise      u16  校正時の測定値の標準偏差（0.1mm単位）
+//   10 valid      u8   校正に使った有効測定数
+//   11 reserved   u8   0
+//   12 generation u32  保存回数（保存のたびに1増える）
+//   16 savedAt    u32  保存時の起動からの経過時間（ms）
+//   20 crc        u16  CRC-16/CCITT（crc欄を除く先頭20バイト、sample_codec.h と同じ）
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hal.h"
+#include "sample_codec.h"
+
+#define BASELINE_RECORD_MAGIC 0x314C4259  // "YBL1"
+#define BASELINE_RECORD_VERSION 1
+#define BASELINE_RECORD_SIZE 22
+#define BASELINE_STORAGE_KEY "baseline"
+#define BASELINE_MIN_MM 20    // これより近いベースラインは壊れた値とみなす
+#define BASELINE_MAX_NOISE 500  // 50.0mm
+
+struct BaselineRecord {
+  int8_t offset;
+  uint16_t baseline;
+  uint16_t noise;  // 0.1mm単位
+  uint8_t valid;
+  uint32_t generation;
+  uint32_t savedAt;
+};
+
+enum BaselineLoadResult : uint8_t {
+  BASELINE_OK,
+  BASELINE_MISSING,         // 未保存
+  BASELINE_BAD_LENGTH,
+  BASELINE_BAD_MAGIC,
+  BASELINE_BAD_VERSION,
+  BASELINE_BAD_CRC,
+  BASELINE_OUT_OF_RANGE,    // CRCは正しいが値が範囲外
+  BASELINE_OFFSET_CHANGED,  // 保存後にセンサーオフセットが変わった
+};
+
+inline const char* baselineLoadResultName(BaselineLoadResult result) {
+  static const char* const names[] = {"ok", "missing", "bad_length", "bad_magic", "bad_version",
+                                      "bad_crc", "out_of_range", "offset_changed"};
+  return result < sizeof(names) / sizeof(names[0]) ? names[result] : "?";
+}
+
+inline size_t encodeBaselineRecord(const BaselineRecord& record, uint8_t* out) {
+  putSampleU32(out, BASELINE_RECORD_MAGIC);
+  out[4] = BASELINE_RECORD_VERSION;
+  out[5] = (uint8_t)record.offset;
+  putSampleU16(out + 6, record.baseline);
+  putSampleU16(out + 8, record.noise);
+  out[10] = record.valid;
+  out[11] = 0;
+  putSampleU32(out + 12, record.generation);
+  putSampleU32(out + 16, record.savedAt);
+  putSampleU16(out + 20, sampleCrc16(out, 20));
+  return BASELINE_RECORD_SIZE;
+}
+
+inline BaselineLoadResult decodeBaselineRecord(const uint8_t* data, size_t length, BaselineRecord& record) {
+  if (length != BASELINE_RECORD_SIZE) {
+    return BASELINE_BAD_LENGTH;
+  }
+  if (getSampleU32(data) != BASELINE_RECORD_MAGIC) {
+    return BASELINE_BAD_MAGIC;
+  }
+  if (data[4] != BASELINE_RECORD_VERSION) {
+    return BASELINE_BAD_VERSION;
+  }
+  if (getSampleU16(data + 20) != sampleCrc16(data, 20)) {
+    return BASELINE_BAD_CRC;
+  }
+  record.offset = (int8_t)data[5];
+  record.baseline = getSampleU16(data + 6);
+  record.noise = getSampleU16(data + 8);
+  record.valid = data[10];
+  record.generation = getSampleU32(data + 12);
+  record.savedAt = getSampleU32(data + 16);
+  if (record.baseline < BASELINE_MIN_MM || record.baseline > 255 || record.noise > BASELINE_MAX_NOISE ||
+      record.valid == 0) {
+    return BASELINE_OUT_OF_RANGE;
+  }
+  return BASELINE_OK;
+}
+
+// 保存されたレコードを読み、現在のオフセットで使えるか確認する
+inline BaselineLoadResult loadBaseline(HalStorage& storage, int8_t offset, BaselineRecord& record) {
+  uint8_t data[BASELINE_RECORD_SIZE];
+  size_t length = storage.read(BASELINE_STORAGE_KEY, data, sizeof(data));
+  if (length == 0) {
+    return BASELINE_MISSING;
+  }
+  if (length != sizeof(data)) {
+    return BASELINE_BAD_LENGTH;
+  }
+  BaselineLoadResult result = decodeBaselineRecord(data, length, record);
+  if (result == BASELINE_OK && record.offset != offset) {
+    return BASELINE_OFFSET_CHANGED;
+  }
+  return result;
+}
+
+inline bool saveBaseline(HalStorage& storage, const BaselineRecord& record) {
+  uint8_t data[BASELINE_RECORD_SIZE];
+  encodeBaselineRecord(record, data);
+  return storage.write(BASELINE_STORAGE_KEY, data, sizeof(data));
+}
+
+// 起動直後の測定平均と保存値の差の許容範囲（mm）
+// 測定のばらつきの3倍か検出閾値の半分の大きい方（最低2mm）
+inline int baselineTolerance(const BaselineRecord& record, int threshold) {
+  int noise3 = (record.noise * 3 + 9) / 10;
+  int tolerance = noise3 > threshold / 2 ? noise3 : threshold / 2;
+  return tolerance > 2 ? tolerance : 2;
+}
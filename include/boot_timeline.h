@@ -0,0 +1,81 @@
+#pragma once
+
+// 起動タイムライン（各段階に到達した時刻を記録し、1行で出力する）
+// 例: "BOOT serial=3 sensor=14 first_sample=26 detect_ready=128 ble_adv=342 calibrated=428"
+// Arduino非依存（ホスト環境でもコンパイル可能）
+// 書き込み（mark）は1つのタスクから、読み出しは他のタスクからでもよい
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BOOT_TIMELINE_MAX 12
+
+class BootTimeline {
+ public:
+  BootTimeline() : count_(0), origin_(0) {}
+
+  // 記録を消して基準時刻を設定する（ファームウェアでは0 = リセット時）
+  void begin(uint32_t origin) {
+    origin_ = origin;
+    count_.store(0, std::memory_order_relaxed);
+  }
+
+  // 段階への到達を記録する（同じ名前は最初の1回だけ、name は文字列リテラルを想定）
+  void mark(const char* name, uint32_t now) {
+    size_t count = count_.load(std::memory_order_relaxed);
+    if (count >= BOOT_TIMELINE_MAX || has(name)) {
+      return;
+    }
+    marks_[count].name = name;
+    marks_[count].at = now - origin_;
+    count_.store(count + 1, std::memory_order_release);  // 書き終えてから読み手に見せる
+  }
+
+  bool has(const char* name) const { return find(name) != nullptr; }
+
+  // 基準時刻からの経過時間（ms、未到達なら0xFFFFFFFF）
+  uint32_t at(const char* name) const {
+    const Mark* m = find(name);
+    return m ? m->at : 0xFFFFFFFFu;
+  }
+
+  // "BOOT name=ms ..." を書き込む（記録順）
+  size_t format(char* out, size_t capacity) const {
+    if (capacity == 0) {
+      return 0;
+    }
+    int used = snprintf(out, capacity, "BOOT");
+    size_t count = count_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count && used >= 0 && (size_t)used < capacity; i++) {
+      used += snprintf(out + used, capacity - used, " %s=%lu", marks_[i].name, (unsigned long)marks_[i].at);
+    }
+    if (used < 0) {
+      out[0] = '\0';
+      return 0;
+    }
+    return (size_t)used < capacity ? (size_t)used : capacity - 1;
+  }
+
+ private:
+  struct Mark {
+    const char* name;
+    uint32_t at;
+  };
+
+  const Mark* find(const char* name) const {
+    size_t count = count_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; i++) {
+      if (strcmp(marks_[i].name, name) == 0) {
+        return &marks_[i];
+      }
+    }
+    return nullptr;
+  }
+
+  Mark marks_[BOOT_TIMELINE_MAX];
+  std::atomic<size_t> count_;
+  uint32_t origin_;
+};
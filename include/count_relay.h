@@ -0,0 +1,93 @@
+#pragma once
+
+// transmitterの中継ロジック（Arduino非依存）
+// receiverから読んだ値 "デバイス番号:カウント[:検出からの経過時間ms]" を
+// レーンごとの前回値と比べ、増えた分だけ通過イベントを発行する
+//
+// - 読み取りが途切れている間に2回以上増えていても、増えた回数分を発行する
+//   （経過時間が分かるのは最後の1回だけなので、それ以前の分は経過時間なしで発行）
+// - カウントが減った場合はreceiverが再起動したとみなし、0から数え直す
+// - 1回で COUNT_RELAY_MAX_STEP を超えて増えた値は壊れた値とみなし、発行せずに基準値だけ取り直す
+//   （不正なパケット1つで大量のイベントを発行してループを止めないため）
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define COUNT_RELAY_LANES 4
+#define COUNT_RELAY_MAX_STEP 64   // 1回の読み取りで発行するイベントの上限
+#define COUNT_RELAY_MAX_DIGITS 9  // 各フィールドの最大桁数（uint32_t・int32_tに収まる範囲）
+
+struct CountReading {
+  int deviceNumber;  // 1〜4
+  uint32_t count;
+  int32_t age;       // 経過時間（ms）、値に含まれない場合は-1
+};
+
+// "1:5" または "1:5:40" を解釈する（数字と区切り以外を含む値・桁数超過は不正）
+inline bool parseCountReading(const char* value, size_t length, CountReading& out) {
+  uint32_t fields[3] = {0, 0, 0};
+  int field = 0;
+  int digits = 0;
+  for (size_t i = 0; i < length; i++) {
+    char c = value[i];
+    if (c >= '0' && c <= '9' && digits < COUNT_RELAY_MAX_DIGITS) {
+      fields[field] = fields[field] * 10 + (uint32_t)(c - '0');
+      digits++;
+    } else if (c == ':' && digits > 0 && field < 2) {
+      field++;
+      digits = 0;
+    } else {
+      return false;
+    }
+  }
+  if (digits == 0 || field < 1) {
+    return false;
+  }
+  out.deviceNumber = (int)fields[0];
+  out.count = fields[1];
+  out.age = field == 2 ? (int32_t)fields[2] : -1;
+  return out.deviceNumber >= 1 && out.deviceNumber <= COUNT_RELAY_LANES;
+}
+
+class CountRelay {
+ public:
+  CountRelay() { reset(); }
+
+  void reset() {
+    for (int i = 0; i < COUNT_RELAY_LANES; i++) {
+      counts_[i] = 0;
+    }
+    resyncs_ = 0;
+  }
+
+  // 読み取った値を処理し、増えた回数だけ onPassage(lane 0〜3, age) を呼ぶ
+  // 戻り値: 発行したイベント数
+  template <typename OnPassage>
+  uint32_t update(const char* value, size_t length, OnPassage onPassage) {
+    CountReading reading;
+    if (!parseCountReading(value, length, reading)) {
+      return 0;
+    }
+    int lane = reading.deviceNumber - 1;
+    if (reading.count < counts_[lane]) {
+      counts_[lane] = 0;
+    }
+    uint32_t increments = reading.count - counts_[lane];
+    counts_[lane] = reading.count;
+    if (increments > COUNT_RELAY_MAX_STEP) {
+      resyncs_++;
+      return 0;
+    }
+    for (uint32_t i = 0; i < increments; i++) {
+      onPassage(lane, i + 1 == increments ? reading.age : (int32_t)-1);
+    }
+    return increments;
+  }
+
+  uint32_t count(int lane) const { return counts_[lane]; }
+  uint32_t resyncs() const { return resyncs_; }  // 増分が大きすぎて発行しなかった回数
+
+ private:
+  uint32_t counts_[COUNT_RELAY_LANES];
+  uint32_t resyncs_;
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+// 締め切り（deadline）による時間管理（全ファームウェア共通）
+// 時刻は HalClock::millis() の値を渡す。uint32_t は約49.7日で0に戻るため、
+// 比較はすべて差分で行い、折り返しをまたいでも正しく判定する（間隔は2^31ms未満に限る）。
+// delay() で待つ代わりに締め切りを記録し、loop()ごとに到達したかを確認する
+
+#include <stdint.h>
+
+#include "hal.h"
+
+// now が deadline 以降ならtrue
+inline bool timeReached(uint32_t now, uint32_t deadline) {
+  return (int32_t)(now - deadline) >= 0;
+}
+
+// 一度きりの締め切り（LED消灯・切断後の再スキャンなど）
+class Deadline {
+ public:
+  Deadline() : at_(0), armed_(false) {}
+
+  void start(uint32_t now, uint32_t duration) {
+    at_ = now + duration;
+    armed_ = true;
+  }
+  void cancel() { armed_ = false; }
+  bool armed() const { return armed_; }
+
+  // 締め切りを過ぎていれば解除してtrue（1回の start() につき1回だけ）
+  bool expire(uint32_t now) {
+    if (armed_ && timeReached(now, at_)) {
+      armed_ = false;
+      return true;
+    }
+    return false;
+  }
+
+  // 締め切りまでの残り（ms、未設定・経過済みなら0）
+  uint32_t remaining(uint32_t now) const {
+    return armed_ && !timeReached(now, at_) ? at_ - now : 0;
+  }
+
+ private:
+  uint32_t at_;
+  bool armed_;
+};
+
+// 一定間隔の処理（ポーリング・ステータス出力・定期スキャンなど）
+// 前回実行から period 以上経過していれば due() がtrue（millis() - last >= interval と同じ判定）
+class IntervalTimer {
+ public:
+  explicit IntervalTimer(uint32_t period) : period_(period), last_(0) {}
+
+  bool due(uint32_t now) {
+    if (now - last_ >= period_) {
+      last_ = now;
+      return true;
+    }
+    return false;
+  }
+  void restart(uint32_t now) { last_ = now; }
+  uint32_t elapsed(uint32_t now) const { return now - last_; }
+  uint32_t period() const { return period_; }
+
+ private:
+  uint32_t period_;
+  uint32_t last_;
+};
+
+// loop()の周期を一定にする（末尾の固定 delay() の代わり）
+// 次の締め切りまでの残り時間だけ待つため、処理時間が変わっても周期は変わらない。
+// 処理が周期を超えた場合は待たずに締め切りを取り直す（遅れを取り戻すための連続実行はしない）
+class LoopPacer {
+ public:
+  explicit LoopPacer(uint32_t period) : period_(period), next_(0), started_(false), overruns_(0) {}
+
+  void wait(HalClock& clock) {
+    uint32_t now = clock.millis();
+    if (!started_) {
+      next_ = now;
+      started_ = true;
+    }
+    next_ += period_;
+    int32_t remaining = (int32_t)(next_ - now);
+    if (remaining < 0) {
+      overruns_++;
+      next_ = now;
+    } else if (remaining > 0) {
+      clock.delay((uint32_t)remaining);
+    }
+  }
+
+  uint32_t overruns() const { return overruns_; }
+
+ private:
+  uint32_t period_;
+  uint32_t next_;
+  bool started_;
+  uint32_t overruns_;
+};
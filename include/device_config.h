@@ -0,0 +1,352 @@
+#pragma once
+
+// デバイスの設定（レーン番号・オフセット・検知パラメータ・名前）と保存形式
+// 起動時にNVSの設定を読み、なければ登録済みMACアドレスの既定値、それもなければ未登録の既定値を使う。
+// 設定はシリアル・BLEの "$" 行コマンドで変更してNVSに保存する（再起動で反映）
+// Arduino非依存（ホスト環境でもコンパイル可能、HalStorage越しに読み書きする）
+//
+//   $show             現在の設定を表示
+//   $lane=2           レーン番号（1〜4、0は未設定）
+//   $offset=-5        センサーオフセット（mm、-128〜127）
+//   $threshold=10     検出閾値（mm、1〜100）
+//   $ignore=3000      重複カウント防止時間（ms、100〜60000）
+//   $name=Lane2       名前（英数字と -_、15文字まで）
+//   $power=balanced   電源モード（full・balanced・saver または 0〜2、power_plan.h）
+//   $save             NVSに保存
+//   $reset            保存した設定を消して既定値に戻す
+//   $restart          再起動（保存した設定を反映）
+//
+// レコード構成（リトルエンディアン、DEVICE_CONFIG_SIZE バイト）:
+//   0  magic     u32  DEVICE_CONFIG_MAGIC
+//   4  version   u8   DEVICE_CONFIG_VERSION（互換性のない変更で上げる）
+//   5  length    u8   レコード長（同じバージョンのまま末尾に欄を足した場合は長くなる）
+//   6  lane      u8
+//   7  offset    i8
+//   8  threshold u8
+//   9  power     u8   電源モード（PowerMode、以前は予約で0 = full）
+//   10 ignoreMs  u16
+//   12 name      char[16]  NUL終端・NUL埋め
+//   28 crc       u16  CRC-16/CCITT（crc欄を除く先頭28バイト、sample_codec.h と同じ）
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal.h"
+#include "power_plan.h"
+#include "sample_codec.h"
+
+#define DEVICE_CONFIG_MAGIC 0x47464359  // "YCFG"
+#define DEVICE_CONFIG_VERSION 1
+#define DEVICE_CONFIG_SIZE 30
+#define DEVICE_CONFIG_NAME_MAX 16  // NUL を含む
+#define DEVICE_CONFIG_KEY "config"
+#define DEVICE_LANES 4
+
+struct DeviceConfig {
+  uint8_t lane;       // 1〜4（0は未設定）
+  int8_t offset;      // センサーオフセット（mm）
+  uint8_t threshold;  // 検出閾値（mm）
+  uint16_t ignoreMs;  // 重複カウント防止時間（ms）
+  uint8_t power;      // 電源モード（PowerMode）
+  char name[DEVICE_CONFIG_NAME_MAX];
+};
+
+// 設定の出どころ
+enum DeviceConfigSource : uint8_t {
+  DEVICE_CONFIG_FROM_STORAGE,  // NVSに保存された設定
+  DEVICE_CONFIG_FROM_TABLE,    // 登録済みMACアドレスの既定値
+  DEVICE_CONFIG_FROM_DEFAULT,  // 未登録デバイスの既定値
+};
+
+inline const char* deviceConfigSourceName(DeviceConfigSource source) {
+  static const char* const names[] = {"nvs", "mac_table", "default"};
+  return source < sizeof(names) / sizeof(names[0]) ? names[source] : "?";
+}
+
+// 登録済みデバイスの既定値（WiFi STAのMACアドレス、NVSに設定がない場合に使う）
+struct KnownDevice {
+  uint8_t mac[6];
+  uint8_t lane;
+  int8_t offset;
+  const char* name;
+};
+
+static const KnownDevice KNOWN_DEVICES[] = {
+    {{0xcc, 0xba, 0x97, 0x15, 0x4d, 0x0c}, 1, 125, "Device1"},
+    {{0xcc, 0xba, 0x97, 0x15, 0x53, 0x20}, 2, 55, "Device2"},
+    {{0xcc, 0xba, 0x97, 0x15, 0x4f, 0x28}, 3, -5, "Device3"},
+    {{0xcc, 0xba, 0x97, 0x15, 0x37, 0x34}, 4, 0, "Device4"},    // 4 old
+    {{0x98, 0x3d, 0xae, 0xee, 0x85, 0x9c}, 4, 125, "Device4"},  // 4 new
+};
+
+inline void setDeviceConfigName(DeviceConfig& config, const char* name) {
+  strncpy(config.name, name, DEVICE_CONFIG_NAME_MAX - 1);
+  config.name[DEVICE_CONFIG_NAME_MAX - 1] = '\0';
+}
+
+// 未登録デバイスの既定値（検知パラメータは PassageDetectorConfig の既定値と同じ）
+inline DeviceConfig defaultDeviceConfig() {
+  DeviceConfig config;
+  memset(&config, 0, sizeof(config));
+  config.lane = 0;
+  config.offset = 0;
+  config.threshold = 10;
+  config.ignoreMs = 3000;
+  config.power = POWER_FULL;
+  setDeviceConfigName(config, "Unknown Device");
+  return config;
+}
+
+inline const KnownDevice* findKnownDevice(const uint8_t mac[6]) {
+  for (const KnownDevice& device : KNOWN_DEVICES) {
+    if (memcmp(device.mac, mac, 6) == 0) {
+      return &device;
+    }
+  }
+  return nullptr;
+}
+
+inline bool validDeviceConfigName(const char* name) {
+  size_t length = strlen(name);
+  if (length == 0 || length >= DEVICE_CONFIG_NAME_MAX) {
+    return false;
+  }
+  for (size_t i = 0; i < length; i++) {
+    char c = name[i];
+    bool ok = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '-' || c == '_';
+    if (!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+inline bool validDeviceConfig(const DeviceConfig& config) {
+  return config.lane <= DEVICE_LANES && config.threshold >= 1 && config.threshold <= 100 &&
+         config.ignoreMs >= 100 && config.ignoreMs <= 60000 && config.power < POWER_MODES &&
+         validDeviceConfigName(config.name);
+}
+
+inline size_t encodeDeviceConfig(const DeviceConfig& config, uint8_t* out) {
+  memset(out, 0, DEVICE_CONFIG_SIZE);
+  putSampleU32(out, DEVICE_CONFIG_MAGIC);
+  out[4] = DEVICE_CONFIG_VERSION;
+  out[5] = DEVICE_CONFIG_SIZE;
+  out[6] = config.lane;
+  out[7] = (uint8_t)config.offset;
+  out[8] = config.threshold;
+  out[9] = config.power;
+  putSampleU16(out + 10, config.ignoreMs);
+  memcpy(out + 12, config.name, strnlen(config.name, DEVICE_CONFIG_NAME_MAX - 1));
+  putSampleU16(out + DEVICE_CONFIG_SIZE - 2, sampleCrc16(out, DEVICE_CONFIG_SIZE - 2));
+  return DEVICE_CONFIG_SIZE;
+}
+
+// 保存されたレコードを解釈する（形式・CRC・値の範囲が正しければtrue）
+// 新しいファームウェアが末尾に欄を足したレコード（length が長い）も、知っている欄だけ読む
+inline bool decodeDeviceConfig(const uint8_t* data, size_t length, DeviceConfig& config) {
+  if (length < DEVICE_CONFIG_SIZE || getSampleU32(data) != DEVICE_CONFIG_MAGIC ||
+      data[4] != DEVICE_CONFIG_VERSION || data[5] != length) {
+    return false;
+  }
+  if (getSampleU16(data + length - 2) != sampleCrc16(data, length - 2)) {
+    return false;
+  }
+  if (memchr(data + 12, '\0', DEVICE_CONFIG_NAME_MAX) == nullptr) {
+    return false;
+  }
+  DeviceConfig decoded;
+  decoded.lane = data[6];
+  decoded.offset = (int8_t)data[7];
+  decoded.threshold = data[8];
+  decoded.power = data[9];
+  decoded.ignoreMs = getSampleU16(data + 10);
+  memcpy(decoded.name, data + 12, DEVICE_CONFIG_NAME_MAX);
+  if (!validDeviceConfig(decoded)) {
+    return false;
+  }
+  config = decoded;
+  return true;
+}
+
+inline bool saveDeviceConfig(HalStorage& storage, const DeviceConfig& config) {
+  uint8_t data[DEVICE_CONFIG_SIZE];
+  encodeDeviceConfig(config, data);
+  return storage.write(DEVICE_CONFIG_KEY, data, sizeof(data));
+}
+
+// 起動時の設定を決める（NVS → 登録済みMACアドレス → 未登録の既定値）
+inline DeviceConfigSource loadDeviceConfig(HalStorage& storage, const uint8_t mac[6], DeviceConfig& config) {
+  uint8_t data[64];
+  size_t length = storage.read(DEVICE_CONFIG_KEY, data, sizeof(data));
+  if (length > 0 && length <= sizeof(data) && decodeDeviceConfig(data, length, config)) {
+    return DEVICE_CONFIG_FROM_STORAGE;
+  }
+  config = defaultDeviceConfig();
+  const KnownDevice* known = findKnownDevice(mac);
+  if (known) {
+    config.lane = known->lane;
+    config.offset = known->offset;
+    setDeviceConfigName(config, known->name);
+    return DEVICE_CONFIG_FROM_TABLE;
+  }
+  return DEVICE_CONFIG_FROM_DEFAULT;
+}
+
+// "$" コマンドの結果
+enum DeviceConfigCommand : uint8_t {
+  DEVICE_CONFIG_CMD_CHANGED,  // 設定を変更した（$save まで保存しない）
+  DEVICE_CONFIG_CMD_SHOW,
+  DEVICE_CONFIG_CMD_SAVE,
+  DEVICE_CONFIG_CMD_RESET,
+  DEVICE_CONFIG_CMD_RESTART,
+  DEVICE_CONFIG_CMD_ERROR,    // 不明なコマンド・範囲外の値（設定は変えない）
+};
+
+inline size_t formatDeviceConfig(const DeviceConfig& config, char* out, size_t capacity) {
+  int length = snprintf(out, capacity, "CONFIG lane=%u offset=%d threshold=%u ignore=%u power=%s name=%s",
+                        config.lane, config.offset, config.threshold, config.ignoreMs, powerModeName(config.power),
+                        config.name);
+  if (length < 0 || capacity == 0) {
+    return 0;
+  }
+  return (size_t)length < capacity ? (size_t)length : capacity - 1;
+}
+
+// 10進の整数（符号付き）を読む（数字以外を含む・範囲外ならfalse）
+inline bool parseDeviceConfigInt(const char* text, size_t length, long min, long max, long& value) {
+  size_t i = 0;
+  bool negative = false;
+  if (i < length && (text[i] == '-' || text[i] == '+')) {
+    negative = text[i] == '-';
+    i++;
+  }
+  if (i == length || length - i > 6) {
+    return false;
+  }
+  long result = 0;
+  for (; i < length; i++) {
+    if (text[i] < '0' || text[i] > '9') {
+      return false;
+    }
+    result = result * 10 + (text[i] - '0');
+  }
+  value = negative ? -result : result;
+  return value >= min && value <= max;
+}
+
+// "$key=value" などの1行を config に適用する（line は "$" を含む、末尾の改行・空白は無視）
+inline DeviceConfigCommand applyDeviceConfigCommand(DeviceConfig& config, const char* line, size_t length) {
+  while (length > 0 && (line[length - 1] == '\r' || line[length - 1] == '\n' || line[length - 1] == ' ')) {
+    length--;
+  }
+  if (length < 2 || line[0] != '$') {
+    return DEVICE_CONFIG_CMD_ERROR;
+  }
+  const char* command = line + 1;
+  size_t commandLength = length - 1;
+  const char* equals = (const char*)memchr(command, '=', commandLength);
+  if (!equals) {
+    if (commandLength == 4 && memcmp(command, "show", 4) == 0) {
+      return DEVICE_CONFIG_CMD_SHOW;
+    }
+    if (commandLength == 4 && memcmp(command, "save", 4) == 0) {
+      return DEVICE_CONFIG_CMD_SAVE;
+    }
+    if (commandLength == 5 && memcmp(command, "reset", 5) == 0) {
+      return DEVICE_CONFIG_CMD_RESET;
+    }
+    if (commandLength == 7 && memcmp(command, "restart", 7) == 0) {
+      return DEVICE_CONFIG_CMD_RESTART;
+    }
+    return DEVICE_CONFIG_CMD_ERROR;
+  }
+  size_t keyLength = (size_t)(equals - command);
+  const char* value = equals + 1;
+  size_t valueLength = commandLength - keyLength - 1;
+  long number;
+  DeviceConfig updated = config;
+  if (keyLength == 4 && memcmp(command, "lane", 4) == 0 &&
+      parseDeviceConfigInt(value, valueLength, 0, DEVICE_LANES, number)) {
+    updated.lane = (uint8_t)number;
+  } else if (keyLength == 6 && memcmp(command, "offset", 6) == 0 &&
+             parseDeviceConfigInt(value, valueLength, -128, 127, number)) {
+    updated.offset = (int8_t)number;
+  } else if (keyLength == 9 && memcmp(command, "threshold", 9) == 0 &&
+             parseDeviceConfigInt(value, valueLength, 1, 100, number)) {
+    updated.threshold = (uint8_t)number;
+  } else if (keyLength == 6 && memcmp(command, "ignore", 6) == 0 &&
+             parseDeviceConfigInt(value, valueLength, 100, 60000, number)) {
+    updated.ignoreMs = (uint16_t)number;
+  } else if (keyLength == 5 && memcmp(command, "power", 5) == 0) {
+    if (!parseDeviceConfigInt(value, valueLength, 0, POWER_MODES - 1, number)) {
+      for (number = 0; number < POWER_MODES; number++) {
+        const char* name = powerModeName((uint8_t)number);
+        if (strlen(name) == valueLength && memcmp(value, name, valueLength) == 0) {
+          break;
+        }
+      }
+      if (number == POWER_MODES) {
+        return DEVICE_CONFIG_CMD_ERROR;
+      }
+    }
+    updated.power = (uint8_t)number;
+  } else if (keyLength == 4 && memcmp(command, "name", 4) == 0 && valueLength > 0 &&
+             valueLength < DEVICE_CONFIG_NAME_MAX) {
+    char name[DEVICE_CONFIG_NAME_MAX];
+    memcpy(name, value, valueLength);
+    name[valueLength] = '\0';
+    if (!validDeviceConfigName(name)) {
+      return DEVICE_CONFIG_CMD_ERROR;
+    }
+    setDeviceConfigName(updated, name);
+  } else {
+    return DEVICE_CONFIG_CMD_ERROR;
+  }
+  config = updated;
+  return DEVICE_CONFIG_CMD_CHANGED;
+}
+
+// "$" で始まる行を1文字ずつ組み立てる（シリアルの1文字コマンドと共存させるため）
+class DeviceConfigLineReader {
+ public:
+  DeviceConfigLineReader() : length_(0), active_(false) {}
+
+  // "$" を受け取ったら行の組み立てを始める
+  void start() {
+    buffer_[0] = '$';
+    length_ = 1;
+    active_ = true;
+  }
+  bool active() const { return active_; }
+
+  // 組み立て中の行に1文字加える（改行で行が完成したらtrue、長すぎる行は捨てる）
+  bool feed(char c) {
+    if (!active_) {
+      return false;
+    }
+    if (c == '\n' || c == '\r') {
+      active_ = false;
+      buffer_[length_] = '\0';
+      return length_ > 1;
+    }
+    if (length_ + 1 >= sizeof(buffer_)) {
+      active_ = false;
+      length_ = 0;
+      return false;
+    }
+    buffer_[length_++] = c;
+    return false;
+  }
+
+  const char* line() const { return buffer_; }
+  size_t length() const { return length_; }
+
+ private:
+  char buffer_[48];
+  size_t length_;
+  bool active_;
+};
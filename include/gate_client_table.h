@@ -0,0 +1,193 @@
+#pragma once
+
+// tanaka_gate_server用の接続クライアント管理
+// クライアントごとに購読状態・MTU・送信位置を持ち、ラウンドロビンで公平に配信する
+// Arduino非依存（ホスト環境でもコンパイル可能）
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gate_event_log.h"
+#include "latency_histogram.h"
+
+// クライアント1台分の状態
+struct GateClientSlot {
+  bool active;
+  bool subscribed;     // CCCDで通知が有効化されているか
+  uint16_t connId;
+  uint16_t mtu;
+  uint32_t cursor;     // 次に送るシーケンス番号
+  uint32_t sent;       // 送信したイベント数
+  uint32_t notifications;
+  uint32_t skipped;    // 送信前にログから消えたイベント数
+  uint32_t congested;  // 送信失敗（輻輳）回数
+  bool announceEpoch;  // 次の通知の先頭にエポック行を付けるか
+  uint32_t catchUps;   // SINCE要求の受付回数
+};
+
+template <size_t MaxClients>
+class GateClientTable {
+ public:
+  GateClientTable() : next_(0), epoch_(0) {
+    for (size_t i = 0; i < MaxClients; i++) {
+      slots_[i] = GateClientSlot();
+    }
+  }
+
+  // 新しい接続を登録する（以降に発生したイベントから送信）
+  GateClientSlot* connect(uint16_t connId, uint32_t startSeq) {
+    GateClientSlot* slot = find(connId);
+    if (!slot) {
+      for (size_t i = 0; i < MaxClients; i++) {
+        if (!slots_[i].active) {
+          slot = &slots_[i];
+          break;
+        }
+      }
+    }
+    if (!slot) {
+      return nullptr;
+    }
+    *slot = GateClientSlot();
+    slot->active = true;
+    slot->connId = connId;
+    slot->mtu = 23;
+    slot->cursor = startSeq;
+    slot->announceEpoch = true;
+    return slot;
+  }
+
+  // サーバー起動ごとのエポックを設定する
+  void setEpoch(uint32_t epoch) { epoch_ = epoch; }
+  uint32_t epoch() const { return epoch_; }
+
+  // SINCE要求: 受信済みのlastSeqより後から送り直す
+  // エポックが異なる（サーバー再起動後）場合は保持している全イベントを送る
+  // 戻り値: 再送対象のイベント数
+  template <size_t N>
+  uint32_t requestSince(uint16_t connId, uint32_t epoch, uint32_t lastSeq, const GateEventLog<N>& log) {
+    GateClientSlot* slot = find(connId);
+    if (!slot) {
+      return 0;
+    }
+    uint32_t cursor = log.oldestSeq();
+    if (epoch == epoch_ && (int32_t)(lastSeq + 1 - cursor) > 0) {
+      cursor = lastSeq + 1;
+      if ((int32_t)(cursor - log.nextSeq()) > 0) {
+        cursor = log.nextSeq();
+      }
+    }
+    slot->cursor = cursor;
+    slot->announceEpoch = true;
+    slot->catchUps++;
+    return log.countSince(cursor);
+  }
+
+  void disconnect(uint16_t connId) {
+    GateClientSlot* slot = find(connId);
+    if (slot) {
+      slot->active = false;
+      slot->subscribed = false;
+    }
+  }
+
+  void setMtu(uint16_t connId, uint16_t mtu) {
+    GateClientSlot* slot = find(connId);
+    if (slot) {
+      slot->mtu = mtu;
+    }
+  }
+
+  void setSubscribed(uint16_t connId, bool subscribed) {
+    GateClientSlot* slot = find(connId);
+    if (slot) {
+      slot->subscribed = subscribed;
+    }
+  }
+
+  GateClientSlot* find(uint16_t connId) {
+    for (size_t i = 0; i < MaxClients; i++) {
+      if (slots_[i].active && slots_[i].connId == connId) {
+        return &slots_[i];
+      }
+    }
+    return nullptr;
+  }
+
+  size_t activeCount() const {
+    size_t n = 0;
+    for (size_t i = 0; i < MaxClients; i++) {
+      if (slots_[i].active) {
+        n++;
+      }
+    }
+    return n;
+  }
+
+  // 未送信イベント数（backlog）
+  template <size_t N>
+  static uint32_t backlog(const GateClientSlot& slot, const GateEventLog<N>& log) {
+    return log.nextSeq() - slot.cursor;
+  }
+
+  // 1ラウンド分の配信: 購読中の各クライアントに最大1通知ずつ送る
+  // 開始位置を毎回ずらし、遅いクライアントが他を待たせないようにする
+  // Senderは bool send(uint16_t connId, const uint8_t* data, size_t length) を持つ型
+  // notifyLatencyを渡すと、イベント受信から通知送信までの時間（ms）を記録する
+  // 戻り値: 送信した通知数
+  template <size_t N, typename Sender>
+  size_t fanOut(const GateEventLog<N>& log, Sender& sender, uint32_t now,
+                LatencyHistogram* notifyLatency = nullptr) {
+    size_t notified = 0;
+    for (size_t k = 0; k < MaxClients; k++) {
+      GateClientSlot& slot = slots_[(next_ + k) % MaxClients];
+      if (!slot.active || !slot.subscribed ||
+          (slot.cursor == log.nextSeq() && !slot.announceEpoch)) {
+        continue;
+      }
+      size_t capacity = slot.mtu > GATE_ATT_HEADER_SIZE ? slot.mtu - GATE_ATT_HEADER_SIZE : 0;
+      if (capacity > GATE_BATCH_MAX) {
+        capacity = GATE_BATCH_MAX;
+      }
+      // 送信前にログから消えたイベントは欠番として数える
+      uint32_t oldest = log.oldestSeq();
+      if ((int32_t)(slot.cursor - oldest) < 0) {
+        slot.skipped += oldest - slot.cursor;
+        slot.cursor = oldest;
+      }
+      // エポック行の後ろに入らないイベントは切り詰めずに次の通知へ回す
+      size_t header = slot.announceEpoch ? formatGateEpoch(buffer_, capacity, epoch_) : 0;
+      uint32_t cursor = slot.cursor;
+      size_t len = header + log.packSince(cursor, buffer_ + header, capacity - header, now, nullptr, header == 0);
+      if (len == 0) {
+        continue;
+      }
+      if (sender.send(slot.connId, (const uint8_t*)buffer_, len)) {
+        if (notifyLatency) {
+          for (uint32_t seq = slot.cursor; seq != cursor; seq++) {
+            notifyLatency->record(now - log.find(seq)->timestamp);
+          }
+        }
+        slot.sent += cursor - slot.cursor;
+        slot.cursor = cursor;
+        slot.announceEpoch = false;
+        slot.notifications++;
+        notified++;
+      } else {
+        // 失敗時は位置を進めず次のラウンドで再送
+        slot.congested++;
+      }
+    }
+    next_ = (next_ + 1) % MaxClients;
+    return notified;
+  }
+
+  const GateClientSlot& slot(size_t index) const { return slots_[index]; }
+  size_t capacity() const { return MaxClients; }
+
+ private:
+  GateClientSlot slots_[MaxClients];
+  size_t next_;
+  uint32_t epoch_;
+  char buffer_[GATE_BATCH_MAX];
+};
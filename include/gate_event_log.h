@@ -0,0 +1,319 @@
+#pragma once
+
+// tanaka_gate_server用のゲートイベントログ
+// 直近N件のイベントをリングバッファに保持し、クライアントごとの読み出し位置から送信する
+// Arduino非依存（ホスト環境でもコンパイル可能）
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// 1イベントあたりのデータ最大長（UART 1行分）
+#define GATE_EVENT_DATA_MAX 16
+
+// ATTヘッダ分（notifyペイロード = MTU - 3）
+#define GATE_ATT_HEADER_SIZE 3
+
+// 1回の通知の最大ペイロード（BLE最大MTU(517) - ATTヘッダ）
+#define GATE_BATCH_MAX 512
+
+// 経過時間が不明なイベント
+#define GATE_AGE_UNKNOWN 0xFFFF
+
+// ゲートイベント（UARTで受信した1行）
+struct GateEvent {
+  uint32_t seq;        // シーケンス番号（1から開始）
+  uint32_t timestamp;  // このノードでの受信時刻（ms）
+  uint16_t age;        // 受信時点での検出からの経過時間（ms、不明ならGATE_AGE_UNKNOWN）
+  uint8_t length;
+  bool isEpoch;        // クライアントの受信キューのエポック行（seq がエポック、データは空）
+  char data[GATE_EVENT_DATA_MAX + 1];
+};
+
+// 送信データ形式: "seq:data[:age]" を改行区切りで連結
+//   例: "12:a:85\n13:s:40\n"
+// ageは検出から送信までの経過時間（ms）。各ノードが自分の滞留時間を加算して引き継ぐ
+// （ノード間の時計は同期していないため、区間ごとの絶対時刻ではなく経過時間で伝える）
+//
+// サーバーの起動ごとに変わるエポックを "#<epoch(16進)>" 行で通知する
+//   例: "#1A2B3C4D\n12:a\n"
+// クライアントはRXキャラクタリスティックへ "SINCE:<epoch(16進)>:<seq>" を書き込み、
+// 受信済み番号より後のイベントを要求する（エポック不一致なら保持分をすべて再送）
+
+// 16進数を読む（読んだ桁数を返す）
+inline size_t parseGateHex(const char* text, size_t length, uint32_t& value) {
+  value = 0;
+  size_t i = 0;
+  for (; i < length && i < 8; i++) {
+    char c = text[i];
+    uint32_t digit;
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if (c >= 'A' && c <= 'F') {
+      digit = c - 'A' + 10;
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else {
+      break;
+    }
+    value = (value << 4) | digit;
+  }
+  return i;
+}
+
+// 10進数を読む（読んだ桁数を返す。uint32_tを超える桁はその手前で止める）
+inline size_t parseGateDecimal(const char* text, size_t length, uint32_t& value) {
+  value = 0;
+  size_t i = 0;
+  for (; i < length && text[i] >= '0' && text[i] <= '9'; i++) {
+    uint32_t digit = (uint32_t)(text[i] - '0');
+    if (value > (0xFFFFFFFFu - digit) / 10) {
+      break;
+    }
+    value = value * 10 + digit;
+  }
+  return i;
+}
+
+// "data:age" を分割する（戻り値: dataの長さ、ageがなければGATE_AGE_UNKNOWN）
+inline size_t splitGateAge(const char* line, size_t length, uint16_t& age) {
+  age = GATE_AGE_UNKNOWN;
+  size_t colon = length;
+  while (colon > 0 && line[colon - 1] >= '0' && line[colon - 1] <= '9') {
+    colon--;
+  }
+  if (colon == 0 || colon == length || line[colon - 1] != ':' || colon - 1 == 0) {
+    return length;
+  }
+  uint32_t value;
+  if (parseGateDecimal(line + colon, length - colon, value) != length - colon) {
+    return length;
+  }
+  age = value < GATE_AGE_UNKNOWN ? (uint16_t)value : GATE_AGE_UNKNOWN - 1;
+  return colon - 1;
+}
+
+// 経過時間に滞留時間を加算する（不明ならそのまま、上限で飽和）
+inline uint16_t addGateAge(uint16_t age, uint32_t elapsed) {
+  if (age == GATE_AGE_UNKNOWN) {
+    return age;
+  }
+  uint32_t total = (uint32_t)age + elapsed;
+  return total < GATE_AGE_UNKNOWN ? (uint16_t)total : GATE_AGE_UNKNOWN - 1;
+}
+
+// エポック行 "#XXXXXXXX\n" を書き込む（収まらなければ0）
+inline size_t formatGateEpoch(char* out, size_t capacity, uint32_t epoch) {
+  if (capacity < 11) {
+    return 0;
+  }
+  snprintf(out, capacity, "#%08lX\n", (unsigned long)epoch);
+  return 10;
+}
+
+// "SINCE:<epoch>:<seq>" を書き込む（戻り値: 文字数）
+inline size_t formatGateSinceRequest(char* out, size_t capacity, uint32_t epoch, uint32_t seq) {
+  int len = snprintf(out, capacity, "SINCE:%08lX:%lu", (unsigned long)epoch, (unsigned long)seq);
+  return (len > 0 && (size_t)len < capacity) ? (size_t)len : 0;
+}
+
+// "SINCE:<epoch>:<seq>" を解析する
+inline bool parseGateSinceRequest(const char* text, size_t length, uint32_t& epoch, uint32_t& seq) {
+  static const char prefix[] = "SINCE:";
+  const size_t prefixLength = sizeof(prefix) - 1;
+  if (length <= prefixLength || memcmp(text, prefix, prefixLength) != 0) {
+    return false;
+  }
+  size_t pos = prefixLength;
+  size_t n = parseGateHex(text + pos, length - pos, epoch);
+  if (n == 0 || pos + n >= length || text[pos + n] != ':') {
+    return false;
+  }
+  pos += n + 1;
+  n = parseGateDecimal(text + pos, length - pos, seq);
+  return n > 0 && pos + n == length;
+}
+
+// UARTから1文字ずつ受け取り、1行（1イベント）に組み立てる（tanaka_gate_server）
+// 改行（\n・\r）で区切り、空白・タブは除去する（trim相当）。
+// GATE_EVENT_DATA_MAX を超える行と制御文字・非ASCII文字を含む行は丸ごと破棄する
+// （途中で切った行や化けた行を別のゲートとして記録しないため）
+class GateLineReader {
+ public:
+  GateLineReader() : length_(0), lineLength_(0), broken_(false), dropped_(0) { line_[0] = '\0'; }
+
+  // 行が完成したらtrue（line()・length()は次のfeed()まで有効）
+  bool feed(char c) {
+    if (c == '\n' || c == '\r') {
+      bool complete = length_ > 0 && !broken_;
+      if (broken_) {
+        dropped_++;
+      }
+      if (complete) {
+        memcpy(line_, buffer_, length_);
+        line_[length_] = '\0';
+        lineLength_ = length_;
+      }
+      length_ = 0;
+      broken_ = false;
+      return complete;
+    }
+    if (c == ' ' || c == '\t') {
+      return false;
+    }
+    if ((unsigned char)c < 0x20 || (unsigned char)c >= 0x7F || length_ == GATE_EVENT_DATA_MAX) {
+      broken_ = true;
+      return false;
+    }
+    buffer_[length_++] = c;
+    return false;
+  }
+
+  const char* line() const { return line_; }
+  size_t length() const { return lineLength_; }
+  uint32_t dropped() const { return dropped_; }  // 破棄した行数
+
+ private:
+  char buffer_[GATE_EVENT_DATA_MAX];
+  char line_[GATE_EVENT_DATA_MAX + 1];
+  size_t length_;
+  size_t lineLength_;
+  bool broken_;
+  uint32_t dropped_;
+};
+
+template <size_t N>
+class GateEventLog {
+ public:
+  GateEventLog() : head_(0), count_(0), nextSeq_(1), appended_(0) {}
+
+  // イベントを追加する（満杯時は最古のイベントを上書き）
+  // 戻り値: 割り当てたシーケンス番号
+  uint32_t append(uint32_t timestamp, const char* data, size_t length, uint16_t age = GATE_AGE_UNKNOWN) {
+    if (length > GATE_EVENT_DATA_MAX) {
+      length = GATE_EVENT_DATA_MAX;
+    }
+    if (count_ == N) {
+      head_ = (head_ + 1) % N;
+      count_--;
+    }
+    GateEvent& ev = slots_[(head_ + count_) % N];
+    ev.seq = nextSeq_++;
+    ev.timestamp = timestamp;
+    ev.age = age;
+    ev.length = (uint8_t)length;
+    ev.isEpoch = false;
+    memcpy(ev.data, data, length);
+    ev.data[length] = '\0';
+    count_++;
+    appended_++;
+    return ev.seq;
+  }
+
+  // 保持している最古のシーケンス番号（空ならnextSeq()）
+  uint32_t oldestSeq() const { return count_ > 0 ? slots_[head_].seq : nextSeq_; }
+  // 次に割り当てるシーケンス番号
+  uint32_t nextSeq() const { return nextSeq_; }
+
+  // 指定番号のイベント（保持していなければnullptr）
+  const GateEvent* find(uint32_t seq) const {
+    uint32_t oldest = oldestSeq();
+    if ((int32_t)(seq - oldest) < 0 || (int32_t)(seq - nextSeq_) >= 0) {
+      return nullptr;
+    }
+    return &slots_[(head_ + (seq - oldest)) % N];
+  }
+
+  // cursor以降のイベントを容量に収まるだけ詰める（ageはnow時点の値）
+  // cursorは送信した次の番号まで進む（保持範囲より古ければ最古まで進め、その数をskippedに加算）
+  // 最初のイベントも入らなければ切り詰めて送る。truncate=false なら何も詰めずに0を返す
+  // （先頭に別の行を置いた残りに詰める場合。そのイベントは次の空の通知に回す）
+  // 戻り値: 書き込んだバイト数
+  size_t packSince(uint32_t& cursor, char* out, size_t capacity, uint32_t now,
+                   uint32_t* skipped = nullptr, bool truncate = true) const {
+    uint32_t oldest = oldestSeq();
+    if ((int32_t)(cursor - oldest) < 0) {
+      if (skipped) {
+        *skipped += oldest - cursor;
+      }
+      cursor = oldest;
+    }
+    size_t used = 0;
+    while ((int32_t)(cursor - nextSeq_) < 0) {
+      const GateEvent& ev = *find(cursor);
+      size_t len = formatEvent(ev, out + used, capacity - used, now);
+      if (len == 0) {
+        if (used != 0 || !truncate) {
+          break;
+        }
+        // 空のバッファにも入らない場合は切り詰めて送信
+        len = formatTruncated(ev, out, capacity);
+        if (len == 0) {
+          return 0;
+        }
+      }
+      used += len;
+      cursor++;
+    }
+    return used;
+  }
+
+  // cursor以降に保持しているイベント数
+  uint32_t countSince(uint32_t cursor) const {
+    uint32_t oldest = oldestSeq();
+    if ((int32_t)(cursor - oldest) < 0) {
+      cursor = oldest;
+    }
+    return (int32_t)(nextSeq_ - cursor) > 0 ? nextSeq_ - cursor : 0;
+  }
+
+  size_t size() const { return count_; }
+  size_t capacity() const { return N; }
+  uint32_t appended() const { return appended_; }
+
+ private:
+  // "seq:data[:age]\n" を書き込む（収まらなければ0）
+  static size_t formatEvent(const GateEvent& ev, char* out, size_t capacity, uint32_t now) {
+    char seqText[11];
+    int seqLen = snprintf(seqText, sizeof(seqText), "%lu", (unsigned long)ev.seq);
+    char ageText[7] = "";
+    int ageLen = 0;
+    if (ev.age != GATE_AGE_UNKNOWN) {
+      ageLen = snprintf(ageText, sizeof(ageText), ":%u", addGateAge(ev.age, now - ev.timestamp));
+    }
+    size_t total = (size_t)seqLen + 1 + ev.length + ageLen + 1;
+    if (total > capacity) {
+      return 0;
+    }
+    memcpy(out, seqText, seqLen);
+    out[seqLen] = ':';
+    memcpy(out + seqLen + 1, ev.data, ev.length);
+    memcpy(out + seqLen + 1 + ev.length, ageText, ageLen);
+    out[total - 1] = '\n';
+    return total;
+  }
+
+  static size_t formatTruncated(const GateEvent& ev, char* out, size_t capacity) {
+    char seqText[11];
+    int seqLen = snprintf(seqText, sizeof(seqText), "%lu", (unsigned long)ev.seq);
+    if ((size_t)seqLen + 2 > capacity) {
+      return 0;
+    }
+    size_t dataLen = capacity - seqLen - 2;
+    if (dataLen > ev.length) {
+      dataLen = ev.length;
+    }
+    memcpy(out, seqText, seqLen);
+    out[seqLen] = ':';
+    memcpy(out + seqLen + 1, ev.data, dataLen);
+    out[seqLen + 1 + dataLen] = '\n';
+    return seqLen + dataLen + 2;
+  }
+
+  GateEvent slots_[N];
+  size_t head_;
+  size_t count_;
+  uint32_t nextSeq_;
+  uint32_t appended_;
+};
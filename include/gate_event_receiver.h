@@ -0,0 +1,240 @@
+#pragma once
+
+// tanaka_gate_client用の受信処理（通知のパース・受信キュー・重複排除）
+// Arduino非依存（ホスト環境でもコンパイル可能）
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "gate_event_log.h"
+
+// 通知ペイロード "seq:data\n..." を1行ずつパースする
+// onEvent(uint32_t seq, const char* data, size_t length, uint16_t age) を行ごとに、
+// onEpoch(uint32_t epoch) をエポック行 "#XXXXXXXX" ごとに呼ぶ
+// 戻り値: パースできたイベント行数（不正な行は読み飛ばす）
+template <typename EventCallback, typename EpochCallback>
+size_t parseGateBatch(const char* payload, size_t length, EventCallback onEvent, EpochCallback onEpoch) {
+  size_t parsed = 0;
+  size_t pos = 0;
+  while (pos < length) {
+    size_t end = pos;
+    while (end < length && payload[end] != '\n') {
+      end++;
+    }
+    const char* line = payload + pos;
+    size_t lineLength = end - pos;
+    if (lineLength > 0 && line[lineLength - 1] == '\r') {
+      lineLength--;
+    }
+    pos = end + 1;
+
+    if (lineLength == 0) {
+      continue;
+    }
+    if (line[0] == '#') {
+      uint32_t epoch;
+      if (parseGateHex(line + 1, lineLength - 1, epoch) == lineLength - 1 && lineLength > 1) {
+        onEpoch(epoch);
+      }
+      continue;
+    }
+    // 先頭の10進数をシーケンス番号として読む
+    uint32_t seq;
+    size_t i = parseGateDecimal(line, lineLength, seq);
+    if (i == 0 || i >= lineLength || line[i] != ':') {
+      continue;
+    }
+    uint16_t age;
+    size_t dataLength = splitGateAge(line + i + 1, lineLength - i - 1, age);
+    onEvent(seq, line + i + 1, dataLength, age);
+    parsed++;
+  }
+  return parsed;
+}
+
+// エポック行を無視する版
+template <typename EventCallback>
+size_t parseGateBatch(const char* payload, size_t length, EventCallback onEvent) {
+  return parseGateBatch(payload, length, onEvent, [](uint32_t) {});
+}
+
+// シーケンス番号による重複排除
+struct GateSequenceFilter {
+  uint32_t lastSeq;
+  bool hasLast;
+  uint32_t accepted;
+  uint32_t duplicates;  // 既に受信済みの番号
+  uint32_t gaps;        // 欠番の数（サーバー側で破棄されたイベント）
+
+  GateSequenceFilter() { reset(); }
+
+  void reset() {
+    lastSeq = 0;
+    hasLast = false;
+    accepted = 0;
+    duplicates = 0;
+    gaps = 0;
+  }
+
+  // 新しいイベントならtrue（32bitの折り返しも考慮）
+  bool accept(uint32_t seq) {
+    if (hasLast && (int32_t)(seq - lastSeq) <= 0) {
+      duplicates++;
+      return false;
+    }
+    if (hasLast) {
+      gaps += seq - lastSeq - 1;
+    }
+    lastSeq = seq;
+    hasLast = true;
+    accepted++;
+    return true;
+  }
+};
+
+// 通知コールバックからloop()へイベントを渡す受信キュー
+// エポック行は isEpoch、seq == エポック のエントリとして積む（"5:" のようにデータが空のイベントもあるため、
+// 長さでは区別しない）。排他制御は呼び出し側で行う
+template <size_t N>
+class GateInbox {
+ public:
+  GateInbox() : head_(0), count_(0), overflows_(0) {}
+
+  bool push(uint32_t seq, const char* data, size_t length,
+            uint32_t timestamp = 0, uint16_t age = GATE_AGE_UNKNOWN) {
+    return pushEntry(seq, data, length, timestamp, age, false);
+  }
+
+  bool pushEpoch(uint32_t epoch) {
+    return pushEntry(epoch, "", 0, 0, GATE_AGE_UNKNOWN, true);
+  }
+
+  bool pop(GateEvent& out) {
+    if (count_ == 0) {
+      return false;
+    }
+    out = slots_[head_];
+    head_ = (head_ + 1) % N;
+    count_--;
+    return true;
+  }
+
+  size_t depth() const { return count_; }
+  uint32_t overflows() const { return overflows_; }
+
+ private:
+  bool pushEntry(uint32_t seq, const char* data, size_t length, uint32_t timestamp, uint16_t age, bool isEpoch) {
+    if (count_ == N) {
+      overflows_++;
+      return false;
+    }
+    if (length > GATE_EVENT_DATA_MAX) {
+      length = GATE_EVENT_DATA_MAX;
+    }
+    GateEvent& ev = slots_[(head_ + count_) % N];
+    ev.seq = seq;
+    ev.timestamp = timestamp;
+    ev.age = age;
+    ev.length = (uint8_t)length;
+    ev.isEpoch = isEpoch;
+    memcpy(ev.data, data, length);
+    ev.data[length] = '\0';
+    count_++;
+    return true;
+  }
+
+  GateEvent slots_[N];
+  size_t head_;
+  size_t count_;
+  uint32_t overflows_;
+};
+
+// 受信キューから取り出したイベントの扱い（tanaka_gate_client の processInbox()、race_sim と共通）
+// エポック行でサーバーの再起動を検出して番号をリセットし、受信済みの番号を破棄する。
+// 転送したイベントの番号を受信位置として覚える（再接続・ソフトリセット後の SINCE 要求に使う）
+//
+// 欠番（受信キューの溢れ・通知の取りこぼし）は転送せず、呼び出し側が requestCatchUp() して
+// "SINCE:<epoch>:<lastSeq>" を送る。応答の先頭のエポック行が届くまでのイベントは再送されるので破棄し、
+// エポック行の直後の欠番はサーバーのログから消えた分（回復できない）として受け入れる
+class GateStreamTracker {
+ public:
+  enum Action : uint8_t {
+    FORWARD,      // 新しいイベント: 転送する
+    DUPLICATE,    // 受信済みの番号: 破棄する
+    EPOCH,        // エポック行（前と同じサーバー）
+    NEW_EPOCH,    // エポック行（初めての接続・サーバーの再起動: 番号をリセットした）
+    GAP,          // 欠番の後のイベント: 破棄して再送を要求する
+    CATCHING_UP,  // 再送の応答待ち: 破棄する
+  };
+
+  static const uint32_t CATCH_UP_TIMEOUT = 1000;  // 応答のエポック行が届かないときに要求し直すまで（ms）
+
+  GateStreamTracker()
+      : hasEpoch_(false), epoch_(0), lastSeq_(0), catchingUp_(false), acceptGap_(true), requestedAt_(0),
+        catchUps_(0) {}
+
+  // 保存しておいた受信位置から再開する（ソフトリセット後。重複排除は次に届いた番号から）
+  void resume(uint32_t epoch, uint32_t lastSeq) {
+    hasEpoch_ = true;
+    epoch_ = epoch;
+    lastSeq_ = lastSeq;
+  }
+
+  Action apply(const GateEvent& ev) {
+    if (ev.isEpoch) {
+      // 接続時・SINCE要求の応答の先頭: 以降はサーバーが送り直した続き
+      catchingUp_ = false;
+      acceptGap_ = true;
+      if (hasEpoch_ && epoch_ == ev.seq) {
+        return EPOCH;
+      }
+      filter_.reset();
+      hasEpoch_ = true;
+      epoch_ = ev.seq;
+      lastSeq_ = 0;
+      return NEW_EPOCH;
+    }
+    if (catchingUp_) {
+      return CATCHING_UP;
+    }
+    if (!acceptGap_ && filter_.hasLast && (int32_t)(ev.seq - filter_.lastSeq) > 1) {
+      return GAP;
+    }
+    if (!filter_.accept(ev.seq)) {
+      return DUPLICATE;
+    }
+    acceptGap_ = false;
+    lastSeq_ = ev.seq;
+    return FORWARD;
+  }
+
+  // 再送要求を始める（GAP・CATCHING_UP のとき、受信キューが溢れたとき）
+  // 戻り値: SINCE要求を送るべきか（応答待ちの間は CATCH_UP_TIMEOUT ごとに1回）
+  bool requestCatchUp(uint32_t now) {
+    if (!hasEpoch_ || (catchingUp_ && now - requestedAt_ < CATCH_UP_TIMEOUT)) {
+      return false;
+    }
+    catchingUp_ = true;
+    requestedAt_ = now;
+    catchUps_++;
+    return true;
+  }
+
+  bool hasEpoch() const { return hasEpoch_; }  // 受信位置が有効か（エポックを受信した・resume() した）
+  uint32_t epoch() const { return epoch_; }
+  uint32_t lastSeq() const { return lastSeq_; }  // 転送した最後のシーケンス番号
+  bool catchingUp() const { return catchingUp_; }
+  uint32_t catchUps() const { return catchUps_; }  // 欠番・溢れで送った SINCE 要求の数
+  const GateSequenceFilter& filter() const { return filter_; }
+
+ private:
+  GateSequenceFilter filter_;
+  bool hasEpoch_;
+  uint32_t epoch_;
+  uint32_t lastSeq_;
+  bool catchingUp_;       // SINCE要求の応答（エポック行）待ち
+  bool acceptGap_;        // 次のイベントの欠番を受け入れるか（エポック行の直後）
+  uint32_t requestedAt_;  // 最後に SINCE要求を送った時刻（ms）
+  uint32_t catchUps_;
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+// ハードウェア抽象化層（HAL）
+// ファームウェアのロジックはこのインターフェース越しにハードウェアを使う。
+// ESP32では hal_arduino.h、ホスト（platform = native）では hal_fake.h の実装を渡す。
+//
+//   HalClock       時刻と待機（millis/micros/delay）。経過時間の判定は deadline.h を使う
+//   HalWaker       loop() の眠りと他のタスクからの起床（task_scheduler.h が使う）
+//   HalRangeSensor 距離センサー（VL6180X、I2Cデバイス単位で抽象化）
+//   HalPwm         GPIO出力とPWM（LED）
+//   HalSerial      シリアル入出力
+//   HalBleLink     BLEの通知リンク（接続状態と送信）
+//   HalStorage     電源を切っても残るキー・値ストア（ESP32ではNVS）
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+class HalClock {
+ public:
+  virtual ~HalClock() {}
+  virtual uint32_t millis() = 0;
+  virtual uint32_t micros() = 0;
+  virtual void delay(uint32_t ms) = 0;
+};
+
+class HalWaker {
+ public:
+  static const uint32_t FOREVER = 0xFFFFFFFF;
+
+  virtual ~HalWaker() {}
+  // ms の間、または wake() されるまで眠る（FOREVER なら wake() まで）。眠る前の wake() も数える
+  virtual void sleep(uint32_t ms) = 0;
+  // 眠っているタスクを起こす（他のタスク・コールバックから呼べる）
+  virtual void wake() = 0;
+};
+
+class HalRangeSensor {
+ public:
+  virtual ~HalRangeSensor() {}
+  virtual bool begin() = 0;
+  // 1回測定する（status は VL6180X_ERROR_* と同じ値、0が正常）
+  virtual void read(uint8_t& range, uint8_t& status) = 0;
+  virtual void setOffset(int8_t offset) = 0;
+};
+
+class HalPwm {
+ public:
+  virtual ~HalPwm() {}
+  virtual void pinMode(uint8_t pin, bool output) = 0;
+  virtual void digitalWrite(uint8_t pin, bool high) = 0;
+  virtual void analogWrite(uint8_t pin, uint8_t duty) = 0;
+  // duty まで ms かけて変化させ、待たずに戻る（ハードウェアフェードがなければすぐに analogWrite）
+  virtual void fade(uint8_t pin, uint8_t duty, uint32_t ms) {
+    (void)ms;
+    analogWrite(pin, duty);
+  }
+};
+
+class HalSerial {
+ public:
+  virtual ~HalSerial() {}
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual size_t write(const char* data, size_t length) = 0;
+
+  void print(const char* text) { write(text, strlen(text)); }
+  void println(const char* text) {
+    print(text);
+    write("\r\n", 2);
+  }
+  void printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+    char line[128];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length > 0) {
+      write(line, (size_t)length < sizeof(line) ? (size_t)length : sizeof(line) - 1);
+    }
+  }
+};
+
+class HalBleLink {
+ public:
+  virtual ~HalBleLink() {}
+  virtual bool connected() = 0;
+  virtual void notify(const char* data, size_t length) = 0;
+};
+
+class HalStorage {
+ public:
+  virtual ~HalStorage() {}
+  // key の値を data に読む（戻り値: 保存されている長さ。未保存なら0、size より長ければ読まない）
+  virtual size_t read(const char* key, void* data, size_t size) = 0;
+  virtual bool write(const char* key, const void* data, size_t size) = 0;
+  virtual bool remove(const char* key) = 0;
+};
@@ -0,0 +1,190 @@
+#pragma once
+
+// HALのESP32（Arduino）実装
+// センサーとBLEはライブラリ型をテンプレート引数で受け取り、このヘッダが
+// Adafruit_VL6180X.h / BLEDevice.h に依存しないようにしている
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <driver/ledc.h>
+
+#include "hal.h"
+
+class ArduinoClock : public HalClock {
+ public:
+  uint32_t millis() override { return ::millis(); }
+  uint32_t micros() override { return ::micros(); }
+  void delay(uint32_t ms) override { ::delay(ms); }
+};
+
+// FreeRTOSのタスク通知で眠り・起こす（begin() を呼んだタスクが眠る）
+class ArduinoWaker : public HalWaker {
+ public:
+  ArduinoWaker() : task_(nullptr) {}
+  // 眠るタスク（setup()・loop() のタスク）から呼ぶ
+  void begin() { task_ = xTaskGetCurrentTaskHandle(); }
+  void sleep(uint32_t ms) override {
+    ulTaskNotifyTake(pdTRUE, ms == FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(ms));
+  }
+  void wake() override {
+    if (task_) {
+      xTaskNotifyGive(task_);
+    }
+  }
+
+ private:
+  TaskHandle_t task_;
+};
+
+// readRange()/readRangeStatus()/begin()/setOffset() を持つセンサー（Adafruit_VL6180X）
+// setConversionWait() を設定すると、readRange() のようにI2Cを読み続けて変換の完了を待つ代わりに
+// startRange() してから眠って待つ（startRange()/isRangeComplete()/readRangeResult() も必要）
+template <typename Sensor>
+class ArduinoRangeSensor : public HalRangeSensor {
+ public:
+  static const uint32_t CONVERSION_TIMEOUT_MS = 50;  // これを過ぎたら完了を待たずに結果を読む
+
+  explicit ArduinoRangeSensor(Sensor& sensor) : sensor_(sensor), conversionWaitMs_(0) {}
+  bool begin() override { return sensor_.begin(); }
+  void read(uint8_t& range, uint8_t& status) override {
+    if (conversionWaitMs_ == 0) {
+      range = sensor_.readRange();
+      status = sensor_.readRangeStatus();
+      return;
+    }
+    sensor_.startRange();
+    uint32_t started = ::millis();
+    ::delay(conversionWaitMs_);  // 変換中はCPUを手放す（自動ライトスリープに入れる）
+    while (!sensor_.isRangeComplete() && ::millis() - started < CONVERSION_TIMEOUT_MS) {
+      ::delay(1);
+    }
+    range = sensor_.readRangeResult();
+    status = sensor_.readRangeStatus();
+  }
+  void setOffset(int8_t offset) override { sensor_.setOffset(offset); }
+
+  // 変換を眠って待つ時間（ms、0ならI2Cを読み続けて待つ）。変換時間より少し短くする
+  void setConversionWait(uint32_t ms) { conversionWaitMs_ = ms; }
+
+ private:
+  Sensor& sensor_;
+  uint32_t conversionWaitMs_;
+};
+
+// PWM出力はLEDCのチャンネルを直接使う（ピンごとに最初の出力でチャンネル0から順に割り当てる）
+// Arduinoの analogWrite() はチャンネルを内部で選ぶため、ハードウェアフェードを指定できない
+class ArduinoPwm : public HalPwm {
+ public:
+  static const uint8_t MAX_CHANNELS = 4;
+  static const uint32_t FREQUENCY = 5000;  // Hz（8ビット）
+
+  ArduinoPwm() : channels_(0) {}
+
+  void pinMode(uint8_t pin, bool output) override { ::pinMode(pin, output ? OUTPUT : INPUT); }
+  void digitalWrite(uint8_t pin, bool high) override { ::digitalWrite(pin, high ? HIGH : LOW); }
+  void analogWrite(uint8_t pin, uint8_t duty) override {
+    int channel = attach(pin);
+    if (channel < 0) {
+      ::analogWrite(pin, duty);
+      return;
+    }
+    ledcWrite(channel, duty);
+  }
+  // LEDCのハードウェアフェード（割り込みで進むためCPUは待たない）
+  void fade(uint8_t pin, uint8_t duty, uint32_t ms) override {
+    int channel = attach(pin);
+    if (channel < 0 || ms == 0) {
+      analogWrite(pin, duty);
+      return;
+    }
+    ledc_mode_t mode = (ledc_mode_t)(channel / 8);
+    ledc_channel_t ledcChannel = (ledc_channel_t)(channel % 8);
+    ledc_set_fade_with_time(mode, ledcChannel, duty, ms);
+    ledc_fade_start(mode, ledcChannel, LEDC_FADE_NO_WAIT);
+  }
+
+ private:
+  // ピンのチャンネル（足りなければ-1）
+  int attach(uint8_t pin) {
+    for (uint8_t i = 0; i < channels_; i++) {
+      if (pins_[i] == pin) {
+        return i;
+      }
+    }
+    if (channels_ >= MAX_CHANNELS) {
+      return -1;
+    }
+    if (channels_ == 0) {
+      ledc_fade_func_install(0);
+    }
+    ledcSetup(channels_, FREQUENCY, 8);
+    ledcAttachPin(pin, channels_);
+    pins_[channels_] = pin;
+    return channels_++;
+  }
+
+  uint8_t pins_[MAX_CHANNELS];
+  uint8_t channels_;
+};
+
+class ArduinoSerial : public HalSerial {
+ public:
+  explicit ArduinoSerial(Stream& stream) : stream_(stream) {}
+  int available() override { return stream_.available(); }
+  int read() override { return stream_.read(); }
+  size_t write(const char* data, size_t length) override {
+    return stream_.write((const uint8_t*)data, length);
+  }
+
+ private:
+  Stream& stream_;
+};
+
+// BLECharacteristic の通知（接続状態はサーバーコールバックが更新するフラグを参照）
+template <typename Characteristic>
+class ArduinoBleLink : public HalBleLink {
+ public:
+  ArduinoBleLink(Characteristic*& characteristic, bool& connected)
+      : characteristic_(characteristic), connected_(connected) {}
+  bool connected() override { return connected_ && characteristic_ != nullptr; }
+  void notify(const char* data, size_t length) override {
+    characteristic_->setValue((uint8_t*)data, length);
+    characteristic_->notify();
+  }
+
+ private:
+  Characteristic*& characteristic_;
+  bool& connected_;
+};
+
+// Preferences（NVS）の名前空間1つ分（NVSの初期化後に使うため、最初の読み書きで開く）
+class ArduinoStorage : public HalStorage {
+ public:
+  explicit ArduinoStorage(const char* ns) : ns_(ns), open_(false) {}
+  size_t read(const char* key, void* data, size_t size) override {
+    if (!begin() || !prefs_.isKey(key)) {
+      return 0;
+    }
+    size_t length = prefs_.getBytesLength(key);
+    if (length == 0 || length > size) {
+      return length;
+    }
+    return prefs_.getBytes(key, data, size);
+  }
+  bool write(const char* key, const void* data, size_t size) override {
+    return begin() && prefs_.putBytes(key, data, size) == size;
+  }
+  bool remove(const char* key) override { return begin() && (!prefs_.isKey(key) || prefs_.remove(key)); }
+
+ private:
+  bool begin() {
+    if (!open_) {
+      open_ = prefs_.begin(ns_, false);
+    }
+    return open_;
+  }
+
+  const char* ns_;
+  bool open_;
+  Preferences prefs_;
+};
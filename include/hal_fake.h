@@ -0,0 +1,198 @@
+#pragma once
+
+// HALのホスト用フェイク実装（platform = native）
+// 時刻は仮想時間で、delay() は待たずに時刻を進めるだけ。
+// センサー値は関数で与え、LED・シリアル・BLEへの出力は記録して後から検査する。
+// ストレージはメモリ上で、同じインスタンスを次のアプリに渡すと再起動を再現できる
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "hal.h"
+
+// startMillis を 0xFFFFFFFF 付近にすると millis() の折り返し（約49.7日）を再現できる
+class FakeClock : public HalClock {
+ public:
+  explicit FakeClock(uint32_t startMillis = 0) : micros_((uint64_t)startMillis * 1000) {}
+  uint32_t millis() override { return (uint32_t)(micros_ / 1000); }
+  uint32_t micros() override { return (uint32_t)micros_; }
+  void delay(uint32_t ms) override { micros_ += (uint64_t)ms * 1000; }
+  void advanceMicros(uint64_t us) { micros_ += us; }
+
+ private:
+  uint64_t micros_;
+};
+
+// 眠ると仮想時計を進める（wake() されていれば進めずに戻る）
+class FakeWaker : public HalWaker {
+ public:
+  explicit FakeWaker(FakeClock& clock) : sleeps(0), wakes(0), clock_(clock), woken_(false) {}
+  void sleep(uint32_t ms) override {
+    sleeps++;
+    if (woken_) {
+      woken_ = false;
+      return;
+    }
+    if (ms != FOREVER) {
+      clock_.delay(ms);
+    }
+  }
+  void wake() override {
+    wakes++;
+    woken_ = true;
+  }
+
+  uint32_t sleeps;
+  uint32_t wakes;
+
+ private:
+  FakeClock& clock_;
+  bool woken_;
+};
+
+// 測定ごとに source(時刻ms, range, status) を呼んで値を決める
+class FakeRangeSensor : public HalRangeSensor {
+ public:
+  typedef std::function<void(uint32_t now, uint8_t& range, uint8_t& status)> Source;
+
+  FakeRangeSensor(FakeClock& clock, Source source, uint32_t readMicros = 0)
+      : present(true), offset(0), reads(0), clock_(clock), source_(source), readMicros_(readMicros) {}
+  bool begin() override { return present; }
+  void read(uint8_t& range, uint8_t& status) override {
+    source_(clock_.millis(), range, status);
+    reads++;
+    // 測定にかかる時間（単発測定モードの変換時間）を模擬
+    if (readMicros_ > 0) {
+      clock_.advanceMicros(readMicros_);
+    }
+  }
+  void setOffset(int8_t value) override { offset = value; }
+
+  bool present;  // falseならbegin()が失敗する（センサーなしモードの検証用）
+  int8_t offset;
+  uint32_t reads;
+
+ private:
+  FakeClock& clock_;
+  Source source_;
+  uint32_t readMicros_;
+};
+
+class FakePwm : public HalPwm {
+ public:
+  FakePwm() : writes(0), fades(0) {
+    for (int i = 0; i < 64; i++) {
+      duty[i] = 0;
+    }
+  }
+  void pinMode(uint8_t, bool) override {}
+  void digitalWrite(uint8_t pin, bool high) override { set(pin, high ? 255 : 0); }
+  void analogWrite(uint8_t pin, uint8_t value) override { set(pin, value); }
+  // フェードは終わりの値をすぐに反映する
+  void fade(uint8_t pin, uint8_t value, uint32_t) override {
+    set(pin, value);
+    fades++;
+  }
+
+  uint8_t duty[64];  // ピンごとの最新デューティ（フェードなら終わりの値）
+  uint32_t writes;
+  uint32_t fades;
+
+ private:
+  void set(uint8_t pin, uint8_t value) {
+    if (pin < 64) {
+      duty[pin] = value;
+    }
+    writes++;
+  }
+};
+
+class FakeSerial : public HalSerial {
+ public:
+  int available() override { return (int)input.size(); }
+  int read() override {
+    if (input.empty()) {
+      return -1;
+    }
+    char c = input[0];
+    input.erase(0, 1);
+    return (unsigned char)c;
+  }
+  size_t write(const char* data, size_t length) override {
+    output.append(data, length);
+    return length;
+  }
+
+  std::string input;   // loop()から読まれる入力
+  std::string output;  // 書き込まれた出力
+};
+
+class FakeBleLink : public HalBleLink {
+ public:
+  FakeBleLink() : isConnected(true) {}
+  bool connected() override { return isConnected; }
+  void notify(const char* data, size_t length) override {
+    notifications.push_back(std::string(data, length));
+  }
+
+  bool isConnected;
+  std::vector<std::string> notifications;
+};
+
+// tanaka_gate_server の通知送信（GateClientTable::fanOut() の Sender）の代わり
+// 成功した通知を接続ごとに記録し、送信を試みた順番も残す。failing の接続への送信は失敗させる（輻輳の再現）
+class FakeNotifySink {
+ public:
+  struct Notification {
+    uint16_t connId;
+    std::string payload;
+  };
+
+  FakeNotifySink() : failures(0) {}
+  bool send(uint16_t connId, const uint8_t* data, size_t length) {
+    attempts.push_back(connId);
+    for (uint16_t failed : failing) {
+      if (failed == connId) {
+        failures++;
+        return false;
+      }
+    }
+    notifications.push_back({connId, std::string((const char*)data, length)});
+    return true;
+  }
+
+  std::vector<Notification> notifications;
+  std::vector<uint16_t> attempts;  // 送信を試みた接続（fanOut() が回った順）
+  std::vector<uint16_t> failing;
+  uint32_t failures;
+};
+
+// NVSの代わり（値は entries を直接書き換えて壊れた保存内容も再現できる）
+class FakeStorage : public HalStorage {
+ public:
+  FakeStorage() : writes(0) {}
+  size_t read(const char* key, void* data, size_t size) override {
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+      return 0;
+    }
+    if (!it->second.empty() && it->second.size() <= size) {
+      memcpy(data, it->second.data(), it->second.size());
+    }
+    return it->second.size();
+  }
+  bool write(const char* key, const void* data, size_t size) override {
+    entries[key].assign((const uint8_t*)data, (const uint8_t*)data + size);
+    writes++;
+    return true;
+  }
+  bool remove(const char* key) override {
+    entries.erase(key);
+    return true;
+  }
+
+  std::map<std::string, std::vector<uint8_t>> entries;
+  uint32_t writes;
+};
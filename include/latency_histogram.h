@@ -0,0 +1,94 @@
+#pragma once
+
+// 固定メモリのレイテンシヒストグラム（全ファームウェア共通）
+// 16未満は1刻み、それ以上は2のべき乗ごとに8分割（相対誤差12.5%以内）
+// Arduino非依存（ホスト環境でもコンパイル可能）
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+class LatencyHistogram {
+ public:
+  static const size_t BUCKETS = 16 + 28 * 8;  // 0〜2^32-1 をカバー
+
+  LatencyHistogram() { reset(); }
+
+  void reset() {
+    memset(counts_, 0, sizeof(counts_));
+    count_ = 0;
+    sum_ = 0;
+    max_ = 0;
+  }
+
+  void record(uint32_t value) {
+    counts_[bucketIndex(value)]++;
+    count_++;
+    sum_ += value;
+    if (value > max_) {
+      max_ = value;
+    }
+  }
+
+  // パーセンタイル（該当バケットの上限値を返す。最大値は超えない）
+  uint32_t percentile(uint8_t p) const {
+    if (count_ == 0) {
+      return 0;
+    }
+    uint64_t rank = ((uint64_t)count_ * p + 99) / 100;
+    if (rank == 0) {
+      rank = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+      seen += counts_[i];
+      if (seen >= rank) {
+        uint32_t upper = bucketUpper(i);
+        return upper < max_ ? upper : max_;
+      }
+    }
+    return max_;
+  }
+
+  uint32_t count() const { return count_; }
+  uint32_t max() const { return max_; }
+  uint32_t mean() const { return count_ ? (uint32_t)(sum_ / count_) : 0; }
+
+  // "name n=.. p50=.. p95=.. p99=.. max=..unit" を書き込む
+  size_t format(char* out, size_t capacity, const char* name, const char* unit) const {
+    int len = snprintf(out, capacity, "%s n=%lu p50=%lu p95=%lu p99=%lu max=%lu%s",
+                       name, (unsigned long)count_,
+                       (unsigned long)percentile(50), (unsigned long)percentile(95),
+                       (unsigned long)percentile(99), (unsigned long)max_, unit);
+    if (len < 0) {
+      return 0;
+    }
+    return (size_t)len < capacity ? (size_t)len : capacity - 1;
+  }
+
+  static size_t bucketIndex(uint32_t value) {
+    if (value < 16) {
+      return value;
+    }
+    unsigned exponent = 31 - __builtin_clz(value);
+    unsigned sub = (value >> (exponent - 3)) & 7;
+    return 16 + (exponent - 4) * 8 + sub;
+  }
+
+  static uint32_t bucketUpper(size_t index) {
+    if (index < 16) {
+      return (uint32_t)index;
+    }
+    unsigned exponent = (unsigned)(index - 16) / 8 + 4;
+    unsigned sub = (unsigned)(index - 16) % 8;
+    uint64_t lower = (uint64_t)(8 + sub) << (exponent - 3);
+    return (uint32_t)(lower + (1ULL << (exponent - 3)) - 1);
+  }
+
+ private:
+  uint32_t counts_[BUCKETS];
+  uint32_t count_;
+  uint64_t sum_;
+  uint32_t max_;
+};
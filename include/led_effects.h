@@ -0,0 +1,248 @@
+#pragma once
+
+// 赤・青の2色LEDの表示エンジン（全ファームウェア共通）
+// 表示するパターン（点灯・点滅・フェード・色の巡回）をレイヤーごとに宣言しておくと、
+// update() が最も優先度の高いレイヤーのパターンを時刻に応じて出力する。
+// 期限付きで表示したレイヤー（カウントアップ・通信中の点滅など）は、期限が過ぎると下のレイヤーに戻る。
+// 出力が変わるときだけ HalPwm に書き込み、フェードは HalPwm::fade()（ESP32ではLEDCの
+// ハードウェアフェード）に任せるので、変化のない update() は比較だけで終わる。
+// フェード中のピンには書き込まない（ESP-IDFのLEDCはフェードが終わるまで次の設定を待たせるため、
+// 次の出力をフェードの終わりまで遅らせる）
+// Arduino非依存（ホストでは FakePwm と仮想時計で確認できる: receiver_native）
+//
+//   leds.set(LED_LAYER_BASE, LedPattern::solid(0, 100), now);                         // 待機中
+//   leds.show(LED_LAYER_ALERT, LedPattern::blink({0, 255}, {0, 0}, 250), now, 3000);  // 3秒間の点滅
+//   leds.update(now);                                                                 // loop() ごとに
+
+#include <stdint.h>
+
+#include "deadline.h"
+#include "hal.h"
+
+struct LedColor {
+  uint8_t red;
+  uint8_t blue;
+
+  bool operator==(const LedColor& other) const { return red == other.red && blue == other.blue; }
+  bool operator!=(const LedColor& other) const { return !(*this == other); }
+};
+
+enum LedEffect : uint8_t {
+  LED_STEP,  // colors を stepMs ごとに順に切り替える（1色なら点灯したまま）
+  LED_FADE,  // colors の次の色へ stepMs かけてフェードする（ハードウェアフェード）
+};
+
+struct LedPattern {
+  static const uint8_t MAX_COLORS = 4;
+
+  LedEffect effect;
+  uint8_t count;    // colors の有効な数（1〜MAX_COLORS）
+  uint16_t stepMs;  // 1色あたりの時間（ms）
+  LedColor colors[MAX_COLORS];
+
+  // 点灯
+  static LedPattern solid(uint8_t red, uint8_t blue) {
+    LedColor color = {red, blue};
+    return make(LED_STEP, &color, 1, 0);
+  }
+  // on と off を stepMs ごとに切り替える（on から始める）
+  static LedPattern blink(LedColor on, LedColor off, uint16_t stepMs) {
+    LedColor colors[2] = {on, off};
+    return make(LED_STEP, colors, 2, stepMs);
+  }
+  // low と high の間を stepMs かけて行き来する（low から high へのフェードから始める）
+  static LedPattern pulse(LedColor low, LedColor high, uint16_t stepMs) {
+    LedColor colors[2] = {low, high};
+    return make(LED_FADE, colors, 2, stepMs);
+  }
+  // 最大 MAX_COLORS 色を stepMs ごとに順に表示する
+  static LedPattern cycle(const LedColor* colors, uint8_t count, uint16_t stepMs) {
+    return make(LED_STEP, colors, count, stepMs);
+  }
+
+  bool operator==(const LedPattern& other) const {
+    if (effect != other.effect || count != other.count || stepMs != other.stepMs) {
+      return false;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+      if (colors[i] != other.colors[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+  bool operator!=(const LedPattern& other) const { return !(*this == other); }
+
+ private:
+  static LedPattern make(LedEffect effect, const LedColor* colors, uint8_t count, uint16_t stepMs) {
+    LedPattern pattern;
+    pattern.effect = effect;
+    pattern.count = count < 1 ? 1 : (count > MAX_COLORS ? MAX_COLORS : count);
+    pattern.stepMs = stepMs;
+    for (uint8_t i = 0; i < MAX_COLORS; i++) {
+      pattern.colors[i] = i < pattern.count ? colors[i] : LedColor{0, 0};
+    }
+    return pattern;
+  }
+};
+
+// レイヤー（大きいほど優先）
+enum LedLayer : uint8_t {
+  LED_LAYER_BASE,    // 動作状態の表示（待機・検知中・エラー・起動中）
+  LED_LAYER_COMM,    // 通信中の短い点灯
+  LED_LAYER_NOTICE,  // 起動完了などの一時的な表示
+  LED_LAYER_ALERT,   // カウントアップなど最優先の表示
+  LED_LAYERS,
+};
+
+class LedEffects {
+ public:
+  static const uint32_t NO_CHANGE = 0xFFFFFFFF;  // update() の戻り値: 時間が経っても出力は変わらない
+  static const uint32_t FADE_GUARD_MS = 1;       // ハードウェアのフェード完了を待つ余裕
+
+  LedEffects(HalPwm& pwm, uint8_t redPin, uint8_t bluePin)
+      : pwm_(pwm), redPin_(redPin), bluePin_(bluePin), output_({0, 0}), written_(false), fading_(false),
+        fadeEnd_(0), writes_(0), fades_(0), deferred_(0) {
+    for (uint8_t i = 0; i < LED_LAYERS; i++) {
+      layers_[i].active = false;
+      layers_[i].timed = false;
+      layers_[i].start = 0;
+    }
+  }
+
+  // レイヤーに期限なしでパターンを設定する（同じパターンを表示中なら最初からやり直さない）
+  void set(uint8_t layer, const LedPattern& pattern, uint32_t now) {
+    Layer& l = layers_[layer];
+    if (l.active && !l.timed && l.pattern == pattern) {
+      return;
+    }
+    l.pattern = pattern;
+    l.start = now;
+    l.active = true;
+    l.timed = false;
+  }
+
+  // レイヤーに durationMs の間だけパターンを表示する（呼ぶたびに最初からやり直す）
+  void show(uint8_t layer, const LedPattern& pattern, uint32_t now, uint32_t durationMs) {
+    Layer& l = layers_[layer];
+    l.pattern = pattern;
+    l.start = now;
+    l.active = true;
+    l.timed = true;
+    l.until.start(now, durationMs);
+  }
+
+  void clear(uint8_t layer) { layers_[layer].active = false; }
+
+  // レイヤーが表示対象か（期限付きなら期限前か）
+  bool active(uint8_t layer, uint32_t now) const {
+    const Layer& l = layers_[layer];
+    return l.active && (!l.timed || l.until.remaining(now) > 0);
+  }
+
+  // 時刻 now の出力を反映する（変わったピンだけ書き込む）
+  // 戻り値: 次に出力が変わりうるまでの時間（ms、パターンが変わらなければ NO_CHANGE）
+  uint32_t update(uint32_t now) {
+    int top = -1;
+    for (int i = LED_LAYERS - 1; i >= 0; i--) {
+      Layer& l = layers_[i];
+      if (!l.active) {
+        continue;
+      }
+      if (l.timed && l.until.expire(now)) {
+        l.active = false;
+        continue;
+      }
+      top = i;
+      break;
+    }
+
+    LedColor target = {0, 0};
+    uint32_t fadeMs = 0;
+    uint32_t next = NO_CHANGE;
+    if (top >= 0) {
+      const Layer& l = layers_[top];
+      const LedPattern& p = l.pattern;
+      if (p.count <= 1 || p.stepMs == 0) {
+        target = p.colors[0];
+      } else {
+        uint32_t elapsed = now - l.start;
+        uint32_t step = elapsed / p.stepMs;
+        next = p.stepMs - elapsed % p.stepMs;
+        if (p.effect == LED_FADE) {
+          target = p.colors[(step + 1) % p.count];  // このステップの終わりの色へ
+          fadeMs = next;
+        } else {
+          target = p.colors[step % p.count];
+        }
+      }
+      if (l.timed) {
+        uint32_t left = l.until.remaining(now);
+        next = left < next ? left : next;
+      }
+    }
+
+    if (written_ && target == output_) {
+      return next;
+    }
+    if (fading_) {
+      if (!timeReached(now, fadeEnd_)) {
+        deferred_++;
+        uint32_t wait = fadeEnd_ - now;
+        return wait < next ? wait : next;
+      }
+      fading_ = false;
+    }
+    writePin(redPin_, target.red, output_.red, fadeMs);
+    writePin(bluePin_, target.blue, output_.blue, fadeMs);
+    if (fadeMs > 0) {
+      fading_ = true;
+      fadeEnd_ = now + fadeMs + FADE_GUARD_MS;
+    }
+    output_ = target;
+    written_ = true;
+    return next;
+  }
+
+  // 次の update() で両方のピンを書き直す（他の処理がピンに書き込んだ後）
+  void invalidate() { written_ = false; }
+
+  LedColor output() const { return output_; }  // 最後に書き込んだ（フェードなら向かっている）色
+  uint32_t writes() const { return writes_; }  // HalPwm への書き込み回数（フェードを含む）
+  uint32_t fades() const { return fades_; }
+  uint32_t deferred() const { return deferred_; }  // フェードの終わりまで待たせた回数
+
+ private:
+  struct Layer {
+    LedPattern pattern;
+    uint32_t start;  // パターンの開始時刻（ステップの基準）
+    Deadline until;  // 期限付きの表示の終わり
+    bool active;
+    bool timed;
+  };
+
+  void writePin(uint8_t pin, uint8_t duty, uint8_t previous, uint32_t fadeMs) {
+    if (written_ && duty == previous) {
+      return;
+    }
+    if (fadeMs > 0) {
+      pwm_.fade(pin, duty, fadeMs);
+      fades_++;
+    } else {
+      pwm_.analogWrite(pin, duty);
+    }
+    writes_++;
+  }
+
+  HalPwm& pwm_;
+  uint8_t redPin_;
+  uint8_t bluePin_;
+  Layer layers_[LED_LAYERS];
+  LedColor output_;
+  bool written_;
+  bool fading_;
+  uint32_t fadeEnd_;
+  uint32_t writes_;
+  uint32_t fades_;
+  uint32_t deferred_;
+};
@@ -0,0 +1,127 @@
+#pragma once
+
+// 固定メモリのランタイムメトリクスレジストリ（全ファームウェア共通）
+// カウンタ・ゲージ・ヒストグラムを名前付きで登録し、1行にまとめて出力する
+// 例: "METRICS samples=1200 sps=50 notify_ok=480 heap_min=201344 loop_us=20011/20480/25012"
+// Arduino非依存（ホストでの計測: hot_path_bench の metrics_register・metrics_update・metrics_format）
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "latency_histogram.h"
+
+enum MetricType : uint8_t {
+  METRIC_COUNTER,    // 単調増加
+  METRIC_GAUGE,      // 現在値
+  METRIC_HISTOGRAM,  // p50/p99/max を出力
+};
+
+struct Metric {
+  const char* name;  // 文字列リテラルを想定（コピーしない）
+  MetricType type;
+  int32_t value;
+  LatencyHistogram* histogram;
+};
+
+template <size_t N>
+class MetricsRegistry {
+ public:
+  MetricsRegistry() : count_(0), overflowSink_(0) {}
+
+  // カウンタを登録する（戻り値の参照を直接加算する）
+  // 満杯時はどこにも出力されないダミーを返す
+  uint32_t& counter(const char* name) {
+    Metric* m = add(name, METRIC_COUNTER);
+    return m ? *reinterpret_cast<uint32_t*>(&m->value) : overflowSinkCounter();
+  }
+
+  // ゲージを登録する
+  int32_t& gauge(const char* name) {
+    Metric* m = add(name, METRIC_GAUGE);
+    return m ? m->value : overflowSink_;
+  }
+
+  // ヒストグラムを登録する（実体は呼び出し側が持つ）
+  bool histogram(const char* name, LatencyHistogram& histogram) {
+    Metric* m = add(name, METRIC_HISTOGRAM);
+    if (!m) {
+      return false;
+    }
+    m->histogram = &histogram;
+    return true;
+  }
+
+  // 全メトリクスを "METRICS name=value ..." の1行に書き込む
+  // 戻り値: 書き込んだ文字数（容量不足の場合は途中で打ち切る）
+  size_t format(char* out, size_t capacity) const {
+    if (capacity == 0) {
+      return 0;
+    }
+    size_t used = append(out, capacity, 0, "METRICS");
+    for (size_t i = 0; i < count_; i++) {
+      const Metric& m = metrics_[i];
+      char item[64];
+      switch (m.type) {
+        case METRIC_COUNTER:
+          snprintf(item, sizeof(item), " %s=%lu", m.name, (unsigned long)(uint32_t)m.value);
+          break;
+        case METRIC_GAUGE:
+          snprintf(item, sizeof(item), " %s=%ld", m.name, (long)m.value);
+          break;
+        case METRIC_HISTOGRAM:
+          snprintf(item, sizeof(item), " %s=%lu/%lu/%lu", m.name,
+                   (unsigned long)m.histogram->percentile(50),
+                   (unsigned long)m.histogram->percentile(99),
+                   (unsigned long)m.histogram->max());
+          break;
+      }
+      size_t next = append(out, capacity, used, item);
+      if (next == used) {
+        break;
+      }
+      used = next;
+    }
+    return used;
+  }
+
+  size_t size() const { return count_; }
+  size_t capacity() const { return N; }
+  const Metric& at(size_t index) const { return metrics_[index]; }
+
+ private:
+  Metric* add(const char* name, MetricType type) {
+    if (count_ >= N) {
+      return nullptr;
+    }
+    Metric& m = metrics_[count_++];
+    m.name = name;
+    m.type = type;
+    m.value = 0;
+    m.histogram = nullptr;
+    return &m;
+  }
+
+  uint32_t& overflowSinkCounter() { return *reinterpret_cast<uint32_t*>(&overflowSink_); }
+
+  // 丸ごと収まる場合のみ追記する
+  static size_t append(char* out, size_t capacity, size_t used, const char* text) {
+    size_t len = 0;
+    while (text[len] != '\0') {
+      len++;
+    }
+    if (used + len + 1 > capacity) {
+      out[used] = '\0';
+      return used;
+    }
+    for (size_t i = 0; i < len; i++) {
+      out[used + i] = text[i];
+    }
+    out[used + len] = '\0';
+    return used + len;
+  }
+
+  Metric metrics_[N];
+  size_t count_;
+  int32_t overflowSink_;
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+// ミニ四駆の通過検知（receiverの検知ロジック、Arduino非依存）
+// ベースライン距離より閾値以上近い値が出たら通過とみなし、
+// 近い値が続く間と最後に近かった時刻から ignoreMs の間は重複カウントしない
+
+#include <stdint.h>
+
+struct PassageDetectorConfig {
+  int threshold = 10;          // 検出閾値（ベースライン距離からの差mm）
+  uint32_t ignoreMs = 3000;    // 重複カウント防止時間（ms）
+  int fallbackBaseline = 200;  // 校正失敗時のベースライン（mm）
+};
+
+enum PassageResult : uint8_t {
+  PASSAGE_NONE,     // レーンに何もない
+  PASSAGE_COUNTED,  // 通過としてカウントした
+  PASSAGE_WAITING,  // レーン内だが重複防止時間中
+  PASSAGE_ERROR,    // 測定エラー（判定しない）
+};
+
+class PassageDetector {
+ public:
+  explicit PassageDetector(const PassageDetectorConfig& config = PassageDetectorConfig())
+      : config_(config), baseline_(0), calibrated_(false), inLaneSeen_(false), count_(0),
+        lastCountTime_(0), lastDetectionTime_(0), previousCountTime_(0), waitRemaining_(0) {}
+
+  // 校正値を設定する（有効な測定が半分未満なら固定値を使い、検知は無効のまま）
+  bool calibrate(uint32_t totalRange, int validMeasurements, int measurements) {
+    if (validMeasurements > 0 && validMeasurements >= measurements / 2) {
+      baseline_ = (int)(totalRange / validMeasurements);
+      calibrated_ = true;
+    } else {
+      baseline_ = config_.fallbackBaseline;
+      calibrated_ = false;
+    }
+    return calibrated_;
+  }
+
+  // 検知パラメータを変更する（起動時に保存された設定を反映する）
+  void setConfig(const PassageDetectorConfig& config) { config_ = config; }
+
+  void setBaseline(int baseline) {
+    baseline_ = baseline;
+    calibrated_ = true;
+  }
+
+  // 1サンプルを判定する
+  PassageResult update(uint32_t now, uint8_t range, uint8_t status) {
+    if (status != 0) {
+      return PASSAGE_ERROR;
+    }
+    if (!calibrated_ || range >= baseline_ - config_.threshold) {
+      return PASSAGE_NONE;
+    }
+    PassageResult result = PASSAGE_WAITING;
+    // 起動後最初のレーン内の値は、起動直後（millis()が小さい間）でも重複防止時間を待たない
+    uint32_t elapsed = inLaneSeen_ ? now - lastCountTime_ : config_.ignoreMs + 1;
+    waitRemaining_ = elapsed < config_.ignoreMs ? config_.ignoreMs - elapsed : 0;
+    if (elapsed > config_.ignoreMs) {
+      count_++;
+      previousCountTime_ = lastCountTime_;
+      lastDetectionTime_ = now;
+      result = PASSAGE_COUNTED;
+    }
+    // レーン内の値が続く限り待機時間を延長する
+    lastCountTime_ = now;
+    inLaneSeen_ = true;
+    return result;
+  }
+
+  // 直前の update() 時点での重複防止時間の残り（ms）
+  uint32_t waitRemaining() const { return waitRemaining_; }
+
+  int baseline() const { return baseline_; }
+  int threshold() const { return config_.threshold; }
+  bool calibrated() const { return calibrated_; }
+  int count() const { return count_; }
+  uint32_t lastDetectionTime() const { return lastDetectionTime_; }
+  uint32_t previousCountTime() const { return previousCountTime_; }  // カウント直前の最後のレーン内時刻
+  const PassageDetectorConfig& config() const { return config_; }
+
+ private:
+  PassageDetectorConfig config_;
+  int baseline_;
+  bool calibrated_;
+  bool inLaneSeen_;
+  int count_;
+  uint32_t lastCountTime_;
+  uint32_t lastDetectionTime_;
+  uint32_t previousCountTime_;
+  uint32_t waitRemaining_;
+};
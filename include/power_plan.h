@@ -0,0 +1,220 @@
+#pragma once
+
+// receiverの電源モードと消費電流の見積もり（デューティ比の計画）
+// 電源モード（"$power=" で設定、再起動で反映）で測定周期・自動ライトスリープ・CPU周波数・BLE送信出力を選び、
+// 実際に測定・loop() のタスクが動いていた時間（PowerLoad）から、CPU・無線・センサーが動いている割合
+// （デューティ比）と平均電流・電池での動作時間を見積もる。
+// 電流値は ESP32-S3・VL6180X のデータシートの代表値（PowerModel）。電流計で測った値に置き換えて使う
+// 測定周期を長くするほど電流は減るが、車体がセンサーの前にいる時間が detectWindowUs より短いと
+// 測定と測定の間に通り過ぎることがある（モードを選ぶときの目安として一緒に出力する）
+// Arduino非依存（ホストで確認できる: receiver_native）
+//
+//   PowerSettings settings = powerSettings(POWER_BALANCED, 20000);
+//   PowerPlan plan = planPower(settings, PowerModel(), load);   // load は10秒間の実測
+//   plan.format(line, sizeof(line), settings, 2000);             // "POWER mode=balanced ... avg=6.2mA life=321h"
+//   formatPowerModes(line, sizeof(line), 20000, PowerModel(), 25);  // 起動時にモードごとの見積もりを比べる
+//   formatPowerModes(line, sizeof(line), 20000, PowerModel(), 25, 25000);  // 測定周期を切り替える場合（下限25ms）
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum PowerMode : uint8_t {
+  POWER_FULL,      // 従来どおり（スリープなし、240MHz、+9dBm）
+  POWER_BALANCED,  // 同じ測定周期のまま、測定の合間とセンサーの変換待ちに眠る（80MHz、+3dBm）
+  POWER_SAVER,     // 測定周期を2倍にして眠る（80MHz、0dBm）
+  POWER_MODES,
+};
+
+inline const char* powerModeName(uint8_t mode) {
+  static const char* const names[] = {"full", "balanced", "saver"};
+  return mode < POWER_MODES ? names[mode] : "?";
+}
+
+// 電源モードごとの設定
+struct PowerSettings {
+  uint8_t mode;
+  uint32_t samplePeriodUs;  // 測定周期（切り替える場合は予測の幅の外の周期）
+  uint32_t fastPeriodUs;    // 予測の幅の中の周期（測定周期の切り替え、adaptive_rate.h。使わなければ0）
+  bool lightSleep;      // 自動ライトスリープ（esp_pm、使えないファームウェアでは false に戻す）
+  bool conversionWait;  // センサーの変換をI2Cを読み続けずに眠って待つ
+  uint16_t cpuMhz;     // 最大CPU周波数（BLEを動かすため80MHz以上）
+  int8_t txPowerDbm;   // BLE送信出力（アドバタイジング・接続とも）
+};
+
+// fullPeriodUs: POWER_FULL の測定周期（receiver.cpp の SAMPLE_PERIOD_US）
+inline PowerSettings powerSettings(uint8_t mode, uint32_t fullPeriodUs) {
+  PowerSettings settings;
+  settings.mode = mode < POWER_MODES ? mode : (uint8_t)POWER_FULL;
+  settings.samplePeriodUs = settings.mode == POWER_SAVER ? fullPeriodUs * 2 : fullPeriodUs;
+  settings.fastPeriodUs = 0;
+  settings.lightSleep = settings.mode != POWER_FULL;
+  settings.conversionWait = settings.mode != POWER_FULL;
+  settings.cpuMhz = settings.mode == POWER_FULL ? 240 : 80;
+  settings.txPowerDbm = settings.mode == POWER_FULL ? 9 : (settings.mode == POWER_BALANCED ? 3 : 0);
+  return settings;
+}
+
+// 測定周期を切り替える場合の設定（予測の幅の中は電源モードの周期の半分、それ以外は floorPeriodUs）
+inline PowerSettings adaptivePowerSettings(PowerSettings settings, uint32_t floorPeriodUs) {
+  settings.fastPeriodUs = settings.samplePeriodUs / 2;
+  settings.samplePeriodUs = floorPeriodUs;
+  return settings;
+}
+
+// 消費電流のモデル（mA・us、ESP32-S3 と VL6180X の代表値）
+struct PowerModel {
+  float cpuBaseMa = 13.0f;         // CPU動作中: baseMa + mhz * perMhzMa（240MHzで約49mA、80MHzで約25mA）
+  float cpuPerMhzMa = 0.15f;
+  float idleBaseMa = 10.0f;        // スリープなしの待ち（WFI、クロックは止まらない）
+  float idlePerMhzMa = 0.08f;
+  float lightSleepMa = 0.25f;      // ライトスリープ中（RTCタイマー・BLEのモデムスリープ）
+  uint32_t wakeUs = 300;           // ライトスリープから起きて戻るまで（起きるたびに）
+  uint32_t sampleCpuUs = 600;      // 変換を眠って待つ場合に、測定1回でCPUが動く時間（I2Cの読み書き）
+  float radioBaseMa = 60.0f;       // 送受信中: baseMa + dBm * perDbmMa
+  float radioPerDbmMa = 3.0f;
+  uint32_t connectionIntervalUs = 30000;  // 接続イベントの間隔（セントラルが決める）
+  uint32_t connectionEventUs = 1200;      // 接続イベント1回の送受信時間
+  uint32_t notifyUs = 300;                // 通知1回で増える送信時間
+  uint32_t advertisingIntervalUs = 40000; // アドバタイジングの間隔
+  uint32_t advertisingEventUs = 2500;     // 3チャンネル分の送信とスキャン応答
+  float sensorRangingMa = 1.7f;    // VL6180X の測距中
+  float sensorStandbyMa = 0.001f;
+  float ledMa = 10.0f;             // LED 1色を最大輝度で点けたとき
+  uint32_t nominalSampleUs = 8000; // 実測の前に見積もる場合の、測定1回の時間（変換待ちを含む）
+  uint32_t nominalLoopUs = 200;    // 同じく、測定1回あたりに loop() のタスクが動く時間
+  float nominalFastShare = 0.08f;  // 同じく、測定周期を切り替える場合に予測の幅の中で測る割合（arrival_sim で約8%）
+
+  float cpuActiveMa(uint16_t mhz) const { return cpuBaseMa + mhz * cpuPerMhzMa; }
+  float cpuIdleMa(uint16_t mhz) const { return idleBaseMa + mhz * idlePerMhzMa; }
+  float radioMa(int8_t dbm) const { return radioBaseMa + dbm * radioPerDbmMa; }
+};
+
+// 一定時間に実際に動いた量（receiver.cpp が10秒ごとに集計する）
+struct PowerLoad {
+  uint32_t windowUs = 0;
+  uint32_t samples = 0;        // 測定の回数
+  uint32_t sampleUs = 0;       // 測定（変換待ちを含む）にかかった時間の合計
+  uint32_t loopBusyUs = 0;     // loop() のタスクを実行していた時間の合計
+  uint32_t wakeups = 0;        // 眠りから起きた回数（測定タスクと loop()）
+  uint32_t notifications = 0;  // BLE通知の回数
+  bool connected = false;
+  float ledLevel = 0;          // LEDの平均輝度（赤・青の合計、1.0 で1色を最大輝度で点けたのと同じ）
+};
+
+// 測定・通知を予定どおりに行った場合の load（電源モードを比べるため、実測の前に見積もる）
+inline PowerLoad nominalPowerLoad(const PowerSettings& settings, const PowerModel& model, uint32_t notifyIntervalMs,
+                                  bool connected) {
+  PowerLoad load;
+  load.windowUs = 1000000;
+  uint32_t meanPeriodUs = settings.samplePeriodUs;
+  if (settings.fastPeriodUs > 0) {
+    meanPeriodUs = (uint32_t)(model.nominalFastShare * settings.fastPeriodUs +
+                              (1 - model.nominalFastShare) * settings.samplePeriodUs);
+  }
+  load.samples = load.windowUs / meanPeriodUs;
+  load.sampleUs = load.samples * model.nominalSampleUs;
+  load.loopBusyUs = load.samples * model.nominalLoopUs;
+  load.wakeups = load.samples * 2;  // 測定タスクと、結果を受け取る loop()
+  uint32_t notifyPeriodUs = notifyIntervalMs * 1000 > settings.samplePeriodUs ? notifyIntervalMs * 1000
+                                                                              : settings.samplePeriodUs;
+  load.notifications = connected ? load.windowUs / notifyPeriodUs : 0;
+  load.connected = connected;
+  return load;
+}
+
+// 見積もりの結果（割合は0〜1）
+struct PowerPlan {
+  float cpuDuty;          // CPUが動いている割合
+  float radioDuty;        // 無線が送受信している割合
+  float sensorDuty;       // センサーが測距している割合
+  float averageMa;
+  uint32_t detectWindowUs;  // 車体がこれ以上センサーの前にいれば必ず1回は測定できる
+
+  float hours(uint32_t batteryMah) const { return averageMa > 0 ? batteryMah / averageMa : 0; }
+
+  // "POWER mode=.. period=..us sleep=.. cpu=..MHz tx=..dBm duty cpu=..% radio=..% sensor=..% avg=..mA life=..h detect>=..ms"
+  size_t format(char* out, size_t capacity, const PowerSettings& settings, uint32_t batteryMah) const {
+    int length = snprintf(out, capacity,
+                          "POWER mode=%s period=%luus sleep=%s cpu=%uMHz tx=%+ddBm duty cpu=%.1f%% radio=%.1f%% "
+                          "sensor=%.1f%% avg=%.1fmA life=%luh/%lumAh detect>=%lums",
+                          powerModeName(settings.mode), (unsigned long)settings.samplePeriodUs,
+                          settings.lightSleep ? "on" : "off", settings.cpuMhz, settings.txPowerDbm, cpuDuty * 100,
+                          radioDuty * 100, sensorDuty * 100, averageMa, (unsigned long)hours(batteryMah),
+                          (unsigned long)batteryMah, (unsigned long)((detectWindowUs + 999) / 1000));
+    if (length < 0 || capacity == 0) {
+      return 0;
+    }
+    return (size_t)length < capacity ? (size_t)length : capacity - 1;
+  }
+};
+
+inline float powerFraction(uint64_t part, uint32_t whole) {
+  if (whole == 0) {
+    return 0;
+  }
+  float fraction = (float)part / whole;
+  return fraction < 1 ? fraction : 1;
+}
+
+// load の間の平均電流を見積もる
+// 変換を眠って待たない場合、CPUは測定の変換待ちの間も動いている（readRange() がI2Cを読み続ける）
+inline PowerPlan planPower(const PowerSettings& settings, const PowerModel& model, const PowerLoad& load) {
+  PowerPlan plan;
+  uint64_t sampleCpuUs = load.sampleUs;
+  if (settings.conversionWait && (uint64_t)load.samples * model.sampleCpuUs < sampleCpuUs) {
+    sampleCpuUs = (uint64_t)load.samples * model.sampleCpuUs;
+  }
+  uint64_t cpuUs = sampleCpuUs + load.loopBusyUs;
+  if (settings.lightSleep) {
+    cpuUs += (uint64_t)load.wakeups * model.wakeUs;
+  }
+  uint64_t radioUs;
+  if (load.connected) {
+    radioUs = (uint64_t)load.windowUs / model.connectionIntervalUs * model.connectionEventUs +
+              (uint64_t)load.notifications * model.notifyUs;
+  } else {
+    radioUs = (uint64_t)load.windowUs / model.advertisingIntervalUs * model.advertisingEventUs;
+  }
+  plan.cpuDuty = powerFraction(cpuUs, load.windowUs);
+  plan.radioDuty = powerFraction(radioUs, load.windowUs);
+  plan.sensorDuty = powerFraction(load.sampleUs, load.windowUs);
+
+  float sleepMa = settings.lightSleep ? model.lightSleepMa : model.cpuIdleMa(settings.cpuMhz);
+  plan.averageMa = plan.cpuDuty * model.cpuActiveMa(settings.cpuMhz) + (1 - plan.cpuDuty) * sleepMa +
+                   plan.radioDuty * model.radioMa(settings.txPowerDbm) +
+                   plan.sensorDuty * model.sensorRangingMa + (1 - plan.sensorDuty) * model.sensorStandbyMa +
+                   load.ledLevel * model.ledMa;
+  plan.detectWindowUs = settings.samplePeriodUs + (load.samples > 0 ? load.sampleUs / load.samples : 0);
+  return plan;
+}
+
+// 電源モードごとの見積もり（接続中・予定どおりに測定した場合）を1行にする
+// "POWER modes full=42.5mA/28ms balanced=6.2mA/28ms saver=4.3mA/48ms"（平均電流/detectWindowUs）
+// adaptiveFloorUs: 測定周期を切り替える場合の予測の幅の外の周期（0なら電源モードの一定周期）
+inline size_t formatPowerModes(char* out, size_t capacity, uint32_t fullPeriodUs, const PowerModel& model,
+                               uint32_t notifyIntervalMs, uint32_t adaptiveFloorUs = 0) {
+  if (capacity == 0) {
+    return 0;
+  }
+  size_t length = 0;
+  int written = snprintf(out, capacity, "POWER modes");
+  for (uint8_t mode = 0; mode < POWER_MODES && written >= 0; mode++) {
+    length += (size_t)written;
+    if (length >= capacity) {
+      return capacity - 1;
+    }
+    PowerSettings settings = powerSettings(mode, fullPeriodUs);
+    if (adaptiveFloorUs > 0) {
+      settings = adaptivePowerSettings(settings, adaptiveFloorUs);
+    }
+    PowerPlan plan = planPower(settings, model, nominalPowerLoad(settings, model, notifyIntervalMs, true));
+    written = snprintf(out + length, capacity - length, " %s=%.1fmA/%lums", powerModeName(mode), plan.averageMa,
+                       (unsigned long)((plan.detectWindowUs + 999) / 1000));
+  }
+  if (written < 0) {
+    return length;
+  }
+  length += (size_t)written;
+  return length < capacity ? length : capacity - 1;
+}
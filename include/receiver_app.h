@@ -0,0 +1,517 @@
+#pragma once
+
+// receiverのロジック本体（センサー初期化・校正・通過検知・LED表示・BLE通知）
+// HAL越しにハードウェアを使うため、ESP32とホスト（フェイク）の両方でそのまま動く。
+// receiver.cpp はこれにBLE初期化・メトリクス・ログを組み合わせる
+//
+// ストレージを設定すると、校正が終わるたびにベースラインを保存し、次の起動では
+// 安定待ちの後の有効な測定値が続けて保存値と合えばすぐ検知を始める（校正は裏で続け、確定したら保存し直す）
+//
+// 処理はサンプリング側（measure(): センサー・校正・通過判定、serial はこちらだけが使う）と
+// 表示・通知側（present() 以降: LED・BLE通知）に分かれ、ReceiverSample だけで受け渡す。
+// receiver.cpp では両者を別のコアのタスクで動かし、SpscQueue でつなぐ。
+// 同じタスクで続けて呼ぶ場合は step() / detect() を使う
+
+#include <atomic>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "adaptive_rate.h"
+#include "baseline_store.h"
+#include "boot_timeline.h"
+#include "deadline.h"
+#include "hal.h"
+#include "led_effects.h"
+#include "passage_detector.h"
+
+// 起動の段階
+enum BootStage : uint8_t {
+  BOOT_SENSOR_INIT,  // センサー初期化中（失敗時は再試行を待つ）
+  BOOT_SETTLING,     // 初期化直後の測定を捨てている
+  BOOT_CALIBRATING,  // ベースライン校正中（仮のベースラインが決まれば検知も行う）
+  BOOT_READY,        // 動作中
+  BOOT_SENSORLESS,   // センサーなしモード（間隔を空けて初期化を再試行）
+};
+
+// 測定1回分の結果（measure() → present()）
+struct ReceiverSample {
+  uint32_t time;           // 測定時刻（ms）
+  uint32_t startedUs;      // 測定を始めた時刻（us、サンプリング周期の計測用）
+  uint32_t scheduledUs;    // 測定の予定時刻（us、SampleScheduler を使う場合。使わなければ0）
+  uint32_t detectionTime;  // 最後に通過を検出した時刻（ms）
+  uint32_t sincePrevious;  // 直前のカウントからの経過（ms、result が PASSAGE_COUNTED のとき）
+  int32_t count;
+  int16_t baseline;
+  uint16_t waitRemaining;  // 重複防止時間の残り（ms）
+  uint16_t missed;         // この測定の前に飛ばした予定の数（SampleScheduler）
+  uint32_t periodUs;       // この測定の予定を決めた周期（us、SampleScheduler。使わなければ0）
+  AdaptiveRateStep rate;   // 測定周期の選択（AdaptiveSampleRate を使う場合）
+  uint8_t range;
+  uint8_t status;
+  PassageResult result;
+  BootStage stage;  // 測定後の起動段階
+  bool measured;    // falseならセンサーなし（range・status・result は無効）
+};
+
+class ReceiverApp {
+ public:
+  static const uint32_t NOTIFY_INTERVAL = 25;           // BLE通知間隔（ms）
+  static const uint32_t COUNT_UP_LED_DURATION = 3000;   // カウントアップ点滅時間（ms）
+  static const int CALIBRATION_MEASUREMENTS = 20;        // 校正に使う測定回数（loop()周期で約400ms）
+  static const int CALIBRATION_MIN_MEASUREMENTS = 5;     // 仮のベースラインで検知を始めるまでの有効測定数
+  static const int SENSOR_SETTLE_SAMPLES = 3;            // 初期化直後に捨てる測定数
+  static const int STORED_VERIFY_SAMPLES = 3;            // 保存値で検知を始めるのに必要な、続けて許容範囲内の測定数
+  static const int SENSOR_MAX_ATTEMPTS = 10;             // センサーなしモードにするまでの初期化回数
+  static const uint32_t SENSOR_RETRY_INTERVAL = 3000;    // 初期化の再試行間隔（ms）
+  static const uint32_t SENSORLESS_RETRY_INTERVAL = 10000;  // センサーなしモードでの再試行間隔（ms）
+  static const uint32_t READY_LED_DURATION = 1200;       // 起動完了の点滅時間（ms）
+  static const uint32_t COMM_LED_DURATION = 50;          // 通信中の青色点灯（ms、同じ時間だけ消してから次を点ける）
+
+  ReceiverApp(HalClock& clock, HalRangeSensor& sensor, HalPwm& pwm, HalSerial& serial, HalBleLink& link,
+              uint8_t redPin, uint8_t bluePin, const PassageDetectorConfig& config = PassageDetectorConfig())
+      : detector(config), clock_(clock), sensor_(sensor), pwm_(pwm), serial_(serial), link_(link),
+        redPin_(redPin), bluePin_(bluePin), deviceNumber_(0), sensorAvailable_(false), firstSampleMarked_(false),
+        firstPassageMarked_(false),
+        bootStage_(BOOT_SENSOR_INIT), sensorOffset_(0), sensorAttempts_(0), settledSamples_(0),
+        calibrationTaken_(0), calibrationValid_(0), calibrationTotal_(0), calibrationSquares_(0), storage_(nullptr), stored_(), storedValid_(false), warmStart_(false), verifying_(false),
+        verifiedSamples_(0),
+        noise_(0), calibrationRequested_(false), shownStage_(BOOT_SENSOR_INIT), leds_(pwm, redPin, bluePin),
+        count_(0), detectionTime_(0), lastNotifyTime_(0), detectionNotifyPending_(false),
+        commLedTimer_(COMM_LED_DURATION * 2) {}
+
+  void setDeviceNumber(int deviceNumber) { deviceNumber_ = deviceNumber; }
+
+  // 校正値の保存先（begin() より前に設定する。nullptrなら保存しない）
+  void setStorage(HalStorage* storage) { storage_ = storage; }
+
+  // 起動を開始する（setup()から呼ぶ。待たずに戻り、以降の段階は loop() の中で進む）
+  //   センサー初期化（失敗しても loop() を止めずに再試行）→ 安定待ち（最初の数サンプルを捨てる）
+  //   → 校正（loop()の測定値をそのまま使う。CALIBRATION_MIN_MEASUREMENTS 回で仮の
+  //   ベースラインを決めて検知を始め、CALIBRATION_MEASUREMENTS 回で確定）→ 動作中
+  // 起動中のLED表示も loop() から時刻に応じて更新する
+  void begin(int8_t offset) {
+    uint32_t now = clock_.millis();
+    // LEDピンを出力モードに設定（センサー初期化前に実行）
+    pwm_.pinMode(redPin_, true);
+    pwm_.pinMode(bluePin_, true);
+    leds_.set(LED_LAYER_BASE, LedPattern::solid(0, 100), now);
+    leds_.update(now);
+    sensorOffset_ = offset;
+    sensorAttempts_ = 0;
+    bootStage_ = BOOT_SENSOR_INIT;
+    shownStage_ = BOOT_SENSOR_INIT;
+    sensorRetry_.start(now, 0);  // 最初の readSensor() ですぐ初期化する
+    boot.mark("app_begin", now);
+    loadStoredBaseline();
+    serial_.println("Starting VL6180X sensor initialization...");
+  }
+
+  BootStage bootStage() const { return bootStage_; }
+  bool warmStart() const { return warmStart_; }  // 保存されたベースラインで検知を始めた
+  uint16_t baselineNoise() const { return noise_; }  // 最後の校正の標準偏差（0.1mm単位）
+  // 表示・通知側から見た起動中（最後に present() した結果の段階）
+  bool booting() const { return shownStage_ != BOOT_READY && shownStage_ != BOOT_SENSORLESS; }
+
+  // ベースライン距離の再校正を始める（'c' コマンド、何も通過していない状態で）
+  // 校正中も以前のベースラインで検知を続け、検知範囲に入った値は平均に含めない
+  void startCalibration() {
+    if (!sensorAvailable_) {
+      serial_.println("Sensor not available. Skipping baseline distance setup.");
+      return;
+    }
+    serial_.println("=== Baseline Distance Calibration Start ===");
+    serial_.println("Measuring baseline distance with nothing in the lane...");
+    calibrationTaken_ = 0;
+    calibrationValid_ = 0;
+    calibrationTotal_ = 0;
+    calibrationSquares_ = 0;
+    bootStage_ = BOOT_CALIBRATING;
+  }
+
+  // 再校正を依頼する（表示・通知側から。次の measure() で startCalibration() する）
+  void requestCalibration() { calibrationRequested_.store(true, std::memory_order_release); }
+
+  // サンプリング側: 1回測定して校正・通過判定を進め、結果を sample に入れる（LED・通知には触れない）
+  // 戻り値: 測定したらtrue（センサーなしモードではfalse、sample.measured と同じ）
+  bool measure(ReceiverSample& sample) {
+    uint32_t startedUs = clock_.micros();
+    if (calibrationRequested_.exchange(false, std::memory_order_acquire)) {
+      startCalibration();
+    }
+    uint8_t range = 0;
+    uint8_t status = 0;
+    bool measured = readSensor(range, status);
+    uint32_t now = clock_.millis();
+    fillSample(sample, now, range, status, measured ? track(now, range, status) : PASSAGE_NONE, measured);
+    sample.startedUs = startedUs;
+    return measured;
+  }
+
+  // センサーを1回読む（センサーなしモードではfalse）
+  // 初期化が済んでいなければ、再試行の時刻になったときだけ初期化を試す
+  bool readSensor(uint8_t& range, uint8_t& status) {
+    if (!sensorAvailable_) {
+      uint32_t now = clock_.millis();
+      if (!sensorRetry_.expire(now) || !tryBeginSensor(now)) {
+        return false;
+      }
+    }
+    sensor_.read(range, status);
+    if (!firstSampleMarked_) {  // 毎サンプルで記録済みの段階を探さないよう、最初の1回だけ
+      boot.mark("first_sample", clock_.millis());
+      firstSampleMarked_ = true;
+    }
+    return true;
+  }
+
+  // 測定値1つの通過判定とLED表示（measure() と present() を同じタスクで続けて行う）
+  PassageResult detect(uint32_t now, uint8_t range, uint8_t status) {
+    ReceiverSample sample;
+    fillSample(sample, now, range, status, track(now, range, status), true);
+    present(sample);
+    return sample.result;
+  }
+
+  // 表示・通知側: measure() の結果をLEDのパターンと通知の状態に反映する（LEDへの出力は updateLeds()）
+  // LED（赤: 検知中、青: 待機、赤点滅: 測定エラー、起動中・起動完了・センサーなしの表示）
+  void present(const ReceiverSample& sample) {
+    uint32_t now = sample.time;
+    count_ = sample.count;
+    detectionTime_ = sample.detectionTime;
+    BootStage previous = shownStage_;
+    shownStage_ = sample.stage;
+    if (!sample.measured) {
+      showSensorless(now, sample.stage);
+      return;
+    }
+    if (sample.stage == BOOT_READY && previous == BOOT_CALIBRATING) {
+      // 校正が終わった: 青色の強い点滅（300msごと）
+      leds_.show(LED_LAYER_NOTICE, LedPattern::blink({0, 255}, {0, 0}, 300), now, READY_LED_DURATION);
+    }
+    PassageResult result = sample.result;
+    if ((sample.stage == BOOT_SETTLING || sample.stage == BOOT_CALIBRATING) && result == PASSAGE_NONE) {
+      leds_.set(LED_LAYER_BASE, LedPattern::blink({0, 100}, {0, 0}, 200), now);  // 起動中は青色の点滅
+      return;
+    }
+    switch (result) {
+      case PASSAGE_COUNTED:
+        // カウントアップ後3秒間の青色点滅（起動完了の点滅より優先）
+        leds_.clear(LED_LAYER_NOTICE);
+        leds_.show(LED_LAYER_ALERT, LedPattern::blink({0, 255}, {0, 0}, 250), now, COUNT_UP_LED_DURATION);
+        detectionNotifyPending_ = true;
+        break;
+      case PASSAGE_WAITING:
+        leds_.set(LED_LAYER_BASE, LedPattern::solid(255, 0), now);  // 赤色点灯（検知中）
+        break;
+      case PASSAGE_NONE:
+        leds_.set(LED_LAYER_BASE, LedPattern::solid(0, 100), now);  // 通常の青色点灯
+        break;
+      case PASSAGE_ERROR:
+        leds_.set(LED_LAYER_BASE, LedPattern::blink({255, 0}, {0, 0}, 250), now);  // 赤色の点滅
+        break;
+    }
+  }
+
+  // LEDの出力を時刻に合わせる（出力が変わるときだけ書き込む）
+  // 戻り値: 次に出力が変わりうるまでの時間（ms、LedEffects::NO_CHANGE なら表示が変わるまで呼ばなくてよい）
+  uint32_t updateLeds(uint32_t now) { return leds_.update(now); }
+  LedColor ledOutput() const { return leds_.output(); }  // 消費電流の見積もり用
+
+  // 接続中は25msごとに "デバイス番号:カウント:検出からの経過時間(ms)" を通知する
+  // 戻り値: 通知したらtrue。検出後最初の通知なら detectToNotify に検出からの経過時間を入れる（それ以外は-1）
+  bool notifyCount(uint32_t now, int32_t& detectToNotify) {
+    detectToNotify = -1;
+    if (!link_.connected() || now - lastNotifyTime_ <= NOTIFY_INTERVAL) {
+      return false;
+    }
+    uint32_t sinceDetection = now - detectionTime_;
+    char value[24];
+    int length = snprintf(value, sizeof(value), "%d:%ld:%lu", deviceNumber_, (long)count_,
+                          (unsigned long)(sinceDetection < 65535 ? sinceDetection : 65534));
+    link_.notify(value, (size_t)length);
+    if (detectionNotifyPending_) {
+      detectToNotify = (int32_t)sinceDetection;
+      detectionNotifyPending_ = false;
+    }
+
+    // 通信中の青色点滅（カウントアップ・起動完了の表示の下）
+    if (commLedTimer_.due(now)) {
+      leds_.show(LED_LAYER_COMM, LedPattern::solid(0, 255), now, COMM_LED_DURATION);
+    }
+    lastNotifyTime_ = now;
+    return true;
+  }
+
+  // センサーなしモード：1秒ごとに青色の明るさを切り替えて待機状態を表示
+  // （起動時の初期化を再試行している間は赤点滅でエラーを表示）
+  void updateSensorlessLed(uint32_t now) {
+    if (bootStage_ == BOOT_SENSOR_INIT && sensorAttempts_ == 0) {
+      return;
+    }
+    showSensorless(now, bootStage_);
+    leds_.update(now);
+  }
+
+  // loop()1回分（メトリクス・ログなしの最小構成、ホストでの実行用）
+  PassageResult step() {
+    ReceiverSample sample;
+    measure(sample);
+    present(sample);
+    if (sample.measured) {
+      int32_t detectToNotify;
+      notifyCount(clock_.millis(), detectToNotify);
+    }
+    updateLeds(clock_.millis());
+    return sample.measured ? sample.result : PASSAGE_NONE;
+  }
+
+  bool sensorAvailable() const { return sensorAvailable_; }
+  bool countUpLedActive(uint32_t now) const { return leds_.active(LED_LAYER_ALERT, now); }
+  const LedEffects& leds() const { return leds_; }
+
+  PassageDetector detector;
+  BootTimeline boot;  // 起動の各段階に到達した時刻（呼び出し側も段階を追記する）
+
+ private:
+  HalClock& clock_;
+  HalRangeSensor& sensor_;
+  HalPwm& pwm_;
+  HalSerial& serial_;
+  HalBleLink& link_;
+  uint8_t redPin_;
+  uint8_t bluePin_;
+  int deviceNumber_;
+  bool sensorAvailable_;
+  bool firstSampleMarked_;  // boot に "first_sample" を記録したか
+  bool firstPassageMarked_;  // boot に "first_passage" を記録したか
+
+  // サンプリング側の通過判定（安定待ち・校正中は測定値を校正に使い、仮のベースラインが決まっていれば検知も行う）
+  PassageResult track(uint32_t now, uint8_t range, uint8_t status) {
+    if (bootStage_ == BOOT_SETTLING) {
+      if (++settledSamples_ >= SENSOR_SETTLE_SAMPLES) {
+        startCalibration();
+      }
+      if (!detector.calibrated()) {
+        return PASSAGE_NONE;
+      }
+    }
+    // 保存値は安定待ちの後の測定値で確かめる（初期化直後の測定値は当てにならない）
+    if (verifying_ && status == 0) {
+      verifyStoredBaseline(now, range);
+    }
+    if (bootStage_ == BOOT_CALIBRATING) {
+      addCalibrationSample(now, range, status);
+    }
+    PassageResult result = detector.update(now, range, status);
+    if (result == PASSAGE_COUNTED && !firstPassageMarked_) {  // first_sample と同じく最初の1回だけ
+      boot.mark("first_passage", now);
+      firstPassageMarked_ = true;
+    }
+    return result;
+  }
+
+  void fillSample(ReceiverSample& sample, uint32_t now, uint8_t range, uint8_t status, PassageResult result,
+                  bool measured) {
+    sample.time = now;
+    sample.startedUs = 0;
+    sample.scheduledUs = 0;
+    sample.missed = 0;
+    sample.periodUs = 0;
+    sample.detectionTime = detector.lastDetectionTime();
+    sample.sincePrevious = now - detector.previousCountTime();
+    sample.count = detector.count();
+    sample.baseline = (int16_t)detector.baseline();
+    uint32_t wait = detector.waitRemaining();
+    sample.waitRemaining = (uint16_t)(wait < 0xFFFF ? wait : 0xFFFF);
+    sample.range = range;
+    sample.status = status;
+    sample.result = result;
+    sample.stage = bootStage_;
+    sample.measured = measured;
+  }
+
+  // センサーを初期化する（失敗したら再試行の締め切りを設定してfalse）
+  // SENSOR_MAX_ATTEMPTS 回失敗したらセンサーなしモードとし、その後も間隔を空けて再試行する
+  bool tryBeginSensor(uint32_t now) {
+    sensorAttempts_++;
+    if (!sensor_.begin()) {
+      if (sensorAttempts_ <= SENSOR_MAX_ATTEMPTS) {
+        serial_.printf("VL6180X initialization failed (attempt %d/%d)\r\n", sensorAttempts_, SENSOR_MAX_ATTEMPTS);
+      }
+      if (sensorAttempts_ == SENSOR_MAX_ATTEMPTS) {
+        serial_.println("VL6180X sensor initialization failed.");
+        serial_.println("Operating in sensor-less mode.");
+        bootStage_ = BOOT_SENSORLESS;
+        boot.mark("sensorless", now);
+      }
+      sensorRetry_.start(now, sensorAttempts_ < SENSOR_MAX_ATTEMPTS ? SENSOR_RETRY_INTERVAL : SENSORLESS_RETRY_INTERVAL);
+      return false;
+    }
+    sensorAvailable_ = true;
+    serial_.println("VL6180X sensor initialization complete");
+    // デバイス固有のオフセットを適用
+    if (sensorOffset_ != 0) {
+      sensor_.setOffset(sensorOffset_);
+      serial_.printf("Offset applied: %dmm\r\n", sensorOffset_);
+    }
+    boot.mark("sensor", now);
+    settledSamples_ = 0;
+    bootStage_ = BOOT_SETTLING;
+    // 保存値があれば安定待ちの後の有効な測定値で確かめて検知を始める
+    verifying_ = warmStart_ && !detector.calibrated();
+    verifiedSamples_ = 0;
+    return true;
+  }
+
+  // 保存された校正値を読む（使えれば warmStart_ を立てる）
+  void loadStoredBaseline() {
+    if (!storage_) {
+      return;
+    }
+    BaselineLoadResult result = loadBaseline(*storage_, sensorOffset_, stored_);
+    storedValid_ = result == BASELINE_OK;
+    warmStart_ = storedValid_;
+    if (warmStart_) {
+      serial_.printf("Stored baseline: %umm noise=%u.%umm (gen %lu)\r\n", stored_.baseline, stored_.noise / 10,
+                     stored_.noise % 10, (unsigned long)stored_.generation);
+    } else {
+      serial_.printf("Stored baseline not used: %s\r\n", baselineLoadResultName(result));
+      if (result != BASELINE_MISSING && result != BASELINE_OFFSET_CHANGED) {
+        stored_.generation = 0;  // 壊れたレコードの値は引き継がない
+      }
+    }
+  }
+
+  // 標準偏差（0.1mm単位）
+  static uint16_t noiseOf(uint32_t total, uint32_t squares, int valid) {
+    if (valid < 2) {
+      return 0;
+    }
+    float mean = (float)total / valid;
+    float variance = (float)squares / valid - mean * mean;
+    float deviation = variance > 0 ? sqrtf(variance) * 10 + 0.5f : 0;
+    return deviation < BASELINE_MAX_NOISE ? (uint16_t)deviation : BASELINE_MAX_NOISE;
+  }
+
+  // 有効な測定値が STORED_VERIFY_SAMPLES 回続けて保存値の許容範囲内なら保存値で検知を始める
+  // 1回でも外れれば（レーンの移動・起動時に車体がいた）保存値を捨て、通常の校正を待つ
+  // （確かめる前に検知すると、保存値が実際より遠い場合に誤ってカウントするため）
+  void verifyStoredBaseline(uint32_t now, uint8_t range) {
+    int tolerance = baselineTolerance(stored_, detector.threshold());
+    int difference = range > stored_.baseline ? range - stored_.baseline : stored_.baseline - range;
+    if (difference <= tolerance) {
+      if (++verifiedSamples_ < STORED_VERIFY_SAMPLES) {
+        return;
+      }
+      verifying_ = false;
+      detector.setBaseline(stored_.baseline);
+      boot.mark("detect_ready", now);
+      return;
+    }
+    serial_.printf("Stored baseline %umm rejected (measured %umm, tolerance %dmm)\r\n", stored_.baseline,
+                   range, tolerance);
+    verifying_ = false;
+    warmStart_ = false;
+    boot.mark("stored_rejected", now);
+  }
+
+  // 校正が済んだベースラインを保存する（前回の保存内容と同じなら書き込まない）
+  void saveCalibratedBaseline(uint32_t now) {
+    if (!storage_) {
+      return;
+    }
+    if (storedValid_ && stored_.baseline == detector.baseline() && stored_.noise == noise_) {
+      return;
+    }
+    BaselineRecord record;
+    record.offset = sensorOffset_;
+    record.baseline = (uint16_t)detector.baseline();
+    record.noise = noise_;
+    record.valid = (uint8_t)calibrationValid_;
+    record.generation = stored_.generation + 1;
+    record.savedAt = now;
+    if (saveBaseline(*storage_, record)) {
+      stored_ = record;
+      storedValid_ = true;
+      serial_.printf("Baseline saved (gen %lu)\r\n", (unsigned long)record.generation);
+    } else {
+      serial_.println("Failed to save baseline");
+    }
+  }
+
+  // 校正用に1サンプルを加える
+  void addCalibrationSample(uint32_t now, uint8_t range, uint8_t status) {
+    calibrationTaken_++;
+    // 検知中の仮のベースラインから見て検知範囲に入る値（通過中の車体）は含めない
+    bool inLane = detector.calibrated() && range < detector.baseline() - detector.threshold();
+    if (status == 0 && !inLane) {
+      calibrationTotal_ += range;
+      calibrationSquares_ += (uint32_t)range * range;
+      calibrationValid_++;
+    }
+    if (!detector.calibrated() && calibrationValid_ >= CALIBRATION_MIN_MEASUREMENTS) {
+      detector.calibrate(calibrationTotal_, calibrationValid_, calibrationValid_);
+      boot.mark("detect_ready", now);
+    }
+    if (calibrationTaken_ < CALIBRATION_MEASUREMENTS) {
+      return;
+    }
+    if (detector.calibrate(calibrationTotal_, calibrationValid_, CALIBRATION_MEASUREMENTS)) {
+      noise_ = noiseOf(calibrationTotal_, calibrationSquares_, calibrationValid_);
+      serial_.printf("Baseline distance setup complete: %dmm noise=%u.%umm (%d/%d valid)\r\n", detector.baseline(),
+                     noise_ / 10, noise_ % 10, calibrationValid_, CALIBRATION_MEASUREMENTS);
+      serial_.printf("Detection threshold: %dmm or less\r\n", detector.baseline() - detector.threshold());
+      saveCalibratedBaseline(now);
+    } else {
+      serial_.println("Failed to set baseline distance. Using fixed value.");
+    }
+    serial_.println("=== Baseline Distance Calibration End ===");
+    if (!boot.has("calibrated")) {
+      serial_.println("To re-run calibration, send 'c'");
+    }
+    boot.mark("calibrated", now);
+    bootStage_ = BOOT_READY;  // 起動完了の点滅は present() が始める
+  }
+
+  // センサーなし（1秒かけて青色の明るさを行き来する）・初期化の再試行中（赤色の点滅）の表示
+  void showSensorless(uint32_t now, BootStage stage) {
+    if (stage == BOOT_SENSOR_INIT) {
+      leds_.set(LED_LAYER_BASE, LedPattern::blink({255, 0}, {0, 0}, 500), now);
+      return;
+    }
+    leds_.set(LED_LAYER_BASE, LedPattern::pulse({0, 50}, {0, 200}, 1000), now);
+  }
+
+  // 起動の状態
+  BootStage bootStage_;
+  int8_t sensorOffset_;
+  int sensorAttempts_;
+  Deadline sensorRetry_;
+  int settledSamples_;
+  int calibrationTaken_;
+  int calibrationValid_;
+  uint32_t calibrationTotal_;
+  uint32_t calibrationSquares_;
+
+  // 保存された校正値
+  HalStorage* storage_;
+  BaselineRecord stored_;
+  bool storedValid_;  // stored_ がストレージの内容と一致し、使える値
+  bool warmStart_;
+  bool verifying_;  // 保存値を測定値と比べている間（安定待ちから STORED_VERIFY_SAMPLES 回の有効な測定まで）
+  int verifiedSamples_;  // 続けて保存値の許容範囲内だった有効な測定数
+  uint16_t noise_;
+  std::atomic<bool> calibrationRequested_;
+
+  // ここから下は表示・通知側の状態（present() 以降だけが触る）
+  BootStage shownStage_;
+  LedEffects leds_;
+
+  // BLE通知の状態（カウントは最後に present() した値）
+  int32_t count_;
+  uint32_t detectionTime_;
+  uint32_t lastNotifyTime_;
+  bool detectionNotifyPending_;
+  IntervalTimer commLedTimer_;
+};
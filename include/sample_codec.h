@@ -0,0 +1,229 @@
+#pragma once
+
+// 距離サンプル記録用のブロック符号化（receiverの記録機能とホスト側デコーダで共用）
+// Arduino非依存（ホスト環境でもコンパイル可能）
+//
+// ファイルは SAMPLE_BLOCK_SIZE バイト固定のブロックを並べたリング。
+// ブロックごとに独立して復号できるため、上書きや書き込み途中の電源断があっても
+// 他のブロックは読める。
+//
+// ブロック構成（リトルエンディアン）:
+//   0  magic   u32  SAMPLE_BLOCK_MAGIC
+//   4  seq     u32  ブロック通し番号（リング上の位置は seq % ブロック数）
+//   8  base    u32  最初のサンプルの基準時刻（ms）
+//   12 count   u16  サンプル数
+//   14 length  u16  ペイロード長
+//   16 crc     u16  CRC-16/CCITT（crc欄を除くヘッダ＋ペイロード）
+//   18 payload      サンプル列（残りは0埋め）
+//
+// サンプル: varint(前サンプルからの経過ms) + varint(zigzag(距離の差分) << 4 | ステータス)
+// 50Hz・距離が安定している間は1サンプル2バイト
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef SAMPLE_BLOCK_SIZE
+#define SAMPLE_BLOCK_SIZE 1024
+#endif
+
+#define SAMPLE_BLOCK_MAGIC 0x31425359  // "YSB1"
+#define SAMPLE_BLOCK_HEADER_SIZE 18
+#define SAMPLE_RECORD_MAX 10  // varint 5バイト x 2
+
+inline uint16_t sampleCrc16(const uint8_t* data, size_t length, uint16_t crc = 0xFFFF) {
+  for (size_t i = 0; i < length; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+inline void putSampleU16(uint8_t* out, uint16_t value) {
+  out[0] = (uint8_t)value;
+  out[1] = (uint8_t)(value >> 8);
+}
+
+inline void putSampleU32(uint8_t* out, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    out[i] = (uint8_t)(value >> (8 * i));
+  }
+}
+
+inline uint16_t getSampleU16(const uint8_t* in) { return (uint16_t)(in[0] | (in[1] << 8)); }
+
+inline uint32_t getSampleU32(const uint8_t* in) {
+  return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+// varintを書き込む（戻り値: 書き込んだバイト数）
+inline size_t putSampleVarint(uint8_t* out, uint32_t value) {
+  size_t n = 0;
+  while (value >= 0x80) {
+    out[n++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  out[n++] = (uint8_t)value;
+  return n;
+}
+
+// varintを読み取る（戻り値: 読んだバイト数、不正なら0）
+inline size_t getSampleVarint(const uint8_t* in, size_t available, uint32_t& value) {
+  value = 0;
+  for (size_t n = 0; n < available && n < 5; n++) {
+    value |= (uint32_t)(in[n] & 0x7F) << (7 * n);
+    if ((in[n] & 0x80) == 0) {
+      return n + 1;
+    }
+  }
+  return 0;
+}
+
+// 1ブロック分をRAM上で組み立てる
+class SampleBlockEncoder {
+ public:
+  SampleBlockEncoder() { begin(0, 0); }
+
+  void begin(uint32_t seq, uint32_t baseTime) {
+    seq_ = seq;
+    baseTime_ = baseTime;
+    lastTime_ = baseTime;
+    lastRange_ = 0;
+    count_ = 0;
+    used_ = SAMPLE_BLOCK_HEADER_SIZE;
+  }
+
+  // サンプルを追加する（収まらない場合は追加せずfalse）
+  bool add(uint32_t time, uint8_t range, uint8_t status) {
+    uint8_t record[SAMPLE_RECORD_MAX];
+    int delta = (int)range - (int)lastRange_;
+    uint32_t zigzag = delta >= 0 ? (uint32_t)delta << 1 : ((uint32_t)(-delta) << 1) - 1;
+    size_t n = putSampleVarint(record, time - lastTime_);
+    n += putSampleVarint(record + n, (zigzag << 4) | (status & 0x0F));
+    if (used_ + n > SAMPLE_BLOCK_SIZE || count_ == UINT16_MAX) {
+      return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+      buffer_[used_ + i] = record[i];
+    }
+    used_ += n;
+    lastTime_ = time;
+    lastRange_ = range;
+    count_++;
+    return true;
+  }
+
+  // ヘッダとCRCを書き込み、残りを0で埋める（戻り値: ブロックサイズ）
+  size_t finish() {
+    putSampleU32(buffer_, SAMPLE_BLOCK_MAGIC);
+    putSampleU32(buffer_ + 4, seq_);
+    putSampleU32(buffer_ + 8, baseTime_);
+    putSampleU16(buffer_ + 12, count_);
+    putSampleU16(buffer_ + 14, (uint16_t)(used_ - SAMPLE_BLOCK_HEADER_SIZE));
+    uint16_t crc = sampleCrc16(buffer_, 16);
+    crc = sampleCrc16(buffer_ + SAMPLE_BLOCK_HEADER_SIZE, used_ - SAMPLE_BLOCK_HEADER_SIZE, crc);
+    putSampleU16(buffer_ + 16, crc);
+    for (size_t i = used_; i < SAMPLE_BLOCK_SIZE; i++) {
+      buffer_[i] = 0;
+    }
+    return SAMPLE_BLOCK_SIZE;
+  }
+
+  const uint8_t* data() const { return buffer_; }
+  uint32_t seq() const { return seq_; }
+  uint16_t count() const { return count_; }
+  size_t used() const { return used_; }
+  bool empty() const { return count_ == 0; }
+
+ private:
+  uint8_t buffer_[SAMPLE_BLOCK_SIZE];
+  size_t used_;
+  uint32_t seq_;
+  uint32_t baseTime_;
+  uint32_t lastTime_;
+  uint8_t lastRange_;
+  uint16_t count_;
+};
+
+enum SampleBlockResult : uint8_t {
+  SAMPLE_BLOCK_OK,
+  SAMPLE_BLOCK_EMPTY,    // 未使用（magicなし）
+  SAMPLE_BLOCK_CORRUPT,  // CRC不一致・長さ不正（書き込み途中の電源断など）
+};
+
+struct SampleBlockInfo {
+  uint32_t seq;
+  uint32_t baseTime;
+  uint16_t count;
+  uint16_t length;
+};
+
+// ヘッダだけを検査する（起動時に続きの通し番号を探す用途）
+inline SampleBlockResult readSampleBlockHeader(const uint8_t* block, size_t size, SampleBlockInfo& info) {
+  if (size < SAMPLE_BLOCK_HEADER_SIZE || getSampleU32(block) != SAMPLE_BLOCK_MAGIC) {
+    return SAMPLE_BLOCK_EMPTY;
+  }
+  info.seq = getSampleU32(block + 4);
+  info.baseTime = getSampleU32(block + 8);
+  info.count = getSampleU16(block + 12);
+  info.length = getSampleU16(block + 14);
+  if (SAMPLE_BLOCK_HEADER_SIZE + (size_t)info.length > size) {
+    return SAMPLE_BLOCK_CORRUPT;
+  }
+  return SAMPLE_BLOCK_OK;
+}
+
+// 1ブロックを復号し、サンプルごとに onSample(time, range, status) を呼ぶ
+// CRC不一致の場合は何も呼ばずに SAMPLE_BLOCK_CORRUPT を返す
+template <typename OnSample>
+SampleBlockResult decodeSampleBlock(const uint8_t* block, size_t size, SampleBlockInfo& info,
+                                    OnSample onSample) {
+  SampleBlockResult result = readSampleBlockHeader(block, size, info);
+  if (result != SAMPLE_BLOCK_OK) {
+    return result;
+  }
+  uint16_t crc = sampleCrc16(block, 16);
+  crc = sampleCrc16(block + SAMPLE_BLOCK_HEADER_SIZE, info.length, crc);
+  if (crc != getSampleU16(block + 16)) {
+    return SAMPLE_BLOCK_CORRUPT;
+  }
+
+  // 先に全体を検証してから通知する（途中で壊れていても部分的に出力しない）
+  for (int pass = 0; pass < 2; pass++) {
+    const uint8_t* p = block + SAMPLE_BLOCK_HEADER_SIZE;
+    size_t remaining = info.length;
+    uint32_t time = info.baseTime;
+    int range = 0;
+    for (uint16_t i = 0; i < info.count; i++) {
+      uint32_t dt;
+      uint32_t packed;
+      size_t n = getSampleVarint(p, remaining, dt);
+      if (n == 0) {
+        return SAMPLE_BLOCK_CORRUPT;
+      }
+      p += n;
+      remaining -= n;
+      n = getSampleVarint(p, remaining, packed);
+      if (n == 0) {
+        return SAMPLE_BLOCK_CORRUPT;
+      }
+      p += n;
+      remaining -= n;
+      uint32_t zigzag = packed >> 4;
+      int delta = (zigzag & 1) ? -(int)((zigzag + 1) >> 1) : (int)(zigzag >> 1);
+      time += dt;
+      range += delta;
+      if (range < 0 || range > 255) {
+        return SAMPLE_BLOCK_CORRUPT;
+      }
+      if (pass == 1) {
+        onSample(time, (uint8_t)range, (uint8_t)(packed & 0x0F));
+      }
+    }
+    if (remaining != 0) {
+      return SAMPLE_BLOCK_CORRUPT;
+    }
+  }
+  return SAMPLE_BLOCK_OK;
+}
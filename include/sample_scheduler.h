@@ -0,0 +1,123 @@
+#pragma once
+
+// 一定周期の測定スケジュールとジッター統計（receiverの測定タスク用）
+// 測定タスクはタイマー（esp_timer の周期タイマー）に起こされ、k 回目の測定の予定時刻は
+// 開始時刻 + k * 周期 に固定される。処理時間やログ出力で周期がずれていくことはない。
+// 予定時刻と実際に測定を始めた時刻の差をジッターとし、次の予定時刻を過ぎても始められなかった
+// 測定（飛ばした予定）と、締め切り（予定時刻 + deadlineUs）より遅れて始めた測定を数える。
+// 周期を変える場合は、測定ごとにその予定の周期（SampleSlot::periodUs）から締め切りを決めて渡す。
+// 時刻は HalClock::micros() の値を渡す（uint32_t の折り返し（約71分）をまたいでも差分で判定する）
+// Arduino非依存（ホストでは仮想時計で確認できる: receiver_native）
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "latency_histogram.h"
+
+// 1回の測定の予定
+struct SampleSlot {
+  uint32_t scheduledUs;  // 予定時刻
+  uint32_t actualUs;     // 実際に測定を始めた時刻
+  uint16_t missed;       // この測定の前に飛ばした予定の数（遅れが周期以上になった分）
+  uint32_t periodUs;     // この予定を決めた周期
+};
+
+class SampleScheduler {
+ public:
+  explicit SampleScheduler(uint32_t periodUs) : periodUs_(periodUs), nextUs_(0) {}
+
+  // 最初の予定時刻を決める（周期タイマーを開始した時刻 + 周期）
+  void start(uint32_t firstDueUs) { nextUs_ = firstDueUs; }
+
+  // 周期を変える（周期タイマーを startUs に新しい周期で開始し直したとき。次の予定は startUs + periodUs）
+  void restart(uint32_t periodUs, uint32_t startUs) {
+    periodUs_ = periodUs;
+    nextUs_ = startUs + periodUs;
+  }
+
+  // 測定を始めた時刻 actualUs に対応する予定を返し、次の予定へ進める
+  // 1周期以上遅れていれば、その間の予定は飛ばして数え、直近の予定に合わせる（まとめて取り戻さない）
+  SampleSlot begin(uint32_t actualUs) {
+    SampleSlot slot;
+    uint32_t missed = 0;
+    int32_t lateness = (int32_t)(actualUs - nextUs_);
+    if (lateness >= (int32_t)periodUs_) {
+      missed = (uint32_t)lateness / periodUs_;
+      nextUs_ += missed * periodUs_;
+    }
+    slot.scheduledUs = nextUs_;
+    slot.actualUs = actualUs;
+    slot.missed = (uint16_t)(missed < 0xFFFF ? missed : 0xFFFF);
+    slot.periodUs = periodUs_;
+    nextUs_ += periodUs_;
+    return slot;
+  }
+
+  // 次の予定時刻までの時間（us、過ぎていれば0。タイマーを使わずに待つ場合）
+  uint32_t untilDue(uint32_t nowUs) const {
+    int32_t remaining = (int32_t)(nextUs_ - nowUs);
+    return remaining > 0 ? (uint32_t)remaining : 0;
+  }
+
+  uint32_t nextDueUs() const { return nextUs_; }
+  uint32_t periodUs() const { return periodUs_; }
+
+ private:
+  uint32_t periodUs_;
+  uint32_t nextUs_;
+};
+
+// 予定時刻と実際の時刻からジッター・締め切り超過を集計する（表示側で SampleSlot を受け取って記録）
+class SampleJitter {
+ public:
+  explicit SampleJitter(uint32_t deadlineUs) : deadlineUs_(deadlineUs), samples_(0), missed_(0), late_(0) {}
+
+  void record(uint32_t scheduledUs, uint32_t actualUs, uint32_t missed) {
+    record(scheduledUs, actualUs, missed, deadlineUs_);
+  }
+  // deadlineUs: この測定の締め切り（周期を変える場合）
+  void record(uint32_t scheduledUs, uint32_t actualUs, uint32_t missed, uint32_t deadlineUs) {
+    int32_t lateness = (int32_t)(actualUs - scheduledUs);
+    uint32_t jitter = lateness < 0 ? (uint32_t)-lateness : (uint32_t)lateness;  // 予定より早い場合も含める
+    jitter_.record(jitter);
+    samples_++;
+    missed_ += missed;
+    if (lateness > (int32_t)deadlineUs) {
+      late_++;
+    }
+  }
+  void record(const SampleSlot& slot) { record(slot.scheduledUs, slot.actualUs, slot.missed); }
+
+  void reset() {
+    jitter_.reset();
+    samples_ = 0;
+    missed_ = 0;
+    late_ = 0;
+  }
+
+  LatencyHistogram& jitter() { return jitter_; }  // 予定時刻との差（us）
+  uint32_t samples() const { return samples_; }
+  uint32_t missed() const { return missed_; }     // 飛ばした予定
+  uint32_t late() const { return late_; }         // 締め切りより遅れて始めた測定
+  uint32_t deadlineUs() const { return deadlineUs_; }  // record() で締め切りを渡さない場合の締め切り
+
+  // "JITTER n=.. p50=.. p95=.. p99=.. max=..us late=.. missed=.." を書き込む
+  size_t format(char* out, size_t capacity) const {
+    size_t used = jitter_.format(out, capacity, "JITTER", "us");
+    if (used + 1 < capacity) {
+      int len = snprintf(out + used, capacity - used, " late=%lu missed=%lu",
+                         (unsigned long)late_, (unsigned long)missed_);
+      if (len > 0) {
+        used += (size_t)len < capacity - used ? (size_t)len : capacity - used - 1;
+      }
+    }
+    return used;
+  }
+
+ private:
+  LatencyHistogram jitter_;
+  uint32_t deadlineUs_;
+  uint32_t samples_;
+  uint32_t missed_;
+  uint32_t late_;
+};
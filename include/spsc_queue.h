@@ -0,0 +1,74 @@
+#pragma once
+
+// ロックフリーの単一生産者・単一消費者キュー（固定長リングバッファ）
+// 生産者と消費者がそれぞれ1つのタスク（ホストではスレッド）に限られる場合に使う。
+// push() は生産者だけ、pop() は消費者だけが呼ぶ。満杯時の push() は待たずに失敗して数える。
+// Arduino非依存（ESP32のデュアルコアでもホストでも std::atomic で受け渡す）
+//
+//   SpscQueue<ReceiverSample, 32> queue;
+//   queue.push(sample);              // サンプリングタスク
+//   while (queue.pop(sample)) {...}  // loop()
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// 生産者と消費者のインデックスを別のキャッシュラインに置く（ホストでの偽共有を避ける）
+#ifndef SPSC_QUEUE_ALIGN
+#define SPSC_QUEUE_ALIGN 64
+#endif
+
+template <typename T, size_t N>
+class SpscQueue {
+ public:
+  SpscQueue() : head_(0), tailCache_(0), tail_(0), headCache_(0), dropped_(0) {}
+
+  // 生産者: 1件積む（満杯ならfalse）
+  bool push(const T& item) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tailCache_ >= N) {
+      tailCache_ = tail_.load(std::memory_order_acquire);
+      if (head - tailCache_ >= N) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+    }
+    items_[head & (N - 1)] = item;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // 消費者: 1件取り出す（空ならfalse）
+  bool pop(T& item) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == headCache_) {
+      headCache_ = head_.load(std::memory_order_acquire);
+      if (tail == headCache_) {
+        return false;
+      }
+    }
+    item = items_[tail & (N - 1)];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // 溜まっている件数（どちらの側から見ても目安）
+  size_t size() const {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+  }
+  bool empty() const { return size() == 0; }
+  static constexpr size_t capacity() { return N; }
+  uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+  T items_[N];
+  // 生産者が書く（tailCache_ は生産者だけが使う tail_ の控え）
+  alignas(SPSC_QUEUE_ALIGN) std::atomic<size_t> head_;
+  size_t tailCache_;
+  // 消費者が書く（headCache_ は消費者だけが使う head_ の控え）
+  alignas(SPSC_QUEUE_ALIGN) std::atomic<size_t> tail_;
+  size_t headCache_;
+  std::atomic<uint32_t> dropped_;
+};
@@ -0,0 +1,153 @@
+#pragma once
+
+// ループ内ステージごとの処理時間プロファイラ（オプトイン）
+// ビルドフラグ -D ENABLE_STAGE_PROFILER=1 で有効化。無効時はマクロが空になり何も生成しない
+//
+// 使い方:
+//   void loop() {
+//     PROFILE_LOOP_START();          // 計測開始点
+//     ...BLE処理...
+//     PROFILE_MARK("ble");           // 直前のマークからここまでを "ble" に加算
+//     ...センサー読み取り...
+//     PROFILE_MARK("sensor");
+//   }
+//   PROFILE_PRINT(Serial);           // ステージごとの min/mean/max を表形式で出力
+//
+// ESP32ではCPUサイクルカウンタ（cyc）、ホストではモノトニッククロック（ns）で計測する
+
+#ifndef ENABLE_STAGE_PROFILER
+#define ENABLE_STAGE_PROFILER 0
+#endif
+
+#if ENABLE_STAGE_PROFILER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#define STAGE_PROFILER_UNIT "cyc"
+inline uint32_t stageProfilerNow() { return ESP.getCycleCount(); }
+#else
+#include <chrono>
+#define STAGE_PROFILER_UNIT "ns"
+inline uint32_t stageProfilerNow() {
+  return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+#ifndef STAGE_PROFILER_MAX_STAGES
+#define STAGE_PROFILER_MAX_STAGES 12
+#endif
+
+struct StageStats {
+  const char* name;
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t total;
+};
+
+class StageProfiler {
+ public:
+  StageProfiler() : stageCount_(0), last_(0) {}
+
+  // 名前からステージ番号を得る（初回は登録、満杯時は最後のステージに合算）
+  uint8_t stage(const char* name) {
+    for (uint8_t i = 0; i < stageCount_; i++) {
+      if (strcmp(stages_[i].name, name) == 0) {
+        return i;
+      }
+    }
+    if (stageCount_ >= STAGE_PROFILER_MAX_STAGES) {
+      return STAGE_PROFILER_MAX_STAGES - 1;
+    }
+    StageStats& s = stages_[stageCount_];
+    s.name = name;
+    s.count = 0;
+    s.min = UINT32_MAX;
+    s.max = 0;
+    s.total = 0;
+    return stageCount_++;
+  }
+
+  void start() { last_ = stageProfilerNow(); }
+
+  // 直前のマークからの経過時間をステージに加算する
+  void mark(uint8_t index) {
+    uint32_t now = stageProfilerNow();
+    uint32_t elapsed = now - last_;
+    last_ = now;
+    StageStats& s = stages_[index];
+    s.count++;
+    s.total += elapsed;
+    if (elapsed < s.min) {
+      s.min = elapsed;
+    }
+    if (elapsed > s.max) {
+      s.max = elapsed;
+    }
+  }
+
+  void reset() {
+    for (uint8_t i = 0; i < stageCount_; i++) {
+      stages_[i].count = 0;
+      stages_[i].min = UINT32_MAX;
+      stages_[i].max = 0;
+      stages_[i].total = 0;
+    }
+  }
+
+  // 表を1行ずつ出力する（Outは println(const char*) を持つ型）
+  template <typename Out>
+  void print(Out& out) const {
+    char line[80];
+    snprintf(line, sizeof(line), "%-12s %8s %10s %10s %10s  (" STAGE_PROFILER_UNIT ")",
+             "stage", "count", "min", "mean", "max");
+    out.println(line);
+    for (uint8_t i = 0; i < stageCount_; i++) {
+      const StageStats& s = stages_[i];
+      snprintf(line, sizeof(line), "%-12s %8lu %10lu %10lu %10lu", s.name,
+               (unsigned long)s.count, (unsigned long)(s.count ? s.min : 0),
+               (unsigned long)(s.count ? s.total / s.count : 0), (unsigned long)s.max);
+      out.println(line);
+    }
+  }
+
+  uint8_t size() const { return stageCount_; }
+  const StageStats& at(uint8_t index) const { return stages_[index]; }
+
+ private:
+  StageStats stages_[STAGE_PROFILER_MAX_STAGES];
+  uint8_t stageCount_;
+  uint32_t last_;
+};
+
+inline StageProfiler& stageProfiler() {
+  static StageProfiler profiler;
+  return profiler;
+}
+
+#define STAGE_PROFILER_CAT_(a, b) a##b
+#define STAGE_PROFILER_CAT(a, b) STAGE_PROFILER_CAT_(a, b)
+
+#define PROFILE_LOOP_START() stageProfiler().start()
+#define PROFILE_MARK(name)                                                              \
+  do {                                                                                  \
+    static const uint8_t STAGE_PROFILER_CAT(stageId_, __LINE__) = stageProfiler().stage(name); \
+    stageProfiler().mark(STAGE_PROFILER_CAT(stageId_, __LINE__));                       \
+  } while (0)
+#define PROFILE_PRINT(out) stageProfiler().print(out)
+#define PROFILE_RESET() stageProfiler().reset()
+
+#else
+
+#define PROFILE_LOOP_START() ((void)0)
+#define PROFILE_MARK(name) ((void)0)
+#define PROFILE_PRINT(out) ((void)0)
+#define PROFILE_RESET() ((void)0)
+
+#endif
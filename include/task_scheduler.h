@@ -0,0 +1,178 @@
+#pragma once
+
+// 協調型のタスクスケジューラ（全ファームウェア共通）
+// loop() の中の処理を「定期的に実行するタスク」「一度だけ実行するタスク」「signal() されたら実行するタスク」
+// として登録し、loop() は run() で期限の来たタスクだけを実行して、次の締め切りまで眠る（HalWaker）。
+// 固定の delay() で待つ代わりに締め切りまで眠るので、何もない間は眠り続け、
+// BLEコールバックなど他のタスクから signal() されればすぐに起きて処理する。
+// タスクは loop() のタスクの中で1つずつ実行される（途中で割り込まれないので、タスク同士は排他不要）。
+// 時刻は HalClock::millis()（締め切りの比較は deadline.h と同じく差分で行う）
+// Arduino非依存（ホストでの計測: hot_path_bench の scheduler_run、scheduler_bench の起床遅延）
+//
+//   TaskScheduler<8> scheduler(halClock, loopWaker);
+//   int statusTask = scheduler.every(sendStatus, 1000);      // 1秒ごと
+//   int ledOffTask = scheduler.add(turnLedOff);              // scheduler.start(ledOffTask, 100) で100ms後に1回
+//   int eventTask = scheduler.add(drainEvents);              // コールバックから scheduler.signal(eventTask)
+//   void loop() { scheduler.loop(); }
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "deadline.h"
+#include "hal.h"
+#include "latency_histogram.h"
+
+typedef void (*SchedulerTask)(uint32_t now);
+
+template <size_t N>
+class TaskScheduler {
+ public:
+  static const uint32_t NO_DEADLINE = 0xFFFFFFFF;  // untilNext() の戻り値: signal() まで眠ってよい
+
+  TaskScheduler(HalClock& clock, HalWaker& waker)
+      : clock_(clock),
+        waker_(waker),
+        count_(0),
+        pending_(0),
+        runs_(0),
+        skipped_(0),
+        loops_(0),
+        busyMicros_(0),
+        lateness_(nullptr) {}
+
+  // period ごとに実行するタスク（最初は firstDelay 後）
+  // 遅れて実行した場合も次の締め切りは period 刻みのまま。1周期以上遅れたら取り戻さずに次から数え直す
+  int every(SchedulerTask task, uint32_t period, uint32_t firstDelay = 0) {
+    int id = add(task);
+    if (id >= 0) {
+      tasks_[id].period = period;
+      start(id, firstDelay);
+    }
+    return id;
+  }
+
+  // 締め切りのないタスク（start() で一度だけ実行する締め切りを設定するか、signal() で起こす）
+  int add(SchedulerTask task) {
+    if (count_ >= N) {
+      return -1;
+    }
+    Entry& e = tasks_[count_];
+    e.task = task;
+    e.period = 0;
+    e.due = 0;
+    e.armed = false;
+    return (int)count_++;
+  }
+
+  // delay 後に実行する（一度だけのタスクは実行すると解除される。定期タスクなら周期の起点を設定し直す）
+  // loop() のタスクから呼ぶ
+  void start(int id, uint32_t delay) {
+    tasks_[id].due = clock_.millis() + delay;
+    tasks_[id].armed = true;
+  }
+  void cancel(int id) { tasks_[id].armed = false; }
+  bool armed(int id) const { return tasks_[id].armed; }
+
+  // タスクをすぐに実行させる（他のタスク・BLEコールバックから呼べる。眠っている loop() を起こす）
+  void signal(int id) {
+    pending_.fetch_or(1u << id, std::memory_order_release);
+    waker_.wake();
+  }
+
+  // 期限の来たタスクと signal() されたタスクを登録順に1回ずつ実行する
+  // 戻り値: 実行したタスクの数
+  size_t run(uint32_t now) {
+    uint32_t signaled = pending_.exchange(0, std::memory_order_acquire);
+    size_t ran = 0;
+    for (size_t i = 0; i < count_; i++) {
+      Entry& e = tasks_[i];
+      bool due = e.armed && timeReached(now, e.due);
+      if (!due && (signaled & (1u << i)) == 0) {
+        continue;
+      }
+      if (due) {
+        if (lateness_) {
+          lateness_->record(now - e.due);
+        }
+        if (e.period > 0) {
+          e.due += e.period;
+          if (timeReached(now, e.due)) {
+            e.due = now + e.period;  // 1周期以上遅れた
+            skipped_++;
+          }
+        } else {
+          e.armed = false;
+        }
+      }
+      e.task(now);
+      ran++;
+    }
+    runs_ += ran;
+    return ran;
+  }
+
+  // 次に実行するタスクまでの時間（ms、signal() 済みなら0、締め切りがなければ NO_DEADLINE）
+  uint32_t untilNext(uint32_t now) const {
+    if (pending_.load(std::memory_order_acquire) != 0) {
+      return 0;
+    }
+    uint32_t next = NO_DEADLINE;
+    for (size_t i = 0; i < count_; i++) {
+      const Entry& e = tasks_[i];
+      if (!e.armed) {
+        continue;
+      }
+      if (timeReached(now, e.due)) {
+        return 0;
+      }
+      uint32_t remaining = e.due - now;
+      next = remaining < next ? remaining : next;
+    }
+    return next;
+  }
+
+  // loop() 1回分: 期限の来たタスクを実行し、次の締め切りか signal() まで眠る
+  void loop() {
+    uint32_t started = clock_.micros();
+    run(clock_.millis());
+    busyMicros_ += clock_.micros() - started;
+    loops_++;
+    uint32_t wait = untilNext(clock_.millis());
+    if (wait > 0) {
+      waker_.sleep(wait);
+    }
+  }
+
+  // 締め切りから実際に実行するまでの遅れ（ms）を記録する（nullptrで記録しない）
+  void setLatencyHistogram(LatencyHistogram* histogram) { lateness_ = histogram; }
+
+  size_t size() const { return count_; }
+  uint32_t runs() const { return runs_; }        // 実行したタスクの延べ数
+  uint32_t skipped() const { return skipped_; }  // 1周期以上遅れた定期タスク
+  // loop() の回数と、そのうちタスクを実行していた時間の合計（us、眠っていた時間は含まない）
+  // 差分を取って loop() のタスクの負荷に使う（power_plan.h）
+  uint32_t loops() const { return loops_; }
+  uint32_t busyMicros() const { return busyMicros_; }
+
+ private:
+  static_assert(N <= 32, "TaskScheduler supports at most 32 tasks");
+
+  struct Entry {
+    SchedulerTask task;
+    uint32_t period;  // 0なら一度だけ
+    uint32_t due;
+    bool armed;
+  };
+
+  HalClock& clock_;
+  HalWaker& waker_;
+  Entry tasks_[N];
+  size_t count_;
+  std::atomic<uint32_t> pending_;  // signal() されたタスク（ビットごと）
+  uint32_t runs_;
+  uint32_t skipped_;
+  uint32_t loops_;
+  uint32_t busyMicros_;
+  LatencyHistogram* lateness_;
+};
@@ -0,0 +1,240 @@
+// 通過予測による測定周期の切り替え（include/adaptive_rate.h）のラップトレース駆動シミュレータ（ホスト用、pio run -e arrival_sim）
+//
+// 通過の開始時刻の列（ラップトレース）と、車体がセンサーの前にいる時間（30〜80ms）から、
+// 測定した時刻にレーン内かどうかを決め、receiverと同じ PassageDetector で数える。測定の周期を次の方式で比べる:
+//
+//   fixed     一定周期（--period-us、receiver の SAMPLE_PERIOD_US）
+//   floor     一定周期（下限の周期 --floor-us のまま）
+//   adaptive  AdaptiveSampleRate（予測の幅の中は --fast-us、それ以外は --floor-us）
+//
+// 方式ごとに、取りこぼした通過・1秒あたりの測定回数・検出の遅れ（通過の開始から最初にレーン内と
+// 測定するまで、us）・予測が当たった通過の数を出力する。
+// adaptive が通過を1つも取りこぼさず、fixed より測定回数が少なく、検出の遅れの中央値が fixed より
+// 短くなければ終了コード1
+//
+// 使い方:
+//   # 合成のレース（1ヒート最大20周、ヒートの間は30〜90秒）を100ヒート
+//   program --heats 100 --seed 1
+//   # 記録した通過時刻（1行1件、ms。detector_sim の --write-truth と同じ形式）で評価
+//   program --truth truth.txt
+//   # 周期を変える（us）
+//   program --period-us 20000 --fast-us 10000 --floor-us 25000
+//
+// 合成のレースは、ヒートごとにラップタイムの平均（3〜6秒）を決め、周ごとに2%のばらつき、
+// 5%の周は10〜40%遅く（接触・減速）、3%の周はコースアウトして1〜2周後に戻る（その間は通過しない）、
+// 2%の周でリタイア（ヒートの残りは通過しない）とする
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <random>
+#include <vector>
+
+#include "adaptive_rate.h"
+#include "latency_histogram.h"
+#include "passage_detector.h"
+
+static const uint8_t BASELINE_MM = 120;
+static const uint8_t IN_LANE_MM = 50;
+
+struct Passage {
+  uint32_t start;  // ms
+  uint32_t end;
+};
+
+struct SimResult {
+  uint32_t samples = 0;
+  uint32_t fastSamples = 0;
+  uint32_t caught = 0;
+  uint32_t missed = 0;
+  uint32_t hits = 0;
+  uint32_t misses = 0;
+  double seconds = 0;
+  LatencyHistogram delay;  // 通過の開始から検出まで（us）
+};
+
+static void generateRace(uint32_t heats, uint32_t seed, std::vector<uint32_t>& starts) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  std::normal_distribution<double> jitter(0.0, 0.02);
+  uint32_t t = 5000;
+  for (uint32_t heat = 0; heat < heats; heat++) {
+    double lapMean = 3000 + unit(rng) * 3000;
+    for (int lap = 0; lap < 20; lap++) {
+      double lapMs = lapMean * (1 + jitter(rng));
+      double roll = unit(rng);
+      if (roll < 0.02) {
+        break;  // リタイア
+      }
+      if (roll < 0.05) {
+        lapMs += lapMean * (1 + (int)(unit(rng) * 2));  // コースアウトして1〜2周後に戻る
+      } else if (roll < 0.10) {
+        lapMs *= 1.1 + unit(rng) * 0.3;  // 減速
+      }
+      t += (uint32_t)lapMs;
+      starts.push_back(t);
+    }
+    t += 30000 + (uint32_t)(unit(rng) * 60000);
+  }
+}
+
+static bool loadStarts(const char* path, std::vector<uint32_t>& starts) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  unsigned long time;
+  char line[64];
+  while (fgets(line, sizeof(line), file)) {
+    if (sscanf(line, "%lu", &time) == 1) {
+      starts.push_back((uint32_t)time);
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+// 測定のたびに nextPeriod(時刻ms, 判定結果) で次の測定までの周期（us）を決めて、トレースの終わりまで測る
+template <typename NextPeriod>
+static void simulate(const std::vector<Passage>& passages, const PassageDetectorConfig& config,
+                     NextPeriod nextPeriod, SimResult& result) {
+  PassageDetector detector(config);
+  detector.setBaseline(BASELINE_MM);
+  std::vector<bool> caught(passages.size(), false);
+  uint64_t endUs = ((uint64_t)passages.back().end + 1000) * 1000;
+  size_t next = 0;  // 終わっていない最初の通過
+  for (uint64_t nowUs = 0; nowUs < endUs;) {
+    uint32_t now = (uint32_t)(nowUs / 1000);
+    while (next < passages.size() && passages[next].end <= now) {
+      next++;
+    }
+    bool inLane = next < passages.size() && passages[next].start <= now;
+    PassageResult passage = detector.update(now, inLane ? IN_LANE_MM : BASELINE_MM, 0);
+    if (passage == PASSAGE_COUNTED && inLane && !caught[next]) {
+      caught[next] = true;
+      result.caught++;
+      result.delay.record((uint32_t)(nowUs - (uint64_t)passages[next].start * 1000));
+    }
+    result.samples++;
+    nowUs += nextPeriod(now, passage);
+  }
+  result.missed = (uint32_t)passages.size() - result.caught;
+  result.seconds = endUs / 1e6;
+}
+
+static void report(const char* name, const SimResult& result, uint32_t passages) {
+  char delay[96];
+  result.delay.format(delay, sizeof(delay), "delay", "us");
+  printf("%-9s caught=%lu/%lu missed=%lu samples/s=%.1f fast=%.1f%% hits=%lu misses=%lu %s\n", name,
+         (unsigned long)result.caught, (unsigned long)passages, (unsigned long)result.missed,
+         result.samples / result.seconds, result.samples ? 100.0 * result.fastSamples / result.samples : 0.0,
+         (unsigned long)result.hits, (unsigned long)result.misses, delay);
+}
+
+static void usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--heats N] [--seed S] [--truth FILE] [--period-us US] [--fast-us US] [--floor-us US] "
+          "[--ignore MS]\n",
+          program);
+}
+
+int main(int argc, char** argv) {
+  uint32_t heats = 100;
+  uint32_t seed = 1;
+  const char* truthPath = nullptr;
+  uint32_t periodUs = 20000;
+  AdaptiveRateConfig rateConfig;
+  PassageDetectorConfig detectorConfig;
+  detectorConfig.ignoreMs = 1000;  // ラップタイム（3秒以上）より短く
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      usage(argv[0]);
+      return 2;
+    }
+    if (strcmp(arg, "--heats") == 0) {
+      heats = (uint32_t)strtoul(value, nullptr, 10);
+    } else if (strcmp(arg, "--seed") == 0) {
+      seed = (uint32_t)strtoul(value, nullptr, 10);
+    } else if (strcmp(arg, "--truth") == 0) {
+      truthPath = value;
+    } else if (strcmp(arg, "--period-us") == 0) {
+      periodUs = (uint32_t)strtoul(value, nullptr, 10);
+    } else if (strcmp(arg, "--fast-us") == 0) {
+      rateConfig.fastPeriodUs = (uint32_t)strtoul(value, nullptr, 10);
+    } else if (strcmp(arg, "--floor-us") == 0) {
+      rateConfig.floorPeriodUs = (uint32_t)strtoul(value, nullptr, 10);
+    } else if (strcmp(arg, "--ignore") == 0) {
+      detectorConfig.ignoreMs = (uint32_t)strtoul(value, nullptr, 10);
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+    i++;
+  }
+  if (periodUs == 0 || rateConfig.fastPeriodUs == 0 || rateConfig.floorPeriodUs == 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::vector<uint32_t> starts;
+  if (truthPath) {
+    if (!loadStarts(truthPath, starts)) {
+      return 2;
+    }
+  } else {
+    generateRace(heats, seed, starts);
+  }
+  if (starts.empty()) {
+    fprintf(stderr, "no passages\n");
+    return 2;
+  }
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<uint32_t> dwell(30, 80);
+  std::vector<Passage> passages;
+  for (uint32_t start : starts) {
+    passages.push_back({start, start + dwell(rng)});
+  }
+  uint32_t total = (uint32_t)passages.size();
+  printf("passages=%lu span=%.0fs period=%luus fast=%luus floor=%luus ignore=%lums\n", (unsigned long)total,
+         passages.back().end / 1000.0, (unsigned long)periodUs, (unsigned long)rateConfig.fastPeriodUs,
+         (unsigned long)rateConfig.floorPeriodUs, (unsigned long)detectorConfig.ignoreMs);
+
+  SimResult fixed;
+  simulate(passages, detectorConfig, [&](uint32_t, PassageResult) { return periodUs; }, fixed);
+  report("fixed", fixed, total);
+
+  SimResult floor;
+  simulate(passages, detectorConfig, [&](uint32_t, PassageResult) { return rateConfig.floorPeriodUs; }, floor);
+  report("floor", floor, total);
+
+  SimResult adaptive;
+  AdaptiveSampleRate rate(rateConfig);
+  AdaptiveRateStats rateStats;
+  simulate(passages, detectorConfig,
+           [&](uint32_t now, PassageResult passage) {
+             AdaptiveRateStep step = rate.update(now, passage);
+             rateStats.record(step);
+             return step.periodUs;
+           },
+           adaptive);
+  adaptive.fastSamples = rateStats.fastSamples();
+  adaptive.hits = rateStats.hits();
+  adaptive.misses = rateStats.misses();
+  report("adaptive", adaptive, total);
+  char line[128];
+  rateStats.format(line, sizeof(line));
+  printf("%s\n", line);
+
+  bool ok = adaptive.missed == 0 && adaptive.samples < fixed.samples &&
+            adaptive.delay.percentile(50) < fixed.delay.percentile(50);
+  printf("RESULT %s (adaptive samples %.0f%% of fixed, delay p50 %luus vs %luus, hits %lu/%lu)\n", ok ? "OK" : "NG",
+         100.0 * adaptive.samples / fixed.samples, (unsigned long)adaptive.delay.percentile(50),
+         (unsigned long)fixed.delay.percentile(50), (unsigned long)adaptive.hits,
+         (unsigned long)(adaptive.hits + adaptive.misses));
+  return ok ? 0 : 1;
+}
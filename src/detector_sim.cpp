@@ -0,0 +1,369 @@
+// 通過検知のトレース駆動シミュレータ（ホスト用、pio run -e detector_sim）
+//
+// receiverと同じ PassageDetector に距離トレースを仮想時間で流し込み、
+// 正解ラベルに対する適合率（precision）・再現率（recall）を閾値の組み合わせごとに出力する。
+//
+// 使い方:
+//   # 合成トレース（100Hz・2時間）で閾値と重複防止時間をスイープ
+//   program --synthetic 2 --threshold 4:20:2 --ignore 500:4000:500
+//   # 記録したトレース（sample_decoderのCSV）と正解時刻（1行1件、ms）で評価
+//   program --trace samples.csv --truth truth.txt --threshold 10 --ignore 3000
+//   # 合成トレースをファイルに書き出す
+//   program --synthetic 1 --write-trace synth.csv --write-truth synth_truth.txt
+//
+// 正解との照合: 正解時刻から -tolerance〜+tolerance ms 以内の最初のカウントを正検出とする
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "passage_detector.h"
+#include "receiver_app.h"
+
+struct TraceSample {
+  uint32_t time;
+  uint8_t range;
+  uint8_t status;
+};
+
+struct SweepRange {
+  int from;
+  int to;
+  int step;
+};
+
+struct SweepResult {
+  int threshold;
+  int ignoreMs;
+  int counted;
+  int truePositives;
+  int falsePositives;
+  int falseNegatives;
+  double precision;
+  double recall;
+  double f1;
+};
+
+// "a:b:step" または単一の値
+static bool parseSweep(const char* text, SweepRange& range) {
+  int n = sscanf(text, "%d:%d:%d", &range.from, &range.to, &range.step);
+  if (n == 1) {
+    range.to = range.from;
+    range.step = 1;
+    return true;
+  }
+  return n == 3 && range.step > 0 && range.to >= range.from;
+}
+
+// sample_decoder のCSV（block,time_ms,range_mm,status）または time_ms,range_mm,status を読む
+static bool loadTrace(const char* path, std::vector<TraceSample>& trace) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  char line[128];
+  while (fgets(line, sizeof(line), file)) {
+    unsigned long a, b, c, d;
+    int n = sscanf(line, "%lu,%lu,%lu,%lu", &a, &b, &c, &d);
+    if (n == 4) {
+      trace.push_back({(uint32_t)b, (uint8_t)c, (uint8_t)d});
+    } else if (n == 3) {
+      trace.push_back({(uint32_t)a, (uint8_t)b, (uint8_t)c});
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+static bool loadTruth(const char* path, std::vector<uint32_t>& truth) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  unsigned long time;
+  char line[64];
+  while (fgets(line, sizeof(line), file)) {
+    if (sscanf(line, "%lu", &time) == 1) {
+      truth.push_back((uint32_t)time);
+    }
+  }
+  fclose(file);
+  std::sort(truth.begin(), truth.end());
+  return true;
+}
+
+// 合成トレース: ベースライン120mm、ノイズ、測定エラー、通過（30〜80ms）、
+// 通過直後の跳ね返り、単発のスパイクを含む。正解は通過開始時刻
+static void generateTrace(double hours, int rateHz, uint32_t seed,
+                          std::vector<TraceSample>& trace, std::vector<uint32_t>& truth) {
+  std::mt19937 rng(seed);
+  std::normal_distribution<double> noise(0.0, 2.0);
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  const double baseline = 120.0;
+  const uint32_t period = 1000 / rateHz;
+  const uint32_t endTime = (uint32_t)(hours * 3600.0 * 1000.0);
+
+  // 通過イベント（開始時刻・終了時刻・距離）
+  struct Dip {
+    uint32_t start;
+    uint32_t end;
+    double range;
+  };
+  std::vector<Dip> dips;
+  uint32_t t = 5000;  // 最初の5秒は校正用に空ける
+  while (t < endTime) {
+    t += 1500 + (uint32_t)(unit(rng) * 4500);  // ラップ間隔 1.5〜6秒
+    uint32_t dwell = 30 + (uint32_t)(unit(rng) * 50);
+    dips.push_back({t, t + dwell, 30 + unit(rng) * 40});
+    truth.push_back(t);
+    if (unit(rng) < 0.2) {
+      // 跳ね返り（ガイドローラーの接触など）で100〜600ms後に短く再接近
+      uint32_t bounce = t + dwell + 100 + (uint32_t)(unit(rng) * 500);
+      dips.push_back({bounce, bounce + 20, 80 + unit(rng) * 30});
+    }
+  }
+  // 単発スパイク（1分に1回程度、5〜20mmの誤差）
+  for (uint32_t s = 10000; s < endTime; s += 1000 + (uint32_t)(unit(rng) * 118000)) {
+    dips.push_back({s, s + period, baseline - 5 - unit(rng) * 15});
+  }
+  std::sort(dips.begin(), dips.end(), [](const Dip& a, const Dip& b) { return a.start < b.start; });
+
+  size_t next = 0;
+  std::vector<Dip> active;
+  for (uint32_t now = 0; now < endTime; now += period + (unit(rng) < 0.1 ? 1 : 0)) {
+    while (next < dips.size() && dips[next].start <= now) {
+      active.push_back(dips[next++]);
+    }
+    double range = baseline;
+    for (size_t i = 0; i < active.size();) {
+      if (active[i].end < now) {
+        active[i] = active.back();
+        active.pop_back();
+        continue;
+      }
+      range = std::min(range, active[i].range);
+      i++;
+    }
+    range += noise(rng);
+    uint8_t status = unit(rng) < 0.005 ? 11 : 0;  // 0.5%は測定エラー
+    trace.push_back({now, (uint8_t)std::max(0.0, std::min(255.0, round(range))), status});
+  }
+}
+
+// 1組のパラメータでトレース全体を流す
+static SweepResult evaluate(const std::vector<TraceSample>& trace, const std::vector<uint32_t>& truth,
+                            int threshold, int ignoreMs, int baseline, uint32_t tolerance,
+                            std::vector<uint32_t>& counts) {
+  PassageDetectorConfig config;
+  config.threshold = threshold;
+  config.ignoreMs = ignoreMs;
+  PassageDetector detector(config);
+  counts.clear();
+
+  // ベースライン: 指定がなければファームウェアと同じく先頭の測定で校正
+  size_t start = 0;
+  if (baseline > 0) {
+    detector.setBaseline(baseline);
+  } else {
+    uint32_t total = 0;
+    int valid = 0;
+    int measurements = ReceiverApp::CALIBRATION_MEASUREMENTS;
+    for (; start < trace.size() && start < (size_t)measurements; start++) {
+      if (trace[start].status == 0) {
+        total += trace[start].range;
+        valid++;
+      }
+    }
+    detector.calibrate(total, valid, measurements);
+  }
+
+  uint32_t previous = 0;
+  for (size_t i = start; i < trace.size(); i++) {
+    const TraceSample& s = trace[i];
+    if (s.time < previous) {
+      // 時刻の巻き戻り（再起動）: 検知状態をリセット
+      int currentBaseline = detector.baseline();
+      detector = PassageDetector(config);
+      detector.setBaseline(currentBaseline);
+    }
+    previous = s.time;
+    if (detector.update(s.time, s.range, s.status) == PASSAGE_COUNTED) {
+      counts.push_back(s.time);
+    }
+  }
+
+  // 正解と照合（時刻順に貪欲に対応付け）
+  SweepResult result = {threshold, ignoreMs, (int)counts.size(), 0, 0, 0, 0, 0, 0};
+  size_t c = 0;
+  for (size_t i = 0; i < truth.size(); i++) {
+    while (c < counts.size() && counts[c] + tolerance < truth[i]) {
+      result.falsePositives++;
+      c++;
+    }
+    if (c < counts.size() && counts[c] <= truth[i] + tolerance) {
+      result.truePositives++;
+      c++;
+    } else {
+      result.falseNegatives++;
+    }
+  }
+  result.falsePositives += (int)(counts.size() - c);
+  result.precision = result.counted > 0 ? (double)result.truePositives / result.counted : 0.0;
+  result.recall = truth.empty() ? 0.0 : (double)result.truePositives / truth.size();
+  result.f1 = result.precision + result.recall > 0
+                  ? 2 * result.precision * result.recall / (result.precision + result.recall)
+                  : 0.0;
+  return result;
+}
+
+static void printResult(const SweepResult& r, const char* note) {
+  printf("%9d %9d %8d %8d %6d %6d %9.4f %9.4f %9.4f%s\n", r.threshold, r.ignoreMs, r.counted,
+         r.truePositives, r.falsePositives, r.falseNegatives, r.precision, r.recall, r.f1, note);
+}
+
+static void usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s (--synthetic HOURS [--rate HZ] [--seed N] | --trace CSV --truth FILE)\n"
+          "          [--threshold A[:B:STEP]] [--ignore A[:B:STEP]] [--tolerance MS] [--baseline MM]\n"
+          "          [--top N] [--write-trace CSV] [--write-truth FILE]\n",
+          program);
+}
+
+int main(int argc, char** argv) {
+  double syntheticHours = 0;
+  int rateHz = 100;
+  uint32_t seed = 1;
+  const char* tracePath = nullptr;
+  const char* truthPath = nullptr;
+  const char* writeTracePath = nullptr;
+  const char* writeTruthPath = nullptr;
+  SweepRange thresholds = {PassageDetectorConfig().threshold, PassageDetectorConfig().threshold, 1};
+  SweepRange ignores = {(int)PassageDetectorConfig().ignoreMs, (int)PassageDetectorConfig().ignoreMs, 1};
+  uint32_t tolerance = 250;
+  int baseline = 0;
+  int top = 10;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    bool ok = value != nullptr;
+    if (strcmp(arg, "--synthetic") == 0 && ok) {
+      syntheticHours = atof(value);
+    } else if (strcmp(arg, "--rate") == 0 && ok) {
+      rateHz = atoi(value);
+    } else if (strcmp(arg, "--seed") == 0 && ok) {
+      seed = (uint32_t)strtoul(value, nullptr, 10);
+    } else if (strcmp(arg, "--trace") == 0 && ok) {
+      tracePath = value;
+    } else if (strcmp(arg, "--truth") == 0 && ok) {
+      truthPath = value;
+    } else if (strcmp(arg, "--threshold") == 0 && ok) {
+      ok = parseSweep(value, thresholds);
+    } else if (strcmp(arg, "--ignore") == 0 && ok) {
+      ok = parseSweep(value, ignores);
+    } else if (strcmp(arg, "--tolerance") == 0 && ok) {
+      tolerance = (uint32_t)atoi(value);
+    } else if (strcmp(arg, "--baseline") == 0 && ok) {
+      baseline = atoi(value);
+    } else if (strcmp(arg, "--top") == 0 && ok) {
+      top = atoi(value);
+    } else if (strcmp(arg, "--write-trace") == 0 && ok) {
+      writeTracePath = value;
+    } else if (strcmp(arg, "--write-truth") == 0 && ok) {
+      writeTruthPath = value;
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      usage(argv[0]);
+      return 2;
+    }
+    i++;
+  }
+
+  std::vector<TraceSample> trace;
+  std::vector<uint32_t> truth;
+  auto loadStart = std::chrono::steady_clock::now();
+  if (syntheticHours > 0) {
+    if (rateHz <= 0 || rateHz > 1000) {
+      usage(argv[0]);
+      return 2;
+    }
+    generateTrace(syntheticHours, rateHz, seed, trace, truth);
+  } else if (tracePath && truthPath) {
+    if (!loadTrace(tracePath, trace) || !loadTruth(truthPath, truth)) {
+      return 1;
+    }
+  } else {
+    usage(argv[0]);
+    return 2;
+  }
+  double loadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loadStart).count();
+
+  if (writeTracePath) {
+    FILE* file = fopen(writeTracePath, "w");
+    if (!file) {
+      perror(writeTracePath);
+      return 1;
+    }
+    fprintf(file, "time_ms,range_mm,status\n");
+    for (const TraceSample& s : trace) {
+      fprintf(file, "%lu,%u,%u\n", (unsigned long)s.time, s.range, s.status);
+    }
+    fclose(file);
+  }
+  if (writeTruthPath) {
+    FILE* file = fopen(writeTruthPath, "w");
+    if (!file) {
+      perror(writeTruthPath);
+      return 1;
+    }
+    for (uint32_t t : truth) {
+      fprintf(file, "%lu\n", (unsigned long)t);
+    }
+    fclose(file);
+  }
+
+  double span = trace.empty() ? 0 : (trace.back().time - trace.front().time) / 1000.0;
+  printf("trace: %zu samples, %.1f s of data, %zu labelled passages (loaded in %.2f s)\n",
+         trace.size(), span, truth.size(), loadSeconds);
+
+  // スイープ
+  std::vector<SweepResult> results;
+  std::vector<uint32_t> counts;
+  auto runStart = std::chrono::steady_clock::now();
+  for (int threshold = thresholds.from; threshold <= thresholds.to; threshold += thresholds.step) {
+    for (int ignoreMs = ignores.from; ignoreMs <= ignores.to; ignoreMs += ignores.step) {
+      results.push_back(evaluate(trace, truth, threshold, ignoreMs, baseline, tolerance, counts));
+    }
+  }
+  double runSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count();
+
+  // 現在のファームウェア設定の結果も別に出す
+  const PassageDetectorConfig defaults;
+  SweepResult current = evaluate(trace, truth, defaults.threshold, defaults.ignoreMs, baseline, tolerance, counts);
+
+  std::stable_sort(results.begin(), results.end(),
+                   [](const SweepResult& a, const SweepResult& b) { return a.f1 > b.f1; });
+  printf("%9s %9s %8s %8s %6s %6s %9s %9s %9s\n", "threshold", "ignore_ms", "counted", "tp", "fp", "fn",
+         "precision", "recall", "f1");
+  for (size_t i = 0; i < results.size() && (int)i < top; i++) {
+    printResult(results[i], "");
+  }
+  printResult(current, "  <- firmware default");
+
+  double processed = (double)trace.size() * results.size();
+  printf("%zu parameter sets in %.2f s (%.1f M samples/s, %.0fx real time per set)\n", results.size(),
+         runSeconds, runSeconds > 0 ? processed / runSeconds / 1e6 : 0.0,
+         runSeconds > 0 ? span * results.size() / runSeconds : 0.0);
+  return 0;
+}
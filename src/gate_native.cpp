@@ -0,0 +1,589 @@
+// ゲートサーバー・クライアントのロジックをフェイクの通知先と仮想時間で動かすホスト実行（pio run -e gate_native）
+//
+// 使い方:
+//   .pio/build/gate_native/program
+//
+// tanaka_gate_server の配信（GateEventLog に積んだイベントを GateClientTable::fanOut() で
+// MTUまで詰めて通知する）を FakeNotifySink で受け、通知の大きさ・詰め方、ログが満杯になって
+// 送れなかったイベントの数え方、送信に失敗し続けるクライアントがいるときの配信を確認する。
+// クライアント側（parseGateBatch → GateInbox → GateStreamTracker）まで通したときに出力される行と、
+// 欠番・受信キューの溢れから SINCE要求で回復できること、レイテンシのヒストグラムと
+// ノードをまたいだ経過時間の合計も確かめる。どれかが期待と違えば終了コード1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "gate_client_table.h"
+#include "gate_event_log.h"
+#include "gate_event_receiver.h"
+#include "hal_fake.h"
+#include "latency_histogram.h"
+
+static const uint32_t EPOCH = 0x1A2B3C4D;
+
+struct ParsedEvent {
+  uint32_t seq;
+  std::string data;
+  uint16_t age;
+};
+
+// 通知のペイロードをクライアントと同じ parseGateBatch() で行に分ける
+static std::vector<ParsedEvent> parseEvents(const std::string& payload) {
+  std::vector<ParsedEvent> events;
+  parseGateBatch(payload.data(), payload.length(), [&](uint32_t seq, const char* data, size_t length, uint16_t age) {
+    events.push_back({seq, std::string(data, length), age});
+  });
+  return events;
+}
+
+// 最初の行（改行を含む）の長さ
+static size_t firstLineLength(const std::string& payload) {
+  size_t end = payload.find('\n');
+  return end == std::string::npos ? payload.length() : end + 1;
+}
+
+// MTU 23（ペイロード20バイト）での詰め方:
+//   "1:a\n"〜"5:a\n"（20バイト）はちょうど1通知に収まり、6件目からは次の通知へ回る
+//   2件は入らない長さ（11バイト）のイベントは1件ずつの通知に分かれる
+//   空の通知にも入らないイベント（16文字+経過時間）は切り詰めてちょうど20バイトで送る
+static bool checkPacking() {
+  GateEventLog<64> log;
+  GateClientTable<1> clients;
+  FakeNotifySink sink;
+  clients.setEpoch(EPOCH);
+  clients.connect(1, log.nextSeq());
+  clients.setSubscribed(1, true);
+  clients.fanOut(log, sink, 0);  // 最初はエポック行だけ
+  for (int i = 0; i < 7; i++) {
+    log.append(0, "a", 1);
+  }
+  clients.fanOut(log, sink, 0);
+  clients.fanOut(log, sink, 0);
+  log.append(0, "abcdefgh", 8);
+  log.append(0, "abcdefgh", 8);
+  clients.fanOut(log, sink, 0);
+  clients.fanOut(log, sink, 0);
+  log.append(0, "abcdefghijklmnop", 16, 85);
+  clients.fanOut(log, sink, 0);
+  clients.fanOut(log, sink, 0);  // 送るものがなければ通知しない
+
+  static const char* const expected[] = {
+      "#1A2B3C4D\n",
+      "1:a\n2:a\n3:a\n4:a\n5:a\n",
+      "6:a\n7:a\n",
+      "8:abcdefgh\n",
+      "9:abcdefgh\n",
+      "10:abcdefghijklmnop\n",
+  };
+  const size_t count = sizeof(expected) / sizeof(expected[0]);
+  bool ok = sink.notifications.size() == count;
+  for (size_t i = 0; ok && i < count; i++) {
+    ok = sink.notifications[i].payload == expected[i];
+  }
+  ok = ok && sink.notifications[1].payload.length() == 23 - GATE_ATT_HEADER_SIZE &&
+       sink.notifications[5].payload.length() == 23 - GATE_ATT_HEADER_SIZE &&
+       clients.slot(0).sent == 10 && clients.slot(0).notifications == count;
+  printf("packing mtu=23 notifications=%zu sent=%lu %s\n", sink.notifications.size(),
+         (unsigned long)clients.slot(0).sent, ok ? "OK" : "NG");
+  return ok;
+}
+
+// いろいろなMTUで長さ・経過時間がまちまちのイベントを送り、
+//   通知がどれも MTU - 3（最大 GATE_BATCH_MAX）以下であること
+//   通知ごとに、次の通知の最初のイベントが入らないところまで詰めてあること
+//   つなげて読むと、追加したイベントが順番どおり欠けずに並ぶこと
+// を確かめる（切り詰めが起きないよう、イベント1行は24バイト以下にする）
+static bool checkPackingSweep() {
+  static const uint16_t mtus[] = {27, 64, 185, 247, 517};
+  const uint32_t events = 400;
+  bool ok = true;
+  for (uint16_t mtu : mtus) {
+    GateEventLog<512> log;
+    GateClientTable<1> clients;
+    FakeNotifySink sink;
+    clients.setEpoch(EPOCH);
+    clients.connect(1, log.nextSeq());
+    clients.setMtu(1, mtu);
+    clients.setSubscribed(1, true);
+    std::vector<ParsedEvent> appended;
+    uint32_t random = 12345;
+    for (uint32_t i = 0; i < events; i++) {
+      random = random * 1103515245 + 12345;
+      size_t length = 1 + (random >> 16) % GATE_EVENT_DATA_MAX;
+      std::string data(length, (char)('a' + i % 26));
+      uint16_t age = (random >> 8) % 4 == 0 ? GATE_AGE_UNKNOWN : (uint16_t)((random >> 4) % 100);
+      uint32_t seq = log.append(0, data.data(), data.length(), age);
+      appended.push_back({seq, data, age});
+    }
+    while (clients.fanOut(log, sink, 0) > 0) {  // 受信した時刻のまま送る（経過時間は変わらない）
+    }
+
+    size_t capacity = mtu - GATE_ATT_HEADER_SIZE < GATE_BATCH_MAX ? mtu - GATE_ATT_HEADER_SIZE : GATE_BATCH_MAX;
+    size_t largest = 0;
+    uint32_t loose = 0;  // 次の通知の最初のイベントが入る余地を残した通知
+    std::vector<ParsedEvent> received;
+    for (size_t i = 0; i < sink.notifications.size(); i++) {
+      const std::string& payload = sink.notifications[i].payload;
+      largest = payload.length() > largest ? payload.length() : largest;
+      if (i + 1 < sink.notifications.size() &&
+          payload.length() + firstLineLength(sink.notifications[i + 1].payload) <= capacity) {
+        loose++;
+      }
+      for (const ParsedEvent& ev : parseEvents(payload)) {
+        received.push_back(ev);
+      }
+    }
+    bool orderOk = received.size() == appended.size();
+    for (size_t i = 0; orderOk && i < received.size(); i++) {
+      orderOk = received[i].seq == appended[i].seq && received[i].data == appended[i].data &&
+                received[i].age == appended[i].age;
+    }
+    bool mtuOk = largest <= capacity && loose == 0 && orderOk;
+    printf("packing mtu=%u capacity=%zu notifications=%zu largest=%zu loose=%lu events=%zu/%lu %s\n", mtu, capacity,
+           sink.notifications.size(), largest, (unsigned long)loose, received.size(), (unsigned long)events,
+           mtuOk ? "OK" : "NG");
+    ok = mtuOk && ok;
+  }
+  return ok;
+}
+
+// 送信できない間に、ログ（8件）より多いイベントが溜まる場合の数え方:
+// 古いイベントから上書きされ、送れるようになったときに失われた件数が skipped に、
+// 送れなかった回数が congested に数えられ、skipped と sent を合わせると追加した件数になること
+static bool checkDropAccounting() {
+  GateEventLog<8> log;
+  GateClientTable<1> clients;
+  FakeNotifySink sink;
+  clients.setEpoch(EPOCH);
+  clients.connect(1, log.nextSeq());
+  clients.setMtu(1, 185);
+  clients.setSubscribed(1, true);
+  sink.failing.push_back(1);
+  for (uint32_t i = 0; i < 20; i++) {
+    log.append(i, "a", 1);
+    clients.fanOut(log, sink, i);
+  }
+  uint32_t cursor = 1;
+  char buffer[GATE_BATCH_MAX];
+  uint32_t packSkipped = 0;
+  log.packSince(cursor, buffer, sizeof(buffer), 20, &packSkipped);
+  sink.failing.clear();
+  while (clients.fanOut(log, sink, 20) > 0) {
+  }
+
+  std::vector<uint32_t> seqs;
+  for (const FakeNotifySink::Notification& notification : sink.notifications) {
+    for (const ParsedEvent& ev : parseEvents(notification.payload)) {
+      seqs.push_back(ev.seq);
+    }
+  }
+  const GateClientSlot& slot = clients.slot(0);
+  bool ok = slot.skipped == 12 && slot.sent == 8 && slot.congested == 20 && sink.failures == 20 &&
+            slot.skipped + slot.sent == log.appended() && packSkipped == 12 && log.size() == 8 &&
+            clients.backlog(slot, log) == 0 && seqs.size() == 8 && seqs.front() == 13 && seqs.back() == 20;
+  printf("drops log=%zu/%zu appended=%lu sent=%lu skipped=%lu congested=%lu %s\n", log.size(), log.capacity(),
+         (unsigned long)log.appended(), (unsigned long)slot.sent, (unsigned long)slot.skipped,
+         (unsigned long)slot.congested, ok ? "OK" : "NG");
+  return ok;
+}
+
+// 3台のうち1台（connId 2）が送信に失敗し続ける場合の fanOut():
+//   ラウンドごとに開始位置が1つずつずれ、毎ラウンド3台とも1回ずつ送信を試みること
+//   残りの2台は毎ラウンドその時点の最新イベントまで受け取り、backlog が0のままであること
+//   失敗している1台は位置が進まず、ログから消えた分が skipped、残りが backlog になること
+//   送れるようになると、残っているイベントを受け取って sent + skipped が追加した件数になること
+static bool checkStuckClient() {
+  const uint32_t rounds = 40;
+  GateEventLog<16> log;
+  GateClientTable<3> clients;
+  FakeNotifySink sink;
+  clients.setEpoch(EPOCH);
+  for (uint16_t connId = 1; connId <= 3; connId++) {
+    clients.connect(connId, log.nextSeq());
+    clients.setSubscribed(connId, true);
+  }
+  sink.failing.push_back(2);
+
+  bool rotated = true;
+  bool advanced = true;
+  for (uint32_t round = 0; round < rounds; round++) {
+    uint32_t seq = log.append(round, "a", 1);
+    size_t attempted = sink.attempts.size();
+    size_t delivered = sink.notifications.size();
+    clients.fanOut(log, sink, round);
+    rotated = rotated && sink.attempts.size() == attempted + 3 && sink.attempts[attempted] == round % 3 + 1;
+    advanced = advanced && sink.notifications.size() == delivered + 2;
+    for (size_t i = delivered; advanced && i < sink.notifications.size(); i++) {
+      std::vector<ParsedEvent> events = parseEvents(sink.notifications[i].payload);
+      advanced = !events.empty() && events.back().seq == seq;
+    }
+  }
+  const GateClientSlot& stuck = clients.slot(1);
+  bool stuckOk = stuck.sent == 0 && stuck.congested == rounds && stuck.skipped == rounds - log.capacity() &&
+                 clients.backlog(stuck, log) == log.capacity();
+  bool othersOk = true;
+  for (size_t index : {(size_t)0, (size_t)2}) {
+    const GateClientSlot& slot = clients.slot(index);
+    othersOk = othersOk && slot.sent == rounds && slot.notifications == rounds && slot.skipped == 0 &&
+               slot.congested == 0 && clients.backlog(slot, log) == 0;
+  }
+  uint32_t stuckBacklog = clients.backlog(stuck, log);
+  uint32_t stuckSkipped = stuck.skipped;
+
+  sink.failing.clear();
+  size_t delivered = sink.notifications.size();
+  while (clients.fanOut(log, sink, rounds) > 0) {
+  }
+  std::vector<uint32_t> seqs;
+  for (size_t i = delivered; i < sink.notifications.size(); i++) {
+    if (sink.notifications[i].connId == 2) {
+      for (const ParsedEvent& ev : parseEvents(sink.notifications[i].payload)) {
+        seqs.push_back(ev.seq);
+      }
+    }
+  }
+  bool recoveredOk = stuck.sent + stuck.skipped == log.appended() && clients.backlog(stuck, log) == 0 &&
+                     seqs.size() == log.capacity() && seqs.front() == log.oldestSeq() && seqs.back() == rounds;
+  bool ok = rotated && advanced && stuckOk && othersOk && recoveredOk;
+  printf("stuck client rounds=%lu rotated=%d advanced=%d backlog=%lu/%lu/%lu skipped=%lu recovered=%zu %s\n",
+         (unsigned long)rounds, rotated, advanced, (unsigned long)clients.backlog(clients.slot(0), log),
+         (unsigned long)stuckBacklog, (unsigned long)clients.backlog(clients.slot(2), log), (unsigned long)stuckSkipped,
+         seqs.size(), ok ? "OK" : "NG");
+  return ok;
+}
+
+// 100ms（仮想時間）の間に50件のイベントが続けて届く場合:
+// サーバーは1msごとに fanOut()、クライアントは通知を parseGateBatch() で GateInbox に積み、
+// 10msごとに GateStreamTracker を通して出力する。データが空のイベント（"5:"）も含めて
+// ちょうど50行が順番どおりに出力され、エポック行を除いて取りこぼしがないこと
+static bool checkBurst() {
+  const uint32_t events = 50;
+  GateEventLog<256> log;
+  GateClientTable<1> clients;
+  FakeNotifySink sink;
+  GateInbox<64> inbox;
+  GateStreamTracker stream;
+  clients.setEpoch(EPOCH);
+  clients.connect(1, log.nextSeq());
+  clients.setSubscribed(1, true);
+
+  std::vector<ParsedEvent> appended;
+  std::vector<GateEvent> output;
+  size_t delivered = 0;
+  uint32_t epochs = 0;
+  for (uint32_t now = 0; now <= 120; now++) {
+    if (now % 2 == 0 && appended.size() < events) {
+      uint32_t i = (uint32_t)appended.size() + 1;
+      std::string data = i % 5 == 0 ? "" : std::string(1 + i % 12, (char)('a' + i % 26));
+      uint16_t age = i % 5 == 3 ? (uint16_t)12 : GATE_AGE_UNKNOWN;
+      uint32_t seq = log.append(now, data.data(), data.length(), age);
+      appended.push_back({seq, data, age});
+    }
+    clients.fanOut(log, sink, now);
+    for (; delivered < sink.notifications.size(); delivered++) {
+      const std::string& payload = sink.notifications[delivered].payload;
+      parseGateBatch(
+          payload.data(), payload.length(),
+          [&](uint32_t seq, const char* data, size_t length, uint16_t age) { inbox.push(seq, data, length, now, age); },
+          [&](uint32_t epoch) { inbox.pushEpoch(epoch); });
+    }
+    if (now % 10 == 0) {
+      GateEvent ev;
+      while (inbox.pop(ev)) {
+        GateStreamTracker::Action action = stream.apply(ev);
+        if (action == GateStreamTracker::NEW_EPOCH) {
+          epochs++;
+        } else if (action == GateStreamTracker::FORWARD) {
+          output.push_back(ev);
+        }
+      }
+    }
+  }
+
+  bool ok = output.size() == events && epochs == 1 && stream.epoch() == EPOCH && inbox.overflows() == 0 &&
+            stream.filter().duplicates == 0 && stream.filter().gaps == 0 && stream.lastSeq() == events;
+  for (size_t i = 0; ok && i < output.size(); i++) {
+    ok = !output[i].isEpoch && output[i].seq == appended[i].seq &&
+         std::string(output[i].data, output[i].length) == appended[i].data;
+  }
+  printf("burst events=%lu notifications=%zu output=%zu epochs=%lu inbox_drop=%lu %s\n", (unsigned long)events,
+         sink.notifications.size(), output.size(), (unsigned long)epochs, (unsigned long)inbox.overflows(),
+         ok ? "OK" : "NG");
+  return ok;
+}
+
+// tanaka_gate_client の notifyCallback() / processInbox() と同じ受信側（SINCE要求はサーバーの表へ直接渡す）
+template <size_t InboxSize>
+struct GateClientModel {
+  GateInbox<InboxSize> inbox;
+  GateStreamTracker stream;
+  uint32_t overflowsSeen = 0;
+  std::vector<uint32_t> output;
+
+  void deliver(const std::string& payload, uint32_t now) {
+    parseGateBatch(
+        payload.data(), payload.length(),
+        [&](uint32_t seq, const char* data, size_t length, uint16_t age) { inbox.push(seq, data, length, now, age); },
+        [&](uint32_t epoch) { inbox.pushEpoch(epoch); });
+  }
+
+  template <size_t N, size_t MaxClients>
+  void process(uint32_t now, GateClientTable<MaxClients>& clients, uint16_t connId, const GateEventLog<N>& log) {
+    GateEvent ev;
+    while (inbox.pop(ev)) {
+      GateStreamTracker::Action action = stream.apply(ev);
+      if (action == GateStreamTracker::FORWARD) {
+        output.push_back(ev.seq);
+      } else if (action == GateStreamTracker::GAP || action == GateStreamTracker::CATCHING_UP) {
+        requestCatchUp(now, clients, connId, log);
+      }
+    }
+    if (inbox.overflows() != overflowsSeen) {
+      overflowsSeen = inbox.overflows();
+      requestCatchUp(now, clients, connId, log);
+    }
+    if (stream.catchingUp()) {  // 応答が届かなければ要求し直す（maintainConnection() と同じ）
+      requestCatchUp(now, clients, connId, log);
+    }
+  }
+
+  template <size_t N, size_t MaxClients>
+  void requestCatchUp(uint32_t now, GateClientTable<MaxClients>& clients, uint16_t connId,
+                      const GateEventLog<N>& log) {
+    if (stream.requestCatchUp(now)) {
+      clients.requestSince(connId, stream.epoch(), stream.lastSeq(), log);
+    }
+  }
+};
+
+// 欠番からの回復: サーバーは1msごとに1件追加して fanOut()、クライアントは1msごとに処理する
+//   lost     追加が続く間、10通に1通が届かない（通知の取りこぼし）
+//   overflow クライアントが50ms止まり、その間に受信キュー（16件）が溢れる
+//   epoch    10通に1通が届かず、最初の再送応答（エポック行で始まる通知）も届かない
+//            （CATCH_UP_TIMEOUT 後に要求し直す）
+// どれも SINCE要求で送り直され、全イベントが欠けず重複せず順番どおりに出力されること
+// （回復できない欠番 gaps が0であること）を確かめる
+static bool checkGapRecovery() {
+  struct Scenario {
+    const char* name;
+    uint32_t loseEvery;  // n通に1通を届けない（0なら届ける）
+    bool loseEpoch;      // 最初の再送応答を届けない
+    uint32_t stallFrom;  // クライアントが止まる時刻（50ms間、0なら止まらない）
+  };
+  static const Scenario scenarios[] = {
+      {"lost", 10, false, 0},
+      {"overflow", 0, false, 100},
+      {"epoch", 10, true, 0},
+  };
+  const uint32_t events = 200;
+  bool ok = true;
+  for (const Scenario& scenario : scenarios) {
+    GateEventLog<256> log;
+    GateClientTable<1> clients;
+    FakeNotifySink sink;
+    GateClientModel<16> client;
+    clients.setEpoch(EPOCH);
+    clients.connect(1, log.nextSeq());
+    clients.setSubscribed(1, true);
+    size_t delivered = 0;
+    bool epochLost = false;
+    uint32_t finishedAt = 0;
+    for (uint32_t now = 0; now < 5000; now++) {
+      if (now < events) {
+        log.append(now, "a", 1);
+      }
+      clients.fanOut(log, sink, now);
+      for (; delivered < sink.notifications.size(); delivered++) {
+        const std::string& payload = sink.notifications[delivered].payload;
+        bool epochLine = payload[0] == '#';
+        if (scenario.loseEpoch && !epochLost && delivered > 0 && epochLine) {
+          epochLost = true;
+          continue;
+        }
+        // 最後のイベントの通知が届かなければ次のイベントまで欠番に気づけないため、落とすのは追加が続く間だけ
+        if (scenario.loseEvery != 0 && delivered % scenario.loseEvery == scenario.loseEvery - 1 && !epochLine &&
+            now + 1 < events) {
+          continue;
+        }
+        client.deliver(payload, now);
+      }
+      if (scenario.stallFrom == 0 || now < scenario.stallFrom || now >= scenario.stallFrom + 50) {
+        client.process(now, clients, 1, log);
+      }
+      if (finishedAt == 0 && client.output.size() == events) {
+        finishedAt = now;
+      }
+    }
+    bool orderOk = client.output.size() == events;
+    for (size_t i = 0; orderOk && i < client.output.size(); i++) {
+      orderOk = client.output[i] == i + 1;
+    }
+    bool scenarioOk = orderOk && client.stream.catchUps() > 0 && client.stream.filter().gaps == 0 &&
+                      !client.stream.catchingUp() && (!scenario.loseEpoch || epochLost) &&
+                      (scenario.stallFrom == 0 || client.inbox.overflows() > 0);
+    printf("gap recovery %-8s events=%zu/%lu catch_ups=%lu inbox_drop=%lu gaps=%lu done_at=%lums %s\n",
+           scenario.name, client.output.size(), (unsigned long)events, (unsigned long)client.stream.catchUps(),
+           (unsigned long)client.inbox.overflows(), (unsigned long)client.stream.filter().gaps,
+           (unsigned long)finishedAt, scenarioOk ? "OK" : "NG");
+    ok = scenarioOk && ok;
+  }
+  return ok;
+}
+
+// 要求した続きがサーバーのログから既に消えていた場合: 応答のエポック行の後の欠番は
+// 回復できないものとして受け入れ（gaps に数える）、要求を繰り返さないこと
+static bool checkUnrecoverableGap() {
+  GateEventLog<8> log;
+  GateClientTable<1> clients;
+  FakeNotifySink sink;
+  GateClientModel<64> client;
+  clients.setEpoch(EPOCH);
+  clients.connect(1, log.nextSeq());
+  clients.setSubscribed(1, true);
+  log.append(0, "a", 1);
+  clients.fanOut(log, sink, 0);
+  for (uint32_t i = 1; i <= 20; i++) {  // 2〜21 は届かないまま、ログから8件を残して消える
+    log.append(i, "a", 1);
+    clients.fanOut(log, sink, i);
+  }
+  log.append(21, "a", 1);
+  size_t delivered = 0;
+  bool lossy = true;  // 22 が届くまで、最初の通知以外は届かない
+  for (uint32_t now = 22; now < 100; now++) {
+    clients.fanOut(log, sink, now);
+    for (; delivered < sink.notifications.size(); delivered++) {
+      const std::string& payload = sink.notifications[delivered].payload;
+      lossy = lossy && parseEvents(payload).back().seq != 22;
+      if (delivered == 0 || !lossy) {
+        client.deliver(payload, now);
+      }
+    }
+    client.process(now, clients, 1, log);
+  }
+  bool ok = client.stream.catchUps() == 1 && client.stream.filter().gaps == 13 && client.output.size() == 9 &&
+            client.output.front() == 1 && client.output[1] == 15 && client.output.back() == 22 &&
+            !client.stream.catchingUp();
+  printf("gap recovery expired events=%zu catch_ups=%lu gaps=%lu %s\n", client.output.size(),
+         (unsigned long)client.stream.catchUps(), (unsigned long)client.stream.filter().gaps, ok ? "OK" : "NG");
+  return ok;
+}
+
+// LatencyHistogram のパーセンタイル・最大値:
+//   16未満は値そのもの、それ以上は真のパーセンタイル以上・その1/8増し以下で、最大値を超えないこと
+//   バケットの上限値がちょうどバケットの境界になっていること
+static bool checkLatencyHistogram() {
+  bool ok = true;
+  LatencyHistogram small;
+  for (uint32_t value = 1; value <= 10; value++) {
+    small.record(value);
+  }
+  ok = ok && small.percentile(50) == 5 && small.percentile(95) == 10 && small.percentile(99) == 10 &&
+       small.max() == 10 && small.mean() == 5 && LatencyHistogram().percentile(50) == 0;
+
+  for (size_t i = 0; ok && i + 1 < LatencyHistogram::BUCKETS; i++) {
+    uint32_t upper = LatencyHistogram::bucketUpper(i);
+    ok = LatencyHistogram::bucketIndex(upper) == i && LatencyHistogram::bucketIndex(upper + 1) == i + 1;
+  }
+
+  static const uint32_t ranges[] = {15, 200, 5000, 70000};
+  static const uint8_t percentiles[] = {1, 50, 90, 95, 99, 100};
+  uint32_t random = 777;
+  for (uint32_t range : ranges) {
+    LatencyHistogram histogram;
+    std::vector<uint32_t> values;
+    for (int i = 0; i < 10000; i++) {
+      random = random * 1103515245 + 12345;
+      uint32_t value = (random >> 8) % (range + 1);
+      values.push_back(value);
+      histogram.record(value);
+    }
+    std::sort(values.begin(), values.end());
+    ok = ok && histogram.max() == values.back() && histogram.count() == values.size();
+    for (uint8_t p : percentiles) {
+      uint32_t exact = values[(values.size() * p + 99) / 100 - 1];
+      uint32_t reported = histogram.percentile(p);
+      bool pOk = exact < 16 ? reported == exact : reported >= exact && reported <= exact + exact / 8;
+      pOk = pOk && reported <= histogram.max();
+      if (!pOk) {
+        printf("  range=%lu p%u exact=%lu reported=%lu\n", (unsigned long)range, p, (unsigned long)exact,
+               (unsigned long)reported);
+      }
+      ok = pOk && ok;
+    }
+  }
+  printf("latency histogram percentiles %s\n", ok ? "OK" : "NG");
+  return ok;
+}
+
+// 経過時間の連鎖: transmitter の UART 行 "a:age" → server（ログに積んで通知）→ 中継（受信した経過時間で
+// もう一度ログに積んで通知）→ client（受信キューから出力）と渡したとき、出力時の経過時間が
+// 最初の経過時間と各ノードの滞留時間の合計になること。ノードごとに時計がずれていても変わらず、
+// 不明は不明のまま、合計が上限を超えると GATE_AGE_UNKNOWN - 1 で止まること
+// （ノード間の無線・UART の伝送時間は誰も計上しないので合計に含まれない）
+static bool checkAgeChain() {
+  struct Case {
+    const char* line;  // transmitter の UART 行
+    uint32_t serverResidence;
+    uint32_t relayResidence;
+    uint32_t clientResidence;
+    uint16_t expected;
+  };
+  static const Case cases[] = {
+      {"a:40", 3, 7, 11, 40 + 3 + 7 + 11},
+      {"s:0", 0, 0, 0, 0},
+      {"d", 3, 7, 11, GATE_AGE_UNKNOWN},
+      {"f:65000", 300, 200, 100, GATE_AGE_UNKNOWN - 1},
+  };
+  // 各ノードの時計（互いに無関係なずれ）
+  const uint32_t serverClock = 1000000;
+  const uint32_t relayClock = 0xFFFFFFFE;  // 滞留中に折り返す
+  const uint32_t clientClock = 42;
+  bool ok = true;
+  for (const Case& c : cases) {
+    GateEventLog<8> server;
+    uint16_t age;
+    size_t dataLength = splitGateAge(c.line, strlen(c.line), age);
+    server.append(serverClock, c.line, dataLength, age);
+    char out[GATE_BATCH_MAX];
+    uint32_t cursor = server.oldestSeq();
+    size_t length = server.packSince(cursor, out, sizeof(out), serverClock + c.serverResidence);
+
+    GateEventLog<8> relay;
+    parseGateBatch(out, length, [&](uint32_t, const char* data, size_t dataLength, uint16_t age) {
+      relay.append(relayClock, data, dataLength, age);
+    });
+    cursor = relay.oldestSeq();
+    length = relay.packSince(cursor, out, sizeof(out), relayClock + c.relayResidence);
+
+    GateInbox<4> inbox;
+    parseGateBatch(out, length, [&](uint32_t seq, const char* data, size_t dataLength, uint16_t age) {
+      inbox.push(seq, data, dataLength, clientClock, age);
+    });
+    GateEvent ev = GateEvent();
+    bool popped = inbox.pop(ev);
+    uint16_t reported = addGateAge(ev.age, clientClock + c.clientResidence - ev.timestamp);
+    bool caseOk = popped && reported == c.expected && ev.length == 1 && ev.data[0] == c.line[0];
+    printf("age chain %-8s server+%lu relay+%lu client+%lu -> %u %s\n", c.line, (unsigned long)c.serverResidence,
+           (unsigned long)c.relayResidence, (unsigned long)c.clientResidence, reported, caseOk ? "OK" : "NG");
+    ok = caseOk && ok;
+  }
+  return ok;
+}
+
+int main() {
+  bool ok = checkPacking();
+  ok = checkPackingSweep() && ok;
+  ok = checkDropAccounting() && ok;
+  ok = checkStuckClient() && ok;
+  ok = checkBurst() && ok;
+  ok = checkGapRecovery() && ok;
+  ok = checkUnrecoverableGap() && ok;
+  ok = checkLatencyHistogram() && ok;
+  ok = checkAgeChain() && ok;
+  return ok ? 0 : 1;
+}
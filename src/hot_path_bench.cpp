@@ -0,0 +1,675 @@
+// ファームウェアのホットパスのマイクロベンチマーク（ホストPCで実行、ESP32ツールチェーン不要）
+// サンプルごと・イベントごとに実行される処理を計測し、ns/op・allocs/op・bytes/op を出力する
+// 結果はCSVに保存でき、以前の結果と比べて回帰を検出できる
+//
+//   program                                   全ベンチマークを実行して表を出力
+//   program --out bench.csv                   結果をCSVに保存（コミットごとに保存して比較する）
+//   program --compare bench.csv               保存した結果と比較し、回帰があれば終了コード1
+//   program --filter gate --min-ms 500 --repeat 9
+//
+// ns/op は repeat 回の計測の中央値。allocs/op・bytes/op は operator new の呼び出し回数・確保量
+// （ファームウェアのホットパスは 0 であるべき。フェイクHALは記録用に確保するため使わない）
+// ns/op はマシンの負荷で変わるため、比較は同じマシンで取った結果どうしで行う
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "async_log.h"
+#include "count_relay.h"
+#include "gate_event_log.h"
+#include "gate_event_receiver.h"
+#include "hal.h"
+#include "latency_histogram.h"
+#include "metrics.h"
+#include "passage_detector.h"
+#include "receiver_app.h"
+#include "sample_codec.h"
+#include "spsc_queue.h"
+#include "task_scheduler.h"
+
+// ---- 確保の計数（このプログラム全体の operator new を置き換える） ----
+
+static uint64_t allocCount = 0;
+static uint64_t allocBytes = 0;
+
+void* operator new(size_t size) {
+  allocCount++;
+  allocBytes += size;
+  void* p = malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+// 計算結果を最適化で消させない
+template <typename T>
+inline void keep(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// ---- 記録しないHAL（フェイクHALは出力を std::string などに記録して確保するため） ----
+
+class BenchClock : public HalClock {
+ public:
+  BenchClock() : now(0) {}
+  uint32_t millis() override { return now; }
+  uint32_t micros() override { return now * 1000; }
+  void delay(uint32_t ms) override { now += ms; }
+  uint32_t now;
+};
+
+class BenchSensor : public HalRangeSensor {
+ public:
+  bool begin() override { return true; }
+  void read(uint8_t& range, uint8_t& status) override {
+    range = 120;
+    status = 0;
+  }
+  void setOffset(int8_t) override {}
+};
+
+class BenchPwm : public HalPwm {
+ public:
+  void pinMode(uint8_t, bool) override {}
+  void digitalWrite(uint8_t, bool) override {}
+  void analogWrite(uint8_t pin, uint8_t value) override { keep(pin + value); }
+};
+
+// 眠らない（スケジューラの run() だけを計測する）
+class BenchWaker : public HalWaker {
+ public:
+  void sleep(uint32_t ms) override { keep(ms); }
+  void wake() override {}
+};
+
+// 書き込まれた最後の内容だけを保持する
+class BenchSerial : public HalSerial {
+ public:
+  BenchSerial() : length(0) {}
+  int available() override { return 0; }
+  int read() override { return -1; }
+  size_t write(const char* data, size_t size) override {
+    length = size < sizeof(last) ? size : sizeof(last);
+    memcpy(last, data, length);
+    return size;
+  }
+  char last[128];
+  size_t length;
+};
+
+class BenchBleLink : public HalBleLink {
+ public:
+  BenchBleLink() : length(0) {}
+  bool connected() override { return true; }
+  void notify(const char* data, size_t size) override {
+    length = size < sizeof(value) ? size : sizeof(value);
+    memcpy(value, data, length);
+  }
+  char value[32];
+  size_t length;
+};
+
+// ---- 計測 ----
+
+struct BenchResult {
+  std::string name;
+  double nsPerOp;
+  double allocsPerOp;
+  double bytesPerOp;
+  uint64_t ops;
+};
+
+struct BenchOptions {
+  const char* filter = nullptr;  // 名前にこの文字列を含むものだけ実行
+  uint32_t minMs = 200;          // 1回の計測の最短時間
+  int repeat = 5;                // 計測回数（中央値を採る）
+};
+
+static double nowSeconds() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// op(i) を1操作として、minMs 以上かかる回数に調整してから repeat 回計測する
+template <typename Op>
+static void bench(std::vector<BenchResult>& results, const BenchOptions& options, const char* name, Op op) {
+  if (options.filter && strstr(name, options.filter) == nullptr) {
+    return;
+  }
+  uint64_t iterations = 1;
+  double elapsed = 0;
+  uint64_t index = 0;
+  while (true) {
+    double start = nowSeconds();
+    for (uint64_t i = 0; i < iterations; i++) {
+      op(index++);
+    }
+    elapsed = nowSeconds() - start;
+    if (elapsed * 1000 >= options.minMs || iterations >= (1ULL << 40)) {
+      break;
+    }
+    // 目標時間の1.2倍程度になるよう回数を増やす（1回で最大100倍）
+    double scale = elapsed > 0 ? options.minMs * 1.2 / (elapsed * 1000) : 100;
+    iterations = (uint64_t)(iterations * std::min(std::max(scale, 2.0), 100.0));
+  }
+
+  std::vector<double> samples;
+  uint64_t allocs = 0;
+  uint64_t bytes = 0;
+  for (int r = 0; r < options.repeat; r++) {
+    uint64_t allocStart = allocCount;
+    uint64_t bytesStart = allocBytes;
+    double start = nowSeconds();
+    for (uint64_t i = 0; i < iterations; i++) {
+      op(index++);
+    }
+    elapsed = nowSeconds() - start;
+    allocs += allocCount - allocStart;
+    bytes += allocBytes - bytesStart;
+    samples.push_back(elapsed * 1e9 / iterations);
+  }
+  std::sort(samples.begin(), samples.end());
+  uint64_t ops = iterations * options.repeat;
+  results.push_back({name, samples[samples.size() / 2], (double)allocs / ops, (double)bytes / ops, ops});
+  const BenchResult& r = results.back();
+  printf("%-22s %10.2f ns/op %8.3f allocs/op %8.1f B/op  (%llu ops)\n", r.name.c_str(), r.nsPerOp,
+         r.allocsPerOp, r.bytesPerOp, (unsigned long long)r.ops);
+  fflush(stdout);
+}
+
+// ---- ベンチマーク本体 ----
+
+// 50Hzサンプリングで約4秒に1回、3サンプル分の通過がある距離の列（誤差も時々混ぜる）
+static const size_t TRACE_LENGTH = 4096;
+static uint8_t traceRange[TRACE_LENGTH];
+static uint8_t traceStatus[TRACE_LENGTH];
+
+static void buildTrace() {
+  uint32_t x = 12345;
+  for (size_t i = 0; i < TRACE_LENGTH; i++) {
+    x = x * 1103515245u + 12345u;
+    bool passing = i % 200 < 3;
+    traceRange[i] = passing ? (uint8_t)(60 + (x >> 28)) : (uint8_t)(118 + ((x >> 20) & 3));
+    traceStatus[i] = (x >> 8) % 97 == 0 ? 11 : 0;
+  }
+}
+
+static void runBenchmarks(std::vector<BenchResult>& results, const BenchOptions& options) {
+  const uint32_t SAMPLE_MS = 20;
+
+  // receiver: 通過判定のみ（1サンプル）
+  {
+    PassageDetector detector;
+    detector.setBaseline(120);
+    bench(results, options, "detect_update", [&](uint64_t i) {
+      size_t k = i % TRACE_LENGTH;
+      keep(detector.update((uint32_t)i * SAMPLE_MS, traceRange[k], traceStatus[k]));
+    });
+  }
+
+  // receiver: loop()1回分の判定・LED・通知（ReceiverApp::detect + notifyCount + updateLeds）
+  {
+    BenchClock clock;
+    BenchSensor sensor;
+    BenchPwm pwm;
+    BenchSerial serial;
+    BenchBleLink link;
+    ReceiverApp app(clock, sensor, pwm, serial, link, 25, 26);
+    app.setDeviceNumber(1);
+    app.detector.setBaseline(120);
+    bench(results, options, "receiver_detect_step", [&](uint64_t i) {
+      size_t k = i % TRACE_LENGTH;
+      uint32_t now = (uint32_t)i * SAMPLE_MS;
+      keep(app.detect(now, traceRange[k], traceStatus[k]));
+      int32_t detectToNotify;
+      keep(app.notifyCount(now, detectToNotify));
+      app.updateLeds(now);
+    });
+  }
+
+  // receiver測定タスク→loop()・transmitterのBLEコールバック→loop(): SpscQueue の push と pop（同じスレッドで1件を1操作とする）
+  {
+    SpscQueue<ReceiverSample, 32> queue;
+    ReceiverSample sample = ReceiverSample();
+    bench(results, options, "spsc_push_pop", [&](uint64_t i) {
+      sample.time = (uint32_t)i;
+      keep(queue.push(sample));
+      keep(queue.pop(sample));
+    });
+  }
+
+  // 全ファームウェア: TaskScheduler の loop() 1回分（transmitter と同じ構成の7タスク、1操作を1msとする）
+  {
+    static uint32_t taskRuns = 0;
+    BenchClock clock;
+    BenchWaker waker;
+    TaskScheduler<8> scheduler(clock, waker);
+    SchedulerTask task = [](uint32_t now) { taskRuns += now & 1; };
+    scheduler.every(task, 100);
+    int oneShot = scheduler.add(task);
+    scheduler.add(task);
+    scheduler.every(task, 10);
+    scheduler.every(task, 1000);
+    scheduler.every(task, 25);
+    scheduler.every(task, 30000);
+    bench(results, options, "scheduler_run", [&](uint64_t i) {
+      clock.now = (uint32_t)i;
+      if (i % 50 == 0) {
+        scheduler.start(oneShot, 100);
+      }
+      keep(scheduler.run(clock.now));
+      keep(scheduler.untilNext(clock.now));
+    });
+    keep(taskRuns);
+  }
+
+  // receiver: ベースライン校正（20回の測定値の集計と平均、1回の校正を1操作とする）
+  {
+    PassageDetector detector;
+    bench(results, options, "baseline_calibrate", [&](uint64_t i) {
+      uint32_t totalRange = 0;
+      int valid = 0;
+      for (int m = 0; m < ReceiverApp::CALIBRATION_MEASUREMENTS; m++) {
+        size_t k = (i * ReceiverApp::CALIBRATION_MEASUREMENTS + m) % TRACE_LENGTH;
+        if (traceStatus[k] == 0) {
+          totalRange += traceRange[k];
+          valid++;
+        }
+      }
+      keep(detector.calibrate(totalRange, valid, ReceiverApp::CALIBRATION_MEASUREMENTS));
+    });
+  }
+
+  // receiver→transmitter: BLE値 "N:count:age" の生成
+  {
+    BenchClock clock;
+    BenchSensor sensor;
+    BenchPwm pwm;
+    BenchSerial serial;
+    BenchBleLink link;
+    ReceiverApp app(clock, sensor, pwm, serial, link, 25, 26);
+    app.setDeviceNumber(3);
+    bench(results, options, "count_encode", [&](uint64_t i) {
+      int32_t detectToNotify;
+      keep(app.notifyCount((uint32_t)i * (ReceiverApp::NOTIFY_INTERVAL + 1), detectToNotify));
+    });
+  }
+
+  // transmitter: BLE値の解釈と増分の中継（値は4レーン分を順に、時々カウントが増える列を事前に作る）
+  {
+    static const size_t VALUES = 1024;
+    static char values[VALUES][16];
+    static size_t lengths[VALUES];
+    for (size_t i = 0; i < VALUES; i++) {
+      lengths[i] = (size_t)snprintf(values[i], sizeof(values[i]), "%d:%lu:%lu", (int)(i & 3) + 1,
+                                    (unsigned long)(i / 64), (unsigned long)(i * 7 % 1000));
+    }
+    CountRelay relay;
+    bench(results, options, "count_relay", [&](uint64_t i) {
+      size_t k = i % VALUES;
+      if (k == 0) {
+        relay.reset();
+      }
+      keep(relay.update(values[k], lengths[k], [](int lane, int32_t age) { keep(lane + age); }));
+    });
+  }
+
+  // transmitter→server: UART行 "a:age\n" の書き出し
+  {
+    BenchSerial uart;
+    const char gateChars[] = {'a', 's', 'd', 'f'};
+    bench(results, options, "uart_frame_tx", [&](uint64_t i) {
+      uart.printf("%c:%lu\n", gateChars[i & 3], (unsigned long)(i % 2000));
+      keep(uart.length);
+    });
+  }
+
+  // server: UART受信の行組み立て・経過時間の分離・ログへの追加（1行を1操作とする）
+  {
+    static const char stream[] = "a:123\ns:45\r\nd:6789\nf\n";
+    const size_t streamLength = sizeof(stream) - 1;
+    GateLineReader reader;
+    GateEventLog<256> log;
+    size_t pos = 0;
+    bench(results, options, "uart_frame_rx", [&](uint64_t i) {
+      while (true) {
+        char c = stream[pos];
+        pos = pos + 1 < streamLength ? pos + 1 : 0;
+        if (reader.feed(c)) {
+          uint16_t age;
+          size_t length = splitGateAge(reader.line(), reader.length(), age);
+          keep(log.append((uint32_t)i, reader.line(), length, age));
+          break;
+        }
+      }
+    });
+  }
+
+  // server→client: 通知ペイロードの生成（MTU 185、1イベントを1操作とする）
+  {
+    GateEventLog<256> log;
+    for (uint32_t i = 0; i < 256; i++) {
+      log.append(i, &"asdf"[i % 4], 1, (uint16_t)(i * 3));
+    }
+    char payload[GATE_BATCH_MAX];
+    uint32_t cursor = log.oldestSeq();
+    uint32_t eventsPerBatch = 0;
+    bench(results, options, "gate_batch_pack", [&](uint64_t) {
+      if (eventsPerBatch == 0) {
+        if (cursor == log.nextSeq()) {
+          cursor = log.oldestSeq();
+        }
+        uint32_t before = cursor;
+        keep(log.packSince(cursor, payload, 182, 1000));
+        eventsPerBatch = cursor - before;
+      }
+      eventsPerBatch--;
+    });
+  }
+
+  // client: 通知ペイロードの解析・受信キュー・重複排除（1イベントを1操作とする）
+  {
+    GateEventLog<256> log;
+    for (uint32_t i = 0; i < 256; i++) {
+      log.append(i, &"asdf"[i % 4], 1, (uint16_t)(i * 3));
+    }
+    char payload[GATE_BATCH_MAX];
+    uint32_t cursor = log.oldestSeq();
+    size_t length = log.packSince(cursor, payload, 182, 1000);
+    GateInbox<64> inbox;
+    GateSequenceFilter filter;
+    GateEvent ev;
+    size_t pending = 0;
+    bench(results, options, "gate_batch_parse", [&](uint64_t) {
+      if (pending == 0) {
+        filter.reset();
+        pending = parseGateBatch(payload, length, [&](uint32_t seq, const char* data, size_t dataLength,
+                                                      uint16_t age) {
+          inbox.push(seq, data, dataLength, 0, age);
+        });
+      }
+      inbox.pop(ev);
+      keep(filter.accept(ev.seq));
+      pending--;
+    });
+  }
+
+  // 全ファームウェア: ログ1レコードの書式化とリングからの取り出し
+  {
+    AsyncLog log;
+    size_t drained = 0;
+    bench(results, options, "log_format", [&](uint64_t i) {
+      log.write(LOG_LEVEL_INFO, LOG_MOD_DETECT, false, "passage count=%d elapsed=%lums", (int)(i & 1023),
+                (unsigned long)i);
+      log.drain([&](const char*, size_t length) { drained += length; });
+      keep(drained);
+    });
+  }
+
+  // 非同期ログの導入前後: イベント処理の中で1行出力するときに呼び出し元が払う時間
+  //   log_before_sync     以前の Serial.print + Serial.flush（書式化して書き、送り終わるまで待つ。
+  //                       ホストでは /dev/null への書き込みと fflush のシステムコールで代用するため実機より軽い）
+  //   log_before_usb_wait 上に、USB CDC の flush がホストの次のポーリング（1msフレーム）まで待つ分を
+  //                       モデルとして足したもの（実機の待ちの目安。計測値ではない）
+  //   log_after_enqueue   LOG_I（リングへ積むだけ。出力はドレインタスクが行うので16件ごとに取り出す）
+  //   log_after_stripped  LOG_D（LOG_COMPILE_LEVEL 未満で空になる）
+  {
+    FILE* serial = fopen("/dev/null", "w");
+    if (serial) {
+      bench(results, options, "log_before_sync", [&](uint64_t i) {
+        fprintf(serial, "passage count=%d elapsed=%lums\r\n", (int)(i & 1023), (unsigned long)i);
+        fflush(serial);
+      });
+      bench(results, options, "log_before_usb_wait", [&](uint64_t i) {
+        fprintf(serial, "passage count=%d elapsed=%lums\r\n", (int)(i & 1023), (unsigned long)i);
+        fflush(serial);
+        double frame = (double)(uint64_t)(nowSeconds() * 1000 + 1) / 1000;
+        while (nowSeconds() < frame) {
+        }
+      });
+      fclose(serial);
+    }
+    size_t drained = 0;
+    bench(results, options, "log_after_enqueue", [&](uint64_t i) {
+      LOG_I(LOG_MOD_DETECT, "passage count=%d elapsed=%lums", (int)(i & 1023), (unsigned long)i);
+      if ((i & 15) == 15) {
+        asyncLog().drain([&](const char*, size_t length) { drained += length; });
+      }
+      keep(drained);
+    });
+    bench(results, options, "log_after_stripped", [&](uint64_t i) {
+      LOG_D(LOG_MOD_DETECT, "passage count=%d elapsed=%lums", (int)(i & 1023), (unsigned long)i);
+      keep(i);
+    });
+  }
+
+  // 全ファームウェア: メトリクスの登録（起動時、カウンタ4・ゲージ4・ヒストグラム2を1操作とする）と、
+  // 登録で得た参照を通したホットパスでの加算
+  {
+    LatencyHistogram loopUs;
+    LatencyHistogram e2e;
+    bench(results, options, "metrics_register", [&](uint64_t) {
+      MetricsRegistry<16> metrics;
+      keep(metrics.counter("samples"));
+      keep(metrics.counter("notify_ok"));
+      keep(metrics.counter("notify_fail"));
+      keep(metrics.counter("passages"));
+      keep(metrics.gauge("sps"));
+      keep(metrics.gauge("heap_min"));
+      keep(metrics.gauge("log_drop"));
+      keep(metrics.gauge("uart_drop"));
+      keep(metrics.histogram("loop_us", loopUs));
+      keep(metrics.histogram("e2e_ms", e2e));
+      keep(metrics.size());
+    });
+    MetricsRegistry<16> metrics;
+    uint32_t& samples = metrics.counter("samples");
+    int32_t& sps = metrics.gauge("sps");
+    bench(results, options, "metrics_update", [&](uint64_t i) {
+      samples++;
+      sps = (int32_t)(i & 63);
+      keep(metrics.at(0).value);
+    });
+  }
+
+  // 全ファームウェア: METRICS行の書式化（カウンタ4・ゲージ4・ヒストグラム2）
+  {
+    MetricsRegistry<16> metrics;
+    LatencyHistogram loopUs;
+    LatencyHistogram e2e;
+    for (uint32_t i = 0; i < 1000; i++) {
+      loopUs.record(20000 + i % 700);
+      e2e.record(40 + i % 90);
+    }
+    uint32_t& samples = metrics.counter("samples");
+    metrics.counter("notify_ok") = 4800;
+    metrics.counter("notify_fail") = 3;
+    metrics.counter("passages") = 120;
+    metrics.gauge("sps") = 50;
+    metrics.gauge("heap_min") = 201344;
+    metrics.gauge("log_drop") = 0;
+    metrics.gauge("uart_drop") = 0;
+    metrics.histogram("loop_us", loopUs);
+    metrics.histogram("e2e_ms", e2e);
+    char line[256];
+    bench(results, options, "metrics_format", [&](uint64_t) {
+      samples++;
+      keep(metrics.format(line, sizeof(line)));
+    });
+  }
+
+  // client: 周回ごとのレイテンシ統計への記録（1周を1操作とする）
+  {
+    LatencyHistogram laps;
+    bench(results, options, "lap_stats_record", [&](uint64_t i) {
+      laps.record(3800 + (uint32_t)((i * 2654435761u) >> 24));
+    });
+  }
+
+  // client: 統計行 "LAT ... p50 p95 p99 max" の書式化
+  {
+    LatencyHistogram laps;
+    for (uint32_t i = 0; i < 5000; i++) {
+      laps.record(3800 + (uint32_t)((i * 2654435761u) >> 24));
+    }
+    char line[128];
+    bench(results, options, "lap_stats_format", [&](uint64_t) {
+      keep(laps.format(line, sizeof(line), "LAT detect->uart", "ms"));
+    });
+  }
+
+  // receiver: 距離サンプルの記録（1サンプルを1操作とする）
+  {
+    SampleBlockEncoder encoder;
+    uint32_t sequence = 0;
+    encoder.begin(sequence, 0);
+    bench(results, options, "sample_record", [&](uint64_t i) {
+      size_t k = i % TRACE_LENGTH;
+      if (!encoder.add((uint32_t)i * SAMPLE_MS, traceRange[k], traceStatus[k])) {
+        keep(encoder.finish());
+        encoder.begin(++sequence, (uint32_t)i * SAMPLE_MS);
+        encoder.add((uint32_t)i * SAMPLE_MS, traceRange[k], traceStatus[k]);
+      }
+    });
+  }
+}
+
+// ---- 結果ファイル ----
+
+static const char* CSV_HEADER = "name,ns_per_op,allocs_per_op,bytes_per_op,ops";
+
+static bool writeResults(const char* path, const std::vector<BenchResult>& results) {
+  FILE* file = fopen(path, "w");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  fprintf(file, "%s\n", CSV_HEADER);
+  for (const BenchResult& r : results) {
+    fprintf(file, "%s,%.3f,%.4f,%.2f,%llu\n", r.name.c_str(), r.nsPerOp, r.allocsPerOp, r.bytesPerOp,
+            (unsigned long long)r.ops);
+  }
+  fclose(file);
+  return true;
+}
+
+static bool readResults(const char* path, std::vector<BenchResult>& results) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    char name[64];
+    BenchResult r;
+    unsigned long long ops;
+    if (sscanf(line, "%63[^,],%lf,%lf,%lf,%llu", name, &r.nsPerOp, &r.allocsPerOp, &r.bytesPerOp, &ops) == 5) {
+      r.name = name;
+      r.ops = ops;
+      results.push_back(r);
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+// 以前の結果と比べる。ns/op が threshold% を超えて遅くなったもの、確保が増えたものを回帰とする
+static int compareResults(const std::vector<BenchResult>& baseline, const std::vector<BenchResult>& results,
+                          double threshold) {
+  int regressions = 0;
+  printf("\n%-22s %12s %12s %8s %14s\n", "compare", "base ns/op", "ns/op", "delta", "allocs/op");
+  for (const BenchResult& r : results) {
+    const BenchResult* base = nullptr;
+    for (const BenchResult& b : baseline) {
+      if (b.name == r.name) {
+        base = &b;
+      }
+    }
+    if (!base) {
+      printf("%-22s %12s %12.2f %8s\n", r.name.c_str(), "-", r.nsPerOp, "new");
+      continue;
+    }
+    double delta = base->nsPerOp > 0 ? (r.nsPerOp - base->nsPerOp) * 100 / base->nsPerOp : 0;
+    bool slower = delta > threshold;
+    bool allocates = r.allocsPerOp > base->allocsPerOp + 1e-6;
+    printf("%-22s %12.2f %12.2f %+7.1f%% %6.3f->%-6.3f%s\n", r.name.c_str(), base->nsPerOp, r.nsPerOp, delta,
+           base->allocsPerOp, r.allocsPerOp, slower || allocates ? "  REGRESSION" : "");
+    if (slower || allocates) {
+      regressions++;
+    }
+  }
+  printf("%d regression(s) (threshold %.0f%%)\n", regressions, threshold);
+  return regressions;
+}
+
+static void usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--filter TEXT] [--min-ms MS] [--repeat N] [--out FILE.csv] [--compare FILE.csv]"
+          " [--threshold PERCENT]\n",
+          program);
+}
+
+int main(int argc, char** argv) {
+  BenchOptions options;
+  const char* outPath = nullptr;
+  const char* comparePath = nullptr;
+  double threshold = 15;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      usage(argv[0]);
+      return 2;
+    }
+    if (strcmp(arg, "--filter") == 0) {
+      options.filter = value;
+    } else if (strcmp(arg, "--min-ms") == 0) {
+      options.minMs = (uint32_t)strtoul(value, nullptr, 10);
+    } else if (strcmp(arg, "--repeat") == 0) {
+      options.repeat = atoi(value) > 0 ? atoi(value) : 1;
+    } else if (strcmp(arg, "--out") == 0) {
+      outPath = value;
+    } else if (strcmp(arg, "--compare") == 0) {
+      comparePath = value;
+    } else if (strcmp(arg, "--threshold") == 0) {
+      threshold = atof(value);
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+    i++;
+  }
+
+  // 比較元を先に読む（--out と同じファイルを指定しても上書き前の結果と比べる）
+  std::vector<BenchResult> baseline;
+  if (comparePath && !readResults(comparePath, baseline)) {
+    return 2;
+  }
+
+  buildTrace();
+  std::vector<BenchResult> results;
+  results.reserve(32);
+  runBenchmarks(results, options);
+
+  if (outPath && !writeResults(outPath, results)) {
+    return 2;
+  }
+  if (comparePath) {
+    return compareResults(baseline, results, threshold) > 0 ? 1 : 0;
+  }
+  return 0;
+}
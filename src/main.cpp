@@ -1,88 +1,98 @@
 #include <Arduino.h>
 #include <Wire.h>
-#include <WiFi.h>
 #include "Adafruit_VL6180X.h"
+#include "async_log.h"
+#include "deadline.h"
+#include "device_config.h"
+#include "hal_arduino.h"
+#include "led_effects.h"
+#include "task_scheduler.h"
 
 // LEDピンの定義（PWM対応ピン）
 #define RED_LED_PIN D0    // 赤色LED（PWM対応）
 #define BLUE_LED_PIN D1   // 青色LED（PWM対応）
 
-// デバイス識別用の構造体
-struct DeviceCalibration {
-  String macAddress;
-  int deviceNumber;
-  String deviceName;
-  // オフセットキャリブレーション値
-  int offsetCalibration;   // オフセット補正値（mm）
-};
+// 時刻はすべてこの時計から読む（ホストでは仮想時計に差し替えられる）
+ArduinoClock halClock;
+ArduinoPwm halPwm;
+IntervalTimer distancePrintTimer(500);  // 距離の出力（2Hz、USB負荷軽減）
+const uint32_t MEASURE_INTERVAL = 20;   // 測定周期（50Hz）
+const uint32_t COMMAND_INTERVAL = 20;   // シリアルコマンドの確認（USB CDCには受信イベントがない）
 
-// 各デバイスのキャリブレーション設定（WiFi MACアドレスベース）
-DeviceCalibration devices[] = {
-  {"cc:ba:97:15:4d:0c", 1, "デバイス1", 125},
-  {"cc:ba:97:15:53:20", 2, "デバイス2", 55},  // WiFi MACアドレスに戻す
-  {"cc:ba:97:15:4f:28", 3, "デバイス3", -5},
-  {"cc:ba:97:15:37:34", 4, "デバイス4", 0}   // WiFi MACアドレス
-};
+// loop() の処理はスケジューラのタスクとして登録し、次の締め切りまで眠る
+ArduinoWaker loopWaker;
+TaskScheduler<4> scheduler(halClock, loopWaker);
+int ledTask = -1;  // LED出力の更新（次に出力が変わる時刻に合わせて起こす）
+
+// loop() のLED表示（距離・エラー・センサーなしのパターンを宣言し、変化したときだけ書き込む）
+LedEffects leds(halPwm, RED_LED_PIN, BLUE_LED_PIN);
+ArduinoStorage halStorage("receiver");  // デバイス設定（receiverと共通のNVS領域）
 
 // グローバル変数
 bool sensorAvailable = false;
-DeviceCalibration currentDevice;
-bool deviceIdentified = false;
+DeviceConfig deviceConfig;
 
 // VL6180Xセンサーのインスタンス
 Adafruit_VL6180X vl = Adafruit_VL6180X();
 
-// デバイス識別機能
+// デバイス識別機能（WiFi STAのMACアドレスをeFuseから読む、WiFiは起動しない）
 void identifyDevice() {
-  // WiFi MACアドレスを取得
-  String wifiMacAddress = WiFi.macAddress();
-  wifiMacAddress.toLowerCase();
-  
-  Serial.print("WiFi MACアドレス: ");
-  Serial.println(wifiMacAddress);
-  
-  // Bluetooth MACアドレスも表示（参考用）
-  String btMacStr = "";
+  uint8_t wifiMac[6];
   uint8_t btMac[6];
+  esp_read_mac(wifiMac, ESP_MAC_WIFI_STA);
   esp_read_mac(btMac, ESP_MAC_BT);
-  for (int i = 0; i < 6; i++) {
-    if (i > 0) btMacStr += ":";
-    if (btMac[i] < 0x10) btMacStr += "0";
-    btMacStr += String(btMac[i], HEX);
-  }
-  btMacStr.toLowerCase();
-  Serial.print("Bluetooth MACアドレス: ");
-  Serial.println(btMacStr);
+  Serial.printf("WiFi MACアドレス: %02x:%02x:%02x:%02x:%02x:%02x\r\n",
+                wifiMac[0], wifiMac[1], wifiMac[2], wifiMac[3], wifiMac[4], wifiMac[5]);
+  Serial.printf("Bluetooth MACアドレス: %02x:%02x:%02x:%02x:%02x:%02x\r\n",
+                btMac[0], btMac[1], btMac[2], btMac[3], btMac[4], btMac[5]);
   
-  // デバイス配列から該当するデバイスを検索（WiFi MACで識別）
-  for (int i = 0; i < 4; i++) {
-    if (devices[i].macAddress == wifiMacAddress) {
-      currentDevice = devices[i];
-      deviceIdentified = true;
-      Serial.print("デバイス識別完了: ");
-      Serial.print(currentDevice.deviceName);
-      Serial.print(" (番号: ");
-      Serial.print(currentDevice.deviceNumber);
-      Serial.println(")");
-      
-      // デバイス固有のオフセット値を表示
-      Serial.print("オフセット値: ");
-      Serial.print(currentDevice.offsetCalibration);
-      Serial.println("mm");
-      return;
-    }
+  // NVSの設定 → 登録済みMACアドレスの既定値 → 未登録の既定値 の順に決める
+  DeviceConfigSource source = loadDeviceConfig(halStorage, wifiMac, deviceConfig);
+  if (source == DEVICE_CONFIG_FROM_DEFAULT) {
+    Serial.println("警告: 未登録のデバイスです。デフォルト設定を使用します。");
   }
-  
-  // 未登録のデバイスの場合はデフォルト値を使用
-  Serial.println("警告: 未登録のデバイスです。デフォルト設定を使用します。");
-  currentDevice = {"unknown", 0, "未登録デバイス", 0};
-  deviceIdentified = false;
+  char line[96];
+  formatDeviceConfig(deviceConfig, line, sizeof(line));
+  Serial.printf("%s source=%s\r\n", line, deviceConfigSourceName(source));
 }
 
-// LEDの強度を設定する関数
+// LEDの強度を設定する関数（setup() の起動表示用、loop() では leds を使う）
 void setLEDIntensity(int redIntensity, int blueIntensity) {
-  analogWrite(RED_LED_PIN, redIntensity);   // 0-255の範囲
-  analogWrite(BLUE_LED_PIN, blueIntensity); // 0-255の範囲
+  halPwm.analogWrite(RED_LED_PIN, redIntensity);   // 0-255の範囲
+  halPwm.analogWrite(BLUE_LED_PIN, blueIntensity); // 0-255の範囲
+  leds.invalidate();
+}
+
+// 距離に応じたLED表示
+LedPattern rangePattern(uint8_t range) {
+  if (range < 25) {
+    return LedPattern::blink({255, 0}, {200, 0}, 100);  // 緊急距離未満: 赤色LED最大強度＋点滅効果（緊急危険）
+  } else if (range < 40) {
+    return LedPattern::solid(255, 0);  // 危険距離: 赤色LED最大強度（非常に危険）
+  } else if (range < 60) {
+    return LedPattern::solid(180, 0);  // 警告距離: 赤色LED中強度（警告）
+  } else if (range < 90) {
+    return LedPattern::solid(200, 30);  // 注意距離: オレンジ色（赤＋青の混合）で注意
+  } else if (range < 130) {
+    return LedPattern::solid(0, 200);  // 検出距離: 青色LED中強度（検出）
+  } else if (range < 180) {
+    return LedPattern::solid(0, 100);  // 遠距離: 青色LED弱（遠距離検出）
+  } else if (range < 250) {
+    return LedPattern::solid(0, 30);  // 微検出距離: 青色LED非常に弱（微検出）
+  }
+  return LedPattern::solid(0, 0);  // 安全距離以上: 両方のLEDを消灯（安全距離）
+}
+
+// センサーなしモード：デバイス番号に応じたLEDテストパターン（1秒ごとに切り替え）
+LedPattern sensorlessPattern(int lane) {
+  static const LedColor patterns[5][4] = {
+    {{50, 0}, {0, 50}, {25, 25}, {0, 0}},       // 未登録デバイス: 赤弱・青弱・両方弱・消灯
+    {{100, 0}, {50, 0}, {200, 0}, {0, 0}},      // デバイス1: 赤色パターン（中・弱・強・消灯）
+    {{0, 100}, {0, 50}, {0, 200}, {0, 0}},      // デバイス2: 青色パターン（中・弱・強・消灯）
+    {{100, 0}, {0, 100}, {100, 0}, {0, 0}},     // デバイス3: 交互パターン（赤・青・赤・消灯）
+    {{100, 100}, {50, 50}, {150, 30}, {0, 0}},  // デバイス4: 混合パターン（紫・紫弱・オレンジ・消灯）
+  };
+  return LedPattern::cycle(patterns[lane >= 1 && lane <= 4 ? lane : 0], 4, 1000);
 }
 
 // オフセットキャリブレーション機能
@@ -98,7 +108,7 @@ void calibrateOffset() {
   
   // シリアル入力待ち
   while (!Serial.available()) {
-    delay(100);
+    halClock.delay(100);
   }
   Serial.read(); // バッファをクリア
   
@@ -125,7 +135,7 @@ void calibrateOffset() {
       Serial.print(i + 1);
       Serial.println(": エラー");
     }
-    delay(200);
+    halClock.delay(200);
   }
   
   if (validMeasurements > 0) {
@@ -143,15 +153,24 @@ void calibrateOffset() {
     vl.setOffset(offset);
     
     // 検証測定
-    delay(500);
+    halClock.delay(500);
     uint8_t verifyRange = vl.readRange();
     Serial.print("検証測定: ");
     Serial.print(verifyRange);
     Serial.println("mm");
     
     Serial.println("オフセットキャリブレーション完了");
-    Serial.print("この値をコードに保存してください: ");
-    Serial.println(offset);
+    // デバイス設定に保存する（receiverファームウェアでも次の起動から使われる）
+    if (offset >= -128 && offset <= 127) {
+      deviceConfig.offset = (int8_t)offset;
+      if (saveDeviceConfig(halStorage, deviceConfig)) {
+        Serial.println("オフセットをデバイス設定に保存しました");
+      } else {
+        Serial.println("デバイス設定の保存に失敗しました");
+      }
+    } else {
+      Serial.println("オフセットが範囲外（-128〜127mm）のため保存しません");
+    }
   } else {
     Serial.println("有効な測定値が取得できませんでした。");
   }
@@ -159,16 +178,18 @@ void calibrateOffset() {
   Serial.println("=== キャリブレーション終了 ===");
 }
 
+// loop() のタスク（setup() で登録する）
+void readCommands(uint32_t now);
+void measure(uint32_t now);
+void updateLeds(uint32_t now);
+
 void setup() {
   Serial.begin(115200);
   delay(1000); // シリアル通信の安定化待ち
   Serial.flush(); // バッファをクリア
+  startAsyncLog(); // loop()内のログは低優先度タスクで出力
   Serial.println("LED制御 + VL6180X ToFセンサー プログラム開始");
   
-  // WiFiを初期化してMACアドレスを取得（接続はしない）
-  WiFi.mode(WIFI_STA);
-  delay(100);
-  
   // デバイス識別を実行
   identifyDevice();
   
@@ -230,10 +251,10 @@ void setup() {
     // センサーなしでも動作継続（無限ループを回避）
   } else {
     // デバイス固有のオフセットを適用
-    if (currentDevice.offsetCalibration != 0) {
-      vl.setOffset(currentDevice.offsetCalibration);
+    if (deviceConfig.offset != 0) {
+      vl.setOffset(deviceConfig.offset);
       Serial.print("オフセット適用: ");
-      Serial.print(currentDevice.offsetCalibration);
+      Serial.print(deviceConfig.offset);
       Serial.println("mm");
     }
     
@@ -251,10 +272,16 @@ void setup() {
   }
   setLEDIntensity(0, 0);
   
+  // loop() のタスク
+  loopWaker.begin();
+  scheduler.every(readCommands, COMMAND_INTERVAL);
+  scheduler.every(measure, MEASURE_INTERVAL);
+  ledTask = scheduler.add(updateLeds);
+  
   Serial.println("セットアップ完了");
 }
 
-void loop() {
+void readCommands(uint32_t) {
   // キャリブレーションコマンドチェック
   if (Serial.available() > 0) {
     char command = Serial.read();
@@ -273,128 +300,46 @@ void loop() {
   //   Serial.println("ハートビート - ループ実行中");
   //   lastHeartbeat = millis();
   // }
-  
+}
+
+void measure(uint32_t) {
   // センサーが利用可能な場合のみセンサー読み取りを実行
   if (sensorAvailable) {
     // VL6180Xセンサーから距離を読み取り（単発測定モード使用）
     uint8_t range = vl.readRange();
     uint8_t status = vl.readRangeStatus();
+    uint32_t now = halClock.millis();
   
   // 測定エラーをチェック
   if (status == VL6180X_ERROR_NONE) {
     // 距離データの出力頻度を制限（USB負荷軽減）
-    static unsigned long lastPrintTime = 0;
-    if (millis() - lastPrintTime > 500) { // 500msごと（2Hz）に距離を出力
-      Serial.print("[");
-      Serial.print(currentDevice.deviceName);
-      Serial.print("] 距離: ");
-      Serial.print(range);
-      Serial.println(" mm");
-      lastPrintTime = millis();
+    if (distancePrintTimer.due(now)) { // 500msごと（2Hz）に距離を出力
+      LOG_I(LOG_MOD_SENSOR, "[%s] 距離: %u mm", deviceConfig.name, range);
     }
     
     // 距離判定（固定閾値を使用）
-    if (range < 25) {
-      // 緊急距離未満: 赤色LED最大強度＋点滅効果（緊急危険）
-      static unsigned long lastFlashTime = 0;
-      static bool flashState = false;
-      if (millis() - lastFlashTime > 100) { // 100msごとに点滅
-        flashState = !flashState;
-        setLEDIntensity(flashState ? 255 : 200, 0);
-        lastFlashTime = millis();
-      }
-    } else if (range < 40) {
-      // 危険距離: 赤色LED最大強度（非常に危険）
-      setLEDIntensity(255, 0);
-    } else if (range < 60) {
-      // 警告距離: 赤色LED中強度（警告）
-      setLEDIntensity(180, 0);
-    } else if (range < 90) {
-      // 注意距離: オレンジ色（赤＋青の混合）で注意
-      setLEDIntensity(200, 30);
-    } else if (range < 130) {
-      // 検出距離: 青色LED中強度（検出）
-      setLEDIntensity(0, 200);
-    } else if (range < 180) {
-      // 遠距離: 青色LED弱（遠距離検出）
-      setLEDIntensity(0, 100);
-    } else if (range < 250) {
-      // 微検出距離: 青色LED非常に弱（微検出）
-      setLEDIntensity(0, 30);
-    } else {
-      // 安全距離以上: 両方のLEDを消灯（安全距離）
-      setLEDIntensity(0, 0);
-    }
+    leds.set(LED_LAYER_BASE, rangePattern(range), now);
   } else {
-    // エラー時は赤色LEDを点滅
-    static unsigned long lastErrorFlashTime = 0;
-    static bool errorFlashState = false;
-    if (millis() - lastErrorFlashTime > 250) { // 250msごとに点滅
-      errorFlashState = !errorFlashState;
-      setLEDIntensity(errorFlashState ? 255 : 0, 0);
-      lastErrorFlashTime = millis();
-    }
+    // エラー時は赤色LEDを点滅（250msごと）
+    leds.set(LED_LAYER_BASE, LedPattern::blink({255, 0}, {0, 0}, 250), now);
   }
   } else {
     // センサーなしモード：デバイス番号に応じたLEDテストパターン表示
-    static unsigned long lastPatternTime = 0;
-    static int patternStep = 0;
-    
-    if (millis() - lastPatternTime > 1000) { // 1秒ごとにパターン変更
-      // デバイス番号に応じて異なるパターンを表示
-      switch (currentDevice.deviceNumber) {
-        case 1: // デバイス1: 赤色パターン
-          switch (patternStep % 4) {
-            case 0: setLEDIntensity(100, 0); break;  // 赤中
-            case 1: setLEDIntensity(50, 0); break;   // 赤弱
-            case 2: setLEDIntensity(200, 0); break;  // 赤強
-            case 3: setLEDIntensity(0, 0); break;    // 消灯
-          }
-          break;
-        case 2: // デバイス2: 青色パターン
-          switch (patternStep % 4) {
-            case 0: setLEDIntensity(0, 100); break;  // 青中
-            case 1: setLEDIntensity(0, 50); break;   // 青弱
-            case 2: setLEDIntensity(0, 200); break;  // 青強
-            case 3: setLEDIntensity(0, 0); break;    // 消灯
-          }
-          break;
-        case 3: // デバイス3: 交互パターン
-          switch (patternStep % 4) {
-            case 0: setLEDIntensity(100, 0); break;  // 赤
-            case 1: setLEDIntensity(0, 100); break;  // 青
-            case 2: setLEDIntensity(100, 0); break;  // 赤
-            case 3: setLEDIntensity(0, 0); break;    // 消灯
-          }
-          break;
-        case 4: // デバイス4: 混合パターン
-          switch (patternStep % 4) {
-            case 0: setLEDIntensity(100, 100); break; // 紫
-            case 1: setLEDIntensity(50, 50); break;   // 紫弱
-            case 2: setLEDIntensity(150, 30); break;  // オレンジ
-            case 3: setLEDIntensity(0, 0); break;     // 消灯
-          }
-          break;
-        default: // 未登録デバイス: デフォルトパターン
-          switch (patternStep % 4) {
-            case 0: setLEDIntensity(50, 0); break;   // 赤弱
-            case 1: setLEDIntensity(0, 50); break;   // 青弱  
-            case 2: setLEDIntensity(25, 25); break; // 両方弱
-            case 3: setLEDIntensity(0, 0); break;   // 消灯
-          }
-          break;
-      }
-      patternStep++;
-      lastPatternTime = millis();
-    }
+    leds.set(LED_LAYER_BASE, sensorlessPattern(deviceConfig.lane), halClock.millis());
   }
-  
-  // シリアルバッファを定期的にフラッシュ（USB安定性向上）
-  static unsigned long lastFlushTime = 0;
-  if (millis() - lastFlushTime > 1000) { // 1秒ごと
-    Serial.flush();
-    lastFlushTime = millis();
+  scheduler.signal(ledTask);
+}
+
+// 表示が変わったときだけLEDに書き込む（次に出力が変わる時刻まで呼ばない）
+void updateLeds(uint32_t) {
+  uint32_t next = leds.update(halClock.millis());
+  if (next != LedEffects::NO_CHANGE) {
+    scheduler.start(ledTask, next);
+  } else {
+    scheduler.cancel(ledTask);
   }
-  
-  delay(20);
-}
\ No newline at end of file
+}
+
+void loop() {
+  scheduler.loop();
+}
@@ -0,0 +1,685 @@
+// ワイヤフォーマットのパーサ・コーデックのファジングとスループット計測（ホスト用）
+//
+// 対象（libFuzzerでは入力の先頭1バイトで選択）:
+//   count_reading  transmitter  receiverの値 "N:count[:age]"（parseCountReading + CountRelay）
+//   gate_line      server       UART行の組み立て（GateLineReader + splitGateAge）
+//   since          server       再送要求 "SINCE:epoch:seq"（parseGateSinceRequest）
+//   gate_batch     client       通知ペイロード（parseGateBatch + GateInbox + GateSequenceFilter）
+//   event_log      server       GateEventLog::packSince の出力を parseGateBatch で読み戻す往復
+//   sample_block   recorder     decodeSampleBlock と、符号化→復号の往復
+//   baseline       receiver     NVSのベースラインレコード（decodeBaselineRecord + FakeStorage経由の読み書き）
+//   device_config  receiver     NVSのデバイス設定（decodeDeviceConfig）と "$" コマンド行（DeviceConfigLineReader）
+// クラッシュに加えて、各対象の不変条件（範囲・往復一致など）を FUZZ_CHECK で検査する
+//
+// libFuzzer（clang）:
+//   clang++ -std=gnu++17 -g -O1 -fsanitize=fuzzer,address,undefined -DPARSER_FUZZ_LIBFUZZER
+//       -Iinclude src/parser_fuzz.cpp -o parser_fuzz
+//   ./parser_fuzz -max_len=1100 corpus/
+// 単体実行（pio run -e parser_fuzz、gcc/clang + ASan/UBSan）:
+//   program                                   全対象を乱数変異で各20万回実行し、スループットを計測
+//   program --target since --iterations 1000000 --seed 7
+//   program crash-1234abcd ...                libFuzzerが保存した入力を再実行
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "baseline_store.h"
+#include "count_relay.h"
+#include "device_config.h"
+#include "gate_event_log.h"
+#include "gate_event_receiver.h"
+#include "hal_fake.h"
+#include "sample_codec.h"
+
+#define FUZZ_CHECK(cond)                                                                      \
+  do {                                                                                        \
+    if (!(cond)) {                                                                            \
+      fprintf(stderr, "FUZZ_CHECK failed: %s (%s:%d)\n", #cond, __FILE__, __LINE__);          \
+      abort();                                                                                \
+    }                                                                                         \
+  } while (0)
+
+// ---- 対象ごとの検査 ----
+
+// receiverの値を1行ずつ読み取り値として中継する
+static void fuzzCountReading(const uint8_t* data, size_t size) {
+  CountRelay relay;
+  size_t start = 0;
+  while (start <= size) {
+    size_t end = start;
+    while (end < size && data[end] != '\n') {
+      end++;
+    }
+    const char* value = (const char*)data + start;
+    CountReading reading;
+    if (parseCountReading(value, end - start, reading)) {
+      FUZZ_CHECK(reading.deviceNumber >= 1 && reading.deviceNumber <= COUNT_RELAY_LANES);
+      FUZZ_CHECK(reading.age >= -1);
+    }
+    uint32_t events = 0;
+    uint32_t emitted = relay.update(value, end - start, [&](int lane, int32_t age) {
+      FUZZ_CHECK(lane >= 0 && lane < COUNT_RELAY_LANES);
+      FUZZ_CHECK(age >= -1);
+      events++;
+    });
+    FUZZ_CHECK(emitted == events);
+    FUZZ_CHECK(events <= COUNT_RELAY_MAX_STEP);
+    start = end + 1;
+  }
+}
+
+// UARTのバイト列を行に組み立て、経過時間を分離してログへ追加する
+static void fuzzGateLine(const uint8_t* data, size_t size) {
+  GateLineReader reader;
+  GateEventLog<8> log;
+  for (size_t i = 0; i < size; i++) {
+    if (!reader.feed((char)data[i])) {
+      continue;
+    }
+    const char* line = reader.line();
+    size_t length = reader.length();
+    FUZZ_CHECK(length >= 1 && length <= GATE_EVENT_DATA_MAX);
+    FUZZ_CHECK(line[length] == '\0');
+    for (size_t k = 0; k < length; k++) {
+      FUZZ_CHECK(line[k] > ' ' && line[k] < 0x7F);
+    }
+    uint16_t age;
+    size_t dataLength = splitGateAge(line, length, age);
+    FUZZ_CHECK(dataLength >= 1 && dataLength <= length);
+    if (age != GATE_AGE_UNKNOWN) {
+      FUZZ_CHECK(dataLength < length && line[dataLength] == ':');
+    } else {
+      FUZZ_CHECK(dataLength == length);
+    }
+    log.append(i, line, dataLength, age);
+  }
+  char out[64];
+  uint32_t cursor = 0;
+  while (log.packSince(cursor, out, sizeof(out), size) > 0) {
+  }
+  FUZZ_CHECK(cursor == log.nextSeq());
+}
+
+// SINCE要求の解析と、解析結果の書き出し→再解析の一致
+static void fuzzSince(const uint8_t* data, size_t size) {
+  uint32_t epoch;
+  uint32_t seq;
+  if (parseGateSinceRequest((const char*)data, size, epoch, seq)) {
+    char text[32];
+    size_t length = formatGateSinceRequest(text, sizeof(text), epoch, seq);
+    FUZZ_CHECK(length > 0);
+    uint32_t epoch2;
+    uint32_t seq2;
+    FUZZ_CHECK(parseGateSinceRequest(text, length, epoch2, seq2));
+    FUZZ_CHECK(epoch2 == epoch && seq2 == seq);
+    // 数字部分はuint32_tに収まる値として読めている
+    const char* colon = (const char*)memchr(data + 6, ':', size - 6);
+    FUZZ_CHECK(colon != nullptr);
+    std::string digits(colon + 1, (const char*)data + size);
+    FUZZ_CHECK(strtoull(digits.c_str(), nullptr, 10) == seq);
+  }
+  // 入力から作った値は必ず往復できる
+  if (size >= 8) {
+    uint32_t e = getSampleU32(data);
+    uint32_t s = getSampleU32(data + 4);
+    char text[32];
+    size_t length = formatGateSinceRequest(text, sizeof(text), e, s);
+    FUZZ_CHECK(length > 0 && parseGateSinceRequest(text, length, epoch, seq));
+    FUZZ_CHECK(epoch == e && seq == s);
+  }
+}
+
+// 通知ペイロードの解析と受信キュー・重複排除
+static void fuzzGateBatch(const uint8_t* data, size_t size) {
+  const char* payload = (const char*)data;
+  GateInbox<64> inbox;
+  GateStreamTracker stream;
+  size_t events = 0;
+  size_t parsed = parseGateBatch(payload, size,
+                                 [&](uint32_t seq, const char* text, size_t length, uint16_t age) {
+                                   FUZZ_CHECK(text >= payload && text + length <= payload + size);
+                                   FUZZ_CHECK(memchr(text, '\n', length) == nullptr);
+                                   inbox.push(seq, text, length, 0, age);
+                                   events++;
+                                 },
+                                 [&](uint32_t epoch) { inbox.pushEpoch(epoch); });
+  FUZZ_CHECK(parsed == events);
+  GateEvent ev;
+  while (inbox.pop(ev)) {
+    FUZZ_CHECK(ev.length <= GATE_EVENT_DATA_MAX);
+    FUZZ_CHECK(ev.data[ev.length] == '\0');
+    FUZZ_CHECK(!ev.isEpoch || ev.length == 0);
+    stream.apply(ev);
+  }
+}
+
+// サーバーと同じ手順でログへ追加し、MTUごとに詰めた通知をクライアントと同じ手順で読み戻す
+static void fuzzEventLog(const uint8_t* data, size_t size) {
+  if (size < 2) {
+    return;
+  }
+  struct Appended {
+    uint32_t seq;
+    std::string data;
+    uint16_t age;
+    uint32_t timestamp;
+  };
+  size_t capacity = 40 + data[0] % 200;  // 1イベントが必ず収まる大きさ以上
+  uint32_t now = 1000000;
+  GateEventLog<16> log;
+  std::vector<Appended> appended;
+  GateLineReader reader;
+  for (size_t i = 1; i < size; i++) {
+    if (reader.feed((char)data[i])) {
+      uint16_t age;
+      size_t dataLength = splitGateAge(reader.line(), reader.length(), age);
+      uint32_t timestamp = now - (uint32_t)(i * 7);
+      uint32_t seq = log.append(timestamp, reader.line(), dataLength, age);
+      appended.push_back({seq, std::string(reader.line(), dataLength), age, timestamp});
+    }
+  }
+  uint32_t cursor = log.oldestSeq();
+  uint32_t expected = cursor;
+  char out[GATE_BATCH_MAX];
+  while (true) {
+    size_t length = log.packSince(cursor, out, capacity, now);
+    if (length == 0) {
+      break;
+    }
+    FUZZ_CHECK(length <= capacity);
+    parseGateBatch(out, length, [&](uint32_t seq, const char* text, size_t textLength, uint16_t age) {
+      FUZZ_CHECK(seq == expected);
+      const Appended& a = appended[appended.size() - (log.nextSeq() - seq)];
+      FUZZ_CHECK(a.seq == seq);
+      FUZZ_CHECK(a.data.size() == textLength && memcmp(a.data.data(), text, textLength) == 0);
+      FUZZ_CHECK(age == addGateAge(a.age, now - a.timestamp));
+      expected++;
+    });
+  }
+  FUZZ_CHECK(expected == log.nextSeq());
+}
+
+// 記録ブロックの復号（任意のバイト列）と、入力から作ったサンプル列の往復
+static void fuzzSampleBlock(const uint8_t* data, size_t size) {
+  static uint8_t block[SAMPLE_BLOCK_SIZE];
+  SampleBlockInfo info;
+  uint32_t samples = 0;
+  if (decodeSampleBlock(data, size, info, [&](uint32_t, uint8_t, uint8_t status) {
+        FUZZ_CHECK(status < 16);
+        samples++;
+      }) == SAMPLE_BLOCK_OK) {
+    FUZZ_CHECK(samples == info.count);
+  }
+  size_t copy = size < SAMPLE_BLOCK_SIZE ? size : SAMPLE_BLOCK_SIZE;
+  memset(block, 0, sizeof(block));
+  memcpy(block, data, copy);
+  decodeSampleBlock(block, sizeof(block), info, [](uint32_t, uint8_t, uint8_t) {});
+
+  // 3バイトごとに1サンプル（経過時間・距離・ステータス）
+  struct Sample {
+    uint32_t time;
+    uint8_t range;
+    uint8_t status;
+  };
+  static SampleBlockEncoder encoder;
+  std::vector<Sample> added;
+  uint32_t time = size >= 4 ? getSampleU32(data) : 0;
+  encoder.begin((uint32_t)size, time);
+  for (size_t i = 4; i + 3 <= size; i += 3) {
+    time += data[i] * (data[i + 2] & 0x80 ? 997u : 1u);
+    Sample s = {time, data[i + 1], (uint8_t)(data[i + 2] & 0x0F)};
+    if (!encoder.add(s.time, s.range, s.status)) {
+      break;
+    }
+    added.push_back(s);
+  }
+  encoder.finish();
+  size_t index = 0;
+  SampleBlockResult result = decodeSampleBlock(encoder.data(), SAMPLE_BLOCK_SIZE, info,
+                                               [&](uint32_t t, uint8_t range, uint8_t status) {
+                                                 FUZZ_CHECK(index < added.size());
+                                                 FUZZ_CHECK(added[index].time == t);
+                                                 FUZZ_CHECK(added[index].range == range);
+                                                 FUZZ_CHECK(added[index].status == status);
+                                                 index++;
+                                               });
+  FUZZ_CHECK(result == SAMPLE_BLOCK_OK);
+  FUZZ_CHECK(index == added.size());
+}
+
+// 保存されたレコードの検査と、検査を通った値の保存→読み込みの往復
+static void fuzzBaseline(const uint8_t* data, size_t size) {
+  BaselineRecord record;
+  BaselineLoadResult result = decodeBaselineRecord(data, size, record);
+  FUZZ_CHECK(result <= BASELINE_OUT_OF_RANGE);
+  if (result == BASELINE_OK) {
+    FUZZ_CHECK(record.baseline >= BASELINE_MIN_MM && record.baseline <= 255);
+    FUZZ_CHECK(record.noise <= BASELINE_MAX_NOISE && record.valid > 0);
+  }
+  if (result == BASELINE_OK || result == BASELINE_OUT_OF_RANGE) {
+    uint8_t encoded[BASELINE_RECORD_SIZE];
+    FUZZ_CHECK(encodeBaselineRecord(record, encoded) == BASELINE_RECORD_SIZE);
+    FUZZ_CHECK(memcmp(encoded, data, 11) == 0 && memcmp(encoded + 12, data + 12, 8) == 0);
+  }
+  FakeStorage storage;
+  storage.entries[BASELINE_STORAGE_KEY].assign(data, data + size);
+  BaselineRecord loaded = BaselineRecord();
+  BaselineLoadResult loadResult = loadBaseline(storage, size > 5 ? (int8_t)data[5] : 0, loaded);
+  FUZZ_CHECK(size == 0 ? loadResult == BASELINE_MISSING : loadResult == result);
+  if (result == BASELINE_OK) {
+    FUZZ_CHECK(saveBaseline(storage, loaded));
+    FUZZ_CHECK(loadBaseline(storage, loaded.offset, record) == BASELINE_OK);
+    FUZZ_CHECK(record.baseline == loaded.baseline && record.generation == loaded.generation);
+    FUZZ_CHECK(loadBaseline(storage, (int8_t)(loaded.offset + 1), record) == BASELINE_OFFSET_CHANGED);
+  }
+  FUZZ_CHECK(baselineTolerance(record, 10) >= 2);
+}
+
+static bool sameDeviceConfig(const DeviceConfig& a, const DeviceConfig& b) {
+  return a.lane == b.lane && a.offset == b.offset && a.threshold == b.threshold && a.ignoreMs == b.ignoreMs &&
+         a.power == b.power && strcmp(a.name, b.name) == 0;
+}
+
+// 保存された設定の検査と往復、"$" コマンドを適用しても設定が範囲内に留まること
+static void fuzzDeviceConfig(const uint8_t* data, size_t size) {
+  DeviceConfig config = defaultDeviceConfig();
+  if (decodeDeviceConfig(data, size, config)) {
+    FUZZ_CHECK(validDeviceConfig(config));
+    uint8_t encoded[DEVICE_CONFIG_SIZE];
+    DeviceConfig decoded;
+    FUZZ_CHECK(decodeDeviceConfig(encoded, encodeDeviceConfig(config, encoded), decoded));
+    FUZZ_CHECK(sameDeviceConfig(decoded, config));
+  }
+  FakeStorage storage;
+  storage.entries[DEVICE_CONFIG_KEY].assign(data, data + size);
+  static const uint8_t mac[6] = {0xcc, 0xba, 0x97, 0x15, 0x53, 0x20};
+  DeviceConfig loaded;
+  DeviceConfigSource source = loadDeviceConfig(storage, mac, loaded);
+  FUZZ_CHECK(validDeviceConfig(loaded));
+  FUZZ_CHECK(source == DEVICE_CONFIG_FROM_STORAGE || (source == DEVICE_CONFIG_FROM_TABLE && loaded.lane == 2));
+
+  // 入力を行の列として読み、"$" で始まる行を順に適用する
+  DeviceConfigLineReader reader;
+  for (size_t i = 0; i < size; i++) {
+    if (!reader.active()) {
+      if (data[i] == '$') {
+        reader.start();
+      }
+      continue;
+    }
+    if (reader.feed((char)data[i])) {
+      FUZZ_CHECK(reader.line()[0] == '$' && reader.length() < 48 && reader.line()[reader.length()] == '\0');
+      DeviceConfig before = loaded;
+      DeviceConfigCommand command = applyDeviceConfigCommand(loaded, reader.line(), reader.length());
+      FUZZ_CHECK(command <= DEVICE_CONFIG_CMD_ERROR && validDeviceConfig(loaded));
+      if (command != DEVICE_CONFIG_CMD_CHANGED) {
+        FUZZ_CHECK(sameDeviceConfig(before, loaded));
+      }
+      char text[96];
+      FUZZ_CHECK(formatDeviceConfig(loaded, text, sizeof(text)) < sizeof(text));
+    }
+  }
+  FUZZ_CHECK(saveDeviceConfig(storage, loaded));
+  DeviceConfig saved;
+  FUZZ_CHECK(loadDeviceConfig(storage, mac, saved) == DEVICE_CONFIG_FROM_STORAGE);
+  FUZZ_CHECK(sameDeviceConfig(saved, loaded));
+}
+
+struct FuzzTarget {
+  const char* name;
+  void (*fuzz)(const uint8_t* data, size_t size);
+};
+
+static const FuzzTarget targets[] = {
+    {"count_reading", fuzzCountReading},
+    {"gate_line", fuzzGateLine},
+    {"since", fuzzSince},
+    {"gate_batch", fuzzGateBatch},
+    {"event_log", fuzzEventLog},
+    {"sample_block", fuzzSampleBlock},
+    {"baseline", fuzzBaseline},
+    {"device_config", fuzzDeviceConfig},
+};
+static const size_t TARGET_COUNT = sizeof(targets) / sizeof(targets[0]);
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+  targets[data[0] % TARGET_COUNT].fuzz(data + 1, size - 1);
+  return 0;
+}
+
+#ifndef PARSER_FUZZ_LIBFUZZER
+
+// ---- 単体実行: 正しい入力を種にした乱数変異 ----
+
+typedef std::mt19937 Rng;
+
+static uint32_t randomBelow(Rng& rng, uint32_t n) { return n ? rng() % n : 0; }
+
+// 対象ごとの正しい入力（変異の種）
+static std::string seedInput(size_t target, Rng& rng) {
+  char text[64];
+  std::string out;
+  switch (target) {
+    case 0:
+      for (int i = 0; i < 4; i++) {
+        snprintf(text, sizeof(text), "%u:%u:%u\n", 1 + randomBelow(rng, 4), randomBelow(rng, 100),
+                 randomBelow(rng, 70000));
+        out += text;
+      }
+      return out;
+    case 1:
+      for (int i = 0; i < 6; i++) {
+        snprintf(text, sizeof(text), "%c:%u\r\n", "asdf"[randomBelow(rng, 4)], randomBelow(rng, 2000));
+        out += randomBelow(rng, 3) ? text : "s\n";
+      }
+      return out;
+    case 2:
+      formatGateSinceRequest(text, sizeof(text), rng(), randomBelow(rng, 3) ? randomBelow(rng, 1000) : rng());
+      return text;
+    case 3: {
+      snprintf(text, sizeof(text), "#%08X\n", (unsigned)rng());
+      out = text;
+      uint32_t seq = randomBelow(rng, 100000);
+      for (int i = 0; i < 8; i++) {
+        snprintf(text, sizeof(text), "%u:%c:%u\n", seq + i, "asdf"[randomBelow(rng, 4)], randomBelow(rng, 500));
+        out += text;
+      }
+      return out;
+    }
+    case 4:
+      out.push_back((char)rng());
+      for (int i = 0; i < 20; i++) {
+        snprintf(text, sizeof(text), "%c:%u\n", "asdf"[randomBelow(rng, 4)], randomBelow(rng, 70000));
+        out += text;
+      }
+      return out;
+    case 6: {
+      BaselineRecord record = {(int8_t)rng(), (uint16_t)(20 + randomBelow(rng, 236)),
+                               (uint16_t)randomBelow(rng, 600), (uint8_t)randomBelow(rng, 21), (uint32_t)rng(), (uint32_t)rng()};
+      uint8_t data[BASELINE_RECORD_SIZE];
+      encodeBaselineRecord(record, data);
+      return std::string((const char*)data, sizeof(data));
+    }
+    case 7: {
+      if (randomBelow(rng, 2)) {
+        DeviceConfig config = defaultDeviceConfig();
+        config.lane = (uint8_t)randomBelow(rng, 5);
+        config.offset = (int8_t)rng();
+        config.ignoreMs = (uint16_t)(100 + randomBelow(rng, 10000));
+        uint8_t data[DEVICE_CONFIG_SIZE];
+        encodeDeviceConfig(config, data);
+        return std::string((const char*)data, sizeof(data));
+      }
+      static const char* const commands[] = {"$lane=%u\n", "$offset=-%u\r\n", "$threshold=%u\n", "$ignore=%u\n",
+                                             "$name=Lane%u\n", "$show\n", "$save\n", "$reset\n"};
+      for (int i = 0; i < 6; i++) {
+        snprintf(text, sizeof(text), commands[randomBelow(rng, 8)], randomBelow(rng, 200));
+        out += text;
+      }
+      return out;
+    }
+    default: {
+      SampleBlockEncoder encoder;
+      encoder.begin(rng(), rng());
+      uint32_t time = 0;
+      for (uint32_t i = 0, n = randomBelow(rng, 400); i < n; i++) {
+        time += 20;
+        encoder.add(time, (uint8_t)(120 - randomBelow(rng, 3) * 40), randomBelow(rng, 3) ? 0 : 11);
+      }
+      encoder.finish();
+      return std::string((const char*)encoder.data(), SAMPLE_BLOCK_SIZE);
+    }
+  }
+}
+
+// バイト反転・置換・挿入・削除・複製・切り詰めを数回適用する
+static void mutate(std::string& input, Rng& rng) {
+  static const char interesting[] = {':', '\n', '\r', '#', ' ', '0', '9', 'a', 'F', '\0', '\x7f', '\xff'};
+  int mutations = 1 + randomBelow(rng, 8);
+  for (int m = 0; m < mutations; m++) {
+    size_t size = input.size();
+    switch (randomBelow(rng, 7)) {
+      case 0:
+        if (size) input[randomBelow(rng, size)] ^= (char)(1 << randomBelow(rng, 8));
+        break;
+      case 1:
+        if (size) input[randomBelow(rng, size)] = (char)rng();
+        break;
+      case 2:
+        input.insert(input.begin() + randomBelow(rng, size + 1), interesting[randomBelow(rng, sizeof(interesting))]);
+        break;
+      case 3:
+        if (size) input.erase(randomBelow(rng, size), 1 + randomBelow(rng, 16));
+        break;
+      case 4:
+        if (size) {
+          size_t from = randomBelow(rng, size);
+          input.insert(randomBelow(rng, size + 1), input.substr(from, 1 + randomBelow(rng, 32)));
+        }
+        break;
+      case 5:
+        if (size) input.resize(randomBelow(rng, size));
+        break;
+      default:
+        input.insert(randomBelow(rng, size + 1), std::string(1 + randomBelow(rng, 12), (char)('0' + randomBelow(rng, 10))));
+        break;
+    }
+  }
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// ---- スループット計測（正しい入力のみ、検査なし） ----
+
+static volatile uint32_t benchSink;
+
+// fn() を benchMs の間くり返し、1回あたりのメッセージ数・バイト数から毎秒の値を出す
+template <typename Fn>
+static void bench(const char* name, const char* unit, uint32_t messagesPerCall, size_t bytesPerCall,
+                  uint32_t benchMs, Fn fn) {
+  uint64_t calls = 0;
+  auto start = std::chrono::steady_clock::now();
+  double elapsed;
+  do {
+    for (int i = 0; i < 256; i++) {
+      fn();
+    }
+    calls += 256;
+    elapsed = secondsSince(start);
+  } while (elapsed * 1000 < benchMs);
+  double messages = (double)calls * messagesPerCall;
+  printf("BENCH %-13s %10.2f M%s/s %9.1f MB/s %8.1f ns/%s\n", name, messages / elapsed / 1e6, unit,
+         (double)calls * bytesPerCall / elapsed / 1e6, elapsed * 1e9 / messages, unit);
+}
+
+static void runBenchmarks(uint32_t benchMs) {
+  {
+    const char value[] = "3:1234:56";
+    bench("count_reading", "msg", 1, sizeof(value) - 1, benchMs, [&]() {
+      CountReading reading;
+      benchSink += parseCountReading(value, sizeof(value) - 1, reading) ? reading.count : 0;
+    });
+  }
+  {
+    const char stream[] = "a:123\ns:45\nd:6789\nf\n";
+    bench("gate_line", "line", 4, sizeof(stream) - 1, benchMs, [&]() {
+      GateLineReader reader;
+      for (size_t i = 0; i < sizeof(stream) - 1; i++) {
+        if (reader.feed(stream[i])) {
+          uint16_t age;
+          benchSink += (uint32_t)splitGateAge(reader.line(), reader.length(), age) + age;
+        }
+      }
+    });
+  }
+  {
+    char request[32];
+    size_t length = formatGateSinceRequest(request, sizeof(request), 0x1A2B3C4D, 123456);
+    bench("since", "msg", 1, length, benchMs, [&]() {
+      uint32_t epoch;
+      uint32_t seq;
+      benchSink += parseGateSinceRequest(request, length, epoch, seq) ? seq : 0;
+    });
+  }
+  GateEventLog<256> log;
+  for (uint32_t i = 0; i < 256; i++) {
+    log.append(i, &"asdf"[i % 4], 1, (uint16_t)(i * 3));
+  }
+  {
+    char payload[GATE_BATCH_MAX];
+    uint32_t cursor = log.oldestSeq();
+    size_t length = log.packSince(cursor, payload, 182, 1000);  // MTU 185
+    uint32_t events = cursor - log.oldestSeq();
+    bench("gate_batch", "event", events, length, benchMs, [&]() {
+      benchSink += (uint32_t)parseGateBatch(payload, length, [](uint32_t seq, const char*, size_t, uint16_t age) {
+        benchSink += seq + age;
+      });
+    });
+    bench("event_log", "event", events, length, benchMs, [&]() {
+      char out[GATE_BATCH_MAX];
+      uint32_t c = log.oldestSeq();
+      benchSink += (uint32_t)log.packSince(c, out, 182, 1000);
+    });
+  }
+  {
+    SampleBlockEncoder encoder;
+    encoder.begin(1, 0);
+    uint32_t count = 0;
+    for (uint32_t t = 20; encoder.add(t, (uint8_t)(t % 97 == 0 ? 40 : 120), 0); t += 20) {
+      count++;
+    }
+    encoder.finish();
+    bench("sample_block", "sample", count, SAMPLE_BLOCK_SIZE, benchMs, [&]() {
+      SampleBlockInfo info;
+      decodeSampleBlock(encoder.data(), SAMPLE_BLOCK_SIZE, info, [](uint32_t t, uint8_t range, uint8_t) {
+        benchSink += t + range;
+      });
+    });
+    bench("sample_encode", "sample", count, SAMPLE_BLOCK_SIZE, benchMs, [&]() {
+      SampleBlockEncoder e;
+      e.begin(1, 0);
+      for (uint32_t t = 20; e.add(t, (uint8_t)(t % 97 == 0 ? 40 : 120), 0); t += 20) {
+      }
+      benchSink += (uint32_t)e.finish();
+    });
+  }
+}
+
+static bool readFile(const char* path, std::string& out) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  char buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    out.append(buffer, n);
+  }
+  fclose(file);
+  return true;
+}
+
+static void usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--target NAME] [--iterations N] [--seed N] [--bench-ms MS] [--no-bench] [FILE...]\n"
+          "targets:",
+          program);
+  for (size_t i = 0; i < TARGET_COUNT; i++) {
+    fprintf(stderr, " %s", targets[i].name);
+  }
+  fprintf(stderr, "\n");
+}
+
+int main(int argc, char** argv) {
+  const char* only = nullptr;
+  uint32_t iterations = 200000;
+  uint32_t seed = 1;
+  uint32_t benchMs = 200;
+  bool runBench = true;
+  std::vector<const char*> files;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (strcmp(arg, "--target") == 0 && value) {
+      only = value;
+      i++;
+    } else if (strcmp(arg, "--iterations") == 0 && value) {
+      iterations = (uint32_t)strtoul(value, nullptr, 10);
+      i++;
+    } else if (strcmp(arg, "--seed") == 0 && value) {
+      seed = (uint32_t)strtoul(value, nullptr, 10);
+      i++;
+    } else if (strcmp(arg, "--bench-ms") == 0 && value) {
+      benchMs = (uint32_t)strtoul(value, nullptr, 10);
+      i++;
+    } else if (strcmp(arg, "--no-bench") == 0) {
+      runBench = false;
+    } else if (arg[0] == '-') {
+      usage(argv[0]);
+      return 2;
+    } else {
+      files.push_back(arg);
+    }
+  }
+
+  // 保存された入力の再実行（libFuzzerの入力形式: 先頭1バイトが対象番号）
+  if (!files.empty()) {
+    for (const char* path : files) {
+      std::string input;
+      if (!readFile(path, input)) {
+        return 1;
+      }
+      LLVMFuzzerTestOneInput((const uint8_t*)input.data(), input.size());
+      printf("REPLAY %s (%zu bytes, target %s): ok\n", path, input.size(),
+             input.empty() ? "-" : targets[(uint8_t)input[0] % TARGET_COUNT].name);
+    }
+    return 0;
+  }
+
+  bool found = only == nullptr;
+  for (size_t t = 0; t < TARGET_COUNT; t++) {
+    if (only && strcmp(only, targets[t].name) != 0) {
+      continue;
+    }
+    found = true;
+    Rng rng(seed + (uint32_t)t);
+    size_t bytes = 0;
+    size_t maxLength = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; i++) {
+      std::string input = seedInput(t, rng);
+      if (randomBelow(rng, 16) != 0) {
+        mutate(input, rng);
+      }
+      targets[t].fuzz((const uint8_t*)input.data(), input.size());
+      bytes += input.size();
+      maxLength = input.size() > maxLength ? input.size() : maxLength;
+    }
+    double elapsed = secondsSince(start);
+    printf("FUZZ  %-13s execs=%lu crash_free=yes %.0f execs/s avg_len=%zu max_len=%zu\n", targets[t].name,
+           (unsigned long)iterations, iterations / elapsed, iterations ? bytes / iterations : 0, maxLength);
+  }
+  if (!found) {
+    usage(argv[0]);
+    return 2;
+  }
+  if (runBench && only == nullptr) {
+    runBenchmarks(benchMs);
+  }
+  return 0;
+}
+
+#endif  // PARSER_FUZZ_LIBFUZZER
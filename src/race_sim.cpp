@@ -0,0 +1,667 @@
+// レース全体のシミュレータ（ホスト用、pio run -e race_sim）
+//
+// receiver×4・transmitter・tanaka_gate_server・tanaka_gate_client のロジックを1プロセスで
+// 仮想時間で動かし、BLE・UARTの区間を遅延・揺らぎ・損失・切断つきのモデルで置き換える。
+// 各レーンの正解通過時刻とclientのUART出力を突き合わせ、レーンごとのカウントが完全に
+// 一致するかを確認する（不一致なら終了コード1）。プロトコル変更を実機の前に評価するために使う
+//
+// 使い方:
+//   program --laps 1000 --seed 1
+//   program --laps 500 --read-loss 0.1 --notify-fail 0.2 --disconnects-per-hour 30
+//
+// モデル化している各機器の動き（ファームウェアと同じ判断をするよう共通ヘッダを使う）:
+//   receiver    ReceiverApp（測定約10ms + delay(20)、25msごとにキャラクタリスティック更新）
+//   transmitter 25msごとに1台ずつブロッキング読み取り → CountRelay → UART "a:age"
+//               切断後は30秒ごとの再スキャン（3秒、最初に見つけた1台で停止）で再接続
+//   server      10msごとにUART行をGateEventLogへ追加し、GateClientTable::fanOut で通知
+//   client      通知を parseGateBatch → GateInbox、10msごとにエポック確認・重複排除してUART出力
+//               再接続時は "SINCE" で受信済み番号の続きを要求してから通知を購読する
+//               欠番・受信キューの溢れの後も "SINCE" で続きを要求する
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "count_relay.h"
+#include "gate_client_table.h"
+#include "gate_event_receiver.h"
+#include "hal_fake.h"
+#include "latency_histogram.h"
+#include "receiver_app.h"
+
+#define LANES 4
+#define EVENT_LOG_SIZE 256     // tanaka_gate_serverと同じ
+#define MAX_GATE_CLIENTS 3     // tanaka_gate_serverと同じ
+#define INBOX_SIZE 64          // tanaka_gate_clientと同じ
+#define CLIENT_MTU 185
+
+#define RED_LED_PIN 1
+#define BLUE_LED_PIN 2
+
+static const uint32_t NEVER = 0xFFFFFFFF;
+static const char gateChars[LANES] = {'a', 's', 'd', 'f'};
+
+// 機器ごとの時間（ms）
+static const uint32_t RECEIVER_LOOP_DELAY = 20;
+static const uint32_t TX_POLLING_INTERVAL = 25;
+static const uint32_t TX_LOOP_DELAY = 10;
+static const uint32_t TX_CONNECT_MS = 300;       // connect + サービス探索
+static const uint32_t TX_SCAN_INTERVAL = 30000;
+static const uint32_t TX_SCAN_DURATION = 3000;
+static const uint32_t ADVERTISING_INTERVAL = 100;
+static const uint32_t SERVER_LOOP_DELAY = 10;
+static const uint32_t CLIENT_LOOP_DELAY = 10;
+static const uint32_t CLIENT_CONNECT_MS = 1000;  // スキャン + connect + MTU交換
+static const uint32_t DRAIN_MS = 60000;          // 最後の通過から終了までの時間
+
+struct SimConfig {
+  int laps = 1000;                 // レーンごとの周回数
+  uint32_t seed = 1;
+  uint32_t bleLatency = 8;         // BLE読み取り・通知の最小遅延（ms）
+  uint32_t bleJitter = 15;         // 遅延の揺らぎ（0〜jitter msを一様に加算）
+  double readLoss = 0.02;          // transmitterの読み取り失敗率
+  double notifyFail = 0.05;        // serverの通知送信失敗率（輻輳）
+  uint32_t uartLatency = 1;        // UART 1行の遅延（ms）
+  double uartLoss = 0;             // UART 1行の損失率（プロトコル上回復できない）
+  double disconnectsPerHour = 6;   // BLEリンク1本あたりの切断頻度
+  uint32_t reconnectMs = 1500;     // 切断後に相手が見えない時間（ms）
+};
+
+class SimRandom {
+ public:
+  explicit SimRandom(uint32_t seed) : engine_(seed) {}
+  uint32_t uniform(uint32_t from, uint32_t to) {
+    return std::uniform_int_distribution<uint32_t>(from, to)(engine_);
+  }
+  bool chance(double p) { return p > 0 && std::uniform_real_distribution<double>(0, 1)(engine_) < p; }
+  double normal(double mean, double sd) { return std::normal_distribution<double>(mean, sd)(engine_); }
+  // 平均 meanMs の指数分布（切断間隔）
+  uint32_t exponential(double meanMs) {
+    double value = std::exponential_distribution<double>(1.0 / meanMs)(engine_);
+    return value < 4e9 ? (uint32_t)value : NEVER - 1;
+  }
+
+ private:
+  std::mt19937 engine_;
+};
+
+// receiverのBLE: 通知した最新値をキャラクタリスティックの値として保持する
+class SimBleLink : public HalBleLink {
+ public:
+  SimBleLink() : isConnected(false) {}
+  bool connected() override { return isConnected; }
+  void notify(const char* data, size_t length) override { value.assign(data, length); }
+
+  bool isConnected;
+  std::string value;
+};
+
+struct Lane {
+  Lane()
+      : sensor(clock, [this](uint32_t now, uint8_t& range, uint8_t& status) { source(now, range, status); },
+               10000),
+        app(clock, sensor, pwm, serial, link, RED_LED_PIN, BLUE_LED_PIN),
+        nextPass(0), nextStep(0), reachableAt(0), nextDrop(NEVER), txConnected(false), doConnect(false),
+        delivered(0) {}
+
+  // 正解の通過時刻から距離を決める（通過中は40mm、それ以外は120mm）
+  void source(uint32_t now, uint8_t& range, uint8_t& status) {
+    while (nextPass < passes.size() && passes[nextPass] + dwell <= now) {
+      nextPass++;
+    }
+    status = 0;
+    range = nextPass < passes.size() && passes[nextPass] <= now ? 40 : 120;
+  }
+
+  // receiverのloop()1回分（自分の時計を現在時刻まで進めてから実行）
+  void step(uint32_t now) {
+    if (now > clock.millis()) {
+      clock.advanceMicros((uint64_t)(now - clock.millis()) * 1000);
+    }
+    app.step();
+    clock.delay(RECEIVER_LOOP_DELAY);
+    nextStep = clock.millis();
+  }
+
+  std::vector<uint32_t> passes;  // 正解の通過開始時刻
+  uint32_t dwell = 50;           // センサー前にいる時間（ms）
+  FakeClock clock;
+  FakeRangeSensor sensor;
+  FakePwm pwm;
+  FakeSerial serial;
+  SimBleLink link;
+  ReceiverApp app;
+  size_t nextPass;
+  uint32_t nextStep;
+  uint32_t reachableAt;  // 切断後、再び見えるようになる時刻
+  uint32_t nextDrop;     // 次の切断時刻
+  bool txConnected;      // transmitter側の接続状態
+  bool doConnect;        // スキャンで見つけた（次のloopで接続）
+  uint32_t delivered;    // clientがUART出力した件数
+};
+
+struct UartLine {
+  uint32_t deliverAt;
+  uint32_t sentAt;
+  std::string text;
+};
+
+struct Packet {
+  uint32_t deliverAt;
+  uint16_t connId;
+  std::string payload;
+};
+
+// clientがUARTへ出力した1件
+struct Output {
+  uint32_t time;
+  int lane;
+  uint32_t passTime;
+  uint32_t reportedAge;  // 経過時間の連鎖から求めた検出からの時間（不明ならGATE_AGE_UNKNOWN）
+};
+
+struct Stats {
+  uint32_t receiverSteps = 0;
+  uint32_t readOk = 0;
+  uint32_t readFail = 0;
+  uint32_t relayEvents = 0;
+  uint32_t uartLost = 0;
+  uint32_t notifyOk = 0;
+  uint32_t notifyFail = 0;
+  uint32_t packetsDropped = 0;
+  uint32_t laneDisconnects = 0;
+  uint32_t clientDisconnects = 0;
+  uint32_t catchUps = 0;
+  uint32_t gapCatchUps = 0;  // 欠番・受信キューの溢れで送った SINCE
+  uint32_t unknownOutputs = 0;
+};
+
+class Simulation {
+ public:
+  explicit Simulation(const SimConfig& config)
+      : config_(config), random_(config.seed), txWake_(0), txLastPolling_(0), txLastScan_(0),
+        txCurrent_(0), serverWake_(0), clientWake_(0), clientConnected_(false), clientReconnectAt_(3000),
+        clientConnId_(0), clientNextDrop_(NEVER),
+        lastPassTime_(0), sender_(*this) {
+    clients_.setEpoch(random_.uniform(1, 0xFFFFFFFE) | 1);
+  }
+
+  // 各レーンの正解通過時刻を作る（1周3.2秒以上、平均4秒）
+  void generatePasses() {
+    for (int i = 0; i < LANES; i++) {
+      uint32_t t = 20000 + random_.uniform(0, 4000);
+      for (int lap = 0; lap < config_.laps; lap++) {
+        lanes_[i].passes.push_back(t);
+        double lapMs = random_.normal(4000, 300);
+        t += lapMs > 3200 ? (uint32_t)lapMs : 3200;
+      }
+      lastPassTime_ = std::max(lastPassTime_, lanes_[i].passes.back());
+    }
+  }
+
+  void run() {
+    // receiverの起動と校正（各自の時計で進める）
+    for (int i = 0; i < LANES; i++) {
+      lanes_[i].app.setDeviceNumber(i + 1);
+      lanes_[i].app.begin(0);
+      lanes_[i].nextStep = lanes_[i].clock.millis();
+      lanes_[i].nextDrop = nextDropTime(0);
+    }
+    clientNextDrop_ = nextDropTime(0);
+    // transmitterの setup(): 待機と起動LED、BLE初期化の後に10秒スキャン
+    txWake_ = scan(2000 + 1200 + 1000, 10000);
+
+    uint32_t endTime = lastPassTime_ + DRAIN_MS;
+    uint32_t now = 0;
+    while (now < endTime) {
+      now = nextWake();
+      for (int i = 0; i < LANES; i++) {
+        if (lanes_[i].nextDrop <= now) {
+          dropLane(i, now);
+        }
+        if (lanes_[i].nextStep <= now) {
+          lanes_[i].step(now);
+          stats.receiverSteps++;
+        }
+      }
+      if (clientNextDrop_ <= now) {
+        dropClient(now);
+      }
+      if (txWake_ <= now) {
+        transmitterLoop(now);
+      }
+      if (serverWake_ <= now) {
+        serverLoop(now);
+      }
+      while (!packets_.empty() && packets_.front().deliverAt <= now) {
+        deliverPacket(packets_.front(), now);
+        packets_.pop_front();
+      }
+      if (clientWake_ <= now) {
+        clientLoop(now);
+      }
+    }
+    simulatedMs = endTime;
+  }
+
+  Lane lanes_[LANES];
+  std::vector<Output> outputs;
+  Stats stats;
+  uint32_t simulatedMs = 0;
+  LatencyHistogram detectToTx;      // 検出からtransmitter受信まで（receiverの経過時間）
+  LatencyHistogram txToServer;      // transmitter送信からserverのログ追加まで
+  LatencyHistogram serverToNotify;  // serverのログ追加から通知送信まで
+  LatencyHistogram serverToUart;    // serverのログ追加からclientのUART出力まで
+  LatencyHistogram endToEnd;        // 通過開始からclientのUART出力まで（正解時刻基準）
+  LatencyHistogram ageUnderReport;  // 正解の経過時間 - 経過時間の連鎖で求めた値（未計上分）
+
+  uint32_t inboxOverflows() const { return inbox_.overflows(); }
+  uint32_t filterGaps() const { return stream_.filter().gaps; }
+  uint32_t filterDuplicates() const { return stream_.filter().duplicates; }
+  uint32_t logSkipped() const { return skipped_; }
+
+ private:
+  struct NotifySender {
+    explicit NotifySender(Simulation& sim) : sim_(sim) {}
+    bool send(uint16_t connId, const uint8_t* data, size_t length) { return sim_.sendNotify(connId, data, length); }
+    Simulation& sim_;
+  };
+
+  uint32_t nextDropTime(uint32_t now) {
+    if (config_.disconnectsPerHour <= 0) {
+      return NEVER;
+    }
+    uint32_t interval = random_.exponential(3600000.0 / config_.disconnectsPerHour);
+    uint32_t at = now + interval;
+    // 最後の通過以降は切断させない（取りこぼしの回復を終了時刻までに終えるため）
+    return at < now || at > lastPassTime_ ? NEVER : at;
+  }
+
+  uint32_t bleDelay() { return config_.bleLatency + random_.uniform(0, config_.bleJitter); }
+
+  uint32_t nextWake() const {
+    uint32_t next = std::min(std::min(txWake_, serverWake_), clientWake_);
+    for (int i = 0; i < LANES; i++) {
+      next = std::min(next, std::min(lanes_[i].nextStep, lanes_[i].nextDrop));
+    }
+    next = std::min(next, clientNextDrop_);
+    if (!packets_.empty()) {
+      next = std::min(next, packets_.front().deliverAt);
+    }
+    return next;
+  }
+
+  // ---- receiver <-> transmitter のBLE ----
+
+  void dropLane(int i, uint32_t now) {
+    Lane& lane = lanes_[i];
+    lane.nextDrop = nextDropTime(now);
+    if (!lane.link.isConnected) {
+      return;
+    }
+    lane.link.isConnected = false;
+    lane.txConnected = false;  // onDisconnect コールバック
+    lane.reachableAt = now + config_.reconnectMs;
+    stats.laneDisconnects++;
+  }
+
+  // ブロッキングスキャン: 最初に見つけた未接続デバイスで停止する
+  // 戻り値: スキャンが終わった時刻
+  uint32_t scan(uint32_t start, uint32_t duration) {
+    uint32_t found = NEVER;
+    for (int i = 0; i < LANES; i++) {
+      if (!lanes_[i].txConnected && !lanes_[i].doConnect) {
+        found = std::min(found, std::max(start, lanes_[i].reachableAt) + ADVERTISING_INTERVAL);
+      }
+    }
+    if (found > start + duration) {
+      return start + duration;
+    }
+    for (int i = 0; i < LANES; i++) {
+      if (!lanes_[i].txConnected && !lanes_[i].doConnect &&
+          std::max(start, lanes_[i].reachableAt) + ADVERTISING_INTERVAL <= found) {
+        lanes_[i].doConnect = true;
+      }
+    }
+    return found;
+  }
+
+  // transmitterのloop()1回分。ブロッキング処理の分だけ次の起床を遅らせる
+  void transmitterLoop(uint32_t now) {
+    uint32_t t = now;
+    if (t - txLastPolling_ >= TX_POLLING_INTERVAL) {
+      txLastPolling_ = t;
+      t = pollLane(txCurrent_, t);
+      txCurrent_ = (txCurrent_ + 1) % LANES;
+    }
+    for (int i = 0; i < LANES; i++) {
+      if (lanes_[i].doConnect) {
+        lanes_[i].doConnect = false;
+        t += TX_CONNECT_MS;
+        lanes_[i].txConnected = true;
+        lanes_[i].link.isConnected = true;
+      }
+    }
+    bool needRescan = false;
+    for (int i = 0; i < LANES; i++) {
+      needRescan = needRescan || (!lanes_[i].txConnected && !lanes_[i].doConnect);
+    }
+    if (needRescan && t - txLastScan_ >= TX_SCAN_INTERVAL) {
+      txLastScan_ = t;
+      t = scan(t, TX_SCAN_DURATION);
+    }
+    txWake_ = t + TX_LOOP_DELAY;
+  }
+
+  // pollDeviceData(): 読み取り要求時点の値が遅延後に返る
+  uint32_t pollLane(int i, uint32_t now) {
+    Lane& lane = lanes_[i];
+    if (!lane.txConnected) {
+      return now;
+    }
+    std::string value = lane.link.value;
+    uint32_t done = now + bleDelay();
+    if (!lane.link.isConnected || random_.chance(config_.readLoss) || value.empty()) {
+      stats.readFail++;
+      return done;
+    }
+    stats.readOk++;
+    relay_.update(value.data(), value.length(), [&](int passLane, int32_t age) {
+      stats.relayEvents++;
+      char line[24];
+      if (age >= 0) {
+        detectToTx.record(age);
+        snprintf(line, sizeof(line), "%c:%lu", gateChars[passLane], (unsigned long)age);
+      } else {
+        snprintf(line, sizeof(line), "%c", gateChars[passLane]);
+      }
+      if (random_.chance(config_.uartLoss)) {
+        stats.uartLost++;
+        return;
+      }
+      uart_.push_back({done + config_.uartLatency, done, line});
+    });
+    return done;
+  }
+
+  // ---- server ----
+
+  void serverLoop(uint32_t now) {
+    while (!uart_.empty() && uart_.front().deliverAt <= now) {
+      const UartLine& line = uart_.front();
+      uint16_t age;
+      size_t dataLength = splitGateAge(line.text.data(), line.text.length(), age);
+      uint32_t seq = eventLog_.append(now, line.text.data(), dataLength, age);
+      if (appendTimes_.size() <= seq) {
+        appendTimes_.resize(seq + 1, 0);
+      }
+      appendTimes_[seq] = now;
+      txToServer.record(now - line.sentAt);
+      uart_.pop_front();
+    }
+    serverNow_ = now;
+    clients_.fanOut(eventLog_, sender_, now, &serverToNotify);
+    serverWake_ = now + SERVER_LOOP_DELAY;
+  }
+
+  bool sendNotify(uint16_t connId, const uint8_t* data, size_t length) {
+    if (!clientConnected_ || connId != clientConnId_ || random_.chance(config_.notifyFail)) {
+      stats.notifyFail++;
+      return false;
+    }
+    stats.notifyOk++;
+    // 同じ接続の通知は順番どおりに届く
+    uint32_t deliverAt = serverNow_ + bleDelay();
+    if (!packets_.empty() && packets_.back().deliverAt > deliverAt) {
+      deliverAt = packets_.back().deliverAt;
+    }
+    packets_.push_back({deliverAt, connId, std::string((const char*)data, length)});
+    return true;
+  }
+
+  // ---- server <-> client のBLE ----
+
+  void dropClient(uint32_t now) {
+    clientNextDrop_ = nextDropTime(now);
+    if (!clientConnected_) {
+      return;
+    }
+    clientConnected_ = false;
+    GateClientSlot* slot = clients_.find(clientConnId_);
+    if (slot) {
+      skipped_ += slot->skipped;
+    }
+    clients_.disconnect(clientConnId_);
+    stats.packetsDropped += (uint32_t)packets_.size();
+    packets_.clear();
+    clientReconnectAt_ = now + config_.reconnectMs + CLIENT_CONNECT_MS;
+    stats.clientDisconnects++;
+  }
+
+  // 接続: SINCEで続きを要求してから購読（tanaka_gate_clientのconnectToServer()と同じ順序）
+  void connectClient() {
+    clientConnId_++;
+    clients_.connect(clientConnId_, eventLog_.nextSeq());
+    clients_.setMtu(clientConnId_, CLIENT_MTU);
+    if (stream_.hasEpoch()) {
+      clients_.requestSince(clientConnId_, stream_.epoch(), stream_.lastSeq(), eventLog_);
+      stats.catchUps++;
+    }
+    clients_.setSubscribed(clientConnId_, true);
+    clientConnected_ = true;
+  }
+
+  // notifyCallback(): ペイロードをパースして受信キューへ
+  void deliverPacket(const Packet& packet, uint32_t now) {
+    parseGateBatch(packet.payload.data(), packet.payload.length(),
+                   [&](uint32_t seq, const char* data, size_t dataLength, uint16_t age) {
+                     inbox_.push(seq, data, dataLength, now, age);
+                   },
+                   [&](uint32_t epoch) { inbox_.pushEpoch(epoch); });
+  }
+
+  // processInbox(): エポック確認・重複排除してUARTへ出力
+  void clientLoop(uint32_t now) {
+    if (!clientConnected_ && now >= clientReconnectAt_) {
+      connectClient();
+    }
+    GateEvent ev;
+    while (inbox_.pop(ev)) {
+      GateStreamTracker::Action action = stream_.apply(ev);
+      if (action == GateStreamTracker::FORWARD) {
+        recordOutput(ev, now);
+      } else if (action == GateStreamTracker::GAP || action == GateStreamTracker::CATCHING_UP) {
+        requestCatchUp(now);
+      }
+    }
+    if (inbox_.overflows() != inboxOverflowsSeen_) {
+      inboxOverflowsSeen_ = inbox_.overflows();
+      requestCatchUp(now);
+    }
+    clientWake_ = now + CLIENT_LOOP_DELAY;
+  }
+
+  // requestCatchUp(): 欠番・受信キューの溢れの後に SINCE で続きを要求する
+  void requestCatchUp(uint32_t now) {
+    if (clientConnected_ && stream_.requestCatchUp(now)) {
+      clients_.requestSince(clientConnId_, stream_.epoch(), stream_.lastSeq(), eventLog_);
+      stats.gapCatchUps++;
+    }
+  }
+
+  void recordOutput(const GateEvent& ev, uint32_t now) {
+    int lane = -1;
+    for (int i = 0; i < LANES; i++) {
+      if (ev.length == 1 && ev.data[0] == gateChars[i]) {
+        lane = i;
+      }
+    }
+    if (lane < 0) {
+      stats.unknownOutputs++;
+      return;
+    }
+    Lane& l = lanes_[lane];
+    uint32_t passTime = l.delivered < l.passes.size() ? l.passes[l.delivered] : now;
+    l.delivered++;
+    uint32_t reported = ev.age != GATE_AGE_UNKNOWN ? addGateAge(ev.age, now - ev.timestamp) : GATE_AGE_UNKNOWN;
+    outputs.push_back({now, lane, passTime, reported});
+    endToEnd.record(now - passTime);
+    if (ev.seq < appendTimes_.size()) {
+      serverToUart.record(now - appendTimes_[ev.seq]);
+    }
+    if (reported != GATE_AGE_UNKNOWN) {
+      ageUnderReport.record(now - passTime > reported ? now - passTime - reported : 0);
+    }
+  }
+
+  SimConfig config_;
+  SimRandom random_;
+
+  // transmitter
+  CountRelay relay_;
+  uint32_t txWake_;
+  uint32_t txLastPolling_;
+  uint32_t txLastScan_;
+  int txCurrent_;
+  std::deque<UartLine> uart_;
+
+  // server
+  GateEventLog<EVENT_LOG_SIZE> eventLog_;
+  GateClientTable<MAX_GATE_CLIENTS> clients_;
+  std::vector<uint32_t> appendTimes_;  // シーケンス番号ごとのログ追加時刻
+  uint32_t serverWake_;
+  uint32_t serverNow_ = 0;
+  uint32_t skipped_ = 0;
+
+  // client
+  GateInbox<INBOX_SIZE> inbox_;
+  GateStreamTracker stream_;
+  uint32_t inboxOverflowsSeen_ = 0;
+  std::deque<Packet> packets_;  // 配送待ちの通知
+  uint32_t clientWake_;
+  bool clientConnected_;
+  uint32_t clientReconnectAt_;
+  uint16_t clientConnId_;
+  uint32_t clientNextDrop_;
+
+  uint32_t lastPassTime_;
+  NotifySender sender_;
+};
+
+static void printHistogram(const LatencyHistogram& histogram, const char* name) {
+  char line[128];
+  histogram.format(line, sizeof(line), name, "ms");
+  printf("%s mean=%lu\n", line, (unsigned long)histogram.mean());
+}
+
+static void usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--laps N] [--seed N] [--ble-latency MS] [--ble-jitter MS] [--read-loss P]\n"
+          "          [--notify-fail P] [--uart-latency MS] [--uart-loss P]\n"
+          "          [--disconnects-per-hour N] [--reconnect-ms MS]\n",
+          program);
+}
+
+int main(int argc, char** argv) {
+  SimConfig config;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    bool ok = value != nullptr;
+    if (strcmp(arg, "--laps") == 0 && ok) {
+      config.laps = atoi(value);
+    } else if (strcmp(arg, "--seed") == 0 && ok) {
+      config.seed = (uint32_t)strtoul(value, nullptr, 10);
+    } else if (strcmp(arg, "--ble-latency") == 0 && ok) {
+      config.bleLatency = (uint32_t)atoi(value);
+    } else if (strcmp(arg, "--ble-jitter") == 0 && ok) {
+      config.bleJitter = (uint32_t)atoi(value);
+    } else if (strcmp(arg, "--read-loss") == 0 && ok) {
+      config.readLoss = atof(value);
+    } else if (strcmp(arg, "--notify-fail") == 0 && ok) {
+      config.notifyFail = atof(value);
+    } else if (strcmp(arg, "--uart-latency") == 0 && ok) {
+      config.uartLatency = (uint32_t)atoi(value);
+    } else if (strcmp(arg, "--uart-loss") == 0 && ok) {
+      config.uartLoss = atof(value);
+    } else if (strcmp(arg, "--disconnects-per-hour") == 0 && ok) {
+      config.disconnectsPerHour = atof(value);
+    } else if (strcmp(arg, "--reconnect-ms") == 0 && ok) {
+      config.reconnectMs = (uint32_t)atoi(value);
+    } else {
+      ok = false;
+    }
+    if (!ok || config.laps <= 0) {
+      usage(argv[0]);
+      return 2;
+    }
+    i++;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  Simulation sim(config);
+  sim.generatePasses();
+  sim.run();
+  double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  printf("race_sim laps=%d seed=%lu ble=%lu+%lums read_loss=%.3f notify_fail=%.3f uart=%lums/%.3f "
+         "disconnects/h=%.1f reconnect=%lums\n",
+         config.laps, (unsigned long)config.seed, (unsigned long)config.bleLatency,
+         (unsigned long)config.bleJitter, config.readLoss, config.notifyFail,
+         (unsigned long)config.uartLatency, config.uartLoss, config.disconnectsPerHour,
+         (unsigned long)config.reconnectMs);
+
+  // レーンごとの照合
+  bool match = true;
+  printf("lane  expected  delivered  result\n");
+  for (int i = 0; i < LANES; i++) {
+    const Lane& lane = sim.lanes_[i];
+    bool ok = lane.delivered == lane.passes.size() && lane.app.detector.count() == (int)lane.passes.size();
+    match = match && ok;
+    printf("%4c  %8zu  %9lu  %s (receiver count=%d)\n", gateChars[i], lane.passes.size(),
+           (unsigned long)lane.delivered, ok ? "OK" : "MISMATCH", lane.app.detector.count());
+  }
+  match = match && sim.stats.unknownOutputs == 0;
+
+  // 通過順と出力順の入れ替わり（他レーンのより後に通過したのに先に出力された件数）
+  uint32_t inversions = 0;
+  uint32_t latestPass = 0;
+  for (const Output& output : sim.outputs) {
+    if (output.passTime < latestPass) {
+      inversions++;
+    }
+    latestPass = std::max(latestPass, output.passTime);
+  }
+
+  const Stats& s = sim.stats;
+  printf("order inversions=%lu/%zu\n", (unsigned long)inversions, sim.outputs.size());
+  printf("tx reads ok=%lu fail=%lu events=%lu uart_lost=%lu\n", (unsigned long)s.readOk,
+         (unsigned long)s.readFail, (unsigned long)s.relayEvents, (unsigned long)s.uartLost);
+  printf("server notify ok=%lu fail=%lu skipped=%lu\n", (unsigned long)s.notifyOk,
+         (unsigned long)s.notifyFail, (unsigned long)sim.logSkipped());
+  printf("client packets_dropped=%lu catchups=%lu gap_catchups=%lu duplicates=%lu gaps=%lu inbox_drop=%lu\n",
+         (unsigned long)s.packetsDropped, (unsigned long)s.catchUps, (unsigned long)s.gapCatchUps,
+         (unsigned long)sim.filterDuplicates(),
+         (unsigned long)sim.filterGaps(), (unsigned long)sim.inboxOverflows());
+  printf("disconnects lane=%lu client=%lu\n", (unsigned long)s.laneDisconnects,
+         (unsigned long)s.clientDisconnects);
+  printHistogram(sim.detectToTx, "LAT detect->tx_rx");
+  printHistogram(sim.txToServer, "LAT tx->server");
+  printHistogram(sim.serverToNotify, "LAT server_rx->notify");
+  printHistogram(sim.serverToUart, "LAT server_rx->uart");
+  printHistogram(sim.endToEnd, "LAT pass->uart");
+  printHistogram(sim.ageUnderReport, "LAT age_unreported");
+  printf("throughput: %.0f simulated s in %.2f s wall (%.0fx), %.0f events/s, %.0f receiver loops/s\n",
+         sim.simulatedMs / 1000.0, wallSeconds, sim.simulatedMs / 1000.0 / wallSeconds,
+         sim.outputs.size() / wallSeconds, s.receiverSteps / wallSeconds);
+  printf("%s\n", match ? "RESULT OK" : "RESULT MISMATCH");
+  return match ? 0 : 1;
+}
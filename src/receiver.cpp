@@ -1,140 +1,602 @@
 #include <Arduino.h>
 #include <Wire.h>
-#include <WiFi.h>
 #include <BLEDevice.h>
 #include <BLEServer.h>
 #include <BLEUtils.h>
 #include <BLE2902.h>
+#include <esp_pm.h>
+#include <esp_timer.h>
 #include "Adafruit_VL6180X.h"
+#include "adaptive_rate.h"
+#include "async_log.h"
+#include "deadline.h"
+#include "device_config.h"
+#include "hal_arduino.h"
+#include "latency_histogram.h"
+#include "metrics.h"
+#include "power_plan.h"
+#include "receiver_app.h"
+#include "sample_scheduler.h"
+#include "spsc_queue.h"
+#include "stage_profiler.h"
+#include "task_scheduler.h"
+
+// 距離サンプルのフラッシュ記録（オプトイン、-D ENABLE_SAMPLE_RECORDER=1）
+#ifndef ENABLE_SAMPLE_RECORDER
+#define ENABLE_SAMPLE_RECORDER 0
+#endif
+#if ENABLE_SAMPLE_RECORDER
+#include <LittleFS.h>
+#include "sample_codec.h"
+#endif
 
 // BLE設定
 #define SERVICE_UUID        "4fafc201-1fb5-459e-8fcc-c5c9c331914b"
 #define CHARACTERISTIC_UUID "beb5483e-36e1-4688-b7f5-ea07361b26a8"
 
+// 測定はloop()と別のコアの高優先度タスクで行う（BLE・シリアル・LEDの処理に測定周期を乱されないように）
+// platformio.ini の receiver 環境で loop() をBLEスタックと同じコア0に移し、コア1を測定専用にしている
+// 測定タスクは esp_timer の周期タイマーで起こす（予定時刻は固定、測定・ログの時間で周期がずれない）
+#ifndef SAMPLE_PERIOD_US
+#define SAMPLE_PERIOD_US 20000                                 // 測定周期（50Hz、build_flags で変更可）
+#endif
+#define SAMPLING_CORE (ARDUINO_RUNNING_CORE == 0 ? 1 : 0)      // loop()と別のコア
+#define SAMPLING_TASK_PRIORITY 20                              // loop()・ログ（優先度1）より高い
+#define COMMAND_POLL_MS 25                                     // シリアルコマンドを確認する間隔（USB CDCには受信イベントがない）
+
+// 測定周期の切り替え（adaptive_rate.h）: 直近のラップタイムから次の通過を予測し、予測の幅の中は
+// 電源モードの測定周期の半分で測り、それ以外は電源モードによらず SAFETY_FLOOR_PERIOD_US で測る
+// （saver の一定周期 40ms は通過の最短 30ms より長いので、切り替えを使う間は saver も下限をこの周期にそろえる）
+#ifndef ADAPTIVE_SAMPLE_RATE
+#define ADAPTIVE_SAMPLE_RATE 1                                 // 0で電源モードの一定周期（build_flags で変更可）
+#endif
+#define SAFETY_FLOOR_PERIOD_US 25000                           // 予測の幅の外の周期（通過の最短30msより短く）
+
+// 電源モード（"$power=" で選び、再起動で反映。power_plan.h）
+// full は従来どおり。balanced・saver は測定の合間とセンサーの変換待ちに自動ライトスリープへ入り、
+// BLEはモデムスリープで接続を保つ（電池駆動向け。スリープ中はUSBシリアルの出力が遅れることがある）
+// saver の測定周期は SAMPLE_PERIOD_US の2倍
+#ifndef BATTERY_MAH
+#define BATTERY_MAH 2000                                       // 動作時間を見積もる電池容量（mAh、build_flags で変更可）
+#endif
+#define CONVERSION_WAIT_MS 3                                   // 変換の完了を確かめ始めるまで眠る時間（変換は数ms）
+#define XTAL_FREQ_MHZ 40                                       // 自動周波数調整の最低周波数
+
 // LEDピン定義（PWM対応ピン）
 #define RED_LED_PIN D0    // 赤色LED（PWM対応）
 #define BLUE_LED_PIN D1   // 青色LED（PWM対応）
 
-// デバイス識別構造体
-struct DeviceCalibration {
-  String macAddress;
-  int deviceNumber;
-  String deviceName;
-  // オフセット校正値
-  int offsetCalibration;   // オフセット補正値（mm）
-};
-
-// 各デバイスの校正設定（WiFi MACアドレスベース）
-DeviceCalibration devices[] = {
-  {"cc:ba:97:15:4d:0c", 1, "Device1", 125},
-  {"cc:ba:97:15:53:20", 2, "Device2", 55},  // WiFi MACアドレス
-  {"cc:ba:97:15:4f:28", 3, "Device3", -5},
-  {"cc:ba:97:15:37:34", 4, "Device4", 0}, // 4 old
-  {"98:3d:ae:ee:85:9c", 4, "Device4", 125} // 4 new
-};
-
 // BLE関連変数
 BLEServer* pServer = NULL;
 BLECharacteristic* pCharacteristic = NULL;
 bool deviceConnected = false;
 bool oldDeviceConnected = false;
 
-// グローバル変数
-bool sensorAvailable = false;
-DeviceCalibration currentDevice;
-bool deviceIdentified = false;
+// デバイス設定（起動時にNVS・登録済みMACアドレスから決める、"$" コマンドで変更）
+DeviceConfig deviceConfig;         // 動作中の設定
+DeviceConfig pendingConfig;        // コマンドで編集中の設定（$save で保存、再起動で反映）
+DeviceConfigSource deviceConfigSource = DEVICE_CONFIG_FROM_DEFAULT;
+DeviceConfigLineReader serialConfigLine;
+
+// BLEから書き込まれた "$" コマンド（BLEタスクで受け取り、loop()で処理する）
+char bleConfigLine[48];
+volatile bool bleConfigPending = false;
 
 // VL6180Xセンサーインスタンス
 Adafruit_VL6180X vl = Adafruit_VL6180X();
 
-// ベースライン距離とカウント関連変数
-int baselineDistance = 0;        // 何も通過していないときのベースライン距離
-bool baselineCalibrated = false;
-int deviceCount = 0;             // このデバイスのカウント数
-unsigned long lastCountTime = 0; // 最後にカウントした時刻
-const unsigned long COUNT_IGNORE_DURATION = 3000; // 3秒間の重複カウント防止
-const int DETECTION_THRESHOLD = 10; // 検出閾値（ベースライン距離からの差mm）
+// HAL経由でロジック本体（検知・LED・通知）を動かす
+// 時刻はすべて halClock から読む（ホストでは仮想時計に差し替えられる）
+ArduinoClock halClock;
+ArduinoRangeSensor<Adafruit_VL6180X> halSensor(vl);
+ArduinoPwm halPwm;
+
+// 測定タスクからのメッセージ（校正結果など、PCが読む行）は行ごとにまとめて Serial へ直接書く
+// （ログキューは満杯なら捨てるため使わない。行はまれなので送信を待っても測定には響かない）
+class LineSerial : public HalSerial {
+ public:
+  int available() override { return 0; }
+  int read() override { return -1; }
+  size_t write(const char* data, size_t length) override {
+    for (size_t i = 0; i < length; i++) {
+      if (data[i] == '\n') {
+        serialWriteLine(line_, length_);
+        length_ = 0;
+      } else if (data[i] != '\r' && length_ < sizeof(line_)) {
+        line_[length_++] = data[i];
+      }
+    }
+    return length;
+  }
+
+ private:
+  char line_[LOG_RECORD_SIZE];
+  size_t length_ = 0;
+};
+
+LineSerial halSerial;
+ArduinoBleLink<BLECharacteristic> halBleLink(pCharacteristic, deviceConnected);
+ArduinoStorage halStorage("receiver");  // デバイス設定・校正値（NVS）
+ReceiverApp app(halClock, halSensor, halPwm, halSerial, halBleLink, RED_LED_PIN, BLUE_LED_PIN);
+
+// 測定タスク → loop() の受け渡し（loop()が止まっても約0.6秒分は溜められる）
+SpscQueue<ReceiverSample, 32> sampleQueue;
+
+// loop() の処理はスケジューラのタスクとして登録し、次の締め切りか
+// 測定タスク・BLEコールバックからの signal() まで眠る
+ArduinoWaker loopWaker;
+TaskScheduler<12> scheduler(halClock, loopWaker);
+int sampleTask = -1;       // 測定結果の反映（測定のたびに測定タスクから signal）
+int ledTask = -1;          // LED出力の更新（次に出力が変わる時刻に合わせて起こす）
+int bleStateTask = -1;     // BLE接続状態の変化（接続・切断コールバックから signal）
+int advertisingTask = -1;  // アドバタイジング再開
+int commandTask = -1;      // 設定・校正コマンド（BLEの書き込みで signal）
+
+// 測定周期のタイマー（esp_timer のタスクから測定タスクを起こす）
+esp_timer_handle_t sampleTimer = nullptr;
+TaskHandle_t samplingTaskHandle = nullptr;
+SampleScheduler sampleScheduler(SAMPLE_PERIOD_US);  // 測定タスクだけが使う（周期は applyPowerMode() で決める）
+SampleJitter sampleJitter(SAMPLE_PERIOD_US / 4);    // loop()側で集計（予定時刻からその予定の周期の1/4以上遅れた測定を数える）
+
+AdaptiveSampleRate adaptiveRate;  // 測定タスクだけが使う（周期は applyPowerMode() で決める）
+AdaptiveRateStats rateStats;      // loop()側で集計（測定タスクの選択は ReceiverSample の rate で受け取る）
+
+// 電源モードと消費電流の見積もり用の集計
+PowerSettings power = powerSettings(POWER_FULL, SAMPLE_PERIOD_US);  // 起動時に deviceConfig.power から決める
+std::atomic<uint32_t> samplingRuns(0);    // 測定タスクが起きた回数（測定タスクだけが書く）
+std::atomic<uint32_t> samplingBusyUs(0);  // 測定にかかった時間の合計（us、変換待ちを含む）
+uint32_t ledLevelSum = 0;                 // 測定ごとのLED出力（赤 + 青）の合計
+uint32_t ledLevelSamples = 0;
+
+// レイテンシ計測（ms）
+LatencyHistogram detectToNotifyLatency; // 検出から最初のBLE通知まで
+
+// ランタイムメトリクス（'!' または定期的に1行で出力）
+MetricsRegistry<40> metrics;
+uint32_t& sampleCount = metrics.counter("samples");
+int32_t& samplesPerSecond = metrics.gauge("sps");
+uint32_t& notifyOk = metrics.counter("notify_ok");
+uint32_t& notifyFail = metrics.counter("notify_fail");
+uint32_t& reconnectCount = metrics.counter("connects");
+int32_t& heapLowWater = metrics.gauge("heap_min");
+int32_t& logDropped = metrics.gauge("log_drop");
+int32_t& bootMs = metrics.gauge("boot_ms");  // リセットから検知開始まで（ms）
+int32_t& baselineWarm = metrics.gauge("bl_warm");    // 保存されたベースラインで起動したら1
+int32_t& baselineNoise = metrics.gauge("bl_noise");  // 校正時の標準偏差（0.1mm）
+int32_t& sampleDropped = metrics.gauge("q_drop");    // loop()が受け取れずに捨てた測定結果
+int32_t& sampleMissed = metrics.gauge("missed");     // 測定できずに飛ばした予定
+int32_t& sampleLate = metrics.gauge("late");         // 予定時刻から1/4周期以上遅れた測定
+int32_t& cpuDuty = metrics.gauge("cpu_pm");          // CPUが動いていた割合の見積もり（‰）
+int32_t& averageCurrent = metrics.gauge("avg_ua");   // 平均電流の見積もり（uA）
+int32_t& lapEstimate = metrics.gauge("lap_ms");      // 次の通過の予測に使うラップタイム
+int32_t& fastShare = metrics.gauge("fast_pm");       // 予測の幅の中で短い周期にした測定の割合（‰）
+int32_t& predictionHits = metrics.gauge("pred_hit");    // 予測の幅の中に来た通過
+int32_t& predictionMisses = metrics.gauge("pred_miss"); // 予測の幅の外に来た通過（下限の周期で検出）
+LatencyHistogram loopPeriod;       // loop()の周期（us）
+LatencyHistogram taskLateness;     // loop() のタスクの締め切りから実行までの遅れ（ms）
+LatencyHistogram samplePeriod;     // 測定タスクの測定周期（us）
+uint32_t* rangeErrorCounters[16];  // VL6180X_ERROR_* ごとのエラー数
+const uint32_t METRICS_INTERVAL = 10000;  // 定期出力間隔（ms）
+const uint32_t RATE_INTERVAL = 1000;      // サンプルレートの更新
+IntervalTimer distancePrintTimer(1000);   // 距離のログ出力（USB負荷軽減）
+
+// アドバタイジング再開（切断後、BLEスタックの準備を待ってから）
+const uint32_t ADVERTISING_RESTART_DELAY = 500;
+const uint32_t BLE_STATE_INTERVAL = 100;  // 接続状態の確認（コールバックの signal の保険）
+
+// BLE初期化タスクの完了（BLEDevice::init() は時間がかかるため、測定と並行して別タスクで行う）
+volatile bool bleReady = false;
+volatile uint32_t bleReadyAt = 0;
+bool bootReported = false;
+
+// VL6180X_ERROR_* をコード別のカウンタとして登録
+void registerRangeErrorMetrics() {
+  static const struct { uint8_t code; const char* name; } errorNames[] = {
+    {VL6180X_ERROR_SYSERR_1, "e_sys1"},
+    {VL6180X_ERROR_SYSERR_5, "e_sys5"},
+    {VL6180X_ERROR_ECEFAIL, "e_ece"},
+    {VL6180X_ERROR_NOCONVERGE, "e_noconv"},
+    {VL6180X_ERROR_RANGEIGNORE, "e_ignore"},
+    {VL6180X_ERROR_SNR, "e_snr"},
+    {VL6180X_ERROR_RAWUFLOW, "e_rawuf"},
+    {VL6180X_ERROR_RAWOFLOW, "e_rawof"},
+    {VL6180X_ERROR_RANGEUFLOW, "e_uflow"},
+    {VL6180X_ERROR_RANGEOFLOW, "e_oflow"},
+  };
+  uint32_t* other = &metrics.counter("e_other");
+  for (int i = 0; i < 16; i++) {
+    rangeErrorCounters[i] = other;
+  }
+  for (const auto& e : errorNames) {
+    rangeErrorCounters[e.code] = &metrics.counter(e.name);
+  }
+  metrics.histogram("loop_us", loopPeriod);
+  metrics.histogram("sample_us", samplePeriod);
+  metrics.histogram("jitter_us", sampleJitter.jitter());
+  metrics.histogram("det_ms", detectToNotifyLatency);
+  metrics.histogram("late_ms", taskLateness);
+}
+
+// 起動タイムラインを1行で出力
+void dumpBootTimeline() {
+  char line[160];
+  app.boot.format(line, sizeof(line));
+  Serial.println(line);
+}
+
+// 前回からの実測で消費電流を見積もり、POWER 行を出力する（ゲージも更新する）
+void reportPower() {
+  static uint32_t lastUs = 0;
+  static uint32_t lastRuns = 0;
+  static uint32_t lastBusyUs = 0;
+  static uint32_t lastLoops = 0;
+  static uint32_t lastLoopBusyUs = 0;
+  static uint32_t lastNotify = 0;
+  uint32_t nowUs = halClock.micros();
+  uint32_t runs = samplingRuns.load(std::memory_order_relaxed);
+  uint32_t busyUs = samplingBusyUs.load(std::memory_order_relaxed);
+  PowerLoad load;
+  load.windowUs = nowUs - lastUs;
+  load.samples = runs - lastRuns;
+  load.sampleUs = busyUs - lastBusyUs;
+  load.loopBusyUs = scheduler.busyMicros() - lastLoopBusyUs;
+  load.wakeups = load.samples + (scheduler.loops() - lastLoops);
+  load.notifications = notifyOk - lastNotify;
+  load.connected = deviceConnected;
+  load.ledLevel = ledLevelSamples > 0 ? (float)ledLevelSum / ledLevelSamples / 255 : 0;
+  lastUs = nowUs;
+  lastRuns = runs;
+  lastBusyUs = busyUs;
+  lastLoops = scheduler.loops();
+  lastLoopBusyUs = scheduler.busyMicros();
+  lastNotify = notifyOk;
+  ledLevelSum = 0;
+  ledLevelSamples = 0;
+  
+  PowerPlan plan = planPower(power, PowerModel(), load);
+  cpuDuty = (int32_t)(plan.cpuDuty * 1000);
+  averageCurrent = (int32_t)(plan.averageMa * 1000);
+  char line[200];
+  plan.format(line, sizeof(line), power, BATTERY_MAH);
+  Serial.println(line);
+}
+
+// メトリクスを1行で出力
+void dumpMetrics() {
+  reportPower();
+  baselineWarm = app.warmStart() ? 1 : 0;
+  baselineNoise = app.baselineNoise();
+  heapLowWater = ESP.getMinFreeHeap();
+  logDropped = asyncLog().dropped();
+  sampleDropped = sampleQueue.dropped();
+  sampleMissed = sampleJitter.missed();
+  sampleLate = sampleJitter.late();
+  uint32_t rateSamples = rateStats.fastSamples() + rateStats.floorSamples();
+  lapEstimate = rateStats.last().lapMs;
+  fastShare = rateSamples ? (int32_t)((uint64_t)rateStats.fastSamples() * 1000 / rateSamples) : 0;
+  predictionHits = rateStats.hits();
+  predictionMisses = rateStats.misses();
+  char line[640];
+  metrics.format(line, sizeof(line));
+  Serial.println(line);
+}
+
+#if ENABLE_SAMPLE_RECORDER
+// 距離サンプルレコーダー
+// 全サンプルをRAM上のブロックに差分符号化し、満杯になったブロックだけを
+// 低優先度タスクがLittleFSへ書き込む。ブロックごとに別のファイル（/rec/<seq % RECORDER_BLOCKS>.bin）にし、
+// 古いファイルを消してから新しく書く（LittleFSはファイルの途中を書き換えると後ろを全部コピーし直すため、
+// 1つのファイルの中をリングにすると1ブロックごとに最大でファイル全体を書き直すことになる）
+#define RECORDER_DIR "/rec"
+#define RECORDER_LEGACY_FILE "/samples.bin"  // 以前の1ファイルのリング（見つけたら消す）
+#define RECORDER_BLOCKS 128  // 1024B x 128 = 128KB（50Hzで約20分）
+
+SampleBlockEncoder recorderBlocks[2];  // 組み立て中と書き込み中
+int recorderFill = 0;                  // 組み立て中のブロック
+volatile int recorderPending = -1;     // 書き込み待ちのブロック（-1なら空き）
+uint32_t recorderNextSeq = 0;
+TaskHandle_t recorderTask = nullptr;
+bool recorderReady = false;
+uint32_t& recorderBlocksWritten = metrics.counter("rec_blocks");
+uint32_t& recorderDropped = metrics.counter("rec_drop");  // 書き込みが追いつかず捨てたサンプル数
+
+// ブロックをリング上の位置のファイルへ書き込む（同じ位置の古いブロックは先に消す）
+void writeRecorderBlock(const SampleBlockEncoder& block) {
+  char path[24];
+  snprintf(path, sizeof(path), RECORDER_DIR "/%lu.bin", (unsigned long)(block.seq() % RECORDER_BLOCKS));
+  LittleFS.remove(path);
+  File file = LittleFS.open(path, "w");
+  if (!file) {
+    return;
+  }
+  file.write(block.data(), SAMPLE_BLOCK_SIZE);
+  file.close();
+  recorderBlocksWritten++;
+}
+
+void recorderWriterTask(void*) {
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    int index = recorderPending;
+    if (index >= 0) {
+      writeRecorderBlock(recorderBlocks[index]);
+      recorderPending = -1;
+    }
+  }
+}
+
+// 記録ディレクトリを用意し、既存ブロックの続きから記録を再開する
+void beginRecorder() {
+  if (!LittleFS.begin(true)) {
+    Serial.println("Sample recorder: LittleFS mount failed");
+    return;
+  }
+  if (LittleFS.exists(RECORDER_LEGACY_FILE)) {
+    LittleFS.remove(RECORDER_LEGACY_FILE);
+  }
+  if (!LittleFS.exists(RECORDER_DIR) && !LittleFS.mkdir(RECORDER_DIR)) {
+    Serial.println("Sample recorder: failed to create " RECORDER_DIR);
+    return;
+  }
+  uint32_t nextSeq = 0;
+  int blocks = 0;
+  File dir = LittleFS.open(RECORDER_DIR);
+  for (File file = dir.openNextFile(); file; file = dir.openNextFile()) {
+    uint8_t header[SAMPLE_BLOCK_HEADER_SIZE];
+    SampleBlockInfo info;
+    // ヘッダのみ読むので長さ検査はブロックサイズで行う
+    if (file.size() == SAMPLE_BLOCK_SIZE && file.read(header, sizeof(header)) == sizeof(header) &&
+        readSampleBlockHeader(header, SAMPLE_BLOCK_SIZE, info) == SAMPLE_BLOCK_OK) {
+      blocks++;
+      if (info.seq + 1 > nextSeq) {
+        nextSeq = info.seq + 1;
+      }
+    }
+    file.close();
+  }
+  dir.close();
+  recorderNextSeq = nextSeq;
+  recorderBlocks[recorderFill].begin(recorderNextSeq++, halClock.millis());
+  xTaskCreatePinnedToCore(recorderWriterTask, "rec", 4096, nullptr, 1, &recorderTask, ARDUINO_RUNNING_CORE);
+  recorderReady = true;
+  Serial.printf("Sample recorder: %d/%d blocks in " RECORDER_DIR ", resuming at block %lu\n", blocks,
+                RECORDER_BLOCKS, (unsigned long)nextSeq);
+}
+
+// 1サンプルを記録する（loop()から呼ぶ、フラッシュへの書き込みは行わない）
+void recordSample(uint32_t time, uint8_t range, uint8_t status) {
+  if (!recorderReady) {
+    return;
+  }
+  SampleBlockEncoder& block = recorderBlocks[recorderFill];
+  if (block.add(time, range, status)) {
+    return;
+  }
+  if (recorderPending >= 0) {
+    // 前のブロックを書き込み中: このブロックは捨てて同じ番号で組み直す
+    recorderDropped += block.count();
+    block.begin(block.seq(), time);
+  } else {
+    block.finish();
+    recorderPending = recorderFill;
+    xTaskNotifyGive(recorderTask);
+    recorderFill ^= 1;
+    recorderBlocks[recorderFill].begin(recorderNextSeq++, time);
+  }
+  recorderBlocks[recorderFill].add(time, range, status);
+}
+
+// 記録したブロックを16進でシリアルに出力する（sample_decoderで復号）
+// 組み立て中のブロックも書き込んでから出力する
+void dumpRecorder() {
+  if (!recorderReady) {
+    Serial.println("Sample recorder disabled");
+    return;
+  }
+  while (recorderPending >= 0) {
+    halClock.delay(1);
+  }
+  SampleBlockEncoder& block = recorderBlocks[recorderFill];
+  if (!block.empty()) {
+    block.finish();  // 以降のadd()は同じブロックへ続けて追記される
+    writeRecorderBlock(block);
+  }
+  // ブロックのファイルをつなげて出力する（順序は問わない。sample_decoder が番号順に並べ直す）
+  size_t total = 0;
+  File dir = LittleFS.open(RECORDER_DIR);
+  for (File file = dir.openNextFile(); file; file = dir.openNextFile()) {
+    total += file.size() == SAMPLE_BLOCK_SIZE ? SAMPLE_BLOCK_SIZE : 0;
+    file.close();
+  }
+  dir.rewindDirectory();
+  Serial.printf("RECDUMP BEGIN %u\n", (unsigned)total);
+  uint8_t chunk[64];
+  char hex[sizeof(chunk) * 2 + 1];
+  for (File file = dir.openNextFile(); file; file = dir.openNextFile()) {
+    if (file.size() == SAMPLE_BLOCK_SIZE) {
+      size_t n;
+      while ((n = file.read(chunk, sizeof(chunk))) > 0) {
+        for (size_t i = 0; i < n; i++) {
+          snprintf(hex + i * 2, 3, "%02x", chunk[i]);
+        }
+        Serial.println(hex);
+      }
+    }
+    file.close();
+  }
+  dir.close();
+  Serial.println("RECDUMP END");
+}
+#endif
+
+// BLE送信結果の集計（notify()の中から呼ばれる）
+class NotifyStatusCallbacks: public BLECharacteristicCallbacks {
+    void onStatus(BLECharacteristic* pCharacteristic, Status s, uint32_t code) {
+      if (s == SUCCESS_NOTIFY) {
+        notifyOk++;
+      } else if (s != SUCCESS_INDICATE) {
+        notifyFail++;
+      }
+    }
 
-// LED制御関連変数
-bool countUpLEDActive = false;   // カウントアップ点滅制御
-unsigned long countUpLEDStartTime = 0; // カウントアップLED開始時刻
-const unsigned long COUNT_UP_LED_DURATION = 3000; // 3秒間の点滅時間
+    // "$" コマンドの書き込み（前のコマンドを処理し終えるまで次は受け付けない）
+    void onWrite(BLECharacteristic* pCharacteristic) {
+      std::string value = pCharacteristic->getValue();
+      if (bleConfigPending || value.length() == 0 || value[0] != '$' || value.length() >= sizeof(bleConfigLine)) {
+        return;
+      }
+      memcpy(bleConfigLine, value.c_str(), value.length());
+      bleConfigLine[value.length()] = '\0';
+      bleConfigPending = true;
+      scheduler.signal(commandTask);
+    }
+};
 
 // BLE接続状態管理コールバッククラス
 class MyServerCallbacks: public BLEServerCallbacks {
     void onConnect(BLEServer* pServer) {
       deviceConnected = true;
-      Serial.println("*** BLE client connected ***");
+      reconnectCount++;
+      LOG_I(LOG_MOD_BLE, "*** BLE client connected ***");
+      scheduler.signal(bleStateTask);
     };
 
     void onDisconnect(BLEServer* pServer) {
       deviceConnected = false;
-      Serial.println("*** BLE client disconnected ***");
+      LOG_I(LOG_MOD_BLE, "*** BLE client disconnected ***");
+      scheduler.signal(bleStateTask);
     }
 };
 
-// デバイス識別機能
+// デバイス識別機能（WiFi STAのMACアドレスをeFuseから読む、WiFiは起動しない）
 void identifyDevice() {
-  // WiFi MACアドレスを取得
-  String wifiMacAddress = WiFi.macAddress();
-  wifiMacAddress.toLowerCase();
-  
-  Serial.print("WiFi MAC address: ");
-  Serial.println(wifiMacAddress);
-  
-  // Bluetooth MACアドレスも表示（参考用）
-  String btMacStr = "";
+  uint8_t wifiMac[6];
   uint8_t btMac[6];
+  esp_read_mac(wifiMac, ESP_MAC_WIFI_STA);
   esp_read_mac(btMac, ESP_MAC_BT);
-  for (int i = 0; i < 6; i++) {
-    if (i > 0) btMacStr += ":";
-    if (btMac[i] < 0x10) btMacStr += "0";
-    btMacStr += String(btMac[i], HEX);
-  }
-  btMacStr.toLowerCase();
-  Serial.print("Bluetooth MAC address: ");
-  Serial.println(btMacStr);
+  Serial.printf("WiFi MAC address: %02x:%02x:%02x:%02x:%02x:%02x\r\n",
+                wifiMac[0], wifiMac[1], wifiMac[2], wifiMac[3], wifiMac[4], wifiMac[5]);
+  Serial.printf("Bluetooth MAC address: %02x:%02x:%02x:%02x:%02x:%02x\r\n",
+                btMac[0], btMac[1], btMac[2], btMac[3], btMac[4], btMac[5]);
   
-  // デバイス配列から一致するデバイスを検索（WiFi MACで識別）
-  for (int i = 0; i < 5; i++) {
-    if (devices[i].macAddress == wifiMacAddress) {
-      currentDevice = devices[i];
-      deviceIdentified = true;
-      Serial.print("Device identification completed: ");
-      Serial.print(currentDevice.deviceName);
-      Serial.print(" (number: ");
-      Serial.print(currentDevice.deviceNumber);
-      Serial.println(")");
-      
-      // デバイス固有のオフセット値を表示
-      Serial.print("Offset value: ");
-      Serial.print(currentDevice.offsetCalibration);
-      Serial.println("mm");
-      return;
+  // NVSの設定 → 登録済みMACアドレスの既定値 → 未登録の既定値 の順に決める
+  deviceConfigSource = loadDeviceConfig(halStorage, wifiMac, deviceConfig);
+  pendingConfig = deviceConfig;
+  if (deviceConfigSource == DEVICE_CONFIG_FROM_DEFAULT) {
+    Serial.println("WARNING: Unregistered device. Using default settings (set with $lane=N, $save).");
+  }
+  char line[128];
+  formatDeviceConfig(deviceConfig, line, sizeof(line));
+  Serial.printf("%s source=%s\r\n", line, deviceConfigSourceName(deviceConfigSource));
+}
+
+// "$" コマンドを処理する（シリアル・BLEの両方から）
+// 変更は pendingConfig に溜め、$save でNVSに保存する。検知パラメータは再起動で反映する
+void handleConfigCommand(const char* line, size_t length) {
+  char text[128];
+  switch (applyDeviceConfigCommand(pendingConfig, line, length)) {
+    case DEVICE_CONFIG_CMD_CHANGED:
+    case DEVICE_CONFIG_CMD_SHOW:
+      formatDeviceConfig(pendingConfig, text, sizeof(text));
+      Serial.println(text);
+      break;
+    case DEVICE_CONFIG_CMD_SAVE:
+      if (saveDeviceConfig(halStorage, pendingConfig)) {
+        Serial.println("CONFIG saved (send $restart to apply)");
+      } else {
+        Serial.println("CONFIG save failed");
+      }
+      break;
+    case DEVICE_CONFIG_CMD_RESET:
+      if (halStorage.remove(DEVICE_CONFIG_KEY)) {
+        Serial.println("CONFIG cleared (send $restart to apply)");
+      } else {
+        Serial.println("CONFIG clear failed");
+      }
+      break;
+    case DEVICE_CONFIG_CMD_RESTART:
+      Serial.println("CONFIG restarting");
+      Serial.flush();
+      ESP.restart();
+      break;
+    case DEVICE_CONFIG_CMD_ERROR:
+      Serial.printf("CONFIG error: %.*s\r\n", (int)length, line);
+      break;
+  }
+}
+
+// 電源モードを反映する（測定周期・CPU周波数・自動ライトスリープ・センサーの変換待ち。BLE送信出力は initBLE()）
+// 自動ライトスリープを使えないファームウェア（CONFIG_PM_ENABLE・ティックレスアイドルが無効）では
+// 周波数を下げるだけにし、POWER 行の sleep=off で分かるようにする
+void applyPowerMode() {
+  power = powerSettings(deviceConfig.power, SAMPLE_PERIOD_US);
+#if ADAPTIVE_SAMPLE_RATE
+  // 予測の幅の外で測る周期を電源モードの周期とする（POWER 行の period・detect はこの周期）
+  power = adaptivePowerSettings(power, SAFETY_FLOOR_PERIOD_US);
+  AdaptiveRateConfig rateConfig;
+  rateConfig.fastPeriodUs = power.fastPeriodUs;
+  rateConfig.floorPeriodUs = power.samplePeriodUs;
+  adaptiveRate = AdaptiveSampleRate(rateConfig);
+#endif
+  sampleScheduler = SampleScheduler(power.samplePeriodUs);
+  sampleJitter = SampleJitter(power.samplePeriodUs / 4);  // 締め切りは測定ごとに sample.periodUs から決める
+  if (power.conversionWait) {
+    halSensor.setConversionWait(CONVERSION_WAIT_MS);
+  }
+  bool configured = false;
+#if CONFIG_PM_ENABLE
+  if (power.lightSleep) {
+    // 測定タスク・loop() がどちらも眠っている間はライトスリープに入り、esp_timer・BLEのイベントで起きる
+    esp_pm_config_esp32s3_t pmConfig = {};
+    pmConfig.max_freq_mhz = power.cpuMhz;
+    pmConfig.min_freq_mhz = XTAL_FREQ_MHZ;
+    pmConfig.light_sleep_enable = true;
+    esp_err_t err = esp_pm_configure(&pmConfig);
+    if (err != ESP_OK) {
+      power.lightSleep = false;
+      pmConfig.light_sleep_enable = false;  // 周波数の自動調整だけにする
+      err = esp_pm_configure(&pmConfig);
     }
+    configured = err == ESP_OK;
   }
-  
-  // 未登録デバイスの場合のデフォルト値を使用
-  Serial.println("WARNING: Unregistered device. Using default settings.");
-  currentDevice = {"unknown", 0, "Unknown Device", 0};
-  deviceIdentified = false;
+#else
+  power.lightSleep = false;
+#endif
+  if (!configured && getCpuFrequencyMhz() != power.cpuMhz) {
+    setCpuFrequencyMhz(power.cpuMhz);
+  }
+  char line[128];
+  formatPowerModes(line, sizeof(line), SAMPLE_PERIOD_US, PowerModel(), ReceiverApp::NOTIFY_INTERVAL,
+                   ADAPTIVE_SAMPLE_RATE ? SAFETY_FLOOR_PERIOD_US : 0);
+  Serial.println(line);
+  Serial.printf("Power mode: %s (period %luus, light sleep %s, %uMHz, %+ddBm)\r\n", powerModeName(power.mode),
+                (unsigned long)power.samplePeriodUs, power.lightSleep ? "on" : "off", power.cpuMhz,
+                power.txPowerDbm);
 }
 
-// LED強度設定機能
-void setLEDIntensity(int redIntensity, int blueIntensity) {
-  analogWrite(RED_LED_PIN, redIntensity);   // 0-255の範囲
-  analogWrite(BLUE_LED_PIN, blueIntensity); // 0-255の範囲
+// BLE送信出力の段階（dBm を超えない段階に丸める）
+esp_power_level_t bleTxPowerLevel(int8_t dbm) {
+  if (dbm >= 9) {
+    return ESP_PWR_LVL_P9;
+  }
+  if (dbm >= 6) {
+    return ESP_PWR_LVL_P6;
+  }
+  if (dbm >= 3) {
+    return ESP_PWR_LVL_P3;
+  }
+  return ESP_PWR_LVL_N0;
 }
 
 // BLE初期化
 void initBLE() {
-  String deviceName = "YonkuCounter_" + String(currentDevice.deviceNumber);
+  String deviceName = "YonkuCounter_" + String(deviceConfig.lane);
   
   BLEDevice::init(deviceName.c_str());
   
-  // BLE送信出力を最大に設定（接続安定性向上）
-  esp_ble_tx_power_set(ESP_BLE_PWR_TYPE_DEFAULT, ESP_PWR_LVL_P9); // 出力を最大値（+9dBm）に設定
-  esp_ble_tx_power_set(ESP_BLE_PWR_TYPE_ADV, ESP_PWR_LVL_P9);     // アドバタイジング出力を最大に設定
+  // BLE送信出力（full は最大の+9dBmで接続安定性を優先、省電力モードでは下げる）
+  esp_ble_tx_power_set(ESP_BLE_PWR_TYPE_DEFAULT, bleTxPowerLevel(power.txPowerDbm));
+  esp_ble_tx_power_set(ESP_BLE_PWR_TYPE_ADV, bleTxPowerLevel(power.txPowerDbm));
   
   pServer = BLEDevice::createServer();
   pServer->setCallbacks(new MyServerCallbacks());
@@ -149,6 +611,7 @@ void initBLE() {
                     );
 
   pCharacteristic->addDescriptor(new BLE2902());
+  pCharacteristic->setCallbacks(new NotifyStatusCallbacks());
 
   pService->start();
   
@@ -166,342 +629,322 @@ void initBLE() {
   Serial.println(CHARACTERISTIC_UUID);
 }
 
-// ベースライン距離校正機能
-void calibrateBaseline() {
-  if (!sensorAvailable) {
-    Serial.println("Sensor not available. Skipping baseline distance setup.");
+void bleInitTask(void*) {
+  initBLE();
+  bleReadyAt = halClock.millis();
+  bleReady = true;
+  vTaskDelete(nullptr);
+}
+
+// 測定周期のタイマー（esp_timer のタスクで実行されるため、測定タスクを起こすだけにする）
+void onSampleTimer(void*) {
+  xTaskNotifyGive(samplingTaskHandle);
+}
+
+// 測定周期を変える（測定タスクから。周期タイマーを今から新しい周期で開始し直す）
+void setSamplePeriod(uint32_t periodUs) {
+  esp_timer_stop(sampleTimer);
+  ulTaskNotifyTake(pdTRUE, 0);  // 止める前に届いていた通知は捨てる（すぐに次の測定をしない）
+  uint32_t now = halClock.micros();
+  esp_timer_start_periodic(sampleTimer, periodUs);
+  sampleScheduler.restart(periodUs, now);
+}
+
+// 測定タスク: タイマーに起こされるたびに測定・校正・通過判定だけを行い、結果を sampleQueue で loop() に渡す
+// LED・BLE通知・シリアル・ログ出力は loop() 側で行う（起動タイムラインもこのタスクだけが書く）
+void samplingTask(void*) {
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY); // 遅れて溜まった通知は1回にまとめる（飛ばした予定は sampleScheduler が数える）
+    if (bleReady && !app.boot.has("ble_adv")) {
+      app.boot.mark("ble_adv", bleReadyAt);
+    }
+    ReceiverSample sample;
+    app.measure(sample);
+    samplingBusyUs.fetch_add(halClock.micros() - sample.startedUs, std::memory_order_relaxed);
+    samplingRuns.fetch_add(1, std::memory_order_relaxed);
+    SampleSlot slot = sampleScheduler.begin(sample.startedUs);
+    sample.scheduledUs = slot.scheduledUs;
+    sample.missed = slot.missed;
+    sample.periodUs = slot.periodUs;
+#if ADAPTIVE_SAMPLE_RATE
+    sample.rate = adaptiveRate.update(sample.time, sample.result);
+    if (sample.rate.periodUs != sampleScheduler.periodUs()) {
+      setSamplePeriod(sample.rate.periodUs);
+    }
+#endif
+    sampleQueue.push(sample); // 満杯なら捨てて数える
+    scheduler.signal(sampleTask);
+  }
+}
+
+// 測定タスクとタイマーを開始する（micros() と esp_timer は同じ時刻源）
+void startSampling() {
+  xTaskCreatePinnedToCore(samplingTask, "sampling", 4096, nullptr, SAMPLING_TASK_PRIORITY,
+                          &samplingTaskHandle, SAMPLING_CORE);
+  esp_timer_create_args_t timerArgs = {};
+  timerArgs.callback = onSampleTimer;
+  timerArgs.dispatch_method = ESP_TIMER_TASK;
+  timerArgs.name = "sample";
+  esp_timer_create(&timerArgs, &sampleTimer);
+  sampleScheduler.start(halClock.micros() + power.samplePeriodUs);
+  esp_timer_start_periodic(sampleTimer, power.samplePeriodUs);
+}
+
+// 測定結果1つをloop()側で処理する（メトリクス・記録・ログ・LED）
+void handleSample(const ReceiverSample& sample) {
+  static uint32_t lastStartedUs = 0;
+  if (lastStartedUs != 0) {
+    samplePeriod.record(sample.startedUs - lastStartedUs);
+  }
+  lastStartedUs = sample.startedUs;
+  sampleJitter.record(sample.scheduledUs, sample.startedUs, sample.missed, sample.periodUs / 4);
+#if ADAPTIVE_SAMPLE_RATE
+  rateStats.record(sample.rate);
+#endif
+  app.present(sample);
+  LedColor led = app.ledOutput();
+  ledLevelSum += led.red + led.blue;
+  ledLevelSamples++;
+  if (!sample.measured) {
     return;
   }
-  
-  Serial.println("=== Baseline Distance Calibration Start ===");
-  Serial.println("Measuring baseline distance with nothing in the lane...");
-  
-  // 複数回測定して平均を取る
-  int measurements = 20;
-  int totalRange = 0;
-  int validMeasurements = 0;
-  
-  Serial.println("Starting measurements...");
-  for (int i = 0; i < measurements; i++) {
-    uint8_t range = vl.readRange();
-    uint8_t status = vl.readRangeStatus();
-    
-    if (status == VL6180X_ERROR_NONE) {
-      totalRange += range;
-      validMeasurements++;
-      Serial.print("Measurement ");
-      Serial.print(i + 1);
-      Serial.print(": ");
-      Serial.print(range);
-      Serial.println("mm");
-    } else {
-      Serial.print("Measurement ");
-      Serial.print(i + 1);
-      Serial.println(": Error");
-    }
-    delay(100);
+  sampleCount++;
+  if (sample.status != VL6180X_ERROR_NONE) {
+    (*rangeErrorCounters[sample.status & 0x0F])++;
   }
+#if ENABLE_SAMPLE_RECORDER
+  recordSample(sample.time, sample.range, sample.status);
+#endif
   
-  if (validMeasurements >= measurements / 2) { // 半分以上の測定が成功した場合
-    baselineDistance = totalRange / validMeasurements;
-    baselineCalibrated = true;
-    
-    Serial.print("Baseline distance setup complete: ");
-    Serial.print(baselineDistance);
-    Serial.println("mm");
-    Serial.print("Detection threshold: ");
-    Serial.print(baselineDistance - DETECTION_THRESHOLD); // 閾値分下回った際に検出
-    Serial.println("mm or less");
-  } else {
-    Serial.println("Failed to set baseline distance. Using fixed value.");
-    baselineDistance = 200; // デフォルト値
-    baselineCalibrated = false;
+  // 距離データの出力頻度を制限（USB負荷軽減）
+  if (sample.status == VL6180X_ERROR_NONE && distancePrintTimer.due(sample.time)) { // 1秒間隔で距離を出力
+    LOG_I(LOG_MOD_SENSOR, "[%s] Distance: %umm, Count: %ld",
+          deviceConfig.name, sample.range, (long)sample.count);
+  }
+  if (sample.result == PASSAGE_COUNTED) {
+    LOG_D(LOG_MOD_DETECT, "=== Count-up timing reached === Elapsed since last count: %lums",
+          (unsigned long)sample.sincePrevious);
+    LOG_I(LOG_MOD_DETECT, "*** Mini 4WD passage detected! *** Distance: %umm (baseline: %dmm) Count: %ld",
+          sample.range, sample.baseline, (long)sample.count);
+  } else if (sample.result == PASSAGE_WAITING) {
+    // カウントアップできない場合のログ（検知中は毎サンプル出るためデバッグレベル）
+    LOG_D(LOG_MOD_DETECT, "[Count waiting] Distance: %umm, remaining wait time: %ums",
+          sample.range, sample.waitRemaining);
   }
-  
-  Serial.println("=== Baseline Distance Calibration End ===");
 }
 
+// loop() のタスク（setup() で登録する）
+void drainSamples(uint32_t now);
+void updateLeds(uint32_t now);
+void updateBleState(uint32_t now);
+void restartAdvertising(uint32_t now);
+void readCommands(uint32_t now);
+void updateSampleRate(uint32_t now);
+void reportMetrics(uint32_t now);
+
+// setup() では待たずに各段階を開始するだけにし、最初の測定までの時間を短くする
+// センサー初期化の再試行・安定待ち・校正は測定タスクの中で、LED表示は loop() の中で、BLE初期化は別タスクで進む
 void setup() {
   Serial.begin(115200);
-  delay(1000); // シリアル通信の安定化待機
-  Serial.flush(); // バッファクリア
+  app.boot.begin(0);  // タイムラインの時刻はリセットからのms
+  app.boot.mark("serial", halClock.millis());
+  startAsyncLog(); // loop()・BLEコールバックのログは低優先度タスクで出力
   Serial.println("Yonku Counter Receiver (Individual Sensor) Program Starting");
+  registerRangeErrorMetrics();
   
-  // WiFiを初期化してMACアドレスを取得（接続しない）
-  WiFi.mode(WIFI_STA);
-  delay(100);
+  // loop() のタスク（測定タスク・BLEのコールバックから signal されるため、それらより先に登録する）
+  loopWaker.begin();
+  scheduler.setLatencyHistogram(&taskLateness);
+  sampleTask = scheduler.add(drainSamples);
+  ledTask = scheduler.add(updateLeds);
+  bleStateTask = scheduler.every(updateBleState, BLE_STATE_INTERVAL);
+  advertisingTask = scheduler.add(restartAdvertising);
+  commandTask = scheduler.every(readCommands, COMMAND_POLL_MS);
+  scheduler.every(updateSampleRate, RATE_INTERVAL, RATE_INTERVAL);
+  scheduler.every(reportMetrics, METRICS_INTERVAL, METRICS_INTERVAL);
   
-  // デバイス識別実行
+  // デバイス識別・設定読み込み
   identifyDevice();
-  
-  // BLE初期化
-  initBLE();
+  applyPowerMode();
+  app.boot.mark("identified", halClock.millis());
   
   // I2C通信を初期化（明示的設定）
   Wire.begin();
   Wire.setClock(100000); // I2Cクロックを100kHzに設定（安定性向上）
   
-  // LEDピンを出力モードに設定（センサー初期化前に実行）
-  pinMode(RED_LED_PIN, OUTPUT);
-  pinMode(BLUE_LED_PIN, OUTPUT);
+  // LED・センサー初期化とベースライン校正を開始（完了を待たない）
+  PassageDetectorConfig detectorConfig;
+  detectorConfig.threshold = deviceConfig.threshold;
+  detectorConfig.ignoreMs = deviceConfig.ignoreMs;
+  app.detector.setConfig(detectorConfig);
+  app.setDeviceNumber(deviceConfig.lane);
+  app.setStorage(&halStorage); // 前回のベースラインがあれば校正を待たずに検知を始める
+  app.begin(deviceConfig.offset);
   
-  // 最初は両LEDを消灯
-  setLEDIntensity(0, 0);
+  // BLE初期化（アドバタイジング開始まで別タスクで行う）
+  xTaskCreate(bleInitTask, "ble_init", 4096, nullptr, 1, nullptr);
   
-  // 起動を示すLED点滅
-  for(int i = 0; i < 3; i++) {
-    setLEDIntensity(0, 100);
-    delay(200);
-    setLEDIntensity(0, 0);
-    delay(200);
-  }
-  
-  // VL6180Xセンサー初期化（タイムアウト付き）
-  Serial.println("Starting VL6180X sensor initialization...");
+#if ENABLE_SAMPLE_RECORDER
+  beginRecorder();
+#endif
   
-  int retryCount = 0;
-  const int maxRetries = 10;
-  bool sensorInitialized = false;
+  app.boot.mark("setup_done", halClock.millis());
+  Serial.println("Receiver setup complete");
   
-  while (retryCount < maxRetries && !sensorInitialized) {
-    if (vl.begin()) {
-      sensorInitialized = true;
-      sensorAvailable = true; // センサー初期化成功
-      Serial.println("VL6180X sensor initialization complete");
-    } else {
-      retryCount++;
-      Serial.print("VL6180X initialization failed (attempt ");
-      Serial.print(retryCount);
-      Serial.print("/");
-      Serial.print(maxRetries);
-      Serial.println(")");
-      
-      // エラー状態を示すLED点滅
-      setLEDIntensity(255, 0);
-      delay(500);
-      setLEDIntensity(0, 0);
-      delay(500);
-      
-      if (retryCount < maxRetries) {
-        Serial.println("Retrying in 2 seconds...");
-        delay(2000);
-      }
-    }
+  // 測定タスクと周期タイマーを開始（これ以降、起動タイムラインは測定タスクだけが書く）
+  startSampling();
+  PROFILE_LOOP_START();
+}
+
+// 測定タスクの結果を順に反映（通過検知のログ・LED表示・BLE通知）
+void drainSamples(uint32_t) {
+  static bool sensorPresent = false;
+  ReceiverSample sample;
+  while (sampleQueue.pop(sample)) {
+    handleSample(sample);
+    sensorPresent = sample.measured;
   }
+  PROFILE_MARK("detect");
   
-  if (!sensorInitialized) {
-    Serial.println("VL6180X sensor initialization failed.");
-    Serial.println("Operating in sensor-less mode.");
-    // センサーなしでも動作継続（無限ループ回避）
-  } else {
-    // デバイス固有のオフセットを適用
-    if (currentDevice.offsetCalibration != 0) {
-      vl.setOffset(currentDevice.offsetCalibration);
-      Serial.print("Offset applied: ");
-      Serial.print(currentDevice.offsetCalibration);
-      Serial.println("mm");
+  if (sensorPresent) {
+    // 常にBLEでカウントデータを送信（データ消失防止、25ms間隔）
+    int32_t detectToNotify;
+    app.notifyCount(halClock.millis(), detectToNotify);
+    if (detectToNotify >= 0) {
+      detectToNotifyLatency.record(detectToNotify);
     }
-    
-    // 安定性向上のためシングルショット測定モードを開始
-    Serial.println("Single-shot measurement mode started");
-    Serial.println("Executing baseline distance calibration...");
-    
-    // ベースライン距離校正を実行
-    delay(2000); // センサーの安定化待機
-    calibrateBaseline();
-    
-    Serial.println("To re-run calibration, send 'c'");
+    PROFILE_MARK("ble_notify");
   }
   
-  // 初期化完了を示すLED点滅
-  for(int i = 0; i < 2; i++) {
-    setLEDIntensity(0, 255);
-    delay(300);
-    setLEDIntensity(0, 0);
-    delay(300);
-  }
-  setLEDIntensity(0, 100); // 通常の青色点灯で開始
+  // 起動タイムライン（校正とBLE初期化が終わったら1回だけ出力）
+  if (!bootReported && !app.booting() && app.boot.has("ble_adv")) {
+    bootReported = true;
+    bootMs = (int32_t)app.boot.at("detect_ready");
+    dumpBootTimeline();
+  }
+  PROFILE_MARK("boot");
   
-  Serial.println("Receiver setup complete");
+  scheduler.signal(ledTask);  // 表示のパターンが変わったかもしれない
 }
 
-void loop() {
-  // BLE接続状態管理
+// LEDは宣言されたパターンを出力するだけ（変化がなければ書き込まない、フェードはLEDCが行う）
+// 次に出力が変わる時刻まで呼ばない
+void updateLeds(uint32_t now) {
+  uint32_t next = app.updateLeds(now);
+  if (next != LedEffects::NO_CHANGE) {
+    scheduler.start(ledTask, next);
+  } else {
+    scheduler.cancel(ledTask);
+  }
+  PROFILE_MARK("led");
+}
+
+// BLE接続状態管理
+void updateBleState(uint32_t) {
   if (!deviceConnected && oldDeviceConnected) {
-    delay(500); // BLEスタックに準備時間を与える
-    pServer->startAdvertising(); // アドバタイジング再開
-    Serial.println("Advertising restarted");
+    // BLEスタックに準備時間を与えてからアドバタイジング再開
+    scheduler.start(advertisingTask, ADVERTISING_RESTART_DELAY);
     oldDeviceConnected = deviceConnected;
   }
   if (deviceConnected && !oldDeviceConnected) {
     oldDeviceConnected = deviceConnected;
   }
+  PROFILE_MARK("ble_state");
+}
+
+void restartAdvertising(uint32_t) {
+  if (!deviceConnected) {
+    pServer->startAdvertising(); // アドバタイジング再開
+    LOG_I(LOG_MOD_BLE, "Advertising restarted");
+  }
+}
 
+void readCommands(uint32_t) {
+  // 設定コマンド（"$" から改行まで、シリアル・BLE）
+  while (serialConfigLine.active() && Serial.available() > 0) {
+    if (serialConfigLine.feed(Serial.read())) {
+      handleConfigCommand(serialConfigLine.line(), serialConfigLine.length());
+    }
+  }
+  if (bleConfigPending) {
+    handleConfigCommand(bleConfigLine, strlen(bleConfigLine));
+    bleConfigPending = false;
+  }
+  
   // 校正コマンドをチェック
-  if (Serial.available() > 0) {
+  if (!serialConfigLine.active() && Serial.available() > 0) {
     char command = Serial.read();
-    if (command == 'c' || command == 'C') {
-      calibrateBaseline();
+    if (command == '$') {
+      serialConfigLine.start(); // 改行までを設定コマンドとして読む
+    } else if (command == 'c' || command == 'C') {
+      app.requestCalibration(); // 測定タスクが以降の測定値で校正する
       // バッファをクリア
       while (Serial.available()) {
         Serial.read();
       }
+    } else if (command == '?') {
+      // レイテンシと測定タイミングのジッターを出力
+      char line[128];
+      detectToNotifyLatency.format(line, sizeof(line), "LAT detect->notify", "ms");
+      Serial.println(line);
+      sampleJitter.format(line, sizeof(line));
+      Serial.println(line);
+      rateStats.format(line, sizeof(line));
+      Serial.println(line);
+    } else if (command == '!') {
+      dumpMetrics();
+    } else if (command == 'b') {
+      dumpBootTimeline();
+    } else if (command == 'd') {
+      // 記録した距離サンプルを出力
+#if ENABLE_SAMPLE_RECORDER
+      dumpRecorder();
+#else
+      Serial.println("Sample recorder disabled (build with -D ENABLE_SAMPLE_RECORDER=1)");
+#endif
+    } else if (command == 'p') {
+      // ステージ別プロファイルを出力
+#if ENABLE_STAGE_PROFILER
+      PROFILE_PRINT(Serial);
+#else
+      Serial.println("Stage profiler disabled (build with -D ENABLE_STAGE_PROFILER=1)");
+#endif
     }
   }
-  
-  // センサーが利用可能な場合のみセンサー読み取りを実行
-  if (sensorAvailable) {
-    // VL6180Xセンサーから距離を読み取り（シングルショット測定モード使用）
-    uint8_t range = vl.readRange();
-    uint8_t status = vl.readRangeStatus();
-  
-    // 測定エラーをチェック
-    if (status == VL6180X_ERROR_NONE) {
-      // 距離データの出力頻度を制限（USB負荷軽減）
-      static unsigned long lastPrintTime = 0;
-      if (millis() - lastPrintTime > 1000) { // 1秒間隔で距離を出力
-        Serial.print("[");
-        Serial.print(currentDevice.deviceName);
-        Serial.print("] Distance: ");
-        Serial.print(range);
-        Serial.print("mm, Count: ");
-        Serial.println(deviceCount);
-        lastPrintTime = millis();
-      }
-      
-      // ミニ四駆通過検知（ベースライン距離より閾値以上小さい場合）
-      if (baselineCalibrated && range < (baselineDistance - DETECTION_THRESHOLD)) {
-        // 重複カウント防止チェック
-        unsigned long currentTime = millis();
-        static bool canCountUpMessageShown = false; // カウントアップ可能メッセージの表示フラグ
-        
-        // 待機時間が経過しているかチェック
-        bool canCountUp = (currentTime - lastCountTime > COUNT_IGNORE_DURATION);
-        
-        // カウントアップ可能タイミングでのメッセージ（待機時間終了時に一度表示）
-        if (canCountUp && !canCountUpMessageShown) {
-          Serial.println("=== Count-up timing reached ===");
-          Serial.print("Elapsed since last count: ");
-          Serial.print(currentTime - lastCountTime);
-          Serial.println("ms");
-          canCountUpMessageShown = true;
-        }
-        
-        if (canCountUp) {
-          deviceCount++;
-          
-          Serial.print("*** Mini 4WD passage detected! ***");
-          Serial.print(" Distance: ");
-          Serial.print(range);
-          Serial.print("mm (baseline: ");
-          Serial.print(baselineDistance);
-          Serial.print("mm) Count: ");
-          Serial.println(deviceCount);
-          
-          // カウントアップLED制御開始
-          countUpLEDActive = true;
-          countUpLEDStartTime = currentTime;
-          setLEDIntensity(0, 0); // 一時的に青色を消灯
-          
-          // カウントアップ可能メッセージフラグをリセット（次回カウントアップ用）
-          canCountUpMessageShown = false;
-        } else {
-          // カウントアップできない場合のログ
-          Serial.print("[Count waiting] Distance: ");
-          Serial.print(range);
-          Serial.print("mm, remaining wait time: ");
-          Serial.print(COUNT_IGNORE_DURATION - (currentTime - lastCountTime));
-          Serial.println("ms");
-        }
-        
-        // ベースライン以下の値が続く限り待機時間を延長するためlastCountTimeを更新
-        lastCountTime = currentTime;
-        
-        // LED制御：物体検知時は赤色点灯（カウントアップ中でない場合）
-        if (!countUpLEDActive) {
-          setLEDIntensity(255, 0); // 赤色点灯（検知中）
-        }
-      } else {
-        // 通過していない場合は通常の青色点灯
-        if (!countUpLEDActive) {
-          setLEDIntensity(0, 100); // 通常の青色点灯
-        }
-      }
-    } else {
-      // エラー時は赤色LED点滅
-      static unsigned long lastErrorFlashTime = 0;
-      static bool errorFlashState = false;
-      if (millis() - lastErrorFlashTime > 250) { // 250ms間隔で点滅
-        errorFlashState = !errorFlashState;
-        setLEDIntensity(errorFlashState ? 255 : 0, 0);
-        lastErrorFlashTime = millis();
-      }
-    }
-    
-    // カウントアップLED点滅制御
-    if (countUpLEDActive) {
-      unsigned long currentTime = millis();
-      unsigned long elapsedTime = currentTime - countUpLEDStartTime;
-      
-      if (elapsedTime < COUNT_UP_LED_DURATION) { // もし，elapsedTimeが3秒未満なら
-        // 3秒間点滅（250ms間隔）
-        static unsigned long lastBlinkTime = 0;
-        static bool blinkState = false;
-        
-        if (currentTime - lastBlinkTime > 250) {
-          blinkState = !blinkState;
-          setLEDIntensity(0, blinkState ? 255 : 0); // 青色点滅
-          lastBlinkTime = currentTime;
-        }
-      } else {
-        // 3秒経過後にカウントアップLED制御終了
-        countUpLEDActive = false;
-        setLEDIntensity(0, 100); // 通常の青色点灯に戻す
-      }
-    }
-    
-    // 常にBLEでカウントデータを送信（データ消失防止）
-    static unsigned long lastBLESendTime = 0;
-    if (deviceConnected && pCharacteristic && millis() - lastBLESendTime > 25) { // 1/25ms(40Hz)間隔で今のカウントを送信
-      String countData = String(currentDevice.deviceNumber) + ":" + String(deviceCount);
-      pCharacteristic->setValue(countData.c_str());
-      pCharacteristic->notify();
-
-      // 通信中の青色点滅（カウントアップ中でない場合のみ）
-      if (!countUpLEDActive) {
-        static unsigned long commLEDStartTime = 0;
-        static bool commLEDActive = false;
-        
-        if (!commLEDActive) {
-          setLEDIntensity(0, 255); // 青色点滅
-          commLEDStartTime = millis();
-          commLEDActive = true;
-        } else if (millis() - commLEDStartTime > 50) { // 50ms間点滅
-          setLEDIntensity(0, 100); // 通常の青色点滅に戻す
-          commLEDActive = false;
-        }
-      }
-      
-      lastBLESendTime = millis();
-    }
-  } else {
-    // センサーレスモード：青色点灯で待機状態を表示
-    static unsigned long lastPatternTime = 0;
-    static bool patternState = false;
-    
-    if (millis() - lastPatternTime > 1000) { // 1秒間隔でパターン変更
-      patternState = !patternState;
-      setLEDIntensity(0, patternState ? 200 : 50); // 青色点滅
-      lastPatternTime = millis();
-    }
+  PROFILE_MARK("serial_cmd");
+}
+
+// サンプルレートの更新（1秒ごと）
+void updateSampleRate(uint32_t) {
+  static uint32_t lastSampleCount = 0;
+  static uint32_t lastRateTime = 0;
+  uint32_t now = halClock.millis();
+  uint32_t elapsed = now - lastRateTime;
+  if (lastRateTime != 0 && elapsed > 0) {
+    samplesPerSecond = (sampleCount - lastSampleCount) * 1000 / elapsed;
   }
+  lastSampleCount = sampleCount;
+  lastRateTime = now;
+  PROFILE_MARK("telemetry");
+}
+
+// メトリクスの定期出力
+void reportMetrics(uint32_t) {
+  dumpMetrics();
+  PROFILE_MARK("telemetry");
+}
+
+void loop() {
+  PROFILE_MARK("idle");  // 前回のタスクの終わりからここまで（スケジューラで眠っていた時間を含む）
   
-  // 定期的にシリアルバッファをフラッシュ（USB安定性向上）
-  static unsigned long lastFlushTime = 0;
-  if (millis() - lastFlushTime > 1000) { // 1秒間隔
-    Serial.flush();
-    lastFlushTime = millis();
+  // ループ周期の計測（タスクを実行するために起きた間隔）
+  static uint32_t lastLoopMicros = 0;
+  uint32_t loopMicros = halClock.micros();
+  if (lastLoopMicros != 0) {
+    loopPeriod.record(loopMicros - lastLoopMicros);
   }
+  lastLoopMicros = loopMicros;
   
-  delay(20); // 1/20ms（50Hz）で測定
+  // 期限の来たタスクを実行し、次の締め切りか測定結果・BLEイベントの signal() まで眠る
+  scheduler.loop();
 }
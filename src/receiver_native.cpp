@@ -0,0 +1,569 @@
+// receiverのロジックをホスト上でフェイクHALと仮想時間で動かす（pio run -e receiver_native）
+//
+// 使い方:
+//   .pio/build/receiver_native/program [通過回数] [開始時刻ms] [最初の通過ms]
+//   # 800回（約1時間分）を millis() の折り返しをまたいで実行
+//   .pio/build/receiver_native/program 800 4294000000
+//   # 起動直後（500ms）の通過を検知できるか
+//   .pio/build/receiver_native/program 5 0 500
+//
+// ベースライン120mmのレーンに一定間隔でミニ四駆を通過させ、カウント数・BLE通知・
+// 検出から通知までの時間・起動タイムラインを確認する。実機なしで検知ロジックの回帰確認に使う
+// 最後に保存されたベースラインで再起動し、すぐ検知を始めるか・壊れた保存内容や
+// レーンの変化（保存値と測定が合わない）を検出できるか、安定待ちの測定値で判断しないか、
+// 続けて合わなければ使わないかを確認する
+// 周期タイマーで起こす測定タスクの予定時刻・ジッター・飛ばした予定の数（SampleScheduler）と
+// LED表示エンジン（LedEffects）のパターンの進み方・書き込み回数も仮想時計で確認する
+// loop() のタスクスケジューラ（TaskScheduler）の締め切り・signal()・遅れたときの扱いも確認する
+// 電源モードごとの消費電流の見積もり（power_plan.h）と "$power=" の設定・保存も確認する
+// 距離サンプル記録のブロック符号化（sample_codec.h）の往復と、反転したビットの検出も確認する
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "deadline.h"
+#include "device_config.h"
+#include "hal_fake.h"
+#include "latency_histogram.h"
+#include "led_effects.h"
+#include "power_plan.h"
+#include "receiver_app.h"
+#include "sample_codec.h"
+#include "sample_scheduler.h"
+#include "task_scheduler.h"
+
+#define RED_LED_PIN 1
+#define BLUE_LED_PIN 2
+
+// 保存内容 storage で再起動し、距離 laneRange のレーンで1秒動かす
+// firstRanges を渡すと、起動後の最初の測定値をその列に置き換える（0は laneRange のまま）
+// 戻り値: 保存値で起動したか（expectWarm）と、確定したベースラインが laneRange になったかが期待どおりならtrue
+static bool reboot(FakeStorage& storage, const char* label, uint8_t laneRange, bool expectWarm,
+                   const std::vector<uint8_t>& firstRanges = std::vector<uint8_t>()) {
+  FakeClock clock;
+  size_t reads = 0;
+  FakeRangeSensor sensor(clock, [&](uint32_t, uint8_t& range, uint8_t& status) {
+    range = reads < firstRanges.size() && firstRanges[reads] != 0 ? firstRanges[reads] : laneRange;
+    status = 0;
+    reads++;
+  }, 10000);
+  FakePwm pwm;
+  FakeSerial serial;
+  FakeBleLink link;
+  ReceiverApp app(clock, sensor, pwm, serial, link, RED_LED_PIN, BLUE_LED_PIN);
+  app.setStorage(&storage);
+  app.boot.begin(0);
+  app.begin(0);
+  LoopPacer loopPacer(20);
+  while (clock.millis() < 1000) {
+    app.step();
+    loopPacer.wait(clock);
+  }
+  bool warm = app.warmStart();
+  char line[160];
+  app.boot.format(line, sizeof(line));
+  bool ok = warm == expectWarm && app.detector.baseline() == laneRange && app.detector.count() == 0;
+  printf("reboot %-8s warm=%d baseline=%d %s %s\n", label, warm, app.detector.baseline(), line, ok ? "OK" : "NG");
+  return ok;
+}
+
+// 周期タイマー（esp_timer）と測定タスクを仮想時計で再現する
+// タスクが動き出すまでの遅れ・締め切りを超える遅れ・数周期の停止（フラッシュ書き込みなど）を注入し、
+// SampleScheduler が返す予定時刻と、SampleJitter の集計が注入した内容と一致するかを確かめる。
+// micros() の折り返し（約71.6分）をまたぐように始める
+static bool checkSampleScheduler() {
+  const uint32_t period = 20000;     // receiver.cpp の SAMPLE_PERIOD_US
+  const uint32_t deadline = period / 4;
+  const uint32_t wakeUs = 40;        // タイマーから測定タスクが動き出すまで
+  const uint32_t measureUs = 2000;   // 測定1回
+  const uint32_t ticks = 5000;       // 100秒分
+  FakeClock clock(4294900);          // 約67秒後に micros() が0に戻る
+  uint64_t now = clock.micros();     // 仮想時計の64ビット時刻（FakeClock と同じ値を進める）
+  SampleScheduler scheduler(period);
+  SampleJitter jitter(deadline);
+  uint64_t first = now + period;
+  scheduler.start((uint32_t)first);
+
+  uint64_t busyUntil = 0;
+  uint32_t samples = 0;
+  uint32_t expectedLate = 0;
+  uint32_t wrongSlot = 0;
+  for (uint32_t k = 0; k < ticks; k++) {
+    uint64_t tick = first + (uint64_t)k * period;
+    if (busyUntil >= tick + period) {
+      continue;  // 次のタイマーまで止まっていた（通知は次の1回にまとめられる）
+    }
+    uint64_t start = tick + wakeUs > busyUntil ? tick + wakeUs : busyUntil;
+    if (k % 97 == 0) {
+      start += deadline + 1000;  // 締め切りを超える遅れ
+    }
+    clock.advanceMicros(start - now);
+    now = start;
+    SampleSlot slot = scheduler.begin(clock.micros());
+    jitter.record(slot);
+    samples++;
+    if (slot.scheduledUs != (uint32_t)tick) {
+      wrongSlot++;
+    }
+    if (start - tick > deadline) {
+      expectedLate++;
+    }
+    busyUntil = start + measureUs;
+    if (k % 500 == 250) {
+      busyUntil += 3 * period + 5000;  // 数周期止まる
+    }
+  }
+
+  char line[160];
+  jitter.format(line, sizeof(line));
+  bool ok = wrongSlot == 0 && jitter.samples() == samples && samples + jitter.missed() == ticks &&
+            jitter.late() == expectedLate && jitter.jitter().max() < period;
+  printf("scheduler samples=%lu missed=%lu late=%lu(expected %lu) wrong_slot=%lu clock_end=%lu%s\n",
+         (unsigned long)samples, (unsigned long)jitter.missed(), (unsigned long)jitter.late(),
+         (unsigned long)expectedLate, (unsigned long)wrongSlot, (unsigned long)clock.micros(),
+         clock.micros() < first ? " (wrapped)" : "");
+  printf("%s %s\n", line, ok ? "OK" : "NG");
+
+  // 周期を半分にした後（測定周期の切り替え）は、締め切りも新しい周期の1/4になる
+  SampleScheduler rated(period);
+  SampleJitter ratedJitter(deadline);
+  rated.start(0);
+  SampleSlot slow = rated.begin(deadline - 1000);  // 元の周期の締め切り内
+  ratedJitter.record(slow.scheduledUs, slow.actualUs, slow.missed, slow.periodUs / 4);
+  rated.restart(period / 2, 1000);
+  SampleSlot fast = rated.begin(1000 + period / 2 + deadline - 1000);  // 元の締め切りなら間に合うが、新しい周期では遅れ
+  ratedJitter.record(fast.scheduledUs, fast.actualUs, fast.missed, fast.periodUs / 4);
+  bool ratedOk = slow.periodUs == period && fast.periodUs == period / 2 && fast.scheduledUs == 1000 + period / 2 &&
+                 ratedJitter.late() == 1 && ratedJitter.missed() == 0;
+  printf("scheduler restart period=%lu->%luus late=%lu %s\n", (unsigned long)slow.periodUs,
+         (unsigned long)fast.periodUs, (unsigned long)ratedJitter.late(), ratedOk ? "OK" : "NG");
+  return ok && ratedOk;
+}
+
+// TaskScheduler を仮想時計で10秒動かす（millis() の折り返しをまたぐ）
+// 25ms・1000msの定期タスク、一度だけのタスク、signal() で起こすタスクを登録し、1000msのタスクの1回目で
+// 70ms止まる（フラッシュ書き込みなど）。定期タスクが締め切りより早く動かないこと・止まった後に
+// 取り戻そうと連続実行しないこと・signal() したタスクが同じ時刻に動くこと・眠っている間は起きないことを確かめる
+struct SchedulerCheck {
+  uint32_t fastRuns;
+  uint32_t fastLast;
+  uint32_t fastMinGap;
+  uint32_t fastMaxGap;
+  uint32_t slowRuns;
+  uint32_t oneShotRuns;
+  uint32_t oneShotAt;
+  uint32_t signals;
+  uint32_t signalAt;
+  uint32_t signalRuns;
+  uint32_t signalWrongTime;
+  int signalTask;
+  FakeClock* clock;
+  TaskScheduler<4>* scheduler;
+};
+static SchedulerCheck schedulerCheck;
+
+static bool checkTaskScheduler() {
+  const uint32_t start = 0xFFFFFFFF - 3000;  // 3秒後に millis() が0に戻る
+  const uint32_t seconds = 10;
+  const uint32_t stallMs = 70;
+  FakeClock clock(start);
+  FakeWaker waker(clock);
+  TaskScheduler<4> scheduler(clock, waker);
+  LatencyHistogram lateness;
+  scheduler.setLatencyHistogram(&lateness);
+  SchedulerCheck& c = schedulerCheck;
+  c = SchedulerCheck();
+  c.fastMinGap = 0xFFFFFFFF;
+  c.clock = &clock;
+  c.scheduler = &scheduler;
+
+  scheduler.every([](uint32_t now) {
+    SchedulerCheck& c = schedulerCheck;
+    if (c.fastRuns > 0) {
+      uint32_t gap = now - c.fastLast;
+      c.fastMinGap = gap < c.fastMinGap ? gap : c.fastMinGap;
+      c.fastMaxGap = gap > c.fastMaxGap ? gap : c.fastMaxGap;
+    }
+    c.fastLast = now;
+    c.fastRuns++;
+    if (c.fastRuns % 37 == 0) {
+      c.signalAt = now;  // 他のタスク（BLEコールバックの代わり）から起こす
+      c.signals++;
+      c.scheduler->signal(c.signalTask);
+    }
+  }, 25);
+  scheduler.every([](uint32_t) {
+    SchedulerCheck& c = schedulerCheck;
+    if (c.slowRuns++ == 0) {
+      c.clock->delay(70);
+    }
+  }, 1000, 1000);
+  int oneShot = scheduler.add([](uint32_t now) {
+    schedulerCheck.oneShotRuns++;
+    schedulerCheck.oneShotAt = now;
+  });
+  c.signalTask = scheduler.add([](uint32_t now) {
+    SchedulerCheck& c = schedulerCheck;
+    c.signalRuns++;
+    if (now != c.signalAt) {
+      c.signalWrongTime++;
+    }
+  });
+  scheduler.start(oneShot, 500);
+
+  while (clock.millis() - start <= seconds * 1000) {
+    scheduler.loop();
+  }
+
+  char line[128];
+  lateness.format(line, sizeof(line), "LATE", "ms");
+  bool ok = c.fastMinGap == 25 && c.fastMaxGap <= 25 + stallMs && scheduler.skipped() == 1 &&
+            c.slowRuns == seconds && c.oneShotRuns == 1 && c.oneShotAt == start + 500 &&
+            c.signalRuns == c.signals && c.signalWrongTime == 0 && !scheduler.armed(oneShot) &&
+            lateness.max() <= stallMs && waker.sleeps < c.fastRuns + c.slowRuns + c.signals + 2 &&
+            scheduler.busyMicros() == stallMs * 1000;
+  printf("task_scheduler fast=%lu gap=%lu..%lums slow=%lu one_shot=%lu@+%lums signals=%lu/%lu skipped=%lu "
+         "wakeups=%lu busy=%luus clock_end=%lu%s\n",
+         (unsigned long)c.fastRuns, (unsigned long)c.fastMinGap, (unsigned long)c.fastMaxGap,
+         (unsigned long)c.slowRuns, (unsigned long)c.oneShotRuns, (unsigned long)(c.oneShotAt - start),
+         (unsigned long)c.signalRuns, (unsigned long)c.signals, (unsigned long)scheduler.skipped(),
+         (unsigned long)waker.sleeps, (unsigned long)scheduler.busyMicros(), (unsigned long)clock.millis(),
+         clock.millis() < start ? " (wrapped)" : "");
+  printf("%s %s\n", line, ok ? "OK" : "NG");
+  return ok;
+}
+
+// LedEffects を1msごとに update() し、出力が期待どおりの時刻に変わるか・変わらないときに書き込まないかを確かめる
+// （millis() の折り返しをまたぐ）。expect(t) は開始からの時刻 t に出ているべき色
+template <typename Expect>
+static bool checkLedRun(const char* label, LedEffects& leds, FakePwm& pwm, uint32_t start, uint32_t ms,
+                        uint32_t expectedWrites, Expect expect) {
+  uint32_t writesBefore = pwm.writes;
+  uint32_t mismatches = 0;
+  for (uint32_t t = 0; t < ms; t++) {
+    leds.update(start + t);
+    LedColor want = expect(t);
+    if (pwm.duty[RED_LED_PIN] != want.red || pwm.duty[BLUE_LED_PIN] != want.blue) {
+      mismatches++;
+    }
+  }
+  uint32_t writes = pwm.writes - writesBefore;
+  bool ok = mismatches == 0 && writes == expectedWrites;
+  printf("leds %-8s writes=%lu(expected %lu) mismatches=%lu %s\n", label, (unsigned long)writes,
+         (unsigned long)expectedWrites, (unsigned long)mismatches, ok ? "OK" : "NG");
+  return ok;
+}
+
+static bool checkLedEffects() {
+  const uint32_t start = 0xFFFFF000;  // 約4秒後に millis() が0に戻る
+  FakePwm pwm;
+  LedEffects leds(pwm, RED_LED_PIN, BLUE_LED_PIN);
+  bool ok = true;
+
+  // 点灯: 最初の1回だけ両ピンに書き、同じパターンを設定し直しても書かない
+  leds.set(LED_LAYER_BASE, LedPattern::solid(0, 100), start);
+  ok = checkLedRun("solid", leds, pwm, start, 5000, 2, [](uint32_t) { return LedColor{0, 100}; }) && ok;
+  uint32_t t0 = start + 5000;
+  leds.set(LED_LAYER_BASE, LedPattern::solid(0, 100), t0);
+  ok = checkLedRun("reset", leds, pwm, t0, 1000, 0, [](uint32_t) { return LedColor{0, 100}; }) && ok;
+
+  // 点滅: 250msごとに青だけが切り替わる（4秒で16回）
+  uint32_t t1 = t0 + 1000;
+  leds.set(LED_LAYER_BASE, LedPattern::blink({0, 255}, {0, 0}, 250), t1);
+  ok = checkLedRun("blink", leds, pwm, t1, 4000, 16, [](uint32_t t) {
+         return LedColor{0, (uint8_t)((t / 250) % 2 == 0 ? 255 : 0)};
+       }) && ok;
+
+  // 優先度: 赤の点灯の上に1秒間だけ通信の点灯、その上に3秒間のカウントアップ点滅。期限が過ぎれば下に戻る
+  // （書き込むのは色が変わるピンだけ: 点滅の消灯 → 赤 は赤のピンだけ）
+  uint32_t t2 = t1 + 4000;
+  leds.set(LED_LAYER_BASE, LedPattern::solid(255, 0), t2);
+  ok = checkLedRun("base", leds, pwm, t2, 500, 1, [](uint32_t) { return LedColor{255, 0}; }) && ok;
+  leds.show(LED_LAYER_COMM, LedPattern::solid(0, 255), t2 + 500, 1000);
+  ok = checkLedRun("comm", leds, pwm, t2 + 500, 500, 2, [](uint32_t) { return LedColor{0, 255}; }) && ok;
+  // 点滅12段（通信の期限は途中で切れるが見えない）→ 期限が過ぎたら赤に戻る
+  leds.show(LED_LAYER_ALERT, LedPattern::blink({0, 255}, {0, 0}, 250), t2 + 1000, 3000);
+  ok = checkLedRun("alert", leds, pwm, t2 + 1000, 4000, 11 + 1, [](uint32_t t) {
+         return t < 3000 ? LedColor{0, (uint8_t)((t / 250) % 2 == 0 ? 255 : 0)} : LedColor{255, 0};
+       }) && ok;
+
+  // フェード: 1段ごとに1回だけハードウェアフェードを指示する（最初の段だけ赤も0へ）
+  // 次の段はフェードの終わり（+ FADE_GUARD_MS）から始まる
+  uint32_t t3 = t2 + 5000;
+  uint32_t fadesBefore = pwm.fades;
+  leds.set(LED_LAYER_BASE, LedPattern::pulse({0, 50}, {0, 200}, 1000), t3);
+  ok = checkLedRun("pulse", leds, pwm, t3, 6000, 2 + 5, [](uint32_t t) {
+         uint32_t step = t < LedEffects::FADE_GUARD_MS ? 0 : (t - LedEffects::FADE_GUARD_MS) / 1000;
+         return LedColor{0, (uint8_t)(step % 2 == 0 ? 200 : 50)};  // FakePwm は向かっている値
+       }) && ok;
+  uint32_t fades = pwm.fades - fadesBefore;
+
+  // フェード中の変更はフェードの終わり（+ FADE_GUARD_MS）まで待たせる
+  uint32_t t4 = t3 + 6000;
+  leds.update(t4 + LedEffects::FADE_GUARD_MS);  // 7段目のフェードを始める
+  leds.set(LED_LAYER_BASE, LedPattern::solid(255, 0), t4 + 300);
+  uint32_t deferredBefore = leds.deferred();
+  ok = checkLedRun("deferred", leds, pwm, t4 + 300, 1000, 2, [](uint32_t t) {
+         return t < 700 + LedEffects::FADE_GUARD_MS ? LedColor{0, 200} : LedColor{255, 0};
+       }) && ok;
+  bool fadeOk = fades == 7 && leds.deferred() > deferredBefore;
+  printf("leds fades=%lu(expected 7) deferred=%lu clock_end=%lu (wrapped) %s\n", (unsigned long)fades,
+         (unsigned long)(leds.deferred() - deferredBefore), (unsigned long)(t4 + 1300), fadeOk ? "OK" : "NG");
+  return ok && fadeOk;
+}
+
+// 電源モードの見積もり: 予定どおりの負荷で full > balanced > saver の順に電流が減ること、
+// 同じ実測の負荷で変換を眠って待つとCPUのデューティ比が変換待ちの分だけ減ること、
+// 割合が0〜1に収まること（負荷が時間を超える・時間が0の場合も）、"$power=" が保存・復元されることを確かめる
+static bool checkPowerPlan() {
+  const uint32_t period = 20000;  // receiver.cpp の SAMPLE_PERIOD_US
+  PowerModel model;
+  bool ok = true;
+  char line[200];
+  float previousMa = 1e9f;
+  for (uint8_t mode = 0; mode < POWER_MODES; mode++) {
+    PowerSettings settings = powerSettings(mode, period);
+    PowerPlan connected = planPower(settings, model, nominalPowerLoad(settings, model, 25, true));
+    PowerPlan advertising = planPower(settings, model, nominalPowerLoad(settings, model, 25, false));
+    connected.format(line, sizeof(line), settings, 2000);
+    bool modeOk = connected.averageMa < previousMa && connected.averageMa > 0 && advertising.averageMa > 0 &&
+                  connected.cpuDuty <= 1 && connected.radioDuty <= 1 && connected.sensorDuty <= 1 &&
+                  connected.detectWindowUs == settings.samplePeriodUs + model.nominalSampleUs;
+    printf("%s %s\n", line, modeOk ? "OK" : "NG");
+    previousMa = connected.averageMa;
+    ok = modeOk && ok;
+  }
+  formatPowerModes(line, sizeof(line), period, model, 25);
+  printf("%s\n", line);
+
+  // 測定周期を切り替える場合（receiver.cpp の既定）: 下限25ms・幅の中は半分の周期で、一定周期より測定が減り、
+  // 見逃さない目安（detect）は下限の周期で決まる
+  const uint32_t floor = 25000;  // receiver.cpp の SAFETY_FLOOR_PERIOD_US
+  for (uint8_t mode = 0; mode < POWER_MODES; mode++) {
+    PowerSettings fixed = powerSettings(mode, period);
+    PowerSettings adaptive = adaptivePowerSettings(fixed, floor);
+    PowerLoad fixedLoad = nominalPowerLoad(fixed, model, 25, true);
+    PowerLoad adaptiveLoad = nominalPowerLoad(adaptive, model, 25, true);
+    PowerPlan plan = planPower(adaptive, model, adaptiveLoad);
+    uint32_t meanPeriod = (uint32_t)(model.nominalFastShare * fixed.samplePeriodUs / 2 +
+                                     (1 - model.nominalFastShare) * floor);
+    bool adaptiveOk = adaptive.fastPeriodUs == fixed.samplePeriodUs / 2 && adaptive.samplePeriodUs == floor &&
+                      adaptiveLoad.samples == 1000000 / meanPeriod &&
+                      (fixed.samplePeriodUs >= floor || adaptiveLoad.samples < fixedLoad.samples) &&
+                      plan.detectWindowUs == floor + model.nominalSampleUs;
+    printf("power adaptive %s samples/s=%lu (fixed %lu) detect>=%lums %s\n", powerModeName(mode),
+           (unsigned long)adaptiveLoad.samples, (unsigned long)fixedLoad.samples,
+           (unsigned long)((plan.detectWindowUs + 999) / 1000), adaptiveOk ? "OK" : "NG");
+    ok = adaptiveOk && ok;
+  }
+  formatPowerModes(line, sizeof(line), period, model, 25, floor);
+  printf("%s\n", line);
+
+  // 10秒間の実測: 500回測定（1回8ms）、loop() は0.1秒、1000回起床
+  PowerLoad load;
+  load.windowUs = 10000000;
+  load.samples = 500;
+  load.sampleUs = 500 * 8000;
+  load.loopBusyUs = 100000;
+  load.wakeups = 1000;
+  load.notifications = 400;
+  load.connected = true;
+  load.ledLevel = 0.4f;
+  PowerPlan full = planPower(powerSettings(POWER_FULL, period), model, load);
+  PowerPlan balanced = planPower(powerSettings(POWER_BALANCED, period), model, load);
+  float fullCpu = (500.0f * 8000 + 100000) / 10000000;
+  float balancedCpu = (500.0f * model.sampleCpuUs + 100000 + 1000.0f * model.wakeUs) / 10000000;
+  bool measuredOk = fabsf(full.cpuDuty - fullCpu) < 1e-4f && fabsf(balanced.cpuDuty - balancedCpu) < 1e-4f &&
+                    fabsf(full.sensorDuty - 0.4f) < 1e-4f && balanced.averageMa < full.averageMa;
+  load.sampleUs = 3 * load.windowUs;  // 集計の食い違い（時間を超える負荷）
+  PowerPlan overloaded = planPower(powerSettings(POWER_FULL, period), model, load);
+  PowerPlan empty = planPower(powerSettings(POWER_SAVER, period), model, PowerLoad());
+  measuredOk = measuredOk && overloaded.cpuDuty == 1 && overloaded.sensorDuty == 1 && empty.cpuDuty == 0 &&
+               empty.radioDuty == 0 && empty.averageMa > 0;
+  printf("power measured cpu full=%.2f%% balanced=%.2f%% avg full=%.1fmA balanced=%.1fmA %s\n",
+         full.cpuDuty * 100, balanced.cpuDuty * 100, full.averageMa, balanced.averageMa, measuredOk ? "OK" : "NG");
+  ok = measuredOk && ok;
+
+  // "$power=" の設定と保存（既定は full）
+  DeviceConfig config = defaultDeviceConfig();
+  setDeviceConfigName(config, "Lane2");
+  FakeStorage storage;
+  static const uint8_t mac[6] = {0};
+  bool configOk = config.power == POWER_FULL &&
+                  applyDeviceConfigCommand(config, "$power=saver", 12) == DEVICE_CONFIG_CMD_CHANGED &&
+                  config.power == POWER_SAVER &&
+                  applyDeviceConfigCommand(config, "$power=3", 8) == DEVICE_CONFIG_CMD_ERROR &&
+                  applyDeviceConfigCommand(config, "$power=1", 8) == DEVICE_CONFIG_CMD_CHANGED &&
+                  saveDeviceConfig(storage, config);
+  DeviceConfig loaded;
+  configOk = configOk && loadDeviceConfig(storage, mac, loaded) == DEVICE_CONFIG_FROM_STORAGE &&
+             loaded.power == POWER_BALANCED;
+  formatDeviceConfig(loaded, line, sizeof(line));
+  printf("%s %s\n", line, configOk ? "OK" : "NG");
+  return ok && configOk;
+}
+
+// 距離サンプル記録の符号化（sample_codec.h）:
+//   50Hz前後の揺らぎ・長い間隔・millis() の折り返し・0↔255 の距離の跳び・全ステータスを含む列を
+//   ブロックに分けて符号化し、復号すると時刻・距離・ステータスがすべて元どおりになること
+//   ブロックの使用範囲（ヘッダ＋ペイロード）のどの1ビットを反転しても、サンプルを1件も出さずに
+//   SAMPLE_BLOCK_CORRUPT（magic が壊れた場合は SAMPLE_BLOCK_EMPTY）を返すこと
+static bool checkSampleCodec() {
+  struct Sample {
+    uint32_t time;
+    uint8_t range;
+    uint8_t status;
+  };
+  std::vector<Sample> samples;
+  uint32_t time = 0xFFFFF000;  // 途中で折り返す
+  uint32_t random = 2024;
+  for (uint32_t i = 0; i < 3000; i++) {
+    random = random * 1103515245 + 12345;
+    time += i % 500 == 499 ? 70000 : 18 + (random >> 16) % 5;
+    uint8_t range = (random >> 8) % 16 == 0 ? (uint8_t)((i & 1) ? 255 : 0) : (uint8_t)(100 + (random >> 20) % 40);
+    samples.push_back({time, range, (uint8_t)(i % 16)});
+  }
+
+  std::vector<std::vector<uint8_t>> blocks;
+  SampleBlockEncoder encoder;
+  encoder.begin(0, samples[0].time);
+  for (const Sample& sample : samples) {
+    if (!encoder.add(sample.time, sample.range, sample.status)) {
+      encoder.finish();
+      blocks.push_back(std::vector<uint8_t>(encoder.data(), encoder.data() + SAMPLE_BLOCK_SIZE));
+      encoder.begin(encoder.seq() + 1, sample.time);
+      encoder.add(sample.time, sample.range, sample.status);
+    }
+  }
+  encoder.finish();
+  blocks.push_back(std::vector<uint8_t>(encoder.data(), encoder.data() + SAMPLE_BLOCK_SIZE));
+
+  std::vector<Sample> decoded;
+  bool roundTripOk = true;
+  for (size_t b = 0; b < blocks.size(); b++) {
+    SampleBlockInfo info;
+    SampleBlockResult result = decodeSampleBlock(blocks[b].data(), SAMPLE_BLOCK_SIZE, info,
+                                                 [&](uint32_t t, uint8_t range, uint8_t status) {
+                                                   decoded.push_back({t, range, status});
+                                                 });
+    roundTripOk = roundTripOk && result == SAMPLE_BLOCK_OK && info.seq == b;
+  }
+  roundTripOk = roundTripOk && decoded.size() == samples.size();
+  for (size_t i = 0; roundTripOk && i < samples.size(); i++) {
+    roundTripOk = decoded[i].time == samples[i].time && decoded[i].range == samples[i].range &&
+                  decoded[i].status == samples[i].status;
+  }
+
+  // 最初のブロックの使用範囲の全ビットを1つずつ反転する
+  std::vector<uint8_t>& block = blocks[0];
+  SampleBlockInfo info = SampleBlockInfo();
+  readSampleBlockHeader(block.data(), SAMPLE_BLOCK_SIZE, info);
+  size_t used = SAMPLE_BLOCK_HEADER_SIZE + info.length;
+  uint32_t flips = 0;
+  uint32_t accepted = 0;
+  for (size_t bit = 0; bit < used * 8; bit++) {
+    block[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+    uint32_t emitted = 0;
+    SampleBlockResult result =
+        decodeSampleBlock(block.data(), SAMPLE_BLOCK_SIZE, info, [&](uint32_t, uint8_t, uint8_t) { emitted++; });
+    if (result == SAMPLE_BLOCK_OK || emitted != 0 || (result == SAMPLE_BLOCK_EMPTY && bit >= 32)) {
+      accepted++;
+    }
+    block[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+    flips++;
+  }
+  bool ok = roundTripOk && accepted == 0;
+  printf("sample codec samples=%zu blocks=%zu decoded=%zu bit_flips=%lu accepted=%lu %s\n", samples.size(),
+         blocks.size(), decoded.size(), (unsigned long)flips, (unsigned long)accepted, ok ? "OK" : "NG");
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  int passes = argc > 1 ? atoi(argv[1]) : 20;
+  uint32_t start = argc > 2 ? (uint32_t)strtoul(argv[2], nullptr, 10) : 0;  // 起動時のmillis()
+  uint32_t firstPass = argc > 3 ? (uint32_t)strtoul(argv[3], nullptr, 10) : 20000;  // 最初の通過時刻（起動からのms）
+  const uint32_t passInterval = 4500;   // 通過間隔（ms、重複防止時間3秒より長い）
+  const uint32_t passDuration = 60;     // センサー前にいる時間（ms）
+
+  FakeClock clock(start);
+  FakeRangeSensor sensor(clock, [&](uint32_t now, uint8_t& range, uint8_t& status) {
+    status = 0;
+    range = 120;
+    uint32_t uptime = now - start;
+    if (uptime >= firstPass) {
+      uint32_t sinceFirst = uptime - firstPass;
+      if (sinceFirst / passInterval < (uint32_t)passes && sinceFirst % passInterval < passDuration) {
+        range = 40;
+      }
+    }
+  }, 10000);  // 単発測定 約10ms
+  FakePwm pwm;
+  FakeSerial serial;
+  FakeBleLink link;
+  FakeStorage storage;
+  ReceiverApp app(clock, sensor, pwm, serial, link, RED_LED_PIN, BLUE_LED_PIN);
+  app.setDeviceNumber(1);
+  app.setStorage(&storage);
+
+  app.boot.begin(start);
+  app.begin(0);  // 起動の各段階は以下のループの中で進む
+
+  LatencyHistogram detectToNotify;
+  uint32_t endTime = firstPass + passInterval * passes + 1000;
+  uint32_t loops = 0;
+  LoopPacer loopPacer(20);
+  while (clock.millis() - start < endTime) {
+    uint8_t range;
+    uint8_t status;
+    if (app.readSensor(range, status)) {
+      uint32_t now = clock.millis();
+      if (app.detect(now, range, status) == PASSAGE_COUNTED) {
+        printf("[%lu] passage detected, count=%d\n", (unsigned long)now, app.detector.count());
+      }
+      int32_t latency;
+      app.notifyCount(clock.millis(), latency);
+      if (latency >= 0) {
+        detectToNotify.record(latency);
+      }
+      app.updateLeds(clock.millis());
+    } else {
+      app.updateSensorlessLed(clock.millis());
+    }
+    loopPacer.wait(clock);
+    loops++;
+  }
+
+  fputs(serial.output.c_str(), stdout);
+  char line[160];
+  app.boot.format(line, sizeof(line));
+  printf("%s\n", line);
+  detectToNotify.format(line, sizeof(line), "LAT detect->notify", "ms");
+  printf("count=%d expected=%d loops=%lu sensor_reads=%lu notifications=%zu led_writes=%lu\n",
+         app.detector.count(), passes, (unsigned long)loops, (unsigned long)sensor.reads,
+         link.notifications.size(), (unsigned long)pwm.writes);
+  printf("last notification: %s\n", link.notifications.empty() ? "-" : link.notifications.back().c_str());
+  printf("clock: start=%lu end=%lu%s loop_overruns=%lu\n", (unsigned long)start, (unsigned long)clock.millis(),
+         clock.millis() < start ? " (wrapped)" : "", (unsigned long)loopPacer.overruns());
+  printf("%s\n", line);
+
+  bool ok = app.detector.count() == passes;
+  ok = reboot(storage, "warm", 120, true) && ok;
+  ok = reboot(storage, "moved", 90, false) && ok;  // 保存値120mm、実際は90mm
+  storage.entries[BASELINE_STORAGE_KEY][7] ^= 0x01;  // 保存内容を壊す
+  ok = reboot(storage, "corrupt", 90, false) && ok;
+  ok = reboot(storage, "resaved", 90, true) && ok;
+  // 安定待ち（最初の3回）の測定値は確かめに使わない
+  ok = reboot(storage, "settling", 90, true, {30, 250, 60}) && ok;
+  // 安定待ちの後、許容範囲内が2回続いても3回目が外れれば保存値を捨てる
+  ok = reboot(storage, "outlier", 90, false, {0, 0, 0, 0, 0, 96}) && ok;
+  printf("storage writes=%lu\n", (unsigned long)storage.writes);
+  ok = checkSampleScheduler() && ok;
+  ok = checkLedEffects() && ok;
+  ok = checkTaskScheduler() && ok;
+  ok = checkPowerPlan() && ok;
+  ok = checkSampleCodec() && ok;
+  return ok ? 0 : 1;
+}
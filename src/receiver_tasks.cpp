@@ -0,0 +1,322 @@
+// receiverの測定タスクとloop()の分割をホスト上のスレッドで再現する（pio run -e receiver_tasks）
+//
+// 使い方:
+//   .pio/build/receiver_tasks/program [--seconds S] [--log-bytes N] [--log-every MS]
+//
+// ファームウェアと同じ組み合わせ（ReceiverApp::measure() → SpscQueue → present()）を
+// std::thread で動かし、loop()側が重いシリアル出力（115200bpsで送信を待つ）をしている間も
+// 20ms周期の測定が乱れず、通過を取りこぼさないことを確かめる。
+// 比較のため、同じ処理を1つのスレッドで順に行う従来の構成（single）も実行する
+//
+//   single  測定・LED・通知・ログを1スレッドで（ログの送信待ちの間は測定できない）
+//   split   測定スレッド（FreeRTOSの測定タスクの代わり）と loop() スレッドをキューでつなぐ
+//
+// 時刻は実時間（std::chrono）。split の測定周期の99パーセンタイルが周期の2倍を超えるか、
+// 通過の取りこぼし・キューの取りこぼし・順序の乱れがあれば終了コード1
+// （ホストのスケジューラはリアルタイムではないため、まれな外れ値は最大値として表示するだけにする）
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "hal_fake.h"
+#include "latency_histogram.h"
+#include "receiver_app.h"
+#include "spsc_queue.h"
+
+#define RED_LED_PIN 1
+#define BLUE_LED_PIN 2
+
+static const uint32_t SAMPLE_PERIOD_MS = 20;   // receiver.cpp の SAMPLE_PERIOD_US（ms）
+static const uint32_t LOOP_IDLE_MS = 25;       // receiver.cpp の COMMAND_POLL_MS（測定結果がなくても起きる間隔）
+static const uint32_t UART_BYTE_US = 87;       // 115200bps で1バイト（10ビット）を送る時間
+static const uint32_t SENSOR_READ_US = 2000;   // 単発測定の変換時間
+static const uint32_t LANE_RANGE = 120;        // レーンの距離（mm）
+static const uint32_t CAR_RANGE = 60;          // 通過中の距離（mm）
+static const uint32_t FIRST_PASS_MS = 1000;    // 校正が終わってから通過させる
+static const uint32_t PASS_INTERVAL_MS = 300;
+static const uint32_t PASS_DURATION_MS = 45;   // 測定2〜3回分
+
+typedef std::chrono::steady_clock SteadyTime;
+
+// 実時間の時計（複数のスレッドから読める）
+class SteadyClock : public HalClock {
+ public:
+  SteadyClock() : origin_(SteadyTime::now()) {}
+  uint32_t millis() override { return (uint32_t)(elapsedMicros() / 1000); }
+  uint32_t micros() override { return (uint32_t)elapsedMicros(); }
+  void delay(uint32_t ms) override { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+
+ private:
+  uint64_t elapsedMicros() const {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(SteadyTime::now() - origin_).count();
+  }
+
+  SteadyTime::time_point origin_;
+};
+
+// 一定間隔でミニ四駆が通過するレーン（測定スレッドだけが読む）
+class LaneSensor : public HalRangeSensor {
+ public:
+  explicit LaneSensor(HalClock& clock) : clock_(clock) {}
+  bool begin() override { return true; }
+  void read(uint8_t& range, uint8_t& status) override {
+    uint32_t now = clock_.millis();
+    bool inLane = now >= FIRST_PASS_MS && (now - FIRST_PASS_MS) % PASS_INTERVAL_MS < PASS_DURATION_MS;
+    range = (uint8_t)(inLane ? CAR_RANGE : LANE_RANGE);
+    status = 0;
+    std::this_thread::sleep_for(std::chrono::microseconds(SENSOR_READ_US));
+  }
+  void setOffset(int8_t) override {}
+
+  // 時刻 end までに始まった通過の回数
+  static uint32_t passesBefore(uint32_t end) {
+    return end <= FIRST_PASS_MS ? 0 : (end - FIRST_PASS_MS + PASS_INTERVAL_MS - 1) / PASS_INTERVAL_MS;
+  }
+
+ private:
+  HalClock& clock_;
+};
+
+// xTaskNotifyGive / ulTaskNotifyTake の代わり
+class TaskNotify {
+ public:
+  TaskNotify() : pending_(0) {}
+  void give() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_++;
+    }
+    cv_.notify_one();
+  }
+  void take(uint32_t timeoutMs) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] { return pending_ > 0; });
+    pending_ = 0;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  uint32_t pending_;
+};
+
+struct RunOptions {
+  uint32_t seconds = 4;
+  uint32_t logBytes = 2000;  // まとめて出力するログの量（メトリクス・記録のダンプ相当）
+  uint32_t logEvery = 500;   // その間隔（ms）
+};
+
+struct RunResult {
+  LatencyHistogram period;  // 測定周期（us）
+  uint32_t samples = 0;
+  uint32_t counted = 0;
+  uint32_t passes = 0;
+  uint32_t dropped = 0;
+  uint32_t disorder = 0;  // 時刻・カウントの逆行
+  size_t maxDepth = 0;
+};
+
+// loop()側の処理（LED・通知・ログ）。ログはシリアルの送信を待つ時間だけ止まる
+class LoopSide {
+ public:
+  LoopSide(ReceiverApp& app, HalClock& clock, const RunOptions& options, RunResult& result)
+      : app_(app), clock_(clock), options_(options), result_(result), lastStartedUs_(0), lastTime_(0),
+        lastCount_(0), nextDump_(FIRST_PASS_MS) {}
+
+  void handle(const ReceiverSample& sample) {
+    if (lastStartedUs_ != 0) {
+      result_.period.record(sample.startedUs - lastStartedUs_);
+      if (sample.time < lastTime_ || sample.count < lastCount_) {
+        result_.disorder++;
+      }
+    }
+    lastStartedUs_ = sample.startedUs;
+    lastTime_ = sample.time;
+    lastCount_ = sample.count;
+    result_.samples++;
+    app_.present(sample);
+    if (sample.result == PASSAGE_COUNTED) {
+      result_.counted++;
+      uartWrite(80);  // 検出ログ1行
+    }
+  }
+
+  void service() {
+    uint32_t now = clock_.millis();
+    int32_t detectToNotify;
+    app_.notifyCount(now, detectToNotify);
+    app_.updateLeds(now);
+    if (now >= nextDump_) {
+      nextDump_ = now + options_.logEvery;
+      uartWrite(options_.logBytes);
+    }
+  }
+
+ private:
+  static void uartWrite(uint32_t bytes) {
+    std::this_thread::sleep_for(std::chrono::microseconds((uint64_t)bytes * UART_BYTE_US));
+  }
+
+  ReceiverApp& app_;
+  HalClock& clock_;
+  const RunOptions& options_;
+  RunResult& result_;
+  uint32_t lastStartedUs_;
+  uint32_t lastTime_;
+  int32_t lastCount_;
+  uint32_t nextDump_;
+};
+
+static PassageDetectorConfig laneConfig() {
+  PassageDetectorConfig config;
+  config.ignoreMs = 150;  // 通過間隔より短く、1回の通過の中では重複させない
+  return config;
+}
+
+// 従来の構成: 1つのスレッドで測定してから loop() 側の処理を行い、次の周期まで待つ
+static void runSingle(const RunOptions& options, RunResult& result) {
+  SteadyClock clock;
+  LaneSensor sensor(clock);
+  FakePwm pwm;
+  FakeSerial serial;
+  FakeBleLink link;
+  ReceiverApp app(clock, sensor, pwm, serial, link, RED_LED_PIN, BLUE_LED_PIN, laneConfig());
+  app.begin(0);
+  LoopSide loop(app, clock, options, result);
+  uint32_t end = options.seconds * 1000;
+  SteadyTime::time_point wake = SteadyTime::now();
+  while (clock.millis() < end) {
+    ReceiverSample sample;
+    app.measure(sample);
+    loop.handle(sample);
+    loop.service();
+    wake += std::chrono::milliseconds(SAMPLE_PERIOD_MS);
+    std::this_thread::sleep_until(wake);  // 遅れた分は取り戻さない（LoopPacer と同じ）
+    if (wake < SteadyTime::now()) {
+      wake = SteadyTime::now();
+    }
+  }
+  result.passes = LaneSensor::passesBefore(clock.millis());
+}
+
+// 分割した構成: 測定スレッドが周期どおりに測定してキューに積み、loop() スレッドが取り出して処理する
+static void runSplit(const RunOptions& options, RunResult& result) {
+  SteadyClock clock;
+  LaneSensor sensor(clock);
+  FakePwm pwm;
+  FakeSerial serial;
+  FakeBleLink link;
+  ReceiverApp app(clock, sensor, pwm, serial, link, RED_LED_PIN, BLUE_LED_PIN, laneConfig());
+  app.begin(0);
+  SpscQueue<ReceiverSample, 32> queue;
+  TaskNotify wakeLoop;
+  std::atomic<bool> running(true);
+  uint32_t end = options.seconds * 1000;
+
+  // 測定タスクの代わり（vTaskDelayUntil と同じく、周期の基準時刻を積み上げる）
+  std::thread sampling([&] {
+    SteadyTime::time_point wake = SteadyTime::now();
+    while (clock.millis() < end) {
+      ReceiverSample sample;
+      app.measure(sample);
+      queue.push(sample);
+      wakeLoop.give();
+      wake += std::chrono::milliseconds(SAMPLE_PERIOD_MS);
+      std::this_thread::sleep_until(wake);
+    }
+    running.store(false, std::memory_order_release);
+    wakeLoop.give();
+  });
+
+  // loop() の代わり
+  std::thread loopThread([&] {
+    LoopSide loop(app, clock, options, result);
+    while (true) {
+      bool finished = !running.load(std::memory_order_acquire);
+      size_t depth = queue.size();
+      if (depth > result.maxDepth) {
+        result.maxDepth = depth;
+      }
+      ReceiverSample sample;
+      while (queue.pop(sample)) {
+        loop.handle(sample);
+      }
+      if (finished) {
+        break;
+      }
+      loop.service();
+      wakeLoop.take(LOOP_IDLE_MS);
+    }
+  });
+
+  sampling.join();
+  loopThread.join();
+  result.dropped = queue.dropped();
+  result.passes = LaneSensor::passesBefore(clock.millis());
+}
+
+static void report(const char* name, const RunResult& result) {
+  char line[128];
+  result.period.format(line, sizeof(line), "period", "us");
+  printf("%-6s samples=%lu counted=%lu/%lu dropped=%lu disorder=%lu max_depth=%lu %s\n", name,
+         (unsigned long)result.samples, (unsigned long)result.counted, (unsigned long)result.passes,
+         (unsigned long)result.dropped, (unsigned long)result.disorder, (unsigned long)result.maxDepth, line);
+}
+
+static void usage(const char* program) {
+  fprintf(stderr, "usage: %s [--seconds S] [--log-bytes N] [--log-every MS]\n", program);
+}
+
+int main(int argc, char** argv) {
+  RunOptions options;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      usage(argv[0]);
+      return 2;
+    }
+    if (strcmp(arg, "--seconds") == 0) {
+      options.seconds = (uint32_t)strtoul(value, nullptr, 10);
+    } else if (strcmp(arg, "--log-bytes") == 0) {
+      options.logBytes = (uint32_t)strtoul(value, nullptr, 10);
+    } else if (strcmp(arg, "--log-every") == 0) {
+      options.logEvery = (uint32_t)strtoul(value, nullptr, 10);
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+    i++;
+  }
+  if (options.seconds < 2 || options.logEvery == 0) {
+    usage(argv[0]);
+    return 2;
+  }
+  printf("period=%lums log=%luB every %lums (%lums of UART time)\n", (unsigned long)SAMPLE_PERIOD_MS,
+         (unsigned long)options.logBytes, (unsigned long)options.logEvery,
+         (unsigned long)(options.logBytes * UART_BYTE_US / 1000));
+
+  RunResult single;
+  runSingle(options, single);
+  report("single", single);
+
+  RunResult split;
+  runSplit(options, split);
+  report("split", split);
+
+  // 最後の通過は測定が終わる直前に始まって数えられないことがあるため1回まで許す
+  bool steady = split.period.percentile(99) <= SAMPLE_PERIOD_MS * 1000 * 2;
+  bool complete = split.counted + 1 >= split.passes && split.counted <= split.passes;
+  bool ok = steady && complete && split.dropped == 0 && split.disorder == 0;
+  printf("RESULT %s (split period p99 %luus, counted %lu/%lu)\n", ok ? "OK" : "NG",
+         (unsigned long)split.period.percentile(99), (unsigned long)split.counted, (unsigned long)split.passes);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,181 @@
+// 距離サンプル記録ファイルのデコーダ（ホスト用、pio run -e sample_decoder）
+//
+// 使い方:
+//   .pio/build/sample_decoder/program samples.bin > samples.csv   // /rec/*.bin をつなげたもの（cat rec/*.bin > samples.bin）
+//   .pio/build/sample_decoder/program monitor.log > samples.csv   // 'd' コマンドのシリアル出力
+//
+// CSV（block,time_ms,range_mm,status）を標準出力へ、集計を標準エラーへ出力する
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "sample_codec.h"
+
+struct DecodedSample {
+  uint32_t time;
+  uint8_t range;
+  uint8_t status;
+};
+
+struct DecodedBlock {
+  uint32_t seq;
+  std::vector<DecodedSample> samples;
+};
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// "RECDUMP BEGIN" 〜 "RECDUMP END" の16進行をバイナリに戻す（他のログ行は無視）
+static bool parseHexDump(const std::vector<uint8_t>& text, std::vector<uint8_t>& out) {
+  std::string content(text.begin(), text.end());
+  size_t begin = content.find("RECDUMP BEGIN");
+  if (begin == std::string::npos) {
+    return false;
+  }
+  size_t pos = content.find('\n', begin);
+  while (pos != std::string::npos && pos < content.size()) {
+    size_t end = content.find('\n', pos + 1);
+    std::string line = content.substr(pos + 1, end == std::string::npos ? std::string::npos : end - pos - 1);
+    while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) {
+      line.pop_back();
+    }
+    if (line.compare(0, 11, "RECDUMP END") == 0) {
+      break;
+    }
+    bool isHex = !line.empty() && line.size() % 2 == 0;
+    for (size_t i = 0; isHex && i < line.size(); i++) {
+      isHex = hexValue(line[i]) >= 0;
+    }
+    if (isHex) {
+      for (size_t i = 0; i < line.size(); i += 2) {
+        out.push_back((uint8_t)(hexValue(line[i]) << 4 | hexValue(line[i + 1])));
+      }
+    }
+    pos = end;
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <samples.bin | serial log with RECDUMP>\n", argv[0]);
+    return 2;
+  }
+  FILE* file = fopen(argv[1], "rb");
+  if (!file) {
+    perror(argv[1]);
+    return 1;
+  }
+  std::vector<uint8_t> raw;
+  uint8_t chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    raw.insert(raw.end(), chunk, chunk + n);
+  }
+  fclose(file);
+
+  std::vector<uint8_t> image;
+  if (!parseHexDump(raw, image)) {
+    image.swap(raw);
+  }
+
+  // ブロックごとに復号
+  std::vector<DecodedBlock> blocks;
+  size_t emptyBlocks = 0;
+  size_t corruptBlocks = 0;
+  for (size_t offset = 0; offset + SAMPLE_BLOCK_SIZE <= image.size(); offset += SAMPLE_BLOCK_SIZE) {
+    DecodedBlock block;
+    SampleBlockInfo info;
+    SampleBlockResult result = decodeSampleBlock(&image[offset], SAMPLE_BLOCK_SIZE, info,
+        [&block](uint32_t time, uint8_t range, uint8_t status) {
+          block.samples.push_back({time, range, status});
+        });
+    if (result == SAMPLE_BLOCK_EMPTY) {
+      emptyBlocks++;
+    } else if (result == SAMPLE_BLOCK_CORRUPT) {
+      corruptBlocks++;
+    } else {
+      block.seq = info.seq;
+      blocks.push_back(block);
+    }
+  }
+  std::sort(blocks.begin(), blocks.end(),
+            [](const DecodedBlock& a, const DecodedBlock& b) { return a.seq < b.seq; });
+
+  // CSV出力と集計
+  printf("block,time_ms,range_mm,status\n");
+  size_t samples = 0;
+  size_t validSamples = 0;
+  size_t statusCounts[16] = {0};
+  size_t missingBlocks = 0;
+  size_t restarts = 0;   // 時刻が巻き戻った回数（再起動）
+  size_t stalls = 0;     // 100ms以上サンプルが空いた回数
+  uint32_t maxGap = 0;
+  uint32_t rangeMin = 255;
+  uint32_t rangeMax = 0;
+  uint64_t rangeSum = 0;
+  uint64_t duration = 0;  // 再起動をまたがない区間の合計（ms）
+  bool hasPrevious = false;
+  uint32_t previousTime = 0;
+  for (size_t b = 0; b < blocks.size(); b++) {
+    if (b > 0 && blocks[b].seq != blocks[b - 1].seq + 1) {
+      missingBlocks += blocks[b].seq - blocks[b - 1].seq - 1;
+      hasPrevious = false;  // 欠落をまたいだ時間差は集計しない
+    }
+    for (const DecodedSample& s : blocks[b].samples) {
+      printf("%lu,%lu,%u,%u\n", (unsigned long)blocks[b].seq, (unsigned long)s.time, s.range, s.status);
+      samples++;
+      statusCounts[s.status & 0x0F]++;
+      if (s.status == 0) {
+        validSamples++;
+        rangeMin = std::min<uint32_t>(rangeMin, s.range);
+        rangeMax = std::max<uint32_t>(rangeMax, s.range);
+        rangeSum += s.range;
+      }
+      if (hasPrevious) {
+        if (s.time < previousTime) {
+          restarts++;
+        } else {
+          uint32_t gap = s.time - previousTime;
+          duration += gap;
+          maxGap = std::max(maxGap, gap);
+          if (gap >= 100) {
+            stalls++;
+          }
+        }
+      }
+      previousTime = s.time;
+      hasPrevious = true;
+    }
+  }
+
+  fprintf(stderr, "blocks: %zu valid, %zu empty, %zu corrupt, %zu missing",
+          blocks.size(), emptyBlocks, corruptBlocks, missingBlocks);
+  if (!blocks.empty()) {
+    fprintf(stderr, " (seq %lu..%lu)", (unsigned long)blocks.front().seq, (unsigned long)blocks.back().seq);
+  }
+  fprintf(stderr, "\nsamples: %zu over %.1f s (%.1f sps), restarts=%zu stalls>=100ms=%zu max_gap=%lums\n",
+          samples, duration / 1000.0, duration > 0 ? samples * 1000.0 / duration : 0.0,
+          restarts, stalls, (unsigned long)maxGap);
+  if (validSamples > 0) {
+    fprintf(stderr, "range: min=%lu max=%lu mean=%.1f mm (status 0 only)\n",
+            (unsigned long)rangeMin, (unsigned long)rangeMax, (double)rangeSum / validSamples);
+  }
+  fprintf(stderr, "status:");
+  for (int i = 0; i < 16; i++) {
+    if (statusCounts[i] > 0) {
+      fprintf(stderr, " %d=%zu", i, statusCounts[i]);
+    }
+  }
+  fprintf(stderr, "\n");
+  return 0;
+}
@@ -0,0 +1,256 @@
+// TaskScheduler（include/task_scheduler.h）の起床遅延と起床回数の計測（ホスト用）
+//
+// 使い方:
+//   .pio/build/scheduler_bench/program [--seconds S]
+//
+// BLEコールバックの代わりのスレッドが 3〜37ms の不規則な間隔でイベントを起こし、loop() の代わりの
+// スレッドがそれを処理するまでの時間（起床遅延）を、次の構成で比べる:
+//
+//   scheduler  TaskScheduler: イベントは signal()、定期処理は締め切りまで眠る（ファームウェアの現在の構成）
+//   poll10     LoopPacer(10) で10msごとに回り、フラグと IntervalTimer を確かめる（以前の transmitter など）
+//   poll100    LoopPacer(100)（以前の single_test）
+//
+// どの構成にも transmitter と同じ間隔の定期処理（25ms・100ms・1000ms）を載せ、
+// 定期処理の締め切りからの遅れ（ms）、1秒あたりの起床回数、使ったCPU時間も出力する。
+// 時刻は実時間（std::chrono）。scheduler の起床遅延の中央値が poll10 より短くなければ終了コード1
+// （ホストのスケジューラはリアルタイムではないため、外れ値は最大値として表示するだけにする）
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "deadline.h"
+#include "hal.h"
+#include "latency_histogram.h"
+#include "task_scheduler.h"
+
+typedef std::chrono::steady_clock SteadyTime;
+
+static const uint32_t EVENT_MIN_MS = 3;
+static const uint32_t EVENT_MAX_MS = 37;
+
+// 実時間の時計（複数のスレッドから読める）
+class SteadyClock : public HalClock {
+ public:
+  SteadyClock() : origin_(SteadyTime::now()) {}
+  uint32_t millis() override { return (uint32_t)(elapsedMicros() / 1000); }
+  uint32_t micros() override { return (uint32_t)elapsedMicros(); }
+  void delay(uint32_t ms) override { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+
+ private:
+  uint64_t elapsedMicros() const {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(SteadyTime::now() - origin_).count();
+  }
+
+  SteadyTime::time_point origin_;
+};
+
+// ulTaskNotifyTake / xTaskNotifyGive（ArduinoWaker）の代わり
+class CondVarWaker : public HalWaker {
+ public:
+  CondVarWaker() : sleeps(0), woken_(false) {}
+  void sleep(uint32_t ms) override {
+    sleeps++;
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (ms == FOREVER) {
+      cv_.wait(lock, [this] { return woken_; });
+    } else {
+      cv_.wait_for(lock, std::chrono::milliseconds(ms), [this] { return woken_; });
+    }
+    woken_ = false;
+  }
+  void wake() override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      woken_ = true;
+    }
+    cv_.notify_one();
+  }
+
+  uint32_t sleeps;
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool woken_;
+};
+
+struct BenchResult {
+  LatencyHistogram wake;      // イベントを起こしてから処理するまで（us）
+  LatencyHistogram lateness;  // 定期処理の締め切りからの遅れ（ms）
+  uint32_t events = 0;        // 起こしたイベント
+  uint32_t handled = 0;       // 処理したイベント（続けて起きたものは1回にまとまる）
+  uint32_t wakeups = 0;       // loop() を回した回数
+  double seconds = 0;
+  double cpuMs = 0;
+};
+
+// 両方の構成で共有する状態（イベントを起こすスレッドと loop() のスレッド）
+struct BenchState {
+  SteadyClock clock;
+  std::atomic<uint32_t> signaledUs{0};  // 最後にイベントを起こした時刻
+  std::atomic<uint32_t> events{0};
+  std::atomic<bool> running{true};
+  uint32_t handledEvents = 0;
+  uint32_t periodicRuns = 0;
+  LatencyHistogram* wake = nullptr;
+};
+
+static BenchState* state = nullptr;  // タスク（関数ポインタ）から参照する
+
+static void handleEvent(uint32_t) {
+  uint32_t now = state->clock.micros();
+  state->wake->record(now - state->signaledUs.load(std::memory_order_acquire));
+  state->handledEvents++;
+}
+
+static void periodicWork(uint32_t) {
+  state->periodicRuns++;
+}
+
+// BLEコールバックの代わり: 不規則な間隔でイベントを起こす
+template <typename Signal>
+static std::thread startEvents(BenchState& s, uint32_t seconds, Signal signal) {
+  return std::thread([&s, seconds, signal] {
+    uint32_t seed = 12345;
+    uint32_t end = seconds * 1000;
+    while (s.clock.millis() < end) {
+      seed = seed * 1103515245u + 12345u;
+      uint32_t gap = EVENT_MIN_MS + (seed >> 16) % (EVENT_MAX_MS - EVENT_MIN_MS + 1);
+      std::this_thread::sleep_for(std::chrono::milliseconds(gap));
+      s.signaledUs.store(s.clock.micros(), std::memory_order_release);
+      s.events.fetch_add(1, std::memory_order_relaxed);
+      signal();
+    }
+    s.running.store(false, std::memory_order_release);
+    signal();
+  });
+}
+
+static double cpuMillis() {
+  return (double)clock() * 1000.0 / CLOCKS_PER_SEC;
+}
+
+static void runScheduler(uint32_t seconds, BenchResult& result) {
+  BenchState s;
+  state = &s;
+  s.wake = &result.wake;
+  CondVarWaker waker;
+  TaskScheduler<8> scheduler(s.clock, waker);
+  scheduler.setLatencyHistogram(&result.lateness);
+  int eventTask = scheduler.add(handleEvent);
+  scheduler.every(periodicWork, 25);
+  scheduler.every(periodicWork, 100);
+  scheduler.every(periodicWork, 1000);
+
+  double cpuStart = cpuMillis();
+  std::thread events = startEvents(s, seconds, [&] { scheduler.signal(eventTask); });
+  while (s.running.load(std::memory_order_acquire)) {
+    scheduler.loop();
+  }
+  events.join();
+  result.cpuMs = cpuMillis() - cpuStart;
+  result.seconds = s.clock.millis() / 1000.0;
+  result.events = s.events.load();
+  result.handled = s.handledEvents;
+  result.wakeups = waker.sleeps;
+}
+
+// 以前の構成: 固定周期で回り、フラグと IntervalTimer を確かめる
+static void runPolling(uint32_t seconds, uint32_t pacerMs, BenchResult& result) {
+  BenchState s;
+  state = &s;
+  s.wake = &result.wake;
+  IntervalTimer timers[3] = {IntervalTimer(25), IntervalTimer(100), IntervalTimer(1000)};
+  LoopPacer pacer(pacerMs);
+
+  double cpuStart = cpuMillis();
+  uint32_t seen = 0;
+  std::thread events = startEvents(s, seconds, [] {});
+  while (s.running.load(std::memory_order_acquire)) {
+    uint32_t now = s.clock.millis();
+    uint32_t count = s.events.load(std::memory_order_acquire);
+    if (count != seen) {  // 前回から起きたイベントをまとめて1回処理する
+      seen = count;
+      handleEvent(now);
+    }
+    for (IntervalTimer& timer : timers) {
+      uint32_t elapsed = timer.elapsed(now);
+      if (timer.due(now)) {
+        result.lateness.record(elapsed - timer.period());
+        periodicWork(now);
+      }
+    }
+    result.wakeups++;
+    pacer.wait(s.clock);
+  }
+  events.join();
+  result.cpuMs = cpuMillis() - cpuStart;
+  result.seconds = s.clock.millis() / 1000.0;
+  result.events = s.events.load();
+  result.handled = s.handledEvents;
+}
+
+static void report(const char* name, const BenchResult& result) {
+  char wake[96];
+  char late[96];
+  result.wake.format(wake, sizeof(wake), "wake", "us");
+  result.lateness.format(late, sizeof(late), "late", "ms");
+  printf("%-9s events=%lu handled=%lu wakeups/s=%.1f cpu=%.1fms %s %s\n", name, (unsigned long)result.events,
+         (unsigned long)result.handled, result.wakeups / result.seconds, result.cpuMs, wake, late);
+}
+
+static void usage(const char* program) {
+  fprintf(stderr, "usage: %s [--seconds S]\n", program);
+}
+
+int main(int argc, char** argv) {
+  uint32_t seconds = 3;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      usage(argv[0]);
+      return 2;
+    }
+    if (strcmp(arg, "--seconds") == 0) {
+      seconds = (uint32_t)strtoul(value, nullptr, 10);
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+    i++;
+  }
+  if (seconds < 1) {
+    usage(argv[0]);
+    return 2;
+  }
+  printf("events every %lu-%lums, periodic 25/100/1000ms, %lus per run\n", (unsigned long)EVENT_MIN_MS,
+         (unsigned long)EVENT_MAX_MS, (unsigned long)seconds);
+
+  BenchResult scheduled;
+  runScheduler(seconds, scheduled);
+  report("scheduler", scheduled);
+
+  BenchResult poll10;
+  runPolling(seconds, 10, poll10);
+  report("poll10", poll10);
+
+  BenchResult poll100;
+  runPolling(seconds, 100, poll100);
+  report("poll100", poll100);
+
+  bool ok = scheduled.wake.percentile(50) < poll10.wake.percentile(50) && scheduled.handled > 0;
+  printf("RESULT %s (wake p50 scheduler %luus, poll10 %luus, poll100 %luus)\n", ok ? "OK" : "NG",
+         (unsigned long)scheduled.wake.percentile(50), (unsigned long)poll10.wake.percentile(50),
+         (unsigned long)poll100.wake.percentile(50));
+  return ok ? 0 : 1;
+}
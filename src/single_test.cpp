@@ -3,6 +3,10 @@
 #include <BLEUtils.h>
 #include <BLEScan.h>
 #include <BLEAdvertisedDevice.h>
+#include "async_log.h"
+#include "deadline.h"
+#include "hal_arduino.h"
+#include "task_scheduler.h"
 
 // BLEの設定
 #define SERVICE_UUID        "4fafc201-1fb5-459e-8fcc-c5c9c331914b"
@@ -18,38 +22,41 @@ bool deviceConnected = false;
 bool doConnect = false;
 BLEAddress* pServerAddress = nullptr;
 
+// 時刻はすべてこの時計から読む（ホストでは仮想時計に差し替えられる）
+ArduinoClock halClock;
+
+// loop() の処理はスケジューラのタスクとして登録し、次の締め切りかBLEコールバックからの signal() まで眠る
+ArduinoWaker loopWaker;
+TaskScheduler<8> scheduler(halClock, loopWaker);
+int ledOnTask = -1;       // 通知を受信した（BLEコールバックから signal）
+int ledOffTask = -1;      // 点灯から100ms後に消灯
+int connectionTask = -1;  // 接続・接続状態の監視（スキャンで見つけたら signal）
+int rescanTask = -1;      // 切断から2秒後に再スキャン
+const uint32_t LED_DURATION = 100;
+
 // BLEクライアント接続状態管理用コールバッククラス
 class MyClientCallback : public BLEClientCallbacks {
     void onConnect(BLEClient* pclient) {
-        Serial.println("*** Client connected successfully ***");
+        LOG_I(LOG_MOD_BLE, "*** Client connected successfully ***");
         deviceConnected = true;
     }
 
     void onDisconnect(BLEClient* pclient) {
-        Serial.println("*** Client disconnected ***");
+        LOG_I(LOG_MOD_BLE, "*** Client disconnected ***");
         deviceConnected = false;
     }
 };
 
-// 通知コールバック
+// 通知コールバック（BLEタスクで実行されるため、ブロックする処理は置かない）
 static void notifyCallback(
   BLERemoteCharacteristic* pBLERemoteCharacteristic,
   uint8_t* pData,
   size_t length,
   bool isNotify) {
+    LOG_I(LOG_MOD_BLE, "Received: %.*s", (int)length, (const char*)pData);
     
-    String receivedData = "";
-    for (int i = 0; i < length; i++) {
-        receivedData += (char)pData[i];
-    }
-    
-    Serial.print("Received: ");
-    Serial.println(receivedData);
-    
-    // LED点灯
-    digitalWrite(LED_PIN, HIGH);
-    delay(100);
-    digitalWrite(LED_PIN, LOW);
+    // LED点灯・消灯はloop()で行う
+    scheduler.signal(ledOnTask);
 }
 
 // BLEサーバーへの接続（元のコードに基づく単純版）
@@ -133,12 +140,22 @@ class SingleDeviceCallback: public BLEAdvertisedDeviceCallbacks {
             BLEDevice::getScan()->stop();
             pServerAddress = new BLEAddress(advertisedDevice.getAddress());
             doConnect = true;
+            scheduler.signal(connectionTask);
         }
     }
 };
 
+// loop() のタスク（setup() で登録する）
+void ledOn(uint32_t now);
+void ledOff(uint32_t now);
+void maintainConnection(uint32_t now);
+void rescan(uint32_t now);
+void scanIfDisconnected(uint32_t now);
+void printStatus(uint32_t now);
+
 void setup() {
     Serial.begin(115200);
+    startAsyncLog();
     delay(2000);
     Serial.println("=== Single Device Connection Test ===");
     Serial.println("This test connects to only ONE YonkuCounter device");
@@ -155,6 +172,15 @@ void setup() {
         delay(200);
     }
     
+    // loop() のタスク
+    loopWaker.begin();
+    ledOnTask = scheduler.add(ledOn);
+    ledOffTask = scheduler.add(ledOff);
+    connectionTask = scheduler.every(maintainConnection, 100);
+    rescanTask = scheduler.add(rescan);
+    scheduler.every(scanIfDisconnected, 5000, 5000);   // 未接続時の再スキャン（5秒）
+    scheduler.every(printStatus, 10000, 10000);        // ステータス表示（10秒）
+    
     // BLE初期化
     Serial.println("Initializing BLE...");
     BLEDevice::init("SingleTestDevice");
@@ -176,7 +202,18 @@ void setup() {
     pBLEScan->start(5, false); // 5秒間スキャン（無制限ではなく）
 }
 
-void loop() {
+// 通知受信でLED点灯（LED_DURATION後に消灯）
+void ledOn(uint32_t) {
+    digitalWrite(LED_PIN, HIGH);
+    scheduler.start(ledOffTask, LED_DURATION);
+}
+
+void ledOff(uint32_t) {
+    digitalWrite(LED_PIN, LOW);
+}
+
+// 接続が必要なら接続し、切れていれば後始末して再スキャンを予約する
+void maintainConnection(uint32_t) {
     // 接続が必要な場合
     if (doConnect) {
         if (connectToServer()) {
@@ -201,31 +238,33 @@ void loop() {
         }
         pRemoteCharacteristic = nullptr;
         
-        delay(2000);
-        Serial.println("Starting scan again...");
-        Serial.flush();
-        BLEDevice::getScan()->start(5, false); // 5秒間スキャン
+        // 2秒後に再スキャン
+        scheduler.start(rescanTask, 2000);
     }
+}
 
-    // 未接続状態での再スキャン制御
-    static unsigned long lastScanTime = 0;
-    const long scanInterval = 5000;  // スキャン間隔（5秒）
-    
-    if (!deviceConnected && !doConnect && (millis() - lastScanTime >= scanInterval)) {
-        lastScanTime = millis();
+void rescan(uint32_t) {
+    Serial.println("Starting scan again...");
+    Serial.flush();
+    BLEDevice::getScan()->start(5, false); // 5秒間スキャン
+}
+
+// 未接続状態での再スキャン制御（5秒ごと）
+void scanIfDisconnected(uint32_t) {
+    if (!deviceConnected && !doConnect && !scheduler.armed(rescanTask)) {
         Serial.println("Scanning for devices...");
         Serial.flush();
         BLEDevice::getScan()->start(5, false);  // 5秒間スキャン
     }
-    
-    // ステータス表示
-    static unsigned long lastStatus = 0;
-    if (millis() - lastStatus > 10000) {
-        Serial.print("Status: ");
-        Serial.println(deviceConnected ? "Connected" : "Scanning...");
-        Serial.flush();
-        lastStatus = millis();
-    }
-    
-    delay(100);
+}
+
+// ステータス表示（10秒ごと）
+void printStatus(uint32_t) {
+    Serial.print("Status: ");
+    Serial.println(deviceConnected ? "Connected" : "Scanning...");
+    Serial.flush();
+}
+
+void loop() {
+    scheduler.loop();
 }
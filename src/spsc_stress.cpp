@@ -0,0 +1,272 @@
+// SpscQueue（include/spsc_queue.h）のマルチスレッド負荷試験とスループット計測（ホスト用）
+//
+// 使い方:
+//   .pio/build/spsc_stress/program [--items N] [--bench-ms MS]
+//
+// 負荷試験（生産者・消費者を別スレッドで動かし、容量ごとに実行）:
+//   lossless  満杯なら生産者が待って積み直す。全件が順番どおり・内容が壊れずに届くこと
+//             （積み直す前の失敗も dropped() に数えられるので、ここでは満杯になった回数の目安）
+//   lossy     満杯なら捨てる（BLEコールバック・測定タスクと同じ使い方）。届いた件数と
+//             dropped() の合計が積んだ件数に一致し、届いたものは順番どおりであること
+// 計測: 別スレッド間の転送（件/s）と、std::mutex + std::deque のキューとの比較
+//
+// 不変条件が崩れたら終了コード1（ThreadSanitizer でも実行できる: -fsanitize=thread）
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "spsc_queue.h"
+
+// BLEイベント・測定結果と同程度の大きさ（内容は seq から決まり、壊れていれば検出できる）
+struct StressItem {
+  uint32_t seq;
+  uint32_t check;
+  uint8_t payload[16];
+};
+
+static StressItem makeItem(uint32_t seq) {
+  StressItem item;
+  item.seq = seq;
+  item.check = seq * 2654435761u;
+  for (size_t i = 0; i < sizeof(item.payload); i++) {
+    item.payload[i] = (uint8_t)(seq + i);
+  }
+  return item;
+}
+
+static bool validItem(const StressItem& item) {
+  if (item.check != item.seq * 2654435761u) {
+    return false;
+  }
+  for (size_t i = 0; i < sizeof(item.payload); i++) {
+    if (item.payload[i] != (uint8_t)(item.seq + i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct StressResult {
+  uint64_t received = 0;
+  uint64_t dropped = 0;
+  uint64_t disorder = 0;  // 順番の乱れ・重複・欠落（lossless）
+  uint64_t corrupt = 0;
+  double seconds = 0;
+};
+
+// 生産者・消費者スレッドで items 件を受け渡す
+template <size_t N>
+static StressResult runStress(uint32_t items, bool lossless) {
+  SpscQueue<StressItem, N> queue;
+  StressResult result;
+  std::atomic<bool> done(false);
+  auto start = std::chrono::steady_clock::now();
+
+  std::thread producer([&] {
+    for (uint32_t seq = 0; seq < items; seq++) {
+      StressItem item = makeItem(seq);
+      while (!queue.push(item)) {
+        if (!lossless) {
+          break;
+        }
+        std::this_thread::yield();
+      }
+      if (!lossless && (seq & 255) == 255) {
+        std::this_thread::yield();  // 1コアのホストでも消費者に受け取る機会を与える
+      }
+    }
+    done.store(true, std::memory_order_release);
+  });
+
+  std::thread consumer([&] {
+    int64_t last = -1;
+    StressItem item;
+    while (true) {
+      bool finished = done.load(std::memory_order_acquire);
+      bool any = false;
+      while (queue.pop(item)) {
+        any = true;
+        result.received++;
+        if (!validItem(item)) {
+          result.corrupt++;
+        }
+        bool inOrder = lossless ? (int64_t)item.seq == last + 1 : (int64_t)item.seq > last;
+        if (!inOrder) {
+          result.disorder++;
+        }
+        last = item.seq;
+      }
+      if (finished && !any) {
+        break;  // 生産者の終了後にもう一度空を確かめてから終わる
+      }
+      if (!any) {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  producer.join();
+  consumer.join();
+  result.seconds = secondsSince(start);
+  result.dropped = queue.dropped();
+  return result;
+}
+
+template <size_t N>
+static bool stress(uint32_t items) {
+  bool ok = true;
+  for (int mode = 0; mode < 2; mode++) {
+    bool lossless = mode == 0;
+    StressResult r = runStress<N>(items, lossless);
+    bool pass = r.corrupt == 0 && r.disorder == 0 &&
+                (lossless ? r.received == items : r.received + r.dropped == items);
+    printf("STRESS capacity=%-5lu %-8s received=%-9llu dropped=%-9llu disorder=%llu corrupt=%llu %6.1f Mitems/s %s\n",
+           (unsigned long)N, lossless ? "lossless" : "lossy", (unsigned long long)r.received,
+           (unsigned long long)r.dropped, (unsigned long long)r.disorder, (unsigned long long)r.corrupt,
+           items / r.seconds / 1e6, pass ? "OK" : "NG");
+    ok = ok && pass;
+  }
+  return ok;
+}
+
+// 比較用: ミューテックスで守った deque（容量は同じく制限する）
+template <typename T, size_t N>
+class MutexQueue {
+ public:
+  bool push(const T& item) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (items_.size() >= N) {
+      return false;
+    }
+    items_.push_back(item);
+    return true;
+  }
+  bool pop(T& item) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (items_.empty()) {
+      return false;
+    }
+    item = items_.front();
+    items_.pop_front();
+    return true;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::deque<T> items_;
+};
+
+// 別スレッド間で benchMs の間受け渡し、1件あたりの時間を出す（満杯・空のときは待たずに回り直す）
+template <typename Queue>
+static void benchTransfer(const char* name, uint32_t benchMs) {
+  Queue queue;
+  std::atomic<bool> stop(false);
+  std::atomic<uint64_t> consumed(0);
+  auto start = std::chrono::steady_clock::now();
+  std::thread consumer([&] {
+    StressItem item;
+    uint64_t n = 0;
+    uint32_t sink = 0;
+    while (!stop.load(std::memory_order_relaxed)) {
+      if (queue.pop(item)) {
+        sink += item.seq;
+        n++;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    consumed.store(n + (sink & 0), std::memory_order_relaxed);
+  });
+  StressItem item = makeItem(0);
+  while (secondsSince(start) * 1000 < benchMs) {
+    for (int i = 0; i < 1024; i++) {
+      item.seq++;
+      if (!queue.push(item)) {
+        std::this_thread::yield();
+      }
+    }
+  }
+  stop.store(true, std::memory_order_relaxed);
+  consumer.join();
+  double seconds = secondsSince(start);
+  uint64_t n = consumed.load(std::memory_order_relaxed);
+  printf("BENCH %-22s %8.2f Mitems/s %8.1f ns/item\n", name, n / seconds / 1e6, n ? seconds * 1e9 / n : 0.0);
+}
+
+// 同じスレッドで push と pop を交互に行う（キュー操作そのものの費用）
+template <typename Queue>
+static void benchSameThread(const char* name, uint32_t benchMs) {
+  Queue queue;
+  StressItem item = makeItem(0);
+  uint64_t n = 0;
+  uint32_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  double seconds;
+  do {
+    for (int i = 0; i < 4096; i++) {
+      item.seq++;
+      queue.push(item);
+      queue.pop(item);
+      sink += item.seq;
+    }
+    n += 4096;
+    seconds = secondsSince(start);
+  } while (seconds * 1000 < benchMs);
+  printf("BENCH %-22s %8.2f Mitems/s %8.1f ns/item%s\n", name, n / seconds / 1e6, seconds * 1e9 / n,
+         sink == 1 ? " " : "");
+}
+
+static void usage(const char* program) {
+  fprintf(stderr, "usage: %s [--items N] [--bench-ms MS]\n", program);
+}
+
+int main(int argc, char** argv) {
+  uint32_t items = 2000000;
+  uint32_t benchMs = 500;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      usage(argv[0]);
+      return 2;
+    }
+    if (strcmp(arg, "--items") == 0) {
+      items = (uint32_t)strtoul(value, nullptr, 10);
+    } else if (strcmp(arg, "--bench-ms") == 0) {
+      benchMs = (uint32_t)strtoul(value, nullptr, 10);
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+    i++;
+  }
+
+  // 最小容量（満杯・空の境界を頻繁に通る）、ファームウェアで使う容量、大きい容量
+  bool ok = true;
+  ok = stress<2>(items) && ok;
+  ok = stress<16>(items) && ok;
+  ok = stress<32>(items) && ok;
+  ok = stress<1024>(items) && ok;
+
+  if (benchMs > 0) {
+    benchSameThread<SpscQueue<StressItem, 32>>("same_thread spsc", benchMs);
+    benchSameThread<MutexQueue<StressItem, 32>>("same_thread mutex", benchMs);
+    benchTransfer<SpscQueue<StressItem, 32>>("cross_thread spsc", benchMs);
+    benchTransfer<MutexQueue<StressItem, 32>>("cross_thread mutex", benchMs);
+    benchTransfer<SpscQueue<StressItem, 1024>>("cross_thread spsc 1024", benchMs);
+  }
+  printf("RESULT %s\n", ok ? "OK" : "NG");
+  return ok ? 0 : 1;
+}
@@ -3,10 +3,18 @@
 #include <BLEUtils.h>
 #include <BLEScan.h>
 #include <BLEAdvertisedDevice.h>
+#include "async_log.h"
+#include "deadline.h"
+#include "gate_event_receiver.h"
+#include "hal_arduino.h"
+#include "latency_histogram.h"
+#include "metrics.h"
+#include "task_scheduler.h"
 
 // BLEの設定
 #define SERVICE_UUID        "6E400001-B5A3-F393-E0A9-E50E24DCCA9E"  // Nordic UART Service UUID
 #define CHARACTERISTIC_UUID "6E400003-B5A3-F393-E0A9-E50E24DCCA9E"  // TX Characteristic UUID
+#define CHARACTERISTIC_UUID_RX "6E400002-B5A3-F393-E0A9-E50E24DCCA9E"  // RX Characteristic UUID（再送要求用）
 
 // LED設定
 #define LED_PIN 21  // 内蔵LED
@@ -16,10 +24,22 @@
 #define UART_TX_PIN 43  // UART送信ピン
 #define UART_BAUD_RATE 115200
 
+// 時刻はすべてこの時計から読む（ホストでは仮想時計に差し替えられる）
+ArduinoClock halClock;
+
+// loop() の処理はスケジューラのタスクとして登録し、次の締め切りかBLEコールバックからの signal() まで眠る
+ArduinoWaker loopWaker;
+TaskScheduler<10> scheduler(halClock, loopWaker);
+int inboxTask = -1;       // 受信キューの転送（通知コールバックから signal）
+int connectionTask = -1;  // 接続・接続状態の監視（スキャンで見つけたら signal）
+int ledOffTask = -1;      // LED消灯
+int rescanTask = -1;      // 切断検出からBLEスタックの後始末を待って再スキャン
+
 // サーバー接続管理
 struct ServerConnection {
   BLEClient* pClient;
   BLERemoteCharacteristic* pRemoteCharacteristic;
+  BLERemoteCharacteristic* pRxCharacteristic;  // 再送要求の書き込み先
   bool connected;
   String deviceName;
   String address;
@@ -31,31 +51,81 @@ ServerConnection server;
 
 // データ管理用変数
 String lastReceivedData = "-";  // 最新の受信データ（初期値は「-」）
-String previousData = "";       // 前回の受信データ（重複チェック用）
+
+// 通知で受け取ったイベントの受信キュー（BLEタスク → loop()）
+const size_t INBOX_SIZE = 64;
+GateInbox<INBOX_SIZE> inbox;
+portMUX_TYPE inboxMux = portMUX_INITIALIZER_UNLOCKED;
+uint32_t inboxOverflowsSeen = 0;  // processInbox() で再送を要求済みの溢れ回数
+GateStreamTracker stream;  // エポックの確認とシーケンス番号による重複排除（受信位置は resumeState にも写す）
+
+// レイテンシ計測（ms）
+LatencyHistogram clientLatency;    // 通知受信からUART送信まで
+LatencyHistogram endToEndLatency;  // 検出からUART送信まで（全区間）
+
+// レイテンシヒストグラムをシリアルに出力
+void dumpLatency() {
+    char line[96];
+    clientLatency.format(line, sizeof(line), "LAT client_rx->uart", "ms");
+    Serial.println(line);
+    endToEndLatency.format(line, sizeof(line), "LAT detect->uart", "ms");
+    Serial.println(line);
+}
+
+// ランタイムメトリクス（'!' または定期的に1行で出力）
+MetricsRegistry<16> metrics;
+uint32_t& forwardedEvents = metrics.counter("events");
+uint32_t& connectCount = metrics.counter("connects");
+uint32_t& connectFail = metrics.counter("connect_fail");
+int32_t& duplicateGauge = metrics.gauge("dups");
+int32_t& gapGauge = metrics.gauge("gaps");
+int32_t& overflowGauge = metrics.gauge("inbox_drop");
+int32_t& catchUpGauge = metrics.gauge("catch_ups");
+int32_t& heapLowWater = metrics.gauge("heap_min");
+int32_t& logDropped = metrics.gauge("log_drop");
+LatencyHistogram loopPeriod;  // loop()の周期（us）
+LatencyHistogram taskLateness;  // タスクの締め切りから実行までの遅れ（ms）
+const uint32_t METRICS_INTERVAL = 10000;  // 定期出力間隔（ms）
+
+// 受信位置（再接続・ソフトリセット後の再送要求に使用、RTCメモリで保持）
+#define RESUME_STATE_MAGIC 0x47415445UL
+struct ResumeState {
+  uint32_t magic;
+  uint32_t epoch;    // サーバーのエポック
+  uint32_t lastSeq;  // UARTへ転送済みの最後のシーケンス番号
+};
+RTC_NOINIT_ATTR ResumeState resumeState;
+
+// 受信位置をRTCメモリへ写す
+void saveResumeState() {
+  resumeState.magic = RESUME_STATE_MAGIC;
+  resumeState.epoch = stream.epoch();
+  resumeState.lastSeq = stream.lastSeq();
+}
 
 // LED制御用変数
-unsigned long ledStartTime = 0;
-bool ledOn = false;
-const int LED_DURATION = 100;  // LED点灯時間（ms）
+const uint32_t LED_DURATION = 100;  // LED点灯時間（ms）
 
-// データポーリング用変数
-unsigned long lastPollingTime = 0;
-const unsigned long POLLING_INTERVAL = 100;  // 100ms間隔でポーリング
+// 定期処理の間隔
+const uint32_t SCAN_INTERVAL = 8000;     // 未接続時の再スキャン（8秒）
+const uint32_t STATUS_INTERVAL = 30000;  // 接続状況の表示（30秒）
+const uint32_t CONNECTION_INTERVAL = 100;  // 接続状態監視
+const uint32_t COMMAND_INTERVAL = 10;    // PCからのコマンドの確認（USB CDCには受信イベントがない）
+const uint32_t RESCAN_DELAY = 1000;
 
 // BLEクライアントコールバッククラス
 class MyClientCallback : public BLEClientCallbacks {
     void onConnect(BLEClient* pclient) {
-        Serial.println("*** Connected to Tanaka Gate Server ***");
+        LOG_I(LOG_MOD_BLE, "*** Connected to Tanaka Gate Server ***");
     }
 
     void onDisconnect(BLEClient* pclient) {
-        Serial.println("*** Disconnected from Tanaka Gate Server ***");
+        LOG_I(LOG_MOD_BLE, "*** Disconnected from Tanaka Gate Server ***");
         server.connected = false;
         
         // 切断時はデータを「-」にリセット
         lastReceivedData = "-";
-        previousData = "";
-        Serial.println("Latest Data: -");
+        LOG_I(LOG_MOD_BLE, "Latest Data: -");
         // Serial2.println("-");
     }
 };
@@ -63,87 +133,107 @@ class MyClientCallback : public BLEClientCallbacks {
 // グローバルコールバックインスタンス
 MyClientCallback clientCallback;
 
-// 通知コールバック（使用しない - ポーリングベースに変更）
+// 通知コールバック（BLEタスクで実行されるため、受信キューへ積むだけにする）
 static void notifyCallback(
   BLERemoteCharacteristic* pBLERemoteCharacteristic,
   uint8_t* pData,
   size_t length,
   bool isNotify) {
-    // ポーリングベースに変更したため、この関数は使用しない
+    portENTER_CRITICAL(&inboxMux);
+    parseGateBatch((const char*)pData, length,
+                   [](uint32_t seq, const char* data, size_t dataLength, uint16_t age) {
+                       inbox.push(seq, data, dataLength, halClock.millis(), age);
+                   },
+                   [](uint32_t epoch) {
+                       inbox.pushEpoch(epoch);
+                   });
+    portEXIT_CRITICAL(&inboxMux);
+    scheduler.signal(inboxTask);
 }
 
-// サーバーからデータを読み取る関数
-bool pollServerData() {
-    if (!server.connected || !server.pRemoteCharacteristic) {
-        return false;
+// メトリクスを1行で出力
+void dumpMetrics() {
+    duplicateGauge = stream.filter().duplicates;
+    gapGauge = stream.filter().gaps;
+    overflowGauge = inbox.overflows();
+    catchUpGauge = stream.catchUps();
+    heapLowWater = ESP.getMinFreeHeap();
+    logDropped = asyncLog().dropped();
+    char line[384];
+    metrics.format(line, sizeof(line));
+    Serial.println(line);
+}
+
+// 欠番・受信キューの溢れの後、受信済みの続きを "SINCE" で要求する（応答待ちの間は一定時間ごと）
+void requestCatchUp(const char* reason) {
+    if (!server.connected || server.pRxCharacteristic == nullptr ||
+        !stream.requestCatchUp(halClock.millis())) {
+        return;
     }
-    
-    try {
-        // キャラクタリスティックからデータを読み取り
-        std::string value = server.pRemoteCharacteristic->readValue();
+    char request[32];
+    size_t requestLength = formatGateSinceRequest(request, sizeof(request), stream.epoch(), stream.lastSeq());
+    server.pRxCharacteristic->writeValue((uint8_t*)request, requestLength, true);
+    LOG_W(LOG_MOD_BLE, "Catch-up requested (%s): %s", reason, request);
+}
+
+// 受信キューのイベントを順に処理する関数
+int processInbox() {
+    int forwarded = 0;
+    GateEvent ev;
+    GateEvent latest;
+    while (true) {
+        portENTER_CRITICAL(&inboxMux);
+        bool hasEvent = inbox.pop(ev);
+        portEXIT_CRITICAL(&inboxMux);
+        if (!hasEvent) {
+            break;
+        }
         
-        if (value.length() > 0) {
-            String receivedData = String(value.c_str());
-            
-            // データが変化した場合のみ処理（タイムスタンプにより常に変化）
-            if (receivedData != previousData) {
-                previousData = receivedData;
-                
-                // タイムスタンプ付きデータから実際のデータを抽出
-                // 形式: "timestamp:actualData"
-                int colonIndex = receivedData.indexOf(':');
-                String actualData;
-                if (colonIndex > 0) {
-                    actualData = receivedData.substring(colonIndex + 1);
-                } else {
-                    actualData = receivedData; // タイムスタンプがない場合はそのまま
-                }
-                
-                lastReceivedData = actualData;
-                
-                // 受信データを表示
-                Serial.print("Latest Data: ");
-                Serial.println(lastReceivedData);
-                Serial.flush();
-                
-                // UARTで実際のデータを送信
-                Serial2.println(lastReceivedData);
-                Serial2.flush();
-                
-                // LED点灯開始
-                digitalWrite(LED_PIN, HIGH);
-                ledOn = true;
-                ledStartTime = millis();
-                
-                return true;
-            }
-        } else {
-            // データがない場合は「-」に設定
-            if (lastReceivedData != "-") {
-                lastReceivedData = "-";
-                Serial.println("Latest Data: -");
-                Serial.flush();
-                
-                // UARTで「-」を送信
-                // Serial2.println("-");
-                // Serial2.flush();
-            }
+        // エポック行: サーバーが再起動していたら番号をリセット。受信済みのシーケンス番号は破棄
+        // 欠番があれば転送せず、受信済みの続きを要求する
+        GateStreamTracker::Action action = stream.apply(ev);
+        if (action == GateStreamTracker::NEW_EPOCH) {
+            LOG_I(LOG_MOD_BLE, "Server epoch: %08lX", (unsigned long)ev.seq);
+            saveResumeState();
+        } else if (action == GateStreamTracker::GAP || action == GateStreamTracker::CATCHING_UP) {
+            requestCatchUp(action == GateStreamTracker::GAP ? "gap" : "retry");
         }
-    } catch (const std::exception& e) {
-        // 読み取りエラーの場合も「-」に設定
-        if (lastReceivedData != "-") {
-            lastReceivedData = "-";
-            Serial.println("Latest Data: -");
-            Serial.flush();
-            
-            // UARTで「-」を送信
-            // Serial2.println("-");
-            // Serial2.flush();
+        if (action != GateStreamTracker::FORWARD) {
+            continue;
         }
-        return false;
+        
+        // UARTで実際のデータを送信（イベントごとのflushはしない）
+        Serial2.println(ev.data);
+        saveResumeState();
+        forwardedEvents++;
+        
+        uint32_t residence = halClock.millis() - ev.timestamp;
+        clientLatency.record(residence);
+        if (ev.age != GATE_AGE_UNKNOWN) {
+            endToEndLatency.record(addGateAge(ev.age, residence));
+        }
+        latest = ev;
+        forwarded++;
+    }
+    
+    // 受信キューが溢れていたら、捨てたイベントを要求する
+    uint32_t overflows = inbox.overflows();
+    if (overflows != inboxOverflowsSeen) {
+        inboxOverflowsSeen = overflows;
+        requestCatchUp("inbox overflow");
     }
     
-    return false;
+    if (forwarded > 0) {
+        lastReceivedData = latest.data;
+        
+        // 受信データを表示
+        LOG_I(LOG_MOD_UART, "Latest Data: %s", lastReceivedData.c_str());
+        
+        // LED点灯開始
+        digitalWrite(LED_PIN, HIGH);
+        scheduler.start(ledOffTask, LED_DURATION);
+    }
+    return forwarded;
 }
 
 // Tanaka Gate Serverへの接続
@@ -189,6 +279,19 @@ bool connectToServer() {
     Serial.println("✓ Characteristic found");
     Serial.flush();
 
+    // 前回の受信位置以降のイベントを要求（切断中・リセット中の取りこぼし防止）
+    // 通知の購読より先に書き込み、再送分が新しいイベントより先に届くようにする
+    server.pRxCharacteristic = pRemoteService->getCharacteristic(BLEUUID(CHARACTERISTIC_UUID_RX));
+    if (server.pRxCharacteristic != nullptr && stream.hasEpoch()) {
+        char request[32];
+        size_t requestLength = formatGateSinceRequest(request, sizeof(request),
+                                                      stream.epoch(), stream.lastSeq());
+        server.pRxCharacteristic->writeValue((uint8_t*)request, requestLength, true);
+        Serial.print("✓ Catch-up requested: ");
+        Serial.println(request);
+        Serial.flush();
+    }
+    
     // 通知の登録
     if(server.pRemoteCharacteristic->canNotify()) {
         server.pRemoteCharacteristic->registerForNotify(notifyCallback);
@@ -238,13 +341,28 @@ class MyAdvertisedDeviceCallbacks: public BLEAdvertisedDeviceCallbacks {
         server.deviceName = deviceName;
         server.address = advertisedDevice.getAddress().toString().c_str();
         server.doConnect = true;
+        scheduler.signal(connectionTask);
       }
     }
   }
 };
 
+// loop() のタスク（setup() で登録する）
+void forwardInbox(uint32_t now);
+void maintainConnection(uint32_t now);
+void ledOffNow(uint32_t now);
+void rescanNow(uint32_t now);
+void readCommands(uint32_t now);
+void scanIfDisconnected(uint32_t now);
+void reportMetrics(uint32_t now);
+void reportStatus(uint32_t now);
+
 void setup() {
   Serial.begin(115200);
+  startAsyncLog();  // BLEコールバック・loop()のログは低優先度タスクで出力
+  metrics.histogram("loop_us", loopPeriod);
+  metrics.histogram("e2e_ms", endToEndLatency);
+  metrics.histogram("late_ms", taskLateness);
   delay(2000); // 安定化のための待機時間を延長
   Serial.println("Tanaka Gate Client Starting...");
   Serial.flush();
@@ -257,9 +375,15 @@ void setup() {
   pinMode(LED_PIN, OUTPUT);
   digitalWrite(LED_PIN, LOW);
   
+  // ソフトリセット前の受信位置（RTCメモリ）から再開する
+  if (resumeState.magic == RESUME_STATE_MAGIC) {
+    stream.resume(resumeState.epoch, resumeState.lastSeq);
+  }
+  
   // サーバー接続状態初期化
   server.pClient = nullptr;
   server.pRemoteCharacteristic = nullptr;
+  server.pRxCharacteristic = nullptr;
   server.connected = false;
   server.deviceName = "";
   server.address = "";
@@ -274,6 +398,18 @@ void setup() {
     delay(200);
   }
   
+  // loop() のタスク（BLEのコールバックから signal されるため、BLEより先に登録する）
+  loopWaker.begin();
+  scheduler.setLatencyHistogram(&taskLateness);
+  inboxTask = scheduler.add(forwardInbox);
+  connectionTask = scheduler.every(maintainConnection, CONNECTION_INTERVAL);
+  ledOffTask = scheduler.add(ledOffNow);
+  rescanTask = scheduler.add(rescanNow);
+  scheduler.every(readCommands, COMMAND_INTERVAL);
+  scheduler.every(scanIfDisconnected, SCAN_INTERVAL, SCAN_INTERVAL);
+  scheduler.every(reportMetrics, METRICS_INTERVAL, METRICS_INTERVAL);
+  scheduler.every(reportStatus, STATUS_INTERVAL, STATUS_INTERVAL);
+  
   // BLE初期化
   Serial.println("Initializing BLE...");
   Serial.flush();
@@ -317,26 +453,36 @@ void setup() {
   Serial.flush();
 }
 
-void loop() {
-  // LED制御（一定時間後に消灯）
-  if (ledOn && (millis() - ledStartTime) > LED_DURATION) {
-    digitalWrite(LED_PIN, LOW);
-    ledOn = false;
-  }
-  
-  // 100ms間隔でサーバーからデータをポーリング
-  if (millis() - lastPollingTime >= POLLING_INTERVAL) {
-    lastPollingTime = millis();
-    
-    // サーバーからデータを読み取り
-    pollServerData();
+// 通知で受信したイベントをUARTへ転送
+void forwardInbox(uint32_t) {
+  processInbox();
+}
+
+void ledOffNow(uint32_t) {
+  digitalWrite(LED_PIN, LOW);
+}
+
+// '?' でレイテンシを出力
+void readCommands(uint32_t) {
+  if (Serial.available() > 0) {
+    char command = Serial.read();
+    if (command == '?') {
+      dumpLatency();
+    } else if (command == '!') {
+      dumpMetrics();
+    }
   }
-  
+}
+
+// サーバーへの接続と接続状態の監視
+void maintainConnection(uint32_t) {
   // サーバーへの接続が必要な場合
   if (server.doConnect) {
     if (connectToServer()) {
+      connectCount++;
       Serial.println("Connected to TanakaGateServer!");
     } else {
+      connectFail++;
       Serial.println("Failed to connect to TanakaGateServer");
     }
     server.doConnect = false;
@@ -352,41 +498,67 @@ void loop() {
       server.pClient = nullptr;
     }
     server.pRemoteCharacteristic = nullptr;
+    server.pRxCharacteristic = nullptr;
     
-    delay(1000);
-    BLEDevice::getScan()->start(10, false); // 再スキャン開始
+    // BLEスタックに後始末の時間を与えてから再スキャン
+    scheduler.start(rescanTask, RESCAN_DELAY);
   }
 
-  // 未接続状態での再スキャン制御
-  static unsigned long lastScanTime = 0;
-  const long scanInterval = 8000;  // スキャン間隔（8秒）
-  
-  if (!server.connected && !server.doConnect && (millis() - lastScanTime >= scanInterval)) {
-    lastScanTime = millis();
+  // 再送要求の応答（エポック行）が届かなければ要求し直す（イベントが届かなくなった場合）
+  if (stream.catchingUp()) {
+    requestCatchUp("timeout");
+  }
+}
+
+void rescanNow(uint32_t) {
+  BLEDevice::getScan()->start(10, false); // 再スキャン開始
+}
+
+// 未接続状態での再スキャン制御
+void scanIfDisconnected(uint32_t) {
+  if (!server.connected && !server.doConnect && !scheduler.armed(rescanTask)) {
     Serial.println("Starting rescan for TanakaGateServer...");
     BLEDevice::getScan()->start(10, false);  // 10秒間スキャン
   }
-  
-  // 接続状況の定期的な表示
-  static unsigned long lastStatusTime = 0;
-  const long statusInterval = 30000;  // 30秒間隔で状況表示
-  
-  if (millis() - lastStatusTime >= statusInterval) {
-    lastStatusTime = millis();
-    Serial.println("--------------------");
-    Serial.print("Server connection status: ");
-    if (server.connected) {
-      Serial.println("Connected");
-      Serial.print("  Server: ");
-      Serial.println(server.deviceName);
-      Serial.print("  Latest Data: ");
-      Serial.println(lastReceivedData);
-    } else {
-      Serial.println("Disconnected");
-      Serial.println("  Latest Data: -");
-    }
-    Serial.println("--------------------");
+}
+
+// メトリクスの定期出力
+void reportMetrics(uint32_t) {
+  dumpMetrics();
+}
+
+// 接続状況の定期的な表示
+void reportStatus(uint32_t) {
+  Serial.println("--------------------");
+  Serial.print("Server connection status: ");
+  if (server.connected) {
+    Serial.println("Connected");
+    Serial.print("  Server: ");
+    Serial.println(server.deviceName);
+    Serial.print("  Latest Data: ");
+    Serial.println(lastReceivedData);
+    Serial.printf("  Events: accepted=%lu duplicates=%lu gaps=%lu overflows=%lu\n",
+                  (unsigned long)stream.filter().accepted,
+                  (unsigned long)stream.filter().duplicates,
+                  (unsigned long)stream.filter().gaps,
+                  (unsigned long)inbox.overflows());
+    dumpLatency();
+  } else {
+    Serial.println("Disconnected");
+    Serial.println("  Latest Data: -");
+  }
+  Serial.println("--------------------");
+}
+
+void loop() {
+  // ループ周期の計測（タスクを実行するために起きた間隔）
+  static uint32_t lastLoopMicros = 0;
+  uint32_t loopMicros = halClock.micros();
+  if (lastLoopMicros != 0) {
+    loopPeriod.record(loopMicros - lastLoopMicros);
   }
+  lastLoopMicros = loopMicros;
   
-  delay(10);  // 短い遅延でCPU使用率を下げる
+  // 次の締め切りか signal() まで眠る
+  scheduler.loop();
 }
@@ -3,6 +3,13 @@
 #include <BLEServer.h>
 #include <BLEUtils.h>
 #include <BLE2902.h>
+#include "async_log.h"
+#include "deadline.h"
+#include "gate_client_table.h"
+#include "hal_arduino.h"
+#include "latency_histogram.h"
+#include "metrics.h"
+#include "task_scheduler.h"
 
 // BLEの設定
 #define SERVICE_UUID        "6E400001-B5A3-F393-E0A9-E50E24DCCA9E"  // Nordic UART Service UUID
@@ -17,73 +24,328 @@
 #define UART_TX_PIN 43  // UART送信ピン（使用しないが定義）
 #define UART_BAUD_RATE 115200
 
+// 同時接続クライアント数の上限
+#define MAX_GATE_CLIENTS 3
+
+// 時刻はすべてこの時計から読む（ホストでは仮想時計に差し替えられる）
+ArduinoClock halClock;
+
+// loop() の処理はスケジューラのタスクとして登録し、次の締め切りか
+// BLEコールバック・UART受信からの signal() まで眠る
+ArduinoWaker loopWaker;
+TaskScheduler<12> scheduler(halClock, loopWaker);
+int connTask = -1;           // 接続イベントの反映（BLEコールバックから signal）
+int uartTask = -1;           // UART受信（受信コールバックから signal、取りこぼし対策に周期的にも見る）
+int deliverTask = -1;        // 通知の配信（新しいイベント・購読で signal、混雑時の再送のため周期的にも）
+int ledFlashTask = -1;       // 接続時のLED点灯（BLEコールバックから signal）
+int disconnectBlinkTask = -1;  // 切断時のLED点滅の開始（BLEコールバックから signal）
+int blinkStepTask = -1;      // 点滅の次のステップ
+int ledOffTask = -1;         // LED消灯
+
 // BLEサーバー関連の変数
 BLEServer* pServer = nullptr;
 BLECharacteristic* pTxCharacteristic = nullptr;
-bool deviceConnected = false;
-bool oldDeviceConnected = false;
+BLE2902* pTxCccd = nullptr;     // 購読状態（CCCD）の書き込み検出用
+
+// ランタイムメトリクス（'!' または定期的に1行で出力）
+MetricsRegistry<16> metrics;
+uint32_t& uartEvents = metrics.counter("uart_events");
+uint32_t& notifyOk = metrics.counter("notify_ok");
+uint32_t& notifyFail = metrics.counter("notify_fail");
+uint32_t& connectCount = metrics.counter("connects");
+uint32_t& rejectCount = metrics.counter("rejects");
+uint32_t& connDropped = metrics.counter("conn_drop");  // 接続イベントキューが満杯で捨てたイベント
+int32_t& clientGauge = metrics.gauge("clients");
+int32_t& heapLowWater = metrics.gauge("heap_min");
+int32_t& logDropped = metrics.gauge("log_drop");
+int32_t& uartDropped = metrics.gauge("uart_drop");
+LatencyHistogram loopPeriod;  // loop()の周期（us）
+LatencyHistogram taskLateness;  // タスクの締め切りから実行までの遅れ（ms）
+const uint32_t METRICS_INTERVAL = 10000;  // 定期出力間隔（ms）
+
+// イベントログ（全クライアント共通、直近分を保持。再接続時の再送にも使用）
+const size_t EVENT_LOG_SIZE = 256;
+GateEventLog<EVENT_LOG_SIZE> eventLog;
+
+// クライアントごとの購読状態・送信位置
+GateClientTable<MAX_GATE_CLIENTS> clients;
 
-// データ管理用変数
-String currentData = "";        // 現在のデータ
-unsigned long dataTimestamp = 0; // データのタイムスタンプ
+// BLEタスクからloop()への接続イベント（クライアント表はloop()でのみ更新する）
+enum ConnEventType : uint8_t {
+    CONN_EVENT_CONNECT,
+    CONN_EVENT_DISCONNECT,
+    CONN_EVENT_MTU,
+    CONN_EVENT_SUBSCRIBE,
+    CONN_EVENT_SINCE,
+};
+const size_t CONN_EVENT_KINDS = CONN_EVENT_SINCE + 1;
+struct ConnEvent {
+    ConnEventType type;
+    uint16_t connId;
+    uint16_t value;
+    uint32_t epoch;  // SINCE要求のエポック
+    uint32_t seq;    // SINCE要求の受信済み番号
+};
+// 接続数（拒否される1台を含む）× 種類分に、接続・切断だけが使える予約分を足した大きさ
+// MTU・購読・SINCE はクライアントが何度でも起こせるため予約分には入れず、
+// 接続・切断（クライアント表の整合に必要）が取りこぼされないようにする
+const size_t CONN_EVENT_RESERVED = (MAX_GATE_CLIENTS + 1) * 2;
+const size_t CONN_EVENT_QUEUE_SIZE = (MAX_GATE_CLIENTS + 1) * CONN_EVENT_KINDS + CONN_EVENT_RESERVED;
+ConnEvent connEvents[CONN_EVENT_QUEUE_SIZE];
+size_t connEventHead = 0;
+size_t connEventCount = 0;
+portMUX_TYPE connEventMux = portMUX_INITIALIZER_UNLOCKED;
+uint32_t connDropReported = 0;  // applyConnEvents() で警告済みの conn_drop
+
+// 接続イベントを積む（BLEタスクから呼ばれる）。満杯なら捨てて conn_drop に数える
+void postConnEvent(ConnEventType type, uint16_t connId, uint16_t value,
+                   uint32_t epoch = 0, uint32_t seq = 0) {
+    bool reserved = type == CONN_EVENT_CONNECT || type == CONN_EVENT_DISCONNECT;
+    size_t limit = reserved ? CONN_EVENT_QUEUE_SIZE : CONN_EVENT_QUEUE_SIZE - CONN_EVENT_RESERVED;
+    portENTER_CRITICAL(&connEventMux);
+    if (connEventCount < limit) {
+        connEvents[(connEventHead + connEventCount) % CONN_EVENT_QUEUE_SIZE] = {type, connId, value, epoch, seq};
+        connEventCount++;
+    } else {
+        connDropped++;
+    }
+    portEXIT_CRITICAL(&connEventMux);
+    scheduler.signal(connTask);
+}
+
+// 特定クライアントへの通知送信
+struct GattsNotifySender {
+    bool send(uint16_t connId, const uint8_t* data, size_t length) {
+        bool ok = esp_ble_gatts_send_indicate(pServer->getGattsIf(), connId,
+                                              pTxCharacteristic->getHandle(),
+                                              length, (uint8_t*)data, false) == ESP_OK;
+        if (ok) {
+            notifyOk++;
+        } else {
+            notifyFail++;
+        }
+        return ok;
+    }
+};
+GattsNotifySender notifySender;
+
+// レイテンシ計測（ms）
+LatencyHistogram upstreamLatency;  // 検出からサーバー受信まで（イベントの経過時間）
+LatencyHistogram notifyLatency;    // サーバー受信から通知送信まで
+
+// レイテンシヒストグラムをシリアルに出力
+void dumpLatency() {
+    char line[96];
+    upstreamLatency.format(line, sizeof(line), "LAT detect->server_rx", "ms");
+    Serial.println(line);
+    notifyLatency.format(line, sizeof(line), "LAT server_rx->notify", "ms");
+    Serial.println(line);
+}
+
+// UART行の組み立て（readStringUntilによるブロッキングを回避、不正な行は破棄）
+GateLineReader uartReader;
+
+// メトリクスを1行で出力
+void dumpMetrics() {
+    clientGauge = clients.activeCount();
+    heapLowWater = ESP.getMinFreeHeap();
+    logDropped = asyncLog().dropped();
+    uartDropped = uartReader.dropped();
+    char line[384];
+    metrics.format(line, sizeof(line));
+    Serial.println(line);
+}
+
+// 配信状況の定期表示
+const uint32_t QUEUE_REPORT_INTERVAL = 30000;  // 30秒間隔
+
+// 定期処理の間隔
+const uint32_t UART_POLL_INTERVAL = 10;  // UART受信の確認（受信コールバックの取りこぼし対策）
+const uint32_t DELIVER_INTERVAL = 10;    // 通知の配信（混雑で送れなかった分の再送）
+const uint32_t COMMAND_INTERVAL = 10;    // PCからのコマンドの確認（USB CDCには受信イベントがない）
 
 // LED制御用変数
-unsigned long ledStartTime = 0;
-bool ledOn = false;
-const int LED_DURATION = 100;  // LED点灯時間（ms）
+const uint32_t LED_DURATION = 100;  // LED点灯時間（ms）
+const uint8_t DISCONNECT_BLINKS = 3;
+uint8_t disconnectBlinkSteps = 0;           // 残りの点滅ステップ（点灯・消灯で1ずつ）
+const uint32_t DISCONNECT_BLINK_INTERVAL = 100;
+
+// LED点灯開始（LED_DURATION後に ledOffTask で消灯。切断時の点滅中は点滅を優先）
+void flashLed(uint32_t) {
+    if (disconnectBlinkSteps > 0) {
+        return;
+    }
+    digitalWrite(LED_PIN, HIGH);
+    scheduler.start(ledOffTask, LED_DURATION);
+}
+
+void ledOffNow(uint32_t) {
+    digitalWrite(LED_PIN, LOW);
+}
+
+// 切断時の点滅を最初から始める
+void startDisconnectBlink(uint32_t) {
+    disconnectBlinkSteps = DISCONNECT_BLINKS * 2;
+    scheduler.cancel(ledOffTask);
+    scheduler.start(blinkStepTask, 0);
+}
+
+void disconnectBlinkStep(uint32_t) {
+    if (disconnectBlinkSteps == 0) {
+        return;
+    }
+    disconnectBlinkSteps--;
+    digitalWrite(LED_PIN, disconnectBlinkSteps % 2 == 1 ? HIGH : LOW);
+    if (disconnectBlinkSteps > 0) {
+        scheduler.start(blinkStepTask, DISCONNECT_BLINK_INTERVAL);
+    }
+}
 
 // BLEサーバーコールバッククラス
 class MyServerCallbacks: public BLEServerCallbacks {
-    void onConnect(BLEServer* pServer) {
-        deviceConnected = true;
-        Serial.println("Client connected");
-        Serial.flush();
+    void onConnect(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) {
+        postConnEvent(CONN_EVENT_CONNECT, param->connect.conn_id, 0);
         
-        // 接続時にLED点灯
-        digitalWrite(LED_PIN, HIGH);
-        ledOn = true;
-        ledStartTime = millis();
+        // 接続時にLED点灯（BLEタスクを止めないよう点灯はloop()で行う）
+        scheduler.signal(ledFlashTask);
     };
 
-    void onDisconnect(BLEServer* pServer) {
-        deviceConnected = false;
-        Serial.println("Client disconnected");
-        Serial.flush();
+    void onDisconnect(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) {
+        postConnEvent(CONN_EVENT_DISCONNECT, param->disconnect.conn_id, 0);
         
-        // 切断時にLED点滅
-        for(int i = 0; i < 3; i++) {
-            digitalWrite(LED_PIN, HIGH);
-            delay(100);
-            digitalWrite(LED_PIN, LOW);
-            delay(100);
-        }
+        // 切断時にLED点滅（3回、BLEタスクを止めないよう点滅はloop()で行う）
+        scheduler.signal(disconnectBlinkTask);
+    }
+
+    void onMtuChanged(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) {
+        postConnEvent(CONN_EVENT_MTU, param->mtu.conn_id, param->mtu.mtu);
     }
 };
 
-// BLE受信コールバッククラス（必要に応じて拡張可能）
+// CCCD書き込みから接続ごとの購読状態を取得するGATTSハンドラ
+void gattsEventHandler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t* param) {
+    if (event == ESP_GATTS_WRITE_EVT && pTxCccd &&
+        param->write.handle == pTxCccd->getHandle() && param->write.len >= 2) {
+        bool notifyEnabled = (param->write.value[0] & 0x01) != 0;
+        postConnEvent(CONN_EVENT_SUBSCRIBE, param->write.conn_id, notifyEnabled ? 1 : 0);
+    }
+}
+
+// 接続イベントをクライアント表へ反映する
+void applyConnEvents(uint32_t) {
+    uint32_t dropped = connDropped;
+    if (dropped != connDropReported) {
+        LOG_W(LOG_MOD_BLE, "Connection events dropped: %lu (queue %u)",
+                      (unsigned long)(dropped - connDropReported), (unsigned)CONN_EVENT_QUEUE_SIZE);
+        connDropReported = dropped;
+    }
+    while (true) {
+        ConnEvent ev;
+        portENTER_CRITICAL(&connEventMux);
+        bool hasEvent = connEventCount > 0;
+        if (hasEvent) {
+            ev = connEvents[connEventHead];
+            connEventHead = (connEventHead + 1) % CONN_EVENT_QUEUE_SIZE;
+            connEventCount--;
+        }
+        portEXIT_CRITICAL(&connEventMux);
+        if (!hasEvent) {
+            break;
+        }
+        
+        switch (ev.type) {
+            case CONN_EVENT_CONNECT:
+                if (clients.connect(ev.connId, eventLog.nextSeq())) {
+                    connectCount++;
+                    LOG_I(LOG_MOD_BLE, "Client connected (conn %u, %u/%u)",
+                                  ev.connId, (unsigned)clients.activeCount(), MAX_GATE_CLIENTS);
+                } else {
+                    rejectCount++;
+                    LOG_W(LOG_MOD_BLE, "Client rejected (conn %u): no free slot", ev.connId);
+                    pServer->disconnect(ev.connId);
+                }
+                break;
+            case CONN_EVENT_DISCONNECT:
+                clients.disconnect(ev.connId);
+                LOG_I(LOG_MOD_BLE, "Client disconnected (conn %u, %u/%u)",
+                              ev.connId, (unsigned)clients.activeCount(), MAX_GATE_CLIENTS);
+                break;
+            case CONN_EVENT_MTU:
+                clients.setMtu(ev.connId, ev.value);
+                LOG_I(LOG_MOD_BLE, "MTU negotiated (conn %u): %u", ev.connId, ev.value);
+                break;
+            case CONN_EVENT_SUBSCRIBE:
+                clients.setSubscribed(ev.connId, ev.value != 0);
+                scheduler.signal(deliverTask);
+                break;
+            case CONN_EVENT_SINCE: {
+                uint32_t pending = clients.requestSince(ev.connId, ev.epoch, ev.seq, eventLog);
+                LOG_I(LOG_MOD_BLE, "Catch-up request (conn %u): epoch=%08lX since=%lu -> %lu events%s",
+                              ev.connId, (unsigned long)ev.epoch, (unsigned long)ev.seq,
+                              (unsigned long)pending, ev.epoch == clients.epoch() ? "" : " (new epoch)");
+                scheduler.signal(deliverTask);
+                break;
+            }
+        }
+        
+        // 空きがある限りアドバタイジングを継続
+        if (ev.type == CONN_EVENT_CONNECT || ev.type == CONN_EVENT_DISCONNECT) {
+            if (clients.activeCount() < MAX_GATE_CLIENTS) {
+                BLEDevice::startAdvertising();
+            }
+        }
+    }
+}
+
+// BLE受信コールバッククラス（"SINCE:<epoch>:<seq>" で再送要求を受け付ける）
 class MyCallbacks: public BLECharacteristicCallbacks {
-    void onWrite(BLECharacteristic *pCharacteristic) {
+    void onWrite(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t* param) {
         std::string rxValue = pCharacteristic->getValue();
         
-        if (rxValue.length() > 0) {
-            Serial.print("Received from client: ");
-            for (int i = 0; i < rxValue.length(); i++) {
-                Serial.print(rxValue[i]);
-            }
-            Serial.println();
-            Serial.flush();
+        uint32_t epoch;
+        uint32_t seq;
+        if (parseGateSinceRequest(rxValue.data(), rxValue.length(), epoch, seq)) {
+            postConnEvent(CONN_EVENT_SINCE, param->write.conn_id, 0, epoch, seq);
+        } else if (rxValue.length() > 0) {
+            LOG_I(LOG_MOD_BLE, "Received from client: %.*s", (int)rxValue.length(), rxValue.data());
         }
     }
 };
 
+// loop() のタスク（setup() で登録する）
+void readUart(uint32_t now);
+void deliver(uint32_t now);
+void readCommands(uint32_t now);
+void reportMetrics(uint32_t now);
+void reportQueues(uint32_t now);
+
 void setup() {
     Serial.begin(115200);
+    startAsyncLog();  // BLEコールバック・loop()のログは低優先度タスクで出力
+    metrics.histogram("loop_us", loopPeriod);
+    metrics.histogram("notify_ms", notifyLatency);
+    metrics.histogram("late_ms", taskLateness);
     delay(2000); // 安定化のための待機時間
     Serial.println("Tanaka Gate Server Starting...");
     Serial.flush();
     
-    // UART初期化（transmitterからのデータ受信用）
+    // loop() のタスク（登録順に実行される: 接続イベント・UART受信を配信より先に）
+    loopWaker.begin();
+    scheduler.setLatencyHistogram(&taskLateness);
+    connTask = scheduler.add(applyConnEvents);
+    uartTask = scheduler.every(readUart, UART_POLL_INTERVAL);
+    deliverTask = scheduler.every(deliver, DELIVER_INTERVAL);
+    ledFlashTask = scheduler.add(flashLed);
+    disconnectBlinkTask = scheduler.add(startDisconnectBlink);
+    blinkStepTask = scheduler.add(disconnectBlinkStep);
+    ledOffTask = scheduler.add(ledOffNow);
+    scheduler.every(readCommands, COMMAND_INTERVAL);
+    scheduler.every(reportMetrics, METRICS_INTERVAL, METRICS_INTERVAL);
+    scheduler.every(reportQueues, QUEUE_REPORT_INTERVAL, QUEUE_REPORT_INTERVAL);
+    
+    // UART初期化（transmitterからのデータ受信用。受信したらすぐに loop() を起こす）
     Serial2.begin(UART_BAUD_RATE, SERIAL_8N1, UART_RX_PIN, UART_TX_PIN);
+    Serial2.onReceive([]() { scheduler.signal(uartTask); });
     
     // LED初期化
     pinMode(LED_PIN, OUTPUT);
@@ -102,6 +364,11 @@ void setup() {
     Serial.flush();
     BLEDevice::init("TanakaGateServer");
     
+    // 起動ごとのエポック（クライアントがサーバー再起動を検出するため）
+    clients.setEpoch(esp_random() | 1);
+    Serial.printf("Event epoch: %08lX\n", (unsigned long)clients.epoch());
+    BLEDevice::setCustomGattsHandler(gattsEventHandler);
+    
     // BLE送信パワーを最大に設定
     esp_ble_tx_power_set(ESP_BLE_PWR_TYPE_DEFAULT, ESP_PWR_LVL_P9);
     esp_ble_tx_power_set(ESP_BLE_PWR_TYPE_ADV, ESP_PWR_LVL_P9);
@@ -118,7 +385,8 @@ void setup() {
                         CHARACTERISTIC_UUID_TX,
                         BLECharacteristic::PROPERTY_NOTIFY
                     );
-    pTxCharacteristic->addDescriptor(new BLE2902());
+    pTxCccd = new BLE2902();
+    pTxCharacteristic->addDescriptor(pTxCccd);
     
     // RX Characteristic作成（クライアントからサーバーへのデータ受信用）
     BLECharacteristic* pRxCharacteristic = pService->createCharacteristic(
@@ -144,61 +412,84 @@ void setup() {
     Serial.flush();
 }
 
-void loop() {
-    // LED制御（一定時間後に消灯）
-    if (ledOn && (millis() - ledStartTime) > LED_DURATION) {
-        digitalWrite(LED_PIN, LOW);
-        ledOn = false;
-    }
-    
-    // UARTからのデータ受信チェック
-    if (Serial2.available()) {
-        String receivedData = Serial2.readStringUntil('\n');
-        receivedData.trim(); // 改行文字等を除去
-        
-        if (receivedData.length() > 0) {
-            Serial.print("Received from transmitter: ");
-            Serial.println(receivedData);
-            Serial.flush();
-            
-            // タイムスタンプ付きでデータを更新
-            currentData = String(millis()) + ":" + receivedData;
-            dataTimestamp = millis();
-            
-            // BLEクライアントに送信
-            if (deviceConnected && pTxCharacteristic) {
-                // タイムスタンプ付きデータをBLE経由で送信（一意性を保証）
-                pTxCharacteristic->setValue(currentData.c_str());
-                pTxCharacteristic->notify();
-                
-                Serial.print("Sent to client: ");
-                Serial.println(currentData);
-                Serial.flush();
-                
-                // データ送信時にLED点灯
-                digitalWrite(LED_PIN, HIGH);
-                ledOn = true;
-                ledStartTime = millis();
-            } else {
-                Serial.println("No client connected - data not sent");
-                Serial.flush();
+// UARTからのデータ受信チェック（届いている分をすべてログへ）
+void readUart(uint32_t) {
+    bool received = false;
+    while (Serial2.available()) {
+        if (uartReader.feed(Serial2.read())) {
+            // "data:age" 形式ならtransmitterまでの経過時間を取り出す
+            uint16_t age;
+            size_t dataLength = splitGateAge(uartReader.line(), uartReader.length(), age);
+            eventLog.append(halClock.millis(), uartReader.line(), dataLength, age);
+            uartEvents++;
+            if (age != GATE_AGE_UNKNOWN) {
+                upstreamLatency.record(age);
             }
+            LOG_I(LOG_MOD_UART, "Received from transmitter: %s", uartReader.line());
+            received = true;
         }
     }
-    
-    // 接続状態の変化をチェック
-    if (!deviceConnected && oldDeviceConnected) {
-        delay(500); // give the bluetooth stack the chance to get things ready
-        pServer->startAdvertising(); // restart advertising
-        Serial.println("Start advertising");
-        Serial.flush();
-        oldDeviceConnected = deviceConnected;
+    if (received) {
+        scheduler.signal(deliverTask);
     }
-    
-    if (deviceConnected && !oldDeviceConnected) {
-        // do stuff here on connecting
-        oldDeviceConnected = deviceConnected;
+}
+
+// 各クライアントへ最大1通知ずつ配信（MTUまでまとめて送信）
+void deliver(uint32_t) {
+    uint32_t now = halClock.millis();
+    if (clients.fanOut(eventLog, notifySender, now, &notifyLatency) > 0) {
+        // データ送信時にLED点灯
+        flashLed(now);
+    }
+}
+
+// '?' でレイテンシを出力
+void readCommands(uint32_t) {
+    if (Serial.available() > 0) {
+        char command = Serial.read();
+        if (command == '?') {
+            dumpLatency();
+        } else if (command == '!') {
+            dumpMetrics();
+        }
+    }
+}
+
+// メトリクスの定期出力
+void reportMetrics(uint32_t) {
+    dumpMetrics();
+}
+
+// 配信状況の定期表示
+void reportQueues(uint32_t) {
+    Serial.printf("EVENTS log=%u/%u appended=%lu next=%lu clients=%u/%u\n",
+                  (unsigned)eventLog.size(), (unsigned)eventLog.capacity(),
+                  (unsigned long)eventLog.appended(), (unsigned long)eventLog.nextSeq(),
+                  (unsigned)clients.activeCount(), MAX_GATE_CLIENTS);
+    for (size_t i = 0; i < clients.capacity(); i++) {
+        const GateClientSlot& slot = clients.slot(i);
+        if (!slot.active) {
+            continue;
+        }
+        Serial.printf("  conn %u: sub=%d mtu=%u backlog=%lu sent=%lu notifies=%lu skipped=%lu congested=%lu catchups=%lu\n",
+                      slot.connId, slot.subscribed ? 1 : 0, slot.mtu,
+                      (unsigned long)clients.backlog(slot, eventLog),
+                      (unsigned long)slot.sent, (unsigned long)slot.notifications,
+                      (unsigned long)slot.skipped, (unsigned long)slot.congested,
+                      (unsigned long)slot.catchUps);
+    }
+    dumpLatency();
+}
+
+void loop() {
+    // ループ周期の計測（タスクを実行するために起きた間隔）
+    static uint32_t lastLoopMicros = 0;
+    uint32_t loopMicros = halClock.micros();
+    if (lastLoopMicros != 0) {
+        loopPeriod.record(loopMicros - lastLoopMicros);
     }
+    lastLoopMicros = loopMicros;
     
-    delay(10); // 短い遅延でCPU使用率を下げる
+    // 次の締め切りか signal() まで眠る
+    scheduler.loop();
 }
@@ -3,6 +3,14 @@
 #include <BLEUtils.h>
 #include <BLEScan.h>
 #include <BLEAdvertisedDevice.h>
+#include "async_log.h"
+#include "count_relay.h"
+#include "deadline.h"
+#include "hal_arduino.h"
+#include "latency_histogram.h"
+#include "metrics.h"
+#include "spsc_queue.h"
+#include "task_scheduler.h"
 
 // BLEの設定
 #define SERVICE_UUID        "4fafc201-1fb5-459e-8fcc-c5c9c331914b"
@@ -16,6 +24,16 @@
 #define UART_TX_PIN 43  // UART送信ピン
 #define UART_BAUD_RATE 115200
 
+// 時刻はすべてこの時計から読む（ホストでは仮想時計に差し替えられる）
+ArduinoClock halClock;
+
+// loop() の処理はスケジューラのタスクとして登録し、次の締め切りかBLEコールバックからの signal() まで眠る
+ArduinoWaker loopWaker;
+TaskScheduler<8> scheduler(halClock, loopWaker);
+int connectionTask = -1;  // BLEイベントの反映・接続・接続状態の監視（BLEコールバックから signal）
+int ledOffTask = -1;      // LED消灯（flashLed() から LED_DURATION 後）
+int rescanTask = -1;      // 切断検出からBLEスタックの後始末を待って再スキャン
+
 // ゲートに対応するUART送信文字
 const char gateChars[4] = {'a', 's', 'd', 'f'}; // ゲート1,2,3,4に対応
 
@@ -34,47 +52,117 @@ struct DeviceConnection {
 DeviceConnection devices[4];
 int connectedDevices = 0;
 
-// 各デバイスのカウント状態管理
-int deviceCounts[4] = {0, 0, 0, 0};  // 各デバイスの最新カウント値
+// BLEコールバック（Bluedroidのタスクで実行される）から loop() への通知
+// コールバックは状態を書き換えず、シリアルにも出力せず、イベントをキューに積むだけにする
+// （BLEのコールバックはすべて同じタスクから呼ばれるため、生産者は1つ）
+enum BleEventType : uint8_t {
+  BLE_EVENT_CONNECTED,
+  BLE_EVENT_DISCONNECTED,
+  BLE_EVENT_FOUND,  // スキャンで接続待ちのレーンのreceiverを見つけた
+};
+
+struct BleEvent {
+  BleEventType type;
+  uint8_t lane;            // BLE_EVENT_FOUND: 0-3
+  uint8_t address[6];      // BLE_EVENT_FOUND: receiverのアドレス
+  BLEClient* client;       // BLE_EVENT_CONNECTED / DISCONNECTED
+  uint32_t time;
+};
+
+SpscQueue<BleEvent, 16> bleEvents;
+std::atomic<uint8_t> scanWanted(0x0F);  // 接続待ちのレーン（ビット0-3、loop()が更新しスキャンコールバックが読む）
+
+// 各デバイスのカウント状態管理（最新カウント値との差分を通過イベントにする）
+CountRelay countRelay;
+
+// レイテンシ計測（ms）
+LatencyHistogram upstreamLatency;  // 検出からtransmitter受信まで（receiverの経過時間）
+LatencyHistogram relayLatency;     // transmitter受信からUART送信まで
+
+// レイテンシヒストグラムをシリアルに出力
+void dumpLatency() {
+    char line[96];
+    upstreamLatency.format(line, sizeof(line), "LAT detect->tx_rx", "ms");
+    Serial.println(line);
+    relayLatency.format(line, sizeof(line), "LAT tx_rx->uart", "ms");
+    Serial.println(line);
+}
+
+// ランタイムメトリクス（PC向けSTATUS出力を乱さないよう '!' 要求時のみ出力）
+MetricsRegistry<16> metrics;
+uint32_t& readOk = metrics.counter("read_ok");
+uint32_t& readFail = metrics.counter("read_fail");
+uint32_t& countEvents = metrics.counter("events");
+uint32_t& reconnectCount = metrics.counter("connects");
+uint32_t& disconnectCount = metrics.counter("disconnects");
+int32_t& heapLowWater = metrics.gauge("heap_min");
+int32_t& logDropped = metrics.gauge("log_drop");
+int32_t& relayResyncs = metrics.gauge("relay_resync");
+int32_t& bleEventDropped = metrics.gauge("ble_q_drop");  // キューが満杯で捨てたBLEイベント
+LatencyHistogram loopPeriod;  // loop()の周期（us）
+LatencyHistogram taskLateness;  // タスクの締め切りから実行までの遅れ（ms）
+
+// メトリクスを1行で出力
+void dumpMetrics() {
+    heapLowWater = ESP.getMinFreeHeap();
+    logDropped = asyncLog().dropped();
+    relayResyncs = countRelay.resyncs();
+    bleEventDropped = bleEvents.dropped();
+    char line[384];
+    metrics.format(line, sizeof(line));
+    Serial.println(line);
+}
 
 // LED制御用変数
-unsigned long ledStartTime = 0;
-bool ledOn = false;
-const int LED_DURATION = 100;  // LED点灯時間（ms）
+const uint32_t LED_DURATION = 100;  // LED点灯時間（ms）
+
+// LED点灯開始（LED_DURATION後に ledOffTask で消灯）
+void flashLed() {
+    digitalWrite(LED_PIN, HIGH);
+    scheduler.start(ledOffTask, LED_DURATION);
+}
 
 // 順次ポーリング用変数
 int currentPollingDevice = 0;  // 現在ポーリング中のデバイス（0-3）
-unsigned long lastPollingTime = 0;
-const unsigned long POLLING_INTERVAL = 25;  // 25ms間隔でポーリング
+const uint32_t POLLING_INTERVAL = 25;  // 25ms間隔でポーリング
+
+// 定期処理の間隔
+const uint32_t STATUS_INTERVAL = 1000;  // PCへの接続状態通知
+const uint32_t SCAN_INTERVAL = 30000;   // 未接続デバイスの再スキャン（通信干渉を減らすため30秒）
+const uint32_t SERIAL_INTERVAL = 10;    // PCからの入力の確認（USB CDCには受信イベントがないため周期的に見る）
+const uint32_t CONNECTION_INTERVAL = 100;  // 接続状態監視（切断イベントを取りこぼした場合の保険）
+const uint32_t RESCAN_DELAY = 500;
+
+// 接続状態をPCへ通知（"STATUS:1,0,1,1"、プロトコル行なのでログキューを通さず直接書く）
+void logStatus() {
+    writeProtocolLine("STATUS:%c,%c,%c,%c",
+            devices[0].connected ? '1' : '0', devices[1].connected ? '1' : '0',
+            devices[2].connected ? '1' : '0', devices[3].connected ? '1' : '0');
+}
+
+// BLEタスクからイベントを積む
+void publishBleEvent(BleEventType type, BLEClient* client, uint8_t lane = 0, const uint8_t* address = nullptr) {
+    BleEvent event;
+    event.type = type;
+    event.lane = lane;
+    memset(event.address, 0, sizeof(event.address));
+    if (address) {
+        memcpy(event.address, address, sizeof(event.address));
+    }
+    event.client = client;
+    event.time = halClock.millis();
+    bleEvents.push(event);  // 満杯なら捨てて数える（切断はloop()の接続状態監視でも検出する）
+    scheduler.signal(connectionTask);
+}
 
 // 単一のコールバックインスタンス
 class MyClientCallback : public BLEClientCallbacks {
     void onConnect(BLEClient* pclient) {
-        // Serial.println("*** Client connected successfully ***");
+        publishBleEvent(BLE_EVENT_CONNECTED, pclient);
     }
 
     void onDisconnect(BLEClient* pclient) {
-        // Serial.println("*** Client disconnected ***");
-        // 該当するデバイスを見つけて状態をリセット
-        for (int i = 0; i < 4; i++) {
-            if (devices[i].pClient == pclient) {
-                devices[i].connected = false;
-                connectedDevices--;
-                // Serial.print("Device ");
-                // Serial.print(i + 1);
-                // Serial.println(" disconnection handled");
-                
-                // 接続状態を直ちにPCへ通知
-                Serial.print("STATUS:");
-                for(int j=0; j<4; j++) {
-                    Serial.print(devices[j].connected ? "1" : "0");
-                    if(j < 3) Serial.print(",");
-                }
-                Serial.println();
-                Serial.flush();
-                break;
-            }
-        }
+        publishBleEvent(BLE_EVENT_DISCONNECTED, pclient);
     }
 };
 
@@ -100,45 +188,43 @@ bool pollDeviceData(int deviceIndex) {
     try {
         // キャラクタリスティックからデータを読み取り
         std::string value = devices[deviceIndex].pRemoteCharacteristic->readValue();
-        
+        uint32_t receiveTime = halClock.millis();
         if (value.length() > 0) {
-            String receivedData = String(value.c_str());
+            readOk++;
+        } else {
+            readFail++;
+        }
+        
+        // 受信データの形式: "デバイス番号:カウント値[:検出からの経過時間ms]" (例: "1:5:40")
+        uint32_t passages = countRelay.update(value.data(), value.length(), [&](int lane, int32_t age) {
+            countEvents++;
+            
+            // ゲート番号のみを出力（yonku_counterと同じ方式）
+            writeProtocolLine("%d", lane + 1);
             
-            // 受信データの形式: "デバイス番号:カウント値" (例: "1:5")
-            int colonIndex = receivedData.indexOf(':');
-            if (colonIndex > 0) {
-                int deviceNum = receivedData.substring(0, colonIndex).toInt();
-                int count = receivedData.substring(colonIndex + 1).toInt();
-                
-                // デバイス番号が有効範囲かチェック
-                if (deviceNum >= 1 && deviceNum <= 4) {
-                    int targetDeviceIndex = deviceNum - 1; // 0-3のインデックスに変換
-                    
-                    // カウントの変化をチェック
-                    if (count != deviceCounts[targetDeviceIndex]) {
-                        // カウント値を更新
-                        deviceCounts[targetDeviceIndex] = count;
-                        
-                        // ゲート番号のみを出力（yonku_counterと同じ方式）
-                        Serial.println(deviceNum);
-                        Serial.flush();
-                        
-                        // UARTで対応する文字を送信（改行付き）
-                        Serial2.println(gateChars[targetDeviceIndex]);
-                        Serial2.flush();
-                        
-                        // LED点灯開始
-                        digitalWrite(LED_PIN, HIGH);
-                        ledOn = true;
-                        ledStartTime = millis();
-                        
-                        return true;
-                    }
-                }
+            // UARTで対応する文字を送信（改行付き）
+            // 経過時間が分かる場合は "文字:経過時間ms" としてtanaka_gate_serverへ引き継ぐ
+            if (age >= 0) {
+                uint32_t relay = halClock.millis() - receiveTime;
+                Serial2.printf("%c:%lu\n", gateChars[lane], (unsigned long)age + relay);
+                upstreamLatency.record(age);
+                relayLatency.record(relay);
+            } else {
+                Serial2.println(gateChars[lane]);
             }
+        });
+        
+        if (passages > 0) {
+            Serial2.flush();
+            
+            // LED点灯開始
+            flashLed();
+            
+            return true;
         }
     } catch (const std::exception& e) {
         // 読み取りエラーの場合は静かに無視
+        readFail++;
         return false;
     }
     
@@ -202,6 +288,7 @@ bool connectToDevice(int deviceIndex) {
     
     devices[deviceIndex].connected = true;
     connectedDevices++;
+    reconnectCount++;
     
     // Serial.print("*** Device ");
     // Serial.print(deviceIndex + 1);
@@ -211,13 +298,7 @@ bool connectToDevice(int deviceIndex) {
     // Serial.flush();
     
     // 接続状態を直ちにPCへ通知
-    Serial.print("STATUS:");
-    for(int i=0; i<4; i++) {
-        Serial.print(devices[i].connected ? "1" : "0");
-        if(i < 3) Serial.print(",");
-    }
-    Serial.println();
-    Serial.flush();
+    logStatus();
     
     return true;
 }
@@ -247,25 +328,87 @@ class MyAdvertisedDeviceCallbacks: public BLEAdvertisedDeviceCallbacks {
       if (deviceNum >= 1 && deviceNum <= 4) {
         int deviceIndex = deviceNum - 1; // 0-3のインデックスに変換
         
-        if (!devices[deviceIndex].connected && !devices[deviceIndex].doConnect) {
-          // Serial.print(">>> Target YonkuCounter device ");
-          // Serial.print(deviceNum);
-          // Serial.println(" found! <<<");
-          // Serial.flush();
-          
+        // 接続待ちのレーンなら、スキャンを止めて loop() に接続を任せる
+        if (scanWanted.load(std::memory_order_acquire) & (1 << deviceIndex)) {
           BLEDevice::getScan()->stop();
-          devices[deviceIndex].pServerAddress = new BLEAddress(advertisedDevice.getAddress());
-          devices[deviceIndex].deviceName = deviceName;
-          devices[deviceIndex].address = advertisedDevice.getAddress().toString().c_str();
-          devices[deviceIndex].doConnect = true;
+          publishBleEvent(BLE_EVENT_FOUND, nullptr, (uint8_t)deviceIndex,
+                          *advertisedDevice.getAddress().getNative());
         }
       }
     }
   }
 };
 
+// デバイスの切断を反映する（BLEの切断コールバックから）
+void handleDisconnect(BLEClient* client) {
+    for (int i = 0; i < 4; i++) {
+        if (devices[i].pClient == client && devices[i].connected) {
+            devices[i].connected = false;
+            connectedDevices--;
+            disconnectCount++;
+            LOG_I(LOG_MOD_BLE, "Device %d disconnected", i + 1);
+            logStatus();  // 接続状態を直ちにPCへ通知
+            break;
+        }
+    }
+}
+
+// スキャンで見つけたreceiverへの接続を予約する（接続は loop() の connectToDevice() で行う）
+void handleFound(const BleEvent& event) {
+    DeviceConnection& device = devices[event.lane];
+    if (device.connected || device.doConnect) {
+        return;
+    }
+    esp_bd_addr_t address;
+    memcpy(address, event.address, sizeof(address));
+    delete device.pServerAddress;
+    device.pServerAddress = new BLEAddress(address);
+    device.deviceName = "YonkuCounter_" + String(event.lane + 1);
+    device.address = device.pServerAddress->toString().c_str();
+    device.doConnect = true;
+}
+
+// BLEコールバックからのイベントを処理する
+void drainBleEvents() {
+    BleEvent event;
+    while (bleEvents.pop(event)) {
+        switch (event.type) {
+            case BLE_EVENT_CONNECTED:
+                LOG_D(LOG_MOD_BLE, "Client connected");
+                break;
+            case BLE_EVENT_DISCONNECTED:
+                handleDisconnect(event.client);
+                break;
+            case BLE_EVENT_FOUND:
+                handleFound(event);
+                break;
+        }
+    }
+    // 接続待ちのレーンをスキャンコールバックへ知らせる
+    uint8_t wanted = 0;
+    for (int i = 0; i < 4; i++) {
+        if (!devices[i].connected && !devices[i].doConnect) {
+            wanted |= 1 << i;
+        }
+    }
+    scanWanted.store(wanted, std::memory_order_release);
+}
+
+// loop() のタスク（setup() で登録する）
+void maintainConnections(uint32_t now);
+void ledOffNow(uint32_t now);
+void rescanNow(uint32_t now);
+void pollSerial(uint32_t now);
+void sendStatus(uint32_t now);
+void pollNextDevice(uint32_t now);
+void scanIfDisconnected(uint32_t now);
+
 void setup() {
   Serial.begin(115200);
+  startAsyncLog();  // シリアル出力は低優先度タスクで行う
+  metrics.histogram("loop_us", loopPeriod);
+  metrics.histogram("relay_ms", relayLatency);
+  metrics.histogram("late_ms", taskLateness);
   delay(2000); // 安定化のための待機時間を延長
   // Serial.println("Yonku Counter Transmitter Starting...");
   // Serial.flush();
@@ -296,6 +439,17 @@ void setup() {
     delay(200);
   }
   
+  // loop() のタスク（登録順に実行される: BLEイベントの反映をポーリングより先に）
+  loopWaker.begin();
+  scheduler.setLatencyHistogram(&taskLateness);
+  connectionTask = scheduler.every(maintainConnections, CONNECTION_INTERVAL);
+  ledOffTask = scheduler.add(ledOffNow);
+  rescanTask = scheduler.add(rescanNow);
+  scheduler.every(pollSerial, SERIAL_INTERVAL);
+  scheduler.every(sendStatus, STATUS_INTERVAL, STATUS_INTERVAL);  // 1秒に1回、PCに接続状態を送信
+  scheduler.every(pollNextDevice, POLLING_INTERVAL);
+  scheduler.every(scanIfDisconnected, SCAN_INTERVAL, SCAN_INTERVAL);
+  
   // BLE初期化
   // Serial.println("Initializing BLE...");
   // Serial.flush();
@@ -339,64 +493,9 @@ void setup() {
   // Serial.flush();
 }
 
-void loop() {
-  // LED制御（一定時間後に消灯）
-  if (ledOn && (millis() - ledStartTime) > LED_DURATION) {
-    digitalWrite(LED_PIN, LOW);
-    ledOn = false;
-  }
-  
-  // シリアル通信からの入力を確認
-  if (Serial.available() > 0) {
-    // 1文字読み取り
-    char inputChar = Serial.read();
-    
-    // 有効な文字の場合のみUART経由で送信
-    if (isalpha(inputChar) || isdigit(inputChar)) {
-      // UART経由でtanaka_gate_serverに送信（改行付き）
-      Serial2.println(inputChar);
-      Serial2.flush();
-      
-      Serial.printf("Manual sent: %c\n", inputChar);
-      Serial.flush();
-      
-      // LED点灯
-      digitalWrite(LED_PIN, HIGH);
-      ledOn = true;
-      ledStartTime = millis();
-    }
-    
-    // バッファをクリア
-    while(Serial.available()) {
-      Serial.read();
-    }
-  }
-  
-  // 1秒に1回、PCに接続状態を送信
-  static unsigned long lastStatusTime = 0;
-  if (millis() - lastStatusTime >= 1000) {
-    lastStatusTime = millis();
-    Serial.print("STATUS:");
-    Serial.print(devices[0].connected ? "1" : "0");
-    Serial.print(",");
-    Serial.print(devices[1].connected ? "1" : "0");
-    Serial.print(",");
-    Serial.print(devices[2].connected ? "1" : "0");
-    Serial.print(",");
-    Serial.println(devices[3].connected ? "1" : "0");
-    Serial.flush();
-  }
-
-  // 50ms間隔で順次ポーリング
-  if (millis() - lastPollingTime >= POLLING_INTERVAL) {
-    lastPollingTime = millis();
-    
-    // 現在のデバイスをポーリング
-    pollDeviceData(currentPollingDevice);
-    
-    // 次のデバイスに移動（0-3を循環）
-    currentPollingDevice = (currentPollingDevice + 1) % 4;
-  }
+// BLEコールバックからのイベント（切断・スキャン結果）を反映し、接続待ちのデバイスに接続する
+void maintainConnections(uint32_t) {
+  drainBleEvents();
   
   // 各デバイスの接続が必要な場合
   for (int i = 0; i < 4; i++) {
@@ -421,14 +520,68 @@ void loop() {
       devices[i].pRemoteCharacteristic = nullptr;
       connectedDevices--;
       
-      delay(500);
-      BLEDevice::getScan()->start(3, false); // 切断時は3秒間だけ再スキャン
+      // BLEスタックに後始末の時間を与えてから再スキャン
+      scheduler.start(rescanTask, RESCAN_DELAY);
     }
   }
+}
 
-  // 未接続状態での再スキャン制御
-  static unsigned long lastScanTime = 0;
-  const long scanInterval = 30000;  // スキャン間隔を30秒に広げる（通信干渉を減らす）
+// LED制御（一定時間後に消灯）
+void ledOffNow(uint32_t) {
+  digitalWrite(LED_PIN, LOW);
+}
+
+void rescanNow(uint32_t) {
+  BLEDevice::getScan()->start(3, false); // 切断時は3秒間だけ再スキャン
+}
+
+// シリアル通信からの入力を確認
+void pollSerial(uint32_t) {
+  if (Serial.available() > 0) {
+    // 1文字読み取り
+    char inputChar = Serial.read();
+    
+    // '?' でレイテンシを出力
+    if (inputChar == '?') {
+      dumpLatency();
+    } else if (inputChar == '!') {
+      dumpMetrics();
+    }
+    
+    // 有効な文字の場合のみUART経由で送信
+    if (isalpha(inputChar) || isdigit(inputChar)) {
+      // UART経由でtanaka_gate_serverに送信（改行付き）
+      Serial2.println(inputChar);
+      Serial2.flush();
+      
+      LOG_I(LOG_MOD_UART, "Manual sent: %c", inputChar);
+      
+      // LED点灯
+      flashLed();
+    }
+    
+    // バッファをクリア
+    while(Serial.available()) {
+      Serial.read();
+    }
+  }
+}
+
+void sendStatus(uint32_t) {
+  logStatus();
+}
+
+// 25ms間隔で順次ポーリング
+void pollNextDevice(uint32_t) {
+  // 現在のデバイスをポーリング
+  pollDeviceData(currentPollingDevice);
+  
+  // 次のデバイスに移動（0-3を循環）
+  currentPollingDevice = (currentPollingDevice + 1) % 4;
+}
+
+// 未接続状態での再スキャン制御
+void scanIfDisconnected(uint32_t) {
   const int scanDuration = 3;       // スキャン時間を3秒に短縮する（以前は10秒）
   
   bool needRescan = false;
@@ -439,11 +592,21 @@ void loop() {
     }
   }
   
-  if (needRescan && (millis() - lastScanTime >= scanInterval)) {
-    lastScanTime = millis();
+  if (needRescan) {
     // 非同期ではないスキャンはループを止めるため、時間は最小限に
     BLEDevice::getScan()->start(scanDuration, false);
   }
+}
+
+void loop() {
+  // ループ周期の計測（タスクを実行するために起きた間隔）
+  static uint32_t lastLoopMicros = 0;
+  uint32_t loopMicros = halClock.micros();
+  if (lastLoopMicros != 0) {
+    loopPeriod.record(loopMicros - lastLoopMicros);
+  }
+  lastLoopMicros = loopMicros;
   
-  delay(10);  // 短い遅延でCPU使用率を下げる（100ms -> 10ms）
+  // 次の締め切りかBLEコールバックからの signal() まで眠る（固定周期で回らない）
+  scheduler.loop();
 }